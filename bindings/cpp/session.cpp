@@ -735,6 +735,11 @@ void session::set_timeout(long timeout)
 	dnet_session_set_timeout(m_data->session_ptr, timeout);
 }
 
+void session::set_timeout_ms(long timeout_ms)
+{
+	dnet_session_set_timeout_ms(m_data->session_ptr, timeout_ms);
+}
+
 long session::get_timeout(void) const
 {
 	timespec *tm = dnet_session_get_timeout(m_data->session_ptr);
@@ -701,12 +701,14 @@ public:
 	};
 
 	find_indexes_handler(const session &sess, const async_generic_result &result, std::vector<int> &&groups,
-		const std::vector<dnet_raw_id> &indexes, bool intersect) :
+		const std::vector<dnet_raw_id> &indexes, bool intersect, const find_indexes_cursor &cursor, size_t limit) :
 		parent_type(sess, result, std::move(groups)),
 		m_logger(m_sess.get_logger()),
 		m_intersect(intersect),
 		m_shard_count(dnet_node_get_indexes_shard_count(sess.get_native_node())),
-		m_indexes(indexes)
+		m_indexes(indexes),
+		m_cursor(cursor),
+		m_limit(limit)
 	{
 		m_sess.set_checker(checkers::no_check);
 
@@ -786,6 +788,7 @@ public:
 		dnet_indexes_request request;
 		memset(&request, 0, sizeof(request));
 		request.entries_count = m_indexes.size();
+		request.limit = m_limit;
 		request.id = id;
 		if (m_intersect)
 			request.flags |= DNET_INDEXES_FLAGS_INTERSECT;
@@ -835,7 +838,19 @@ public:
 
 			for (size_t i = 0; i < m_indexes.size(); ++i) {
 				entry.id = m_id_precalc[it->shard_id * m_indexes.size() + i];
-				buffer.write(entry);
+
+				/*
+				 * Every shard returns its objects which follow the cursor,
+				 * client takes the first ones among all shards
+				 */
+				if (i == 0 && m_cursor.started()) {
+					entry.size = sizeof(dnet_raw_id);
+					buffer.write(entry);
+					buffer.write(m_cursor.last());
+					entry.size = 0;
+				} else {
+					buffer.write(entry);
+				}
 			}
 
 			if (more) {
@@ -898,9 +913,27 @@ private:
 	id_map m_convert_map;
 	std::vector<dnet_raw_id> m_id_precalc;
 	std::vector<dnet_raw_id> m_indexes;
+	const find_indexes_cursor m_cursor;
+	const size_t m_limit;
+};
+
+/*
+ * Pages of all shards, which are merged when all of them are received
+ */
+struct find_indexes_page
+{
+	find_indexes_page(const find_indexes_cursor &cursor, size_t limit) : cursor(cursor), limit(limit)
+	{
+	}
+
+	const find_indexes_cursor cursor;
+	const size_t limit;
+	std::mutex lock;
+	sync_find_indexes_result entries;
 };
 
 static void on_find_indexes_process(session sess, std::shared_ptr<find_indexes_handler::id_map> convert_map,
+	std::shared_ptr<find_indexes_page> page,
 	async_result_handler<find_indexes_result_entry> handler, const callback_result_entry &entry)
 {
 	if (!filters::positive(entry))
@@ -927,16 +960,39 @@ static void on_find_indexes_process(session sess, std::shared_ptr<find_indexes_h
 			id = converted->second;
 		}
 
-		handler.process(entry);
+		if (page) {
+			// servers which don't know about pages return all objects
+			if (page->cursor.started() && !(page->cursor.last() < entry.id))
+				continue;
+
+			std::lock_guard<std::mutex> guard(page->lock);
+			page->entries.emplace_back(std::move(entry));
+		} else {
+			handler.process(entry);
+		}
 	}
 }
 
-static void on_find_indexes_complete(async_result_handler<find_indexes_result_entry> handler, const error_info &error)
+static void on_find_indexes_complete(std::shared_ptr<find_indexes_page> page,
+	async_result_handler<find_indexes_result_entry> handler, const error_info &error)
 {
+	if (page) {
+		auto &entries = page->entries;
+		std::sort(entries.begin(), entries.end(), [] (const find_indexes_result_entry &a, const find_indexes_result_entry &b) {
+			return a.id < b.id;
+		});
+		if (page->limit && entries.size() > page->limit)
+			entries.resize(page->limit);
+
+		for (auto it = entries.begin(); it != entries.end(); ++it)
+			handler.process(*it);
+	}
+
 	handler.complete(error);
 }
 
-async_find_indexes_result session::find_indexes_internal(const std::vector<dnet_raw_id> &indexes, bool intersect)
+async_find_indexes_result session::find_indexes_internal(const std::vector<dnet_raw_id> &indexes, bool intersect,
+	const find_indexes_cursor &cursor, size_t limit)
 {
 	async_find_indexes_result result(*this);
 	async_result_handler<find_indexes_result_entry> handler(result);
@@ -952,21 +1008,30 @@ async_find_indexes_result session::find_indexes_internal(const std::vector<dnet_
 
 	session sess = clean_clone();
 	async_generic_result raw_result(sess);
-	auto raw_handler = std::make_shared<find_indexes_handler>(*this, raw_result, std::move(groups), indexes, intersect);
+	auto raw_handler = std::make_shared<find_indexes_handler>(*this, raw_result, std::move(groups), indexes, intersect,
+		cursor, limit);
 	auto convert_map = std::make_shared<find_indexes_handler::id_map>(std::move(raw_handler->take_convert_map()));
 	raw_handler->start();
 
+	/*
+	 * Whole results are passed to user as soon as replies come,
+	 * pages are merged and cut to the limit when all shards have replied
+	 */
+	std::shared_ptr<find_indexes_page> page;
+	if (limit || cursor.started())
+		page = std::make_shared<find_indexes_page>(cursor, limit);
+
 	using namespace std::placeholders;
 
-	raw_result.connect(std::bind(on_find_indexes_process, sess, convert_map, handler, _1),
-		std::bind(on_find_indexes_complete, handler, _1));
+	raw_result.connect(std::bind(on_find_indexes_process, sess, convert_map, page, handler, _1),
+		std::bind(on_find_indexes_complete, page, handler, _1));
 
 	return result;
 }
 
 async_find_indexes_result session::find_all_indexes(const std::vector<dnet_raw_id> &indexes)
 {
-	return find_indexes_internal(indexes, true);
+	return find_indexes_internal(indexes, true, find_indexes_cursor(), 0);
 }
 
 async_find_indexes_result session::find_all_indexes(const std::vector<std::string> &indexes)
@@ -974,9 +1039,21 @@ async_find_indexes_result session::find_all_indexes(const std::vector<std::strin
 	return find_all_indexes(session_convert_indexes(*this, indexes));
 }
 
+async_find_indexes_result session::find_all_indexes(const std::vector<dnet_raw_id> &indexes,
+	const find_indexes_cursor &cursor, size_t limit)
+{
+	return find_indexes_internal(indexes, true, cursor, limit);
+}
+
+async_find_indexes_result session::find_all_indexes(const std::vector<std::string> &indexes,
+	const find_indexes_cursor &cursor, size_t limit)
+{
+	return find_all_indexes(session_convert_indexes(*this, indexes), cursor, limit);
+}
+
 async_find_indexes_result session::find_any_indexes(const std::vector<dnet_raw_id> &indexes)
 {
-	return find_indexes_internal(indexes, false);
+	return find_indexes_internal(indexes, false, find_indexes_cursor(), 0);
 }
 
 async_find_indexes_result session::find_any_indexes(const std::vector<std::string> &indexes)
@@ -984,6 +1061,18 @@ async_find_indexes_result session::find_any_indexes(const std::vector<std::strin
 	return find_any_indexes(session_convert_indexes(*this, indexes));
 }
 
+async_find_indexes_result session::find_any_indexes(const std::vector<dnet_raw_id> &indexes,
+	const find_indexes_cursor &cursor, size_t limit)
+{
+	return find_indexes_internal(indexes, false, cursor, limit);
+}
+
+async_find_indexes_result session::find_any_indexes(const std::vector<std::string> &indexes,
+	const find_indexes_cursor &cursor, size_t limit)
+{
+	return find_any_indexes(session_convert_indexes(*this, indexes), cursor, limit);
+}
+
 struct check_indexes_handler
 {
 	session sess;
@@ -1029,66 +1118,6 @@ async_list_indexes_result session::list_indexes(const key &request_id)
 	return result;
 }
 
-/*!
- * Auxiliary function to parse char* buffer with c-msgpack library
- */
-static bool buffer_reader(cmp_ctx_t *ctx, void *data, size_t limit)
-{
-	char *start_ptr = static_cast<char *>(ctx->buf);
-	char *ptr = start_ptr;
-	while (ptr && limit) {
-		++ptr;
-		--limit;
-	}
-	if (limit != 0) {
-		return false;
-	}
-	memcpy(data, start_ptr, ptr - start_ptr);
-	ctx->buf = ptr;
-	return true;
-}
-
-/*!
- * Structure of secondary index msgpack is following
- * Array of 4 elements
- * Version number
- * Array of indexes
- *
- * We need to get size of indexes array, that's why we
- * skip first two fields in msgpack and return size
- * of array in third position of msgpack
- */
-static uint32_t get_index_size(const std::string &index_metadata, int &err)
-{
-	err = 0;
-	cmp_ctx_t cmp;
-
-	char *buffer = new char[index_metadata.length() + 1];
-	memcpy(buffer, index_metadata.data(), index_metadata.length() + 1);
-
-	cmp_init(&cmp, buffer, buffer_reader, NULL);
-
-	uint32_t array_size;
-	if (!cmp_read_array(&cmp, &array_size)) {
-		err = -EBADMSG;
-		return 0;
-	}
-
-	int32_t version;
-	if (!cmp_read_int(&cmp, &version)) {
-		err = -EBADMSG;
-		return 0;
-	}
-
-	if (!cmp_read_array(&cmp, &array_size)) {
-		err = -EBADMSG;
-		return 0;
-	}
-
-	delete[] buffer;
-	return array_size;
-}
-
 typedef std::map<dnet_raw_id, int, dnet_raw_id_less_than<> > id_to_shard_map;
 
 /*!
@@ -1112,14 +1141,17 @@ struct get_index_metadata_callback
 		memcpy(raw_id.id, result.command()->id.id, DNET_ID_SIZE);
 		metadata.shard_id = id_to_shard[raw_id];
 
-		std::string content =  result.file().to_string().substr(DNET_INDEX_TABLE_MAGIC_SIZE);
-		int err = 0;
-		metadata.index_size = get_index_size(content, err);
-		if (err) {
-			metadata.is_valid = false;
-			BH_LOG(sess.get_logger(), DNET_LOG_ERROR, "get_index_metadata: Incorrect msgpack format: err: %d", err);
-		} else {
+		// Delta log has to be applied to the base segment to get the actual number of entries
+		try {
+			dnet_indexes indexes;
+			indexes_unpack_raw(result.file(), &indexes);
+
+			metadata.index_size = indexes.indexes.size();
 			metadata.is_valid = true;
+		} catch (const std::exception &e) {
+			metadata.index_size = 0;
+			metadata.is_valid = false;
+			BH_LOG(sess.get_logger(), DNET_LOG_ERROR, "get_index_metadata: Incorrect msgpack format: %s", e.what());
 		}
 		handler.process(metadata);
 	}
@@ -1377,14 +1409,8 @@ struct merge_indexes_callback
 
 		// Pack indexes and write serialized data to server
 		try {
-			msgpack::sbuffer buffer;
-			msgpack::pack(buffer, result);
-
-			data_buffer tmp_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
-			tmp_buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
-			tmp_buffer.write(buffer.data(), buffer.size());
-
-			data_pointer data = std::move(tmp_buffer);
+			dnet_node *node = write_session.get_native_node();
+			data_pointer data = indexes_pack(result, node->flags & DNET_CFG_FIXED_WIDTH_INDEXES);
 
 			write_session.write_data(id, data, 0).connect(handler);
 		} catch (std::bad_alloc &) {
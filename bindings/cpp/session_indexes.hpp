@@ -24,10 +24,14 @@
 
 #include <msgpack.hpp>
 
+#include <algorithm>
 #include <iostream>
 
 #define DNET_INDEX_TABLE_MAGIC 0x5DA38CFBE7734027ull
 #define DNET_INDEX_TABLE_MAGIC_SIZE 8
+#define DNET_INDEX_DELTA_MAGIC 0x7C2E91D04AB35F16ull
+#define DNET_INDEX_TABLE_FLAT_MAGIC 0x3F1A6C52D98E04B7ull
+#define DNET_INDEX_TABLE_FLAT_VERSION 1
 
 namespace ioremap { namespace elliptics {
 
@@ -58,19 +62,481 @@ struct dnet_indexes
 };
 
 
-template <typename T>
-static inline void indexes_unpack_raw(const data_pointer &file, T *data)
+/*!
+ * Single update of index table.
+ *
+ * Stored index object consists of base segment followed by log of delta records
+ * (delta magic and msgpacked dnet_index_delta) which were appended to it after base was written.
+ * Object may also consist of deltas only if they were appended to not existing table.
+ *
+ * Base segment is either magic and msgpacked dnet_indexes sorted by id or fixed-width table,
+ * see dnet_index_table_header. Both are read, fixed-width one is written only by nodes
+ * with DNET_CFG_FIXED_WIDTH_INDEXES flag, since older versions are not able to read it.
+ */
+struct dnet_index_delta
+{
+	// DNET_INDEXES_FLAGS_INTERNAL_INSERT or DNET_INDEXES_FLAGS_INTERNAL_REMOVE
+	uint32_t action;
+	dnet_index_entry entry;
+	int shard_id;
+	int shard_count;
+};
+
+/*!
+ * Header of base segment in fixed-width layout.
+ *
+ * It is followed by array of @entries_count ids (@id_size bytes each), array of @entries_count
+ * dnet_index_table_entry and data area of @data_size bytes, entries point to their data by offsets
+ * relative to the data area. Ids are sorted, so table is searched in place without decoding it.
+ * All integers are little-endian.
+ */
+struct dnet_index_table_header
+{
+	uint64_t		magic;
+	uint16_t		version;
+	uint16_t		id_size;
+	uint32_t		reserved;
+	int32_t			shard_id;
+	int32_t			shard_count;
+	uint64_t		entries_count;
+	uint64_t		data_size;
+} __attribute__ ((packed));
+
+struct dnet_index_table_entry
+{
+	uint64_t		data_offset;
+	uint64_t		data_size;
+	struct dnet_time	time;
+} __attribute__ ((packed));
+
+/*!
+ * Entry of index table which is going to be packed, it points to id and data stored elsewhere
+ */
+struct dnet_index_entry_ref
+{
+	const dnet_raw_id *id;
+	const void *data;
+	size_t size;
+	dnet_time time;
+};
+
+/*!
+ * Read-only view of base segment in fixed-width layout.
+ * Ids, data and times are accessed in place, data is shared with stored object.
+ */
+class index_table_view
+{
+public:
+	index_table_view() : m_ids(NULL), m_entries(NULL), m_data(NULL), m_count(0), m_data_size(0), m_base_size(0),
+		m_shard_id(0), m_shard_count(0)
+	{
+	}
+
+	/*!
+	 * Returns false if @file does not start with fixed-width base segment, throws if its header is broken.
+	 * Only header and bounds of the arrays are checked, so that lookups do not pay for a pass over all entries,
+	 * data of every entry is checked when it is accessed by data() or ref().
+	 */
+	bool parse(const data_pointer &file)
+	{
+		static const unsigned long long magic = dnet_bswap64(DNET_INDEX_TABLE_FLAT_MAGIC);
+
+		if (file.size() < sizeof(dnet_index_table_header)
+			|| memcmp(file.data(), &magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0) {
+			return false;
+		}
+
+		const dnet_index_table_header *header = file.data<dnet_index_table_header>();
+		if (dnet_bswap16(header->version) != DNET_INDEX_TABLE_FLAT_VERSION)
+			throw std::runtime_error("Unsupported index table version");
+		if (dnet_bswap16(header->id_size) != DNET_ID_SIZE)
+			throw std::runtime_error("Invalid index table id size");
+
+		const uint64_t count = dnet_bswap64(header->entries_count);
+		const uint64_t data_size = dnet_bswap64(header->data_size);
+		const uint64_t max_count = (file.size() - sizeof(dnet_index_table_header))
+			/ (DNET_ID_SIZE + sizeof(dnet_index_table_entry));
+
+		if (count > max_count || data_size > file.size() - sizeof(dnet_index_table_header)
+				- count * (DNET_ID_SIZE + sizeof(dnet_index_table_entry))) {
+			throw std::runtime_error("Truncated index table");
+		}
+
+		const char *ptr = file.data<char>() + sizeof(dnet_index_table_header);
+
+		m_file = file;
+		m_count = count;
+		m_data_size = data_size;
+		m_ids = reinterpret_cast<const dnet_raw_id *>(ptr);
+		m_entries = reinterpret_cast<const dnet_index_table_entry *>(ptr + count * DNET_ID_SIZE);
+		m_data = reinterpret_cast<const char *>(m_entries + count);
+		m_base_size = (m_data - file.data<char>()) + data_size;
+		m_shard_id = int32_t(dnet_bswap32(header->shard_id));
+		m_shard_count = int32_t(dnet_bswap32(header->shard_count));
+
+		return true;
+	}
+
+	size_t size() const
+	{
+		return m_count;
+	}
+
+	/*!
+	 * Size of base segment, the rest of stored object is delta log
+	 */
+	size_t base_size() const
+	{
+		return m_base_size;
+	}
+
+	int shard_id() const
+	{
+		return m_shard_id;
+	}
+
+	int shard_count() const
+	{
+		return m_shard_count;
+	}
+
+	const dnet_raw_id &id(size_t index) const
+	{
+		return m_ids[index];
+	}
+
+	data_pointer data(size_t index) const
+	{
+		check_entry(index);
+		return m_file.slice(m_data - m_file.data<char>() + data_offset(index), data_size_at(index));
+	}
+
+	dnet_time time(size_t index) const
+	{
+		dnet_time time;
+		time.tsec = dnet_bswap64(m_entries[index].time.tsec);
+		time.tnsec = dnet_bswap64(m_entries[index].time.tnsec);
+		return time;
+	}
+
+	dnet_index_entry_ref ref(size_t index) const
+	{
+		check_entry(index);
+		dnet_index_entry_ref ref = { &m_ids[index], m_data + data_offset(index), data_size_at(index), time(index) };
+		return ref;
+	}
+
+	/*!
+	 * Returns position of the first id which is not less than @id among ids starting from @first
+	 */
+	size_t lower_bound(const dnet_raw_id &id, size_t first = 0) const
+	{
+		size_t count = m_count - first;
+
+		while (count > 0) {
+			const size_t step = count / 2;
+			if (memcmp(m_ids[first + step].id, id.id, DNET_ID_SIZE) < 0) {
+				first += step + 1;
+				count -= step + 1;
+			} else {
+				count = step;
+			}
+		}
+
+		return first;
+	}
+
+private:
+	uint64_t data_offset(size_t index) const
+	{
+		return dnet_bswap64(m_entries[index].data_offset);
+	}
+
+	uint64_t data_size_at(size_t index) const
+	{
+		return dnet_bswap64(m_entries[index].data_size);
+	}
+
+	void check_entry(size_t index) const
+	{
+		if (data_offset(index) > m_data_size || m_data_size - data_offset(index) < data_size_at(index))
+			throw std::runtime_error("Invalid index table entry");
+	}
+
+	data_pointer m_file;
+	const dnet_raw_id *m_ids;
+	const dnet_index_table_entry *m_entries;
+	const char *m_data;
+	size_t m_count;
+	size_t m_data_size;
+	size_t m_base_size;
+	int m_shard_id;
+	int m_shard_count;
+};
+
+static inline std::vector<dnet_index_entry_ref> indexes_refs(const dnet_indexes &table)
+{
+	std::vector<dnet_index_entry_ref> refs(table.indexes.size());
+
+	for (size_t i = 0; i < refs.size(); ++i) {
+		const dnet_index_entry &entry = table.indexes[i];
+		dnet_index_entry_ref ref = { &entry.index, entry.data.data(), entry.data.size(), entry.time };
+		refs[i] = ref;
+	}
+
+	return refs;
+}
+
+static inline std::vector<dnet_index_entry_ref> indexes_refs(const index_table_view &view)
+{
+	std::vector<dnet_index_entry_ref> refs(view.size());
+
+	for (size_t i = 0; i < refs.size(); ++i)
+		refs[i] = view.ref(i);
+
+	return refs;
+}
+
+/*!
+ * Packs sorted entries into base segment in fixed-width layout
+ */
+static inline data_pointer indexes_pack_flat(int shard_id, int shard_count, const std::vector<dnet_index_entry_ref> &refs)
+{
+	uint64_t data_size = 0;
+	for (auto it = refs.begin(); it != refs.end(); ++it)
+		data_size += it->size;
+
+	data_buffer buffer(sizeof(dnet_index_table_header)
+		+ refs.size() * (DNET_ID_SIZE + sizeof(dnet_index_table_entry)) + data_size);
+
+	dnet_index_table_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = dnet_bswap64(DNET_INDEX_TABLE_FLAT_MAGIC);
+	header.version = dnet_bswap16(DNET_INDEX_TABLE_FLAT_VERSION);
+	header.id_size = dnet_bswap16(DNET_ID_SIZE);
+	header.shard_id = dnet_bswap32(shard_id);
+	header.shard_count = dnet_bswap32(shard_count);
+	header.entries_count = dnet_bswap64(refs.size());
+	header.data_size = dnet_bswap64(data_size);
+	buffer.write(header);
+
+	for (auto it = refs.begin(); it != refs.end(); ++it)
+		buffer.write(it->id->id, DNET_ID_SIZE);
+
+	uint64_t offset = 0;
+	for (auto it = refs.begin(); it != refs.end(); ++it) {
+		dnet_index_table_entry entry;
+		entry.data_offset = dnet_bswap64(offset);
+		entry.data_size = dnet_bswap64(it->size);
+		entry.time.tsec = dnet_bswap64(it->time.tsec);
+		entry.time.tnsec = dnet_bswap64(it->time.tnsec);
+		buffer.write(entry);
+
+		offset += it->size;
+	}
+
+	for (auto it = refs.begin(); it != refs.end(); ++it) {
+		if (it->size)
+			buffer.write(static_cast<const char *>(it->data), it->size);
+	}
+
+	return std::move(buffer);
+}
+
+static inline bool indexes_delta_less_than(const dnet_index_delta &first, const dnet_index_delta &second)
+{
+	return memcmp(first.entry.index.id, second.entry.index.id, DNET_ID_SIZE) < 0;
+}
+
+/*!
+ * Applies @deltas in their order to sorted @table in one pass
+ */
+static inline void indexes_apply_deltas(dnet_indexes &table, std::vector<dnet_index_delta> &deltas)
+{
+	if (deltas.empty())
+		return;
+
+	table.shard_id = deltas.back().shard_id;
+	table.shard_count = deltas.back().shard_count;
+
+	// Only the latest delta of every id matters
+	std::stable_sort(deltas.begin(), deltas.end(), indexes_delta_less_than);
+
+	std::vector<dnet_index_entry> result;
+	result.reserve(table.indexes.size() + deltas.size());
+
+	auto it = table.indexes.begin();
+	for (auto jt = deltas.begin(); jt != deltas.end(); ++jt) {
+		auto next = jt + 1;
+		if (next != deltas.end() && memcmp(jt->entry.index.id, next->entry.index.id, DNET_ID_SIZE) == 0)
+			continue;
+
+		int cmp = -1;
+		for (; it != table.indexes.end(); ++it) {
+			cmp = memcmp(it->index.id, jt->entry.index.id, DNET_ID_SIZE);
+			if (cmp >= 0)
+				break;
+			result.emplace_back(std::move(*it));
+		}
+
+		if (cmp == 0) {
+			// Inserting the same data again does not change the entry, just like in-place update does
+			if (jt->action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
+				if (it->data == jt->entry.data)
+					result.emplace_back(std::move(*it));
+				else
+					result.emplace_back(std::move(jt->entry));
+			}
+			++it;
+		} else if (jt->action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
+			result.emplace_back(std::move(jt->entry));
+		}
+	}
+
+	for (; it != table.indexes.end(); ++it)
+		result.emplace_back(std::move(*it));
+
+	table.indexes.swap(result);
+}
+
+/*!
+ * Applies @deltas in their order to sorted entries @refs without decoding them,
+ * @refs point to data of @deltas afterwards, so they must outlive @refs
+ */
+static inline void indexes_apply_deltas(std::vector<dnet_index_entry_ref> &refs, std::vector<dnet_index_delta> &deltas)
+{
+	if (deltas.empty())
+		return;
+
+	std::stable_sort(deltas.begin(), deltas.end(), indexes_delta_less_than);
+
+	std::vector<dnet_index_entry_ref> result;
+	result.reserve(refs.size() + deltas.size());
+
+	auto it = refs.begin();
+	for (auto jt = deltas.begin(); jt != deltas.end(); ++jt) {
+		auto next = jt + 1;
+		if (next != deltas.end() && memcmp(jt->entry.index.id, next->entry.index.id, DNET_ID_SIZE) == 0)
+			continue;
+
+		int cmp = -1;
+		for (; it != refs.end(); ++it) {
+			cmp = memcmp(it->id->id, jt->entry.index.id, DNET_ID_SIZE);
+			if (cmp >= 0)
+				break;
+			result.push_back(*it);
+		}
+
+		const dnet_index_entry_ref delta_ref = {
+			&jt->entry.index, jt->entry.data.data(), jt->entry.data.size(), jt->entry.time
+		};
+
+		if (cmp == 0) {
+			if (jt->action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
+				const bool same = it->size == delta_ref.size && (!it->size || !memcmp(it->data, delta_ref.data, it->size));
+				result.push_back(same ? *it : delta_ref);
+			}
+			++it;
+		} else if (jt->action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
+			result.push_back(delta_ref);
+		}
+	}
+
+	result.insert(result.end(), it, refs.end());
+	refs.swap(result);
+}
+
+/*!
+ * Returns size of base segment of stored index object, the rest of it is delta log
+ */
+static inline size_t indexes_base_size(const data_pointer &file)
 {
 	static const unsigned long long magic = dnet_bswap64(DNET_INDEX_TABLE_MAGIC);
 
+	index_table_view view;
+	if (view.parse(file))
+		return view.base_size();
+
 	if (file.size() < DNET_INDEX_TABLE_MAGIC_SIZE
 		|| memcmp(file.data(), &magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0) {
-		throw std::runtime_error("Invalid magic");
+		return 0;
 	}
 
+	size_t offset = DNET_INDEX_TABLE_MAGIC_SIZE;
 	msgpack::unpacked msg;
-	msgpack::unpack(&msg, file.data<char>() + DNET_INDEX_TABLE_MAGIC_SIZE, file.size() - DNET_INDEX_TABLE_MAGIC_SIZE);
-	msg.get().convert(data);
+	msgpack::unpack(&msg, file.data<char>(), file.size(), &offset);
+	return offset;
+}
+
+/*!
+ * Unpacks delta log of stored index object which starts at @offset
+ */
+template <typename T>
+static inline void indexes_unpack_deltas(const data_pointer &file, size_t offset, std::vector<T> *deltas)
+{
+	static const unsigned long long delta_magic = dnet_bswap64(DNET_INDEX_DELTA_MAGIC);
+
+	const char *ptr = file.data<char>();
+	const size_t size = file.size();
+
+	while (offset < size) {
+		if (size - offset < DNET_INDEX_TABLE_MAGIC_SIZE
+			|| memcmp(ptr + offset, &delta_magic, DNET_INDEX_TABLE_MAGIC_SIZE) != 0) {
+			throw std::runtime_error("Invalid delta magic");
+		}
+		offset += DNET_INDEX_TABLE_MAGIC_SIZE;
+
+		msgpack::unpacked msg;
+		msgpack::unpack(&msg, ptr, size, &offset);
+
+		deltas->emplace_back();
+		msg.get().convert(&deltas->back());
+	}
+}
+
+template <typename T>
+static inline void indexes_unpack_raw(const data_pointer &file, T *data)
+{
+	static const unsigned long long magic = dnet_bswap64(DNET_INDEX_TABLE_MAGIC);
+	static const unsigned long long delta_magic = dnet_bswap64(DNET_INDEX_DELTA_MAGIC);
+
+	const char *ptr = file.data<char>();
+	const size_t size = file.size();
+	size_t offset = DNET_INDEX_TABLE_MAGIC_SIZE;
+
+	index_table_view view;
+
+	if (view.parse(file)) {
+		data->shard_id = view.shard_id();
+		data->shard_count = view.shard_count();
+		data->indexes.resize(view.size());
+
+		for (size_t i = 0; i < view.size(); ++i) {
+			dnet_index_entry &entry = data->indexes[i];
+			const dnet_index_entry_ref ref = view.ref(i);
+
+			entry.index = *ref.id;
+			entry.data = ref.size ? data_pointer::copy(ref.data, ref.size) : data_pointer();
+			entry.time = ref.time;
+		}
+
+		offset = view.base_size();
+	} else if (size >= DNET_INDEX_TABLE_MAGIC_SIZE && memcmp(ptr, &magic, DNET_INDEX_TABLE_MAGIC_SIZE) == 0) {
+		msgpack::unpacked msg;
+		msgpack::unpack(&msg, ptr, size, &offset);
+		msg.get().convert(data);
+	} else if (size >= DNET_INDEX_TABLE_MAGIC_SIZE && memcmp(ptr, &delta_magic, DNET_INDEX_TABLE_MAGIC_SIZE) == 0) {
+		data->shard_id = 0;
+		data->shard_count = 0;
+		data->indexes.clear();
+		offset = 0;
+	} else {
+		throw std::runtime_error("Invalid magic");
+	}
+
+	std::vector<dnet_index_delta> deltas;
+	indexes_unpack_deltas(file, offset, &deltas);
+	indexes_apply_deltas(*data, deltas);
 }
 
 template <typename T>
@@ -119,6 +585,10 @@ enum dnet_indexes_version : uint16_t {
 	dnet_indexes_version_second = 2
 };
 
+enum dnet_index_delta_version : uint16_t {
+	dnet_index_delta_version_first = 1
+};
+
 enum find_indexes_result_entry_version : uint16_t {
 	find_indexes_result_entry_version_first = 1
 };
@@ -247,6 +717,21 @@ inline dnet_indexes &operator >>(msgpack::object o, dnet_indexes &v)
 	return v;
 }
 
+/*
+ * Entry reference is packed just like dnet_index_entry it points to
+ */
+template <typename Stream>
+inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const dnet_index_entry_ref &v)
+{
+	o.pack_array(4);
+	o.pack(*v.id);
+	o.pack_raw(v.size);
+	o.pack_raw_body(static_cast<const char *>(v.data), v.size);
+	o.pack(v.time.tsec);
+	o.pack(v.time.tnsec);
+	return o;
+}
+
 template <typename Stream>
 inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const dnet_indexes &v)
 {
@@ -258,6 +743,45 @@ inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const dn
 	return o;
 }
 
+inline dnet_index_delta &operator >>(msgpack::object o, dnet_index_delta &v)
+{
+	if (o.type != msgpack::type::ARRAY || o.via.array.size < 1)
+		throw msgpack::type_error();
+
+	object *p = o.via.array.ptr;
+	const uint32_t size = o.via.array.size;
+	uint16_t version = 0;
+	p[0].convert(&version);
+	switch (version) {
+	case dnet_index_delta_version_first: {
+		if (size != 5)
+			throw msgpack::type_error();
+
+		p[1].convert(&v.action);
+		p[2].convert(&v.entry);
+		p[3].convert(&v.shard_id);
+		p[4].convert(&v.shard_count);
+		break;
+	}
+	default:
+		throw msgpack::type_error();
+	}
+
+	return v;
+}
+
+template <typename Stream>
+inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const dnet_index_delta &v)
+{
+	o.pack_array(5);
+	o.pack(uint16_t(dnet_index_delta_version_first));
+	o.pack(v.action);
+	o.pack(v.entry);
+	o.pack(v.shard_id);
+	o.pack(v.shard_count);
+	return o;
+}
+
 template <typename Stream>
 inline msgpack::packer<Stream> &operator <<(msgpack::packer<Stream> &o, const find_indexes_result_entry &result)
 {
@@ -296,4 +820,73 @@ inline find_indexes_result_entry &operator >>(msgpack::object obj, find_indexes_
 
 } /* namespace msgpack */
 
+namespace ioremap { namespace elliptics {
+
+/*!
+ * Packs base segment with magic, it is followed by msgpacked table
+ */
+static inline data_pointer indexes_pack_base(const msgpack::sbuffer &buffer)
+{
+	data_buffer tmp_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
+	tmp_buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
+	tmp_buffer.write(buffer.data(), buffer.size());
+
+	return std::move(tmp_buffer);
+}
+
+/*!
+ * Packs sorted entries into base segment, in fixed-width layout if @flat is set
+ * or into msgpacked dnet_indexes otherwise
+ */
+static inline data_pointer indexes_pack_refs(int shard_id, int shard_count, const std::vector<dnet_index_entry_ref> &refs, bool flat)
+{
+	if (flat)
+		return indexes_pack_flat(shard_id, shard_count, refs);
+
+	msgpack::sbuffer buffer;
+	msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+	packer.pack_array(4);
+	packer.pack(uint16_t(msgpack::dnet_indexes_version_second));
+	packer.pack_array(refs.size());
+	for (auto it = refs.begin(); it != refs.end(); ++it)
+		packer.pack(*it);
+	packer.pack(shard_id);
+	packer.pack(shard_count);
+
+	return indexes_pack_base(buffer);
+}
+
+/*!
+ * Packs index table into format of stored index object, inverse of indexes_unpack_raw().
+ * Table is packed in fixed-width layout if @flat is set or into msgpacked dnet_indexes otherwise
+ */
+static inline data_pointer indexes_pack(const dnet_indexes &data, bool flat)
+{
+	if (flat)
+		return indexes_pack_flat(data.shard_id, data.shard_count, indexes_refs(data));
+
+	msgpack::sbuffer buffer;
+	msgpack::pack(&buffer, data);
+
+	return indexes_pack_base(buffer);
+}
+
+/*!
+ * Packs delta record which is appended to stored index object
+ */
+static inline data_pointer indexes_pack_delta(const dnet_index_delta &delta)
+{
+	msgpack::sbuffer buffer;
+	msgpack::pack(&buffer, delta);
+
+	data_buffer tmp_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
+	tmp_buffer.write(dnet_bswap64(DNET_INDEX_DELTA_MAGIC));
+	tmp_buffer.write(buffer.data(), buffer.size());
+
+	return std::move(tmp_buffer);
+}
+
+}} /* namespace ioremap::elliptics */
+
 #endif /* __CPP_SESSION_INDEXES_HPP */
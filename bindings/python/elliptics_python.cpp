@@ -86,6 +86,8 @@ enum elliptics_config_flags {
 	config_flags_mix_states			= DNET_CFG_MIX_STATES,
 	config_flags_no_csum			= DNET_CFG_NO_CSUM,
 	config_flags_randomize_states	= DNET_CFG_RANDOMIZE_STATES,
+	config_flags_per_core_net_threads	= DNET_CFG_PER_CORE_NET_THREADS,
+	config_flags_fixed_width_indexes	= DNET_CFG_FIXED_WIDTH_INDEXES,
 };
 
 enum elliptics_node_status_flags {
@@ -455,13 +457,17 @@ BOOST_PYTHON_MODULE(core)
 	    "no_route_list\n    Do not request route table from remote nodes\n"
 	    "mix_states\n    Mix states according to their weights before reading data\n"
 	    "no_csum\n    Globally disable checksum verification and update\n"
-	    "randomize_states\n    Randomize states for read requests\n\n"
+	    "randomize_states\n    Randomize states for read requests\n"
+	    "per_core_net_threads\n    Pin net threads to CPUs, every one owns its listening socket and connections\n"
+	    "fixed_width_indexes\n    Write index shards in fixed-width layout, which older versions can not read\n\n"
 	    "config.flags = elliptics.config_flags.mix_stats | elliptics.config_flags.randomize_states\n"
 	    )
 		.value("no_route_list", config_flags_no_route_list)
 		.value("mix_states", config_flags_mix_states)
 		.value("no_csum", config_flags_no_csum)
 		.value("randomize_states", config_flags_randomize_states)
+		.value("per_core_net_threads", config_flags_per_core_net_threads)
+		.value("fixed_width_indexes", config_flags_fixed_width_indexes)
 	;
 
 	bp::enum_<elliptics_node_status_flags>("status_flags",
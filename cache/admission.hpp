@@ -0,0 +1,195 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ADMISSION_HPP
+#define ADMISSION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#if __GNUC__ == 4 && __GNUC_MINOR__ < 5
+#  include <cstdatomic>
+#else
+#  include <atomic>
+#endif
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Decides whether object missing in the cache is worth taking place of the object
+ * which would be evicted to make room for it.
+ */
+class admission_policy_t {
+public:
+	virtual ~admission_policy_t() {}
+
+	/*!
+	 * Notes access to object with id @id, may be called concurrently
+	 */
+	virtual void record(const unsigned char *id) = 0;
+
+	/*!
+	 * Returns true if @candidate should be cached in place of @victim
+	 */
+	virtual bool admit(const unsigned char *candidate, const unsigned char *victim) = 0;
+};
+
+/*!
+ * Count-min sketch of 4-bit saturating counters estimating how often every id has been accessed recently.
+ * All counters are halved once number of recorded accesses reaches sample size, so old popularity fades away.
+ */
+class frequency_sketch_t {
+public:
+	explicit frequency_sketch_t(size_t counters_number) :
+		m_mask(round_up(counters_number) - 1),
+		m_table(new std::atomic<uint64_t>[(m_mask + 1) / counters_per_word]),
+		m_sample_size((m_mask + 1) * 10),
+		m_additions(0) {
+		for (size_t i = 0; i < (m_mask + 1) / counters_per_word; ++i) {
+			m_table[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void increment(const unsigned char *id) {
+		bool added = false;
+
+		for (size_t i = 0; i < hashes_number; ++i) {
+			added |= increment_at(get_index(id, i));
+		}
+
+		if (added && m_additions.fetch_add(1, std::memory_order_relaxed) + 1 == m_sample_size)
+			reset();
+	}
+
+	unsigned estimate(const unsigned char *id) const {
+		unsigned frequency = counter_max;
+
+		for (size_t i = 0; i < hashes_number; ++i) {
+			const size_t index = get_index(id, i);
+			const uint64_t word = m_table[index / counters_per_word].load(std::memory_order_relaxed);
+			const unsigned counter = (word >> get_shift(index)) & counter_max;
+
+			if (counter < frequency)
+				frequency = counter;
+		}
+
+		return frequency;
+	}
+
+	size_t counters_number() const {
+		return m_mask + 1;
+	}
+
+private:
+	static const size_t hashes_number = 4;
+	static const size_t counters_per_word = 16;
+	static const unsigned counter_max = 0xf;
+
+	size_t m_mask;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_table;
+	size_t m_sample_size;
+	std::atomic<size_t> m_additions;
+
+	static size_t round_up(size_t number) {
+		size_t result = counters_per_word;
+		while (result < number)
+			result *= 2;
+		return result;
+	}
+
+	/*!
+	 * Ids are already uniformly distributed, so their consecutive words are used as independent hashes
+	 */
+	size_t get_index(const unsigned char *id, size_t hash_number) const {
+		uint64_t hash;
+		memcpy(&hash, id + (hash_number + 1) * sizeof(hash), sizeof(hash));
+		return hash & m_mask;
+	}
+
+	static size_t get_shift(size_t index) {
+		return (index % counters_per_word) * 4;
+	}
+
+	bool increment_at(size_t index) {
+		std::atomic<uint64_t> &word = m_table[index / counters_per_word];
+		const size_t shift = get_shift(index);
+		uint64_t value = word.load(std::memory_order_relaxed);
+
+		do {
+			if (((value >> shift) & counter_max) == counter_max)
+				return false;
+		} while (!word.compare_exchange_weak(value, value + (uint64_t(1) << shift), std::memory_order_relaxed));
+
+		return true;
+	}
+
+	void reset() {
+		for (size_t i = 0; i < (m_mask + 1) / counters_per_word; ++i) {
+			uint64_t value = m_table[i].load(std::memory_order_relaxed);
+			while (!m_table[i].compare_exchange_weak(value, (value >> 1) & 0x7777777777777777ULL, std::memory_order_relaxed));
+		}
+
+		m_additions.fetch_sub(m_sample_size / 2, std::memory_order_relaxed);
+	}
+};
+
+/*!
+ * TinyLFU: candidate is admitted only if it has been accessed more often than the victim,
+ * so single pass over cold keys can not wash popular objects out of the cache.
+ */
+class tinylfu_admission_t : public admission_policy_t {
+public:
+	explicit tinylfu_admission_t(size_t counters_number) : m_sketch(counters_number) {
+	}
+
+	virtual void record(const unsigned char *id) {
+		m_sketch.increment(id);
+	}
+
+	virtual bool admit(const unsigned char *candidate, const unsigned char *victim) {
+		return m_sketch.estimate(candidate) > m_sketch.estimate(victim);
+	}
+
+private:
+	frequency_sketch_t m_sketch;
+};
+
+/*!
+ * Creates admission policy @name for cache shard of @max_size bytes,
+ * returns empty pointer for "none" policy which admits everything.
+ */
+static inline std::unique_ptr<admission_policy_t> create_admission_policy(const std::string &name, size_t max_size) {
+	if (name == "none")
+		return std::unique_ptr<admission_policy_t>();
+
+	if (name == "tinylfu") {
+		// about one counter per kilobyte of cache, the sketch itself takes 1/2048 of the cache size
+		const size_t counters_number = std::min<size_t>(std::max<size_t>(max_size / 1024, 4096), 1 << 24);
+		return std::unique_ptr<admission_policy_t>(new tinylfu_admission_t(counters_number));
+	}
+
+	throw std::invalid_argument("unknown cache admission policy: " + name);
+}
+
+}}
+
+#endif // ADMISSION_HPP
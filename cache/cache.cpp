@@ -19,6 +19,7 @@
 #include "slru_cache.hpp"
 
 #include <fstream>
+#include <unistd.h>
 
 #include "boost/lexical_cast.hpp"
 
@@ -29,6 +30,8 @@
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 
+#include <elliptics/timer.hpp>
+
 #include "../example/config.hpp"
 
 namespace ioremap { namespace cache {
@@ -45,13 +48,38 @@ std::unique_ptr<cache_config> cache_config::parse(const elliptics::config::confi
 	config.count = cache.at<size_t>("shards", DNET_DEFAULT_CACHES_NUMBER);
 	config.sync_timeout = cache.at<unsigned>("sync_timeout", DNET_DEFAULT_CACHE_SYNC_TIMEOUT_SEC);
 	config.pages_proportions = cache.at("pages_proportions", std::vector<size_t>(DNET_DEFAULT_CACHE_PAGES_NUMBER, 1));
+	config.admission = cache.at<std::string>("admission", "none");
+	if (config.admission != "none" && config.admission != "tinylfu") {
+		throw elliptics::config::config_error(cache.at("admission").path() + " must be one of: none, tinylfu");
+	}
+	config.snapshot_dir = cache.at<std::string>("snapshot_dir", std::string());
+	config.snapshot_interval = cache.at<unsigned>("snapshot_interval", DNET_DEFAULT_CACHE_SNAPSHOT_INTERVAL_SEC);
+	if (config.snapshot_interval == 0) {
+		throw elliptics::config::config_error(cache.at("snapshot_interval").path() + " must be non-zero");
+	}
+	config.warm_up_rate = cache.at<size_t>("warm_up_rate", DNET_DEFAULT_CACHE_WARM_UP_RATE);
+	config.sync_threads = cache.at<size_t>("sync_threads", DNET_DEFAULT_CACHE_SYNC_THREADS);
+	config.dirty_ratio = cache.at<unsigned>("dirty_ratio", DNET_DEFAULT_CACHE_DIRTY_RATIO);
+	if (config.dirty_ratio > 100) {
+		throw elliptics::config::config_error(cache.at("dirty_ratio").path() + " must be in range [0, 100]");
+	}
+	config.indexes_size = cache.at<size_t>("indexes_size", 0);
 	return blackhole::utils::make_unique<cache_config>(config);
 }
 
-cache_manager::cache_manager(dnet_backend_io *backend, dnet_node *n, const cache_config &config) : m_node(n) {
+cache_manager::cache_manager(dnet_backend_io *backend, dnet_node *n, const cache_config &config) :
+	m_node(n),
+	m_backend(backend),
+	m_sync_pool(config.sync_threads, backend->backend_id),
+	m_histograms(CACHE_HISTOGRAM_LOCK_WAIT + config.count),
+	m_snapshot_interval(config.snapshot_interval),
+	m_warm_up_rate(config.warm_up_rate),
+	m_warming_up(true),
+	m_need_exit(false) {
 	size_t caches_number = config.count;
 	m_cache_pages_number = config.pages_proportions.size();
 	m_max_cache_size = config.size;
+	m_max_indexes_size = config.indexes_size;
 	size_t max_size = m_max_cache_size / caches_number;
 
 	size_t proportionsSum = 0;
@@ -65,18 +93,39 @@ cache_manager::cache_manager(dnet_backend_io *backend, dnet_node *n, const cache
 	}
 
 	for (size_t i = 0; i < caches_number; ++i) {
-		m_caches.emplace_back(std::make_shared<slru_cache_t>(backend, n, pages_max_sizes, config.sync_timeout));
+		m_caches.emplace_back(std::make_shared<slru_cache_t>(backend, n, pages_max_sizes, config.sync_timeout,
+				create_admission_policy(config.admission, max_size),
+				&m_sync_pool, max_size / 100 * config.dirty_ratio, m_max_indexes_size / caches_number,
+				&m_histograms, CACHE_HISTOGRAM_LOCK_WAIT + i));
+	}
+
+	if (!config.snapshot_dir.empty()) {
+		m_snapshot_path = config.snapshot_dir + "/cache-" + boost::lexical_cast<std::string>(backend->backend_id) + ".snapshot";
+		m_snapshot_thread = std::thread(std::bind(&cache_manager::snapshot_loop, this));
 	}
 }
 
 cache_manager::~cache_manager() {
+	{
+		std::lock_guard<std::mutex> guard(m_snapshot_lock);
+		m_need_exit = true;
+	}
+	m_snapshot_wait.notify_all();
+
+	if (m_warm_up_thread.joinable())
+		m_warm_up_thread.join();
+	if (m_snapshot_thread.joinable())
+		m_snapshot_thread.join();
+
+	if (!m_snapshot_path.empty() && !m_warming_up)
+		save_snapshot();
 }
 
 int cache_manager::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data) {
 	return m_caches[idx(id)]->write(id, st, cmd, io, data);
 }
 
-std::shared_ptr<raw_data_t> cache_manager::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
+raw_data_ptr_t cache_manager::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
 	return m_caches[idx(id)]->read(id, cmd, io);
 }
 
@@ -88,22 +137,16 @@ int cache_manager::lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd
 	return m_caches[idx(id)]->lookup(id, st, cmd);
 }
 
-int cache_manager::indexes_find(dnet_cmd *cmd, dnet_indexes_request *request) {
-	(void) cmd;
-	(void) request;
-	return -ENOTSUP;
+bool cache_manager::indexes_enabled() const {
+	return m_max_indexes_size != 0;
 }
 
-int cache_manager::indexes_update(dnet_cmd *cmd, dnet_indexes_request *request) {
-	(void) cmd;
-	(void) request;
-	return -ENOTSUP;
+std::shared_ptr<const elliptics::dnet_indexes> cache_manager::indexes_find(const unsigned char *id, int *err) {
+	return m_caches[idx(id)]->indexes_find(id, err);
 }
 
-int cache_manager::indexes_internal(dnet_cmd *cmd, dnet_indexes_request *request) {
-	(void) cmd;
-	(void) request;
-	return -ENOTSUP;
+int cache_manager::indexes_update(const unsigned char *id, const std::function<bool (elliptics::dnet_indexes &)> &update) {
+	return m_caches[idx(id)]->indexes_update(id, update);
 }
 
 void cache_manager::clear() {
@@ -130,6 +173,19 @@ cache_stats cache_manager::get_total_cache_stats() const {
 		stats.number_of_objects_marked_for_deletion += page_stats.number_of_objects_marked_for_deletion;
 		stats.size_of_objects_marked_for_deletion += page_stats.size_of_objects_marked_for_deletion;
 		stats.size_of_objects += page_stats.size_of_objects;
+		stats.size_of_entries_slabs += page_stats.size_of_entries_slabs;
+		stats.hits += page_stats.hits;
+		stats.misses += page_stats.misses;
+		stats.coalesced_misses += page_stats.coalesced_misses;
+		stats.admitted += page_stats.admitted;
+		stats.rejected += page_stats.rejected;
+		stats.size_of_dirty_objects += page_stats.size_of_dirty_objects;
+		stats.number_of_index_tables += page_stats.number_of_index_tables;
+		stats.size_of_index_tables += page_stats.size_of_index_tables;
+		stats.index_table_hits += page_stats.index_table_hits;
+		stats.index_table_misses += page_stats.index_table_misses;
+		stats.object_sizes.merge(page_stats.object_sizes);
+		stats.lock_wait.merge(page_stats.lock_wait);
 
 		for (size_t j = 0; j < m_cache_pages_number; ++j) {
 			stats.pages_sizes[j] += page_stats.pages_sizes[j];
@@ -160,6 +216,19 @@ rapidjson::Value &cache_manager::get_caches_size_stats_json(rapidjson::Value &st
 	return stat_value;
 }
 
+rapidjson::Value &cache_manager::get_latency_stats_json(rapidjson::Value &stat_value, rapidjson::Document::AllocatorType &allocator) const {
+	for (size_t i = 0; i < CACHE_HISTOGRAM_LOCK_WAIT; ++i) {
+		rapidjson::Value histogram_stat(rapidjson::kObjectType);
+		m_histograms.get(i).to_json(histogram_stat, allocator);
+		stat_value.AddMember(cache_histogram_name(i), histogram_stat, allocator);
+	}
+	return stat_value;
+}
+
+log_histogram_t cache_manager::get_histogram(cache_histogram_t histogram) const {
+	return m_histograms.get(histogram);
+}
+
 std::string cache_manager::stat_json() const {
 	rapidjson::Document doc;
 	doc.SetObject();
@@ -171,6 +240,10 @@ std::string cache_manager::stat_json() const {
 	get_total_caches_size_stats_json(size_stats, allocator);
 
 	total_cache.AddMember("size_stats", size_stats, allocator);
+
+	rapidjson::Value latency_stats(rapidjson::kObjectType);
+	get_latency_stats_json(latency_stats, allocator);
+	total_cache.AddMember("latency_stats", latency_stats, allocator);
 	doc.AddMember("total_cache", total_cache, allocator);
 
 	rapidjson::Value caches(rapidjson::kObjectType);
@@ -183,6 +256,166 @@ std::string cache_manager::stat_json() const {
 	return buffer.GetString();
 }
 
+/*
+ * Starts reading objects listed in the snapshot back into the cache in background,
+ * must be called once the backend is able to serve reads.
+ */
+void cache_manager::warm_up() {
+	if (m_snapshot_path.empty() || m_warm_up_thread.joinable())
+		return;
+
+	m_warm_up_thread = std::thread(std::bind(&cache_manager::warm_up_loop, this));
+}
+
+bool cache_manager::need_exit() {
+	std::lock_guard<std::mutex> guard(m_snapshot_lock);
+	return m_need_exit || dnet_need_exit(m_node) || m_backend->need_exit;
+}
+
+/*
+ * Sleeps for @msecs milliseconds, returns true if cache is being destroyed
+ */
+bool cache_manager::wait_for_exit(int64_t msecs) {
+	std::unique_lock<std::mutex> guard(m_snapshot_lock);
+	m_snapshot_wait.wait_for(guard, std::chrono::milliseconds(msecs), [this] () { return m_need_exit; });
+	return m_need_exit || dnet_need_exit(m_node) || m_backend->need_exit;
+}
+
+/*
+ * Writes ids of all cached objects into temporary file which atomically replaces the snapshot
+ */
+int cache_manager::save_snapshot() {
+	std::vector<cache_snapshot_record_t> records;
+	std::vector<std::vector<cache_snapshot_record_t>> pages(m_cache_pages_number);
+
+	for (size_t i = 0; i < m_caches.size(); ++i) {
+		records.clear();
+		m_caches[i]->get_snapshot(records);
+
+		for (auto it = records.begin(); it != records.end(); ++it) {
+			pages[it->page_number].push_back(*it);
+		}
+	}
+
+	cache_snapshot_header_t header;
+	memcpy(header.magic, "ECSNAPSH", sizeof(header.magic));
+	header.version = 1;
+	header.pages_number = m_cache_pages_number;
+
+	const std::string tmp_path = m_snapshot_path + ".tmp";
+	size_t records_number = 0;
+	int err = 0;
+
+	FILE *f = fopen(tmp_path.c_str(), "w");
+	if (!f) {
+		err = -errno;
+		dnet_log(m_node, DNET_LOG_ERROR, "CACHE: failed to open snapshot %s: %d", tmp_path.c_str(), err);
+		return err;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, f) != 1)
+		err = -errno;
+
+	for (size_t page_number = 0; !err && page_number < pages.size(); ++page_number) {
+		const std::vector<cache_snapshot_record_t> &page = pages[page_number];
+
+		if (!page.empty() && fwrite(page.data(), sizeof(cache_snapshot_record_t), page.size(), f) != page.size())
+			err = -errno;
+
+		records_number += page.size();
+	}
+
+	if (!err && (fflush(f) || fsync(fileno(f))))
+		err = -errno;
+
+	fclose(f);
+
+	if (!err && rename(tmp_path.c_str(), m_snapshot_path.c_str()))
+		err = -errno;
+
+	if (err) {
+		dnet_log(m_node, DNET_LOG_ERROR, "CACHE: failed to save snapshot %s: %d", m_snapshot_path.c_str(), err);
+		unlink(tmp_path.c_str());
+		return err;
+	}
+
+	dnet_log(m_node, DNET_LOG_INFO, "CACHE: saved snapshot %s: objects: %zu", m_snapshot_path.c_str(), records_number);
+	return 0;
+}
+
+void cache_manager::snapshot_loop() {
+	dnet_set_name("dnet_cache_snap_%zu", m_backend->backend_id);
+
+	while (!wait_for_exit(m_snapshot_interval * 1000)) {
+		if (!m_warming_up)
+			save_snapshot();
+	}
+}
+
+/*
+ * Populates objects listed in the snapshot, disk reads are throttled down to m_warm_up_rate bytes per second
+ */
+void cache_manager::warm_up_loop() {
+	dnet_set_name("dnet_cache_warm_%zu", m_backend->backend_id);
+
+	FILE *f = fopen(m_snapshot_path.c_str(), "r");
+	if (!f) {
+		if (errno != ENOENT) {
+			dnet_log(m_node, DNET_LOG_ERROR, "CACHE: failed to open snapshot %s: %d", m_snapshot_path.c_str(), -errno);
+		}
+		m_warming_up = false;
+		return;
+	}
+
+	cache_snapshot_header_t header;
+	if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, "ECSNAPSH", sizeof(header.magic)) || header.version != 1) {
+		dnet_log(m_node, DNET_LOG_ERROR, "CACHE: invalid snapshot %s", m_snapshot_path.c_str());
+		fclose(f);
+		m_warming_up = false;
+		return;
+	}
+
+	elliptics::timer tm;
+	size_t total_size = 0, objects_number = 0;
+	cache_snapshot_record_t record;
+
+	while (fread(&record, sizeof(record), 1, f) == 1) {
+		if (need_exit())
+			break;
+
+		size_t size = 0;
+		int err = 0;
+
+		try {
+			err = m_caches[idx(record.id.id)]->warm_up(record.id.id, record.page_number, &size);
+		} catch (const std::exception &e) {
+			dnet_log(m_node, DNET_LOG_ERROR, "%s: CACHE: warm up failed: %s", dnet_dump_id_str(record.id.id), e.what());
+			err = -EIO;
+		}
+
+		if (!err && size)
+			++objects_number;
+		total_size += size;
+
+		if (m_warm_up_rate) {
+			const int64_t expected = total_size * 1000 / m_warm_up_rate;
+			const int64_t elapsed = tm.elapsed();
+
+			if (expected > elapsed && wait_for_exit(expected - elapsed))
+				break;
+		}
+	}
+
+	fclose(f);
+
+	dnet_log(m_node, DNET_LOG_INFO, "CACHE: warmed up from snapshot %s: objects: %zu, size: %zu, time: %lld ms",
+			m_snapshot_path.c_str(), objects_number, total_size, (long long)tm.elapsed());
+
+	// interrupted warm up leaves the snapshot for the next start
+	if (!need_exit())
+		m_warming_up = false;
+}
+
 size_t cache_manager::idx(const unsigned char *id) {
 	size_t i = *(size_t *)id;
 	size_t j = *(size_t *)(id + DNET_ID_SIZE - sizeof(size_t));
@@ -193,6 +426,11 @@ size_t cache_manager::idx(const unsigned char *id) {
 
 using namespace ioremap::cache;
 
+static void dnet_cache_data_put(void *data_ref)
+{
+	intrusive_ptr_release(static_cast<raw_data_t *>(data_ref));
+}
+
 int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data)
 {
 	react::action_guard cache_guard(ACTION_CACHE);
@@ -208,7 +446,7 @@ int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st
 	}
 
 	cache_manager *cache = (cache_manager *)backend->cache;
-	std::shared_ptr<raw_data_t> d;
+	raw_data_ptr_t d;
 
 	try {
 		switch (cmd->cmd) {
@@ -256,7 +494,13 @@ int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st
 				io->total_size = d->size();
 
 				cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-				err = dnet_send_read_data(st, cmd, io, (char *)d->data().data() + io->offset, -1, io->offset, 0);
+
+				/*!
+				 * Queued reply holds a reference to cached data instead of its copy
+				 */
+				intrusive_ptr_add_ref(d.get());
+				err = dnet_send_read_data_ref(st, cmd, io, d->data() + io->offset,
+						d.get(), dnet_cache_data_put);
 				break;
 			case DNET_CMD_DEL:
 				err = cache->remove(cmd->id.id, io);
@@ -309,3 +553,9 @@ void dnet_cache_cleanup(void *cache)
 {
 	delete (cache_manager *)cache;
 }
+
+void dnet_cache_warm_up(void *cache)
+{
+	if (cache)
+		((cache_manager *)cache)->warm_up();
+}
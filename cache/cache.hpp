@@ -20,10 +20,13 @@
 
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <cstdio>
 #include <unordered_map>
 #include <limits>
+#include <system_error>
+#include <pthread.h>
 #if __GNUC__ == 4 && __GNUC_MINOR__ < 5
 #  include <cstdatomic>
 #else
@@ -31,6 +34,7 @@
 #endif
 
 #include <boost/intrusive/list.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 #include "library/elliptics.h"
 #include "indexes/local_session.h"
@@ -42,37 +46,113 @@
 #include "monitor/rapidjson/writer.h"
 #include "monitor/rapidjson/stringbuffer.h"
 
-#include "treap.hpp"
+#include "hash_index.hpp"
+#include "event_heap.hpp"
+#include "slab.hpp"
+#include "admission.hpp"
+#include "sync_pool.hpp"
+#include "histogram.hpp"
 
 #include "react/elliptics_react.hpp"
 
 namespace ioremap { namespace cache {
 
+/*!
+ * Payload of cached object.
+ * Header and data share single allocation rounded up to allocator size class, whole allocation
+ * is accounted as object's size. Payload is reference counted, so replies queued for sending
+ * keep it alive after object is modified or evicted.
+ */
 class raw_data_t {
 public:
-	raw_data_t(const char *data, size_t size) {
-		m_data.reserve(size);
-		m_data.insert(m_data.begin(), data, data + size);
+	/*!
+	 * Allocates payload which may hold at least @capacity bytes and copies @size bytes of @data into it
+	 */
+	static boost::intrusive_ptr<raw_data_t> create(const char *data, size_t size, size_t capacity) {
+		const size_t allocated_size = size_class(sizeof(raw_data_t) + std::max(size, capacity));
+
+		void *ptr = malloc(allocated_size);
+		if (!ptr)
+			throw std::bad_alloc();
+
+		raw_data_t *raw = new (ptr) raw_data_t(size, allocated_size - sizeof(raw_data_t));
+		if (size)
+			memcpy(raw->data(), data, size);
+
+		return boost::intrusive_ptr<raw_data_t>(raw);
 	}
 
-	std::vector<char> &data(void) {
-		return m_data;
+	raw_data_t(const raw_data_t &) = delete;
+	raw_data_t &operator =(const raw_data_t &) = delete;
+
+	char *data(void) {
+		return reinterpret_cast<char *>(this + 1);
+	}
+
+	const char *data(void) const {
+		return reinterpret_cast<const char *>(this + 1);
 	}
 
-	size_t size(void) {
-		return m_data.size();
+	size_t size(void) const {
+		return m_size;
+	}
+
+	void set_size(size_t size) {
+		m_size = size;
+	}
+
+	size_t capacity(void) const {
+		return m_capacity;
+	}
+
+	bool unique(void) const {
+		return m_refcnt.load(std::memory_order_acquire) == 1;
+	}
+
+	friend void intrusive_ptr_add_ref(raw_data_t *raw) {
+		raw->m_refcnt.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	friend void intrusive_ptr_release(raw_data_t *raw) {
+		if (raw->m_refcnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			raw->~raw_data_t();
+			free(raw);
+		}
 	}
 
 private:
-	std::vector<char> m_data;
+	raw_data_t(size_t size, size_t capacity) : m_refcnt(0), m_size(size), m_capacity(capacity) {
+	}
+
+	/*!
+	 * Four classes per power of two, so that rounding wastes at most quarter of allocation
+	 * and freed blocks are reusable for other objects of similar size.
+	 */
+	static size_t size_class(size_t size) {
+		if (size <= 64)
+			return 64;
+
+		size_t step = 1;
+		while (step * 8 <= size)
+			step *= 2;
+		step = std::max<size_t>(step, 16);
+
+		return (size + step - 1) / step * step;
+	}
+
+	std::atomic<size_t> m_refcnt;
+	size_t m_size;
+	size_t m_capacity;
 };
 
+typedef boost::intrusive_ptr<raw_data_t> raw_data_ptr_t;
+
 struct data_lru_tag_t;
 typedef boost::intrusive::list_base_hook<boost::intrusive::tag<data_lru_tag_t>,
 boost::intrusive::link_mode<boost::intrusive::safe_link>, boost::intrusive::optimize_size<true>
 > lru_list_base_hook_t;
 
-class data_t : public lru_list_base_hook_t, public treap_node_t<data_t> {
+class data_t : public lru_list_base_hook_t, public event_heap_node_t {
 public:
 	enum class sync_state_t : char {
 		NOT_SYNCING,
@@ -98,7 +178,7 @@ public:
 		if (lifetime)
 			m_lifetime = lifetime + time(NULL);
 
-		m_data.reset(new raw_data_t(data, size));
+		m_data = raw_data_t::create(data, size, size);
 	}
 
 	data_t(const data_t &other) = delete;
@@ -114,10 +194,34 @@ public:
 		return m_id;
 	}
 
-	std::shared_ptr<raw_data_t> data(void) const {
+	const raw_data_ptr_t &data(void) const {
 		return m_data;
 	}
 
+	/*!
+	 * Makes payload @new_size bytes long and returns it for modification, bytes past old size are zeroed.
+	 * Replies queued for sending may still reference current payload, so it is copied instead of
+	 * being modified in place. It is also reallocated if it is too small, appended objects grow
+	 * by half of their size to keep appends amortized.
+	 */
+	char *resize_data(size_t new_size) {
+		const size_t old_size = m_data->size();
+
+		if (!m_data->unique() || new_size > m_data->capacity()) {
+			size_t capacity = new_size;
+			if (new_size > m_data->capacity() && new_size > old_size)
+				capacity = std::max(new_size, old_size + old_size / 2);
+
+			m_data = raw_data_t::create(m_data->data(), std::min(old_size, new_size), capacity);
+		}
+
+		if (new_size > old_size)
+			memset(m_data->data() + old_size, 0, new_size - old_size);
+
+		m_data->set_size(new_size);
+		return m_data->data();
+	}
+
 	size_t lifetime(void) const {
 		return m_lifetime;
 	}
@@ -232,11 +336,11 @@ public:
 	}
 
 	size_t overhead_size(void) const {
-		return sizeof(*this) + sizeof(*m_data);
+		return sizeof(*this) + sizeof(raw_data_t);
 	}
 
 	size_t capacity(void) const {
-		return m_data->data().capacity();
+		return m_data->capacity();
 	}
 
 	friend bool operator< (const data_t &a, const data_t &b) {
@@ -263,14 +367,14 @@ private:
 	sync_state_t m_sync_state;
 	char m_cache_page_number;
 	struct dnet_raw_id m_id;
-	std::shared_ptr<raw_data_t> m_data;
+	raw_data_ptr_t m_data;
 };
 
 struct record_info {
 	record_info(data_t* obj) {
 		only_append = obj->only_append();
 		memcpy(id.id, obj->id().id, DNET_ID_SIZE);
-		data = obj->data()->data();
+		data.assign(obj->data()->data(), obj->data()->data() + obj->data()->size());
 		user_flags = obj->user_flags();
 		timestamp = obj->timestamp();
 		is_synced = false;
@@ -303,17 +407,69 @@ struct eventtime_less {
 	}
 };
 
-typedef treap<data_t> treap_t;
+/*!
+ * Histograms recorded by cache, latencies are in microseconds.
+ * Lock wait histograms of shards follow the fixed ones.
+ */
+enum cache_histogram_t {
+	CACHE_HISTOGRAM_READ_HIT = 0,
+	CACHE_HISTOGRAM_READ_MISS,
+	CACHE_HISTOGRAM_READ_POPULATE,
+	CACHE_HISTOGRAM_WRITE_HIT,
+	CACHE_HISTOGRAM_WRITE_MISS,
+	CACHE_HISTOGRAM_WRITE_POPULATE,
+	CACHE_HISTOGRAM_LOOKUP_HIT,
+	CACHE_HISTOGRAM_LOOKUP_MISS,
+	CACHE_HISTOGRAM_LOCK_WAIT
+};
+
+static inline const char *cache_histogram_name(size_t histogram) {
+	static const char *names[] = {
+		"read_hit", "read_miss", "read_populate",
+		"write_hit", "write_miss", "write_populate",
+		"lookup_hit", "lookup_miss",
+	};
+
+	return histogram < CACHE_HISTOGRAM_LOCK_WAIT ? names[histogram] : "lock_wait";
+}
+
+typedef hash_index<data_t> hash_index_t;
+typedef event_heap<data_t> event_heap_t;
 
 struct cache_stats {
 	cache_stats():
 		number_of_objects(0), size_of_objects(0),
-		number_of_objects_marked_for_deletion(0), size_of_objects_marked_for_deletion(0) {}
+		number_of_objects_marked_for_deletion(0), size_of_objects_marked_for_deletion(0),
+		size_of_entries_slabs(0), hits(0), misses(0), coalesced_misses(0),
+		admitted(0), rejected(0), size_of_dirty_objects(0),
+		number_of_index_tables(0), size_of_index_tables(0), index_table_hits(0), index_table_misses(0) {}
 
 	std::size_t number_of_objects;
 	std::size_t size_of_objects;
 	std::size_t number_of_objects_marked_for_deletion;
 	std::size_t size_of_objects_marked_for_deletion;
+	// memory taken by slabs of object headers, size of objects includes only headers which are in use
+	std::size_t size_of_entries_slabs;
+
+	// reads served from cache and reads which have not found the object in it
+	std::size_t hits;
+	std::size_t misses;
+	// misses which waited for disk read issued by another request instead of reading the object themselves
+	std::size_t coalesced_misses;
+	// decisions of admission policy made when new object had to evict another one
+	std::size_t admitted;
+	std::size_t rejected;
+	// size of objects which are not synced to the backend yet, including ones being synced
+	std::size_t size_of_dirty_objects;
+	// decoded tables of secondary indexes and lookups which have found or have not found the table
+	std::size_t number_of_index_tables;
+	std::size_t size_of_index_tables;
+	std::size_t index_table_hits;
+	std::size_t index_table_misses;
+
+	// sizes of cached objects and time spent waiting for shard lock in microseconds
+	log_histogram_t object_sizes;
+	log_histogram_t lock_wait;
 
 	std::vector<size_t> pages_sizes;
 	std::vector<size_t> pages_max_sizes;
@@ -322,7 +478,18 @@ struct cache_stats {
 		stat_value.AddMember("size", size_of_objects, allocator)
 				  .AddMember("removing_size", size_of_objects_marked_for_deletion, allocator)
 				  .AddMember("objects", number_of_objects, allocator)
-				  .AddMember("removing_objects", number_of_objects_marked_for_deletion, allocator);
+				  .AddMember("removing_objects", number_of_objects_marked_for_deletion, allocator)
+				  .AddMember("entries_slabs_size", size_of_entries_slabs, allocator)
+				  .AddMember("hits", hits, allocator)
+				  .AddMember("misses", misses, allocator)
+				  .AddMember("coalesced_misses", coalesced_misses, allocator)
+				  .AddMember("admitted", admitted, allocator)
+				  .AddMember("rejected", rejected, allocator)
+				  .AddMember("dirty_size", size_of_dirty_objects, allocator)
+				  .AddMember("index_tables", number_of_index_tables, allocator)
+				  .AddMember("index_tables_size", size_of_index_tables, allocator)
+				  .AddMember("index_table_hits", index_table_hits, allocator)
+				  .AddMember("index_table_misses", index_table_misses, allocator);
 
 		rapidjson::Value pages_sizes_stat(rapidjson::kArrayType);
 		for (auto it = pages_sizes.begin(), end = pages_sizes.end(); it != end; ++it) {
@@ -335,10 +502,31 @@ struct cache_stats {
 			pages_max_sizes_stat.PushBack(*it, allocator);
 		}
 		stat_value.AddMember("pages_max_sizes", pages_max_sizes_stat, allocator);
+
+		rapidjson::Value object_sizes_stat(rapidjson::kObjectType);
+		stat_value.AddMember("object_sizes", object_sizes.to_json(object_sizes_stat, allocator), allocator);
+
+		rapidjson::Value lock_wait_stat(rapidjson::kObjectType);
+		stat_value.AddMember("lock_wait", lock_wait.to_json(lock_wait_stat, allocator), allocator);
 		return stat_value;
 	}
 };
 
+/*
+ * Cache snapshot file starts with header followed by records of cached objects,
+ * hottest pages go first and every page is listed from its least recently used object.
+ */
+struct cache_snapshot_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t pages_number;
+} __attribute__ ((packed));
+
+struct cache_snapshot_record_t {
+	dnet_raw_id id;
+	uint8_t page_number;
+} __attribute__ ((packed));
+
 class slru_cache_t;
 
 class cache_manager {
@@ -349,17 +537,17 @@ class cache_manager {
 
 		int write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data);
 
-		std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
+		raw_data_ptr_t read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
 
 		int remove(const unsigned char *id, dnet_io_attr *io);
 
 		int lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd);
 
-		int indexes_find(dnet_cmd *cmd, dnet_indexes_request *request);
+		bool indexes_enabled() const;
 
-		int indexes_update(dnet_cmd *cmd, dnet_indexes_request *request);
+		std::shared_ptr<const ioremap::elliptics::dnet_indexes> indexes_find(const unsigned char *id, int *err);
 
-		int indexes_internal(dnet_cmd *cmd, dnet_indexes_request *request);
+		int indexes_update(const unsigned char *id, const std::function<bool (ioremap::elliptics::dnet_indexes &)> &update);
 
 		void clear();
 
@@ -379,15 +567,47 @@ class cache_manager {
 
 		rapidjson::Value& get_caches_time_stats_json(rapidjson::Value& stat_value, rapidjson::Document::AllocatorType &allocator) const;
 
+		rapidjson::Value& get_latency_stats_json(rapidjson::Value& stat_value, rapidjson::Document::AllocatorType &allocator) const;
+
+		log_histogram_t get_histogram(cache_histogram_t histogram) const;
+
 		std::string stat_json() const;
 
+		void warm_up();
+
 	private:
 		dnet_node *m_node;
+		dnet_backend_io *m_backend;
+		// shards use the pool and histograms, so they have to be destroyed after them
+		sync_pool_t m_sync_pool;
+		histogram_set_t m_histograms;
 		std::vector<std::shared_ptr<slru_cache_t>> m_caches;
 		size_t m_max_cache_size;
 		size_t m_cache_pages_number;
+		size_t m_max_indexes_size;
+
+		std::string m_snapshot_path;
+		unsigned m_snapshot_interval;
+		size_t m_warm_up_rate;
+		// snapshot is not overwritten until the cache is warmed up from it
+		std::atomic<bool> m_warming_up;
+		std::mutex m_snapshot_lock;
+		std::condition_variable m_snapshot_wait;
+		bool m_need_exit;
+		std::thread m_snapshot_thread;
+		std::thread m_warm_up_thread;
 
 		size_t idx(const unsigned char *id);
+
+		bool need_exit();
+
+		bool wait_for_exit(int64_t msecs);
+
+		int save_snapshot();
+
+		void snapshot_loop();
+
+		void warm_up_loop();
 };
 
 template <typename T>
@@ -466,6 +686,111 @@ private:
 	elliptics_timer m_timer;
 };
 
+/*!
+ * Reader-writer lock preferring writers, so that constant stream of cache hits can not starve
+ * writes and life-check thread. Exclusive side is Lockable and may be used with elliptics_unique_lock.
+ */
+class shared_mutex_t
+{
+public:
+	shared_mutex_t() : m_histograms(NULL), m_histogram(0)
+	{
+		pthread_rwlockattr_t attr;
+
+		pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+		pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+		int err = pthread_rwlock_init(&m_lock, &attr);
+		pthread_rwlockattr_destroy(&attr);
+
+		if (err)
+			throw std::system_error(err, std::system_category(), "pthread_rwlock_init");
+	}
+
+	~shared_mutex_t()
+	{
+		pthread_rwlock_destroy(&m_lock);
+	}
+
+	shared_mutex_t(const shared_mutex_t &) = delete;
+	shared_mutex_t &operator =(const shared_mutex_t &) = delete;
+
+	/*!
+	 * Time spent waiting for the lock is recorded into @histogram of @histograms,
+	 * must be set before the lock is used
+	 */
+	void set_wait_histogram(histogram_set_t *histograms, size_t histogram)
+	{
+		m_histograms = histograms;
+		m_histogram = histogram;
+	}
+
+	void lock()
+	{
+		if (!m_histograms) {
+			pthread_rwlock_wrlock(&m_lock);
+		} else if (pthread_rwlock_trywrlock(&m_lock) == 0) {
+			m_histograms->record(m_histogram, 0);
+		} else {
+			scoped_latency_t latency(m_histograms, m_histogram);
+			pthread_rwlock_wrlock(&m_lock);
+		}
+	}
+
+	bool try_lock()
+	{
+		return pthread_rwlock_trywrlock(&m_lock) == 0;
+	}
+
+	void unlock()
+	{
+		pthread_rwlock_unlock(&m_lock);
+	}
+
+	void lock_shared()
+	{
+		if (!m_histograms) {
+			pthread_rwlock_rdlock(&m_lock);
+		} else if (pthread_rwlock_tryrdlock(&m_lock) == 0) {
+			m_histograms->record(m_histogram, 0);
+		} else {
+			scoped_latency_t latency(m_histograms, m_histogram);
+			pthread_rwlock_rdlock(&m_lock);
+		}
+	}
+
+	void unlock_shared()
+	{
+		pthread_rwlock_unlock(&m_lock);
+	}
+
+private:
+	pthread_rwlock_t m_lock;
+	histogram_set_t *m_histograms;
+	size_t m_histogram;
+};
+
+class elliptics_shared_lock
+{
+public:
+	elliptics_shared_lock(shared_mutex_t &mutex) : m_mutex(mutex)
+	{
+		m_mutex.lock_shared();
+	}
+
+	~elliptics_shared_lock()
+	{
+		m_mutex.unlock_shared();
+	}
+
+	elliptics_shared_lock(const elliptics_shared_lock &) = delete;
+	elliptics_shared_lock &operator =(const elliptics_shared_lock &) = delete;
+
+private:
+	shared_mutex_t &m_mutex;
+};
+
 }}
 
 #endif // CACHE_HPP
@@ -0,0 +1,145 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT_HEAP_HPP
+#define EVENT_HEAP_HPP
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace ioremap { namespace cache {
+
+class event_heap_node_t {
+public:
+	static const size_t npos = static_cast<size_t>(-1);
+
+	event_heap_node_t(): heap_index(npos) {}
+
+	// position of the node in event heap, npos if it has no scheduled event
+	size_t heap_index;
+};
+
+/*!
+ * Binary min-heap of nodes ordered by their eventtime().
+ * Only nodes which have some event scheduled are kept in the heap,
+ * update() must be called every time node's eventtime() changes.
+ */
+template<typename node_type>
+class event_heap {
+public:
+	typedef node_type* p_node_type;
+
+	/*!
+	 * Puts node into the heap, moves it to its new position or removes it
+	 * depending on its current eventtime()
+	 */
+	void update(p_node_type node) {
+		const bool scheduled = node->eventtime() != std::numeric_limits<size_t>::max();
+
+		if (node->heap_index == event_heap_node_t::npos) {
+			if (scheduled) {
+				node->heap_index = m_heap.size();
+				m_heap.push_back(node);
+				sift_up(node->heap_index);
+			}
+		} else if (!scheduled) {
+			erase(node);
+		} else {
+			sift_down(sift_up(node->heap_index));
+		}
+	}
+
+	void erase(p_node_type node) {
+		const size_t index = node->heap_index;
+		if (index == event_heap_node_t::npos)
+			return;
+
+		node->heap_index = event_heap_node_t::npos;
+
+		p_node_type last = m_heap.back();
+		m_heap.pop_back();
+
+		if (last != node) {
+			m_heap[index] = last;
+			last->heap_index = index;
+			sift_down(sift_up(index));
+		}
+	}
+
+	p_node_type top() const {
+		return m_heap.empty() ? NULL : m_heap.front();
+	}
+
+	bool empty() const {
+		return m_heap.empty();
+	}
+
+	size_t size() const {
+		return m_heap.size();
+	}
+
+private:
+	std::vector<p_node_type> m_heap;
+
+	bool less(size_t lhs, size_t rhs) const {
+		return m_heap[lhs]->eventtime() < m_heap[rhs]->eventtime();
+	}
+
+	void swap(size_t lhs, size_t rhs) {
+		std::swap(m_heap[lhs], m_heap[rhs]);
+		m_heap[lhs]->heap_index = lhs;
+		m_heap[rhs]->heap_index = rhs;
+	}
+
+	size_t sift_up(size_t index) {
+		while (index > 0) {
+			size_t parent = (index - 1) / 2;
+			if (!less(index, parent))
+				break;
+
+			swap(index, parent);
+			index = parent;
+		}
+
+		return index;
+	}
+
+	size_t sift_down(size_t index) {
+		for (;;) {
+			size_t smallest = index;
+			size_t left = 2 * index + 1;
+			size_t right = left + 1;
+
+			if (left < m_heap.size() && less(left, smallest))
+				smallest = left;
+			if (right < m_heap.size() && less(right, smallest))
+				smallest = right;
+			if (smallest == index)
+				break;
+
+			swap(index, smallest);
+			index = smallest;
+		}
+
+		return index;
+	}
+};
+
+}}
+
+#endif // EVENT_HEAP_HPP
@@ -0,0 +1,240 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HASH_INDEX_HPP
+#define HASH_INDEX_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include "elliptics/packet.h"
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Open addressing hash table of nodes keyed by their DNET_ID_SIZE-byte ids.
+ *
+ * Table consists of cache line sized chunks, every chunk holds up to chunk_size node pointers
+ * and one byte fingerprint per slot, so lookup usually touches single cache line
+ * and compares full id only for slots whose fingerprint matches.
+ * Nodes which do not fit into their home chunk go to the following ones, every chunk counts
+ * number of nodes which have passed it while being inserted. Lookup stops at the first chunk
+ * with zero counter, so erase needs no tombstones.
+ *
+ * Index does not own its nodes.
+ */
+template<typename node_type>
+class hash_index {
+public:
+	typedef node_type* p_node_type;
+	typedef const unsigned char * key_type;
+
+	hash_index(): m_chunks(NULL), m_mask(0), m_size(0) {
+		rehash(1);
+	}
+
+	~hash_index() {
+		free(m_chunks);
+	}
+
+	hash_index(const hash_index &) = delete;
+	hash_index &operator =(const hash_index &) = delete;
+
+	p_node_type find(key_type key) const {
+		const size_t hash = get_hash(key);
+		const uint8_t tag = get_tag(hash);
+		size_t index = hash & m_mask;
+
+		for (size_t probe = 0; probe <= m_mask; ++probe) {
+			const chunk_t &chunk = m_chunks[index];
+
+			for (size_t i = 0; i < chunk_size; ++i) {
+				if (chunk.tags[i] == tag && !memcmp(get_key(chunk.items[i]), key, DNET_ID_SIZE))
+					return chunk.items[i];
+			}
+
+			if (!chunk.overflow)
+				break;
+
+			index = (index + 1) & m_mask;
+		}
+
+		return NULL;
+	}
+
+	/*!
+	 * Node must not be in the index yet
+	 */
+	void insert(p_node_type node) {
+		if (!node) {
+			throw std::logic_error("insert: can't insert NULL");
+		}
+
+		if (m_size + 1 > max_load())
+			rehash((m_mask + 1) * 2);
+
+		insert_nocheck(node);
+		++m_size;
+	}
+
+	void erase(p_node_type node) {
+		const size_t hash = get_hash(get_key(node));
+		const size_t home = hash & m_mask;
+		const uint8_t tag = get_tag(hash);
+		size_t index = home;
+
+		for (size_t probe = 0; probe <= m_mask; ++probe) {
+			chunk_t &chunk = m_chunks[index];
+
+			for (size_t i = 0; i < chunk_size; ++i) {
+				if (chunk.tags[i] == tag && chunk.items[i] == node) {
+					chunk.tags[i] = 0;
+					chunk.items[i] = NULL;
+					--m_size;
+
+					// chunks which node has passed on insert do not have to be probed for it anymore
+					for (size_t j = home; j != index; j = (j + 1) & m_mask) {
+						if (m_chunks[j].overflow != overflow_max)
+							--m_chunks[j].overflow;
+					}
+
+					if (m_size < max_load() / 8 && m_mask > 0)
+						rehash((m_mask + 1) / 2);
+					return;
+				}
+			}
+
+			index = (index + 1) & m_mask;
+		}
+
+		throw std::logic_error("erase: element does not exist");
+	}
+
+	/*!
+	 * Returns first node at or after position @pos and moves @pos past it, NULL if there are no more nodes.
+	 * Erasing returned node does not invalidate @pos unless index is shrunk,
+	 * nodes may be skipped or returned twice then.
+	 */
+	p_node_type next(size_t &pos) const {
+		const size_t slots_number = (m_mask + 1) * chunk_size;
+
+		for (; pos < slots_number; ++pos) {
+			const chunk_t &chunk = m_chunks[pos / chunk_size];
+
+			if (chunk.tags[pos % chunk_size])
+				return chunk.items[pos++ % chunk_size];
+		}
+
+		return NULL;
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	bool empty() const {
+		return !m_size;
+	}
+
+private:
+	static const size_t chunk_size = 7;
+	static const uint8_t overflow_max = 0xff;
+
+	struct chunk_t {
+		// zero for empty slot, fingerprint of node's id otherwise
+		uint8_t tags[chunk_size];
+		// number of nodes whose home is one of previous chunks, but which are stored after this one
+		uint8_t overflow;
+		p_node_type items[chunk_size];
+	} __attribute__ ((aligned(64)));
+
+	chunk_t *m_chunks;
+	size_t m_mask;
+	size_t m_size;
+
+	size_t max_load() const {
+		return (m_mask + 1) * chunk_size * 6 / 7;
+	}
+
+	static key_type get_key(p_node_type node) {
+		return node->id().id;
+	}
+
+	/*!
+	 * Ids are already uniformly distributed, so their first bytes are used as hash
+	 */
+	static size_t get_hash(key_type key) {
+		size_t hash;
+		memcpy(&hash, key, sizeof(hash));
+		return hash;
+	}
+
+	static uint8_t get_tag(size_t hash) {
+		return (hash >> (sizeof(size_t) * 8 - 8)) | 0x80;
+	}
+
+	void insert_nocheck(p_node_type node) {
+		const size_t hash = get_hash(get_key(node));
+		size_t index = hash & m_mask;
+
+		for (;;) {
+			chunk_t &chunk = m_chunks[index];
+
+			for (size_t i = 0; i < chunk_size; ++i) {
+				if (!chunk.tags[i]) {
+					chunk.tags[i] = get_tag(hash);
+					chunk.items[i] = node;
+					return;
+				}
+			}
+
+			if (chunk.overflow != overflow_max)
+				++chunk.overflow;
+
+			index = (index + 1) & m_mask;
+		}
+	}
+
+	void rehash(size_t chunks_number) {
+		void *ptr;
+		if (posix_memalign(&ptr, sizeof(chunk_t), chunks_number * sizeof(chunk_t)))
+			throw std::bad_alloc();
+		memset(ptr, 0, chunks_number * sizeof(chunk_t));
+
+		chunk_t *old_chunks = m_chunks;
+		const size_t old_chunks_number = old_chunks ? m_mask + 1 : 0;
+
+		m_chunks = static_cast<chunk_t *>(ptr);
+		m_mask = chunks_number - 1;
+
+		for (size_t i = 0; i < old_chunks_number; ++i) {
+			for (size_t j = 0; j < chunk_size; ++j) {
+				if (old_chunks[i].tags[j])
+					insert_nocheck(old_chunks[i].items[j]);
+			}
+		}
+
+		free(old_chunks);
+	}
+};
+
+}}
+
+#endif // HASH_INDEX_HPP
@@ -0,0 +1,317 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "monitor/rapidjson/document.h"
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Log-linear bucketing in the spirit of HdrHistogram: every power of two range of values
+ * is split into sub_buckets_number equal buckets, so value is known with relative error below 1/8.
+ */
+struct log_buckets {
+	static const size_t sub_bucket_bits = 3;
+	static const size_t sub_buckets_number = 1 << sub_bucket_bits;
+	// values which do not fit into max_bits bits are counted in the last bucket
+	static const size_t max_bits = 40;
+	static const size_t number = (max_bits - sub_bucket_bits + 1) * sub_buckets_number;
+
+	static size_t index(uint64_t value) {
+		if (value < sub_buckets_number)
+			return value;
+
+		const size_t bits = 64 - __builtin_clzll(value);
+		if (bits > max_bits)
+			return number - 1;
+
+		const size_t shift = bits - sub_bucket_bits - 1;
+		return (shift + 1) * sub_buckets_number + ((value >> shift) & (sub_buckets_number - 1));
+	}
+
+	static uint64_t lower_bound(size_t index) {
+		if (index < sub_buckets_number)
+			return index;
+
+		const size_t shift = index / sub_buckets_number - 1;
+		return (sub_buckets_number + index % sub_buckets_number) << shift;
+	}
+
+	static uint64_t upper_bound(size_t index) {
+		if (index < sub_buckets_number)
+			return index;
+
+		const size_t shift = index / sub_buckets_number - 1;
+		return lower_bound(index) + (1ULL << shift) - 1;
+	}
+};
+
+/*!
+ * Snapshot of histogram which is merged from recorders and reported to the monitor
+ */
+class log_histogram_t {
+public:
+	log_histogram_t() : m_counts(log_buckets::number, 0), m_sum(0) {}
+
+	void add(size_t index, uint64_t count) {
+		m_counts[index] += count;
+	}
+
+	void add_sum(uint64_t sum) {
+		m_sum += sum;
+	}
+
+	void merge(const log_histogram_t &other) {
+		for (size_t i = 0; i < log_buckets::number; ++i)
+			m_counts[i] += other.m_counts[i];
+		m_sum += other.m_sum;
+	}
+
+	uint64_t count() const {
+		uint64_t count = 0;
+		for (size_t i = 0; i < log_buckets::number; ++i)
+			count += m_counts[i];
+		return count;
+	}
+
+	/*!
+	 * Returns the highest value which is equivalent to the value @percent percents of recorded values are below of
+	 */
+	uint64_t percentile(double percent) const {
+		const uint64_t total = count();
+		if (!total)
+			return 0;
+
+		const uint64_t rank = std::max<uint64_t>(1, total * percent / 100 + 0.5);
+		uint64_t seen = 0;
+
+		for (size_t i = 0; i < log_buckets::number; ++i) {
+			seen += m_counts[i];
+			if (seen >= rank)
+				return log_buckets::upper_bound(i);
+		}
+
+		return log_buckets::upper_bound(log_buckets::number - 1);
+	}
+
+	/*!
+	 * Only non-empty buckets are reported as [lower bound, count] pairs
+	 */
+	rapidjson::Value &to_json(rapidjson::Value &stat_value, rapidjson::Document::AllocatorType &allocator) const {
+		const uint64_t total = count();
+
+		stat_value.AddMember("count", total, allocator)
+			  .AddMember("mean", total ? m_sum / total : 0, allocator)
+			  .AddMember("p50", percentile(50), allocator)
+			  .AddMember("p90", percentile(90), allocator)
+			  .AddMember("p99", percentile(99), allocator)
+			  .AddMember("p999", percentile(99.9), allocator)
+			  .AddMember("max", percentile(100), allocator);
+
+		rapidjson::Value buckets(rapidjson::kArrayType);
+		for (size_t i = 0; i < log_buckets::number; ++i) {
+			if (!m_counts[i])
+				continue;
+
+			rapidjson::Value bucket(rapidjson::kArrayType);
+			bucket.PushBack(log_buckets::lower_bound(i), allocator);
+			bucket.PushBack(m_counts[i], allocator);
+			buckets.PushBack(bucket, allocator);
+		}
+		stat_value.AddMember("buckets", buckets, allocator);
+
+		return stat_value;
+	}
+
+private:
+	std::vector<uint64_t> m_counts;
+	uint64_t m_sum;
+};
+
+/*!
+ * Histogram which is written by single thread at a time and may be read by any thread concurrently,
+ * so counters are updated by plain relaxed stores instead of atomic read-modify-write operations.
+ */
+class atomic_histogram_t {
+public:
+	atomic_histogram_t() : m_sum(0) {
+		for (size_t i = 0; i < log_buckets::number; ++i)
+			m_counts[i].store(0, std::memory_order_relaxed);
+	}
+
+	atomic_histogram_t(const atomic_histogram_t &) = delete;
+	atomic_histogram_t &operator =(const atomic_histogram_t &) = delete;
+
+	void record(uint64_t value) {
+		increase(m_counts[log_buckets::index(value)], 1);
+		increase(m_sum, value);
+	}
+
+	/*!
+	 * Forgets previously recorded @value, used by histograms of values which change over time
+	 */
+	void remove(uint64_t value) {
+		increase(m_counts[log_buckets::index(value)], -1);
+		increase(m_sum, -value);
+	}
+
+	void merge_into(log_histogram_t &histogram) const {
+		for (size_t i = 0; i < log_buckets::number; ++i)
+			histogram.add(i, m_counts[i].load(std::memory_order_relaxed));
+		histogram.add_sum(m_sum.load(std::memory_order_relaxed));
+	}
+
+private:
+	std::atomic<uint64_t> m_counts[log_buckets::number];
+	std::atomic<uint64_t> m_sum;
+
+	static void increase(std::atomic<uint64_t> &counter, uint64_t value) {
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+};
+
+/*!
+ * Set of histograms recorded by many threads. Every thread records into its own copy of the set,
+ * so recording is uncontended, copies are merged only when statistics are reported.
+ */
+class histogram_set_t {
+public:
+	explicit histogram_set_t(size_t histograms_number) : m_id(next_id()), m_histograms_number(histograms_number) {
+	}
+
+	histogram_set_t(const histogram_set_t &) = delete;
+	histogram_set_t &operator =(const histogram_set_t &) = delete;
+
+	size_t size() const {
+		return m_histograms_number;
+	}
+
+	void record(size_t histogram, uint64_t value) {
+		local_recorder()->histograms[histogram].record(value);
+	}
+
+	log_histogram_t get(size_t histogram) const {
+		log_histogram_t result;
+
+		std::lock_guard<std::mutex> guard(m_lock);
+		for (auto it = m_recorders.begin(); it != m_recorders.end(); ++it) {
+			(*it)->histograms[histogram].merge_into(result);
+		}
+
+		return result;
+	}
+
+private:
+	struct recorder_t {
+		recorder_t(std::thread::id thread, size_t histograms_number) :
+			thread(thread), histograms(new atomic_histogram_t[histograms_number]) {}
+
+		std::thread::id thread;
+		std::unique_ptr<atomic_histogram_t[]> histograms;
+	};
+
+	// ids are never reused, so thread which remembers recorder of destroyed set never matches it again
+	const uint64_t m_id;
+	const size_t m_histograms_number;
+	mutable std::mutex m_lock;
+	// recorders of exited threads are kept, their values are still reported
+	std::vector<std::unique_ptr<recorder_t>> m_recorders;
+
+	static uint64_t next_id() {
+		static std::atomic<uint64_t> id(0);
+		return ++id;
+	}
+
+	/*!
+	 * Thread usually records into the same set all the time, so it remembers the last used recorder
+	 * and looks its recorder up under lock only when it switches between sets
+	 */
+	recorder_t *local_recorder() {
+		static __thread uint64_t last_id = 0;
+		static __thread recorder_t *last_recorder = NULL;
+
+		if (last_id == m_id)
+			return last_recorder;
+
+		const std::thread::id thread = std::this_thread::get_id();
+		recorder_t *recorder = NULL;
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			for (auto it = m_recorders.begin(); it != m_recorders.end(); ++it) {
+				if ((*it)->thread == thread) {
+					recorder = it->get();
+					break;
+				}
+			}
+
+			if (!recorder) {
+				m_recorders.emplace_back(new recorder_t(thread, m_histograms_number));
+				recorder = m_recorders.back().get();
+			}
+		}
+
+		last_id = m_id;
+		last_recorder = recorder;
+		return recorder;
+	}
+};
+
+/*!
+ * Records time elapsed since construction into the histogram of the set in microseconds,
+ * histogram may be changed until the scope is left
+ */
+class scoped_latency_t {
+public:
+	scoped_latency_t(histogram_set_t *histograms, size_t histogram) :
+		m_histograms(histograms), m_histogram(histogram), m_start(std::chrono::steady_clock::now()) {
+	}
+
+	~scoped_latency_t() {
+		if (m_histograms) {
+			m_histograms->record(m_histogram, std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - m_start).count());
+		}
+	}
+
+	scoped_latency_t(const scoped_latency_t &) = delete;
+	scoped_latency_t &operator =(const scoped_latency_t &) = delete;
+
+	void set_histogram(size_t histogram) {
+		m_histogram = histogram;
+	}
+
+private:
+	histogram_set_t *m_histograms;
+	size_t m_histogram;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+}}
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,176 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLAB_HPP
+#define SLAB_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Allocator of fixed size objects.
+ *
+ * Objects are carved from chunk_size-aligned chunks, so chunk of any object is found by masking its address.
+ * Chunks with free slots are kept in a list, allocation takes slot from the first of them.
+ * Chunk is returned to the system once all its objects are freed, unless it is the only chunk with free slots,
+ * so memory held by the slab follows number of live objects.
+ *
+ * Slab is not thread-safe, cache shard uses it under its exclusive lock.
+ */
+template<typename T>
+class object_slab {
+public:
+	object_slab(): m_partial(NULL), m_chunks_number(0) {
+	}
+
+	/*!
+	 * All objects must be destroyed before slab is
+	 */
+	~object_slab() {
+		while (m_partial) {
+			chunk_t *chunk = m_partial;
+			m_partial = chunk->next;
+			free(chunk);
+		}
+	}
+
+	object_slab(const object_slab &) = delete;
+	object_slab &operator =(const object_slab &) = delete;
+
+	template<typename... Args>
+	T *create(Args&&... args) {
+		void *ptr = allocate();
+
+		try {
+			return new (ptr) T(std::forward<Args>(args)...);
+		} catch (...) {
+			deallocate(ptr);
+			throw;
+		}
+	}
+
+	void destroy(T *obj) {
+		obj->~T();
+		deallocate(obj);
+	}
+
+	/*!
+	 * Memory taken from the system
+	 */
+	size_t allocated_size() const {
+		return m_chunks_number * chunk_size;
+	}
+
+private:
+	static const size_t chunk_size = 64 * 1024;
+
+	union slot_t {
+		slot_t *next;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	struct chunk_t {
+		chunk_t *prev;
+		chunk_t *next;
+		slot_t *free;
+		size_t used;
+	};
+
+	static const size_t slots_offset = (sizeof(chunk_t) + alignof(slot_t) - 1) / alignof(slot_t) * alignof(slot_t);
+	static const size_t slots_number = (chunk_size - slots_offset) / sizeof(slot_t);
+
+	// chunks which have free slots
+	chunk_t *m_partial;
+	size_t m_chunks_number;
+
+	static chunk_t *get_chunk(void *ptr) {
+		return reinterpret_cast<chunk_t *>(reinterpret_cast<uintptr_t>(ptr) & ~(chunk_size - 1));
+	}
+
+	void link(chunk_t *chunk) {
+		chunk->prev = NULL;
+		chunk->next = m_partial;
+		if (m_partial)
+			m_partial->prev = chunk;
+		m_partial = chunk;
+	}
+
+	void unlink(chunk_t *chunk) {
+		if (chunk->prev)
+			chunk->prev->next = chunk->next;
+		else
+			m_partial = chunk->next;
+		if (chunk->next)
+			chunk->next->prev = chunk->prev;
+	}
+
+	void *allocate() {
+		if (!m_partial) {
+			void *ptr;
+			if (posix_memalign(&ptr, chunk_size, chunk_size))
+				throw std::bad_alloc();
+
+			chunk_t *chunk = static_cast<chunk_t *>(ptr);
+			slot_t *slots = reinterpret_cast<slot_t *>(static_cast<char *>(ptr) + slots_offset);
+
+			chunk->free = NULL;
+			chunk->used = 0;
+			for (size_t i = slots_number; i > 0; --i) {
+				slots[i - 1].next = chunk->free;
+				chunk->free = &slots[i - 1];
+			}
+
+			link(chunk);
+			++m_chunks_number;
+		}
+
+		chunk_t *chunk = m_partial;
+		slot_t *slot = chunk->free;
+
+		chunk->free = slot->next;
+		if (++chunk->used == slots_number)
+			unlink(chunk);
+
+		return slot;
+	}
+
+	void deallocate(void *ptr) {
+		chunk_t *chunk = get_chunk(ptr);
+		slot_t *slot = static_cast<slot_t *>(ptr);
+
+		if (chunk->used == slots_number)
+			link(chunk);
+
+		slot->next = chunk->free;
+		chunk->free = slot;
+
+		if (--chunk->used == 0 && (chunk->prev || chunk->next)) {
+			unlink(chunk);
+			free(chunk);
+			--m_chunks_number;
+		}
+	}
+};
+
+}}
+
+#endif // SLAB_HPP
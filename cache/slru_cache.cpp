@@ -26,7 +26,9 @@ namespace ioremap { namespace cache {
 // public:
 
 slru_cache_t::slru_cache_t(struct dnet_backend_io *backend, struct dnet_node *n,
-	const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout) :
+	const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout,
+	std::unique_ptr<admission_policy_t> admission, sync_pool_t *sync_pool, size_t max_dirty_size,
+	size_t max_index_tables_size, histogram_set_t *histograms, size_t lock_wait_histogram) :
 	m_backend(backend),
 	m_node(n),
 	m_cache_pages_number(cache_pages_max_sizes.size()),
@@ -34,7 +36,29 @@ slru_cache_t::slru_cache_t(struct dnet_backend_io *backend, struct dnet_node *n,
 	m_cache_pages_sizes(m_cache_pages_number, 0),
 	m_cache_pages_lru(new lru_list_t[m_cache_pages_number]),
 	m_clear_occured(false),
-	m_sync_timeout(sync_timeout) {
+	m_sync_timeout(sync_timeout),
+	m_admission(std::move(admission)),
+	m_sync_pool(sync_pool),
+	m_max_dirty_size(max_dirty_size),
+	m_dirty_size(0),
+	m_flush_pos(0),
+	m_promotion_buffers(new promotion_buffer_t[promotion_buffers_number]),
+	m_index_tables_size(0),
+	m_max_index_tables_size(max_index_tables_size),
+	m_dirty_index_tables(0),
+	m_index_tables_loading(0),
+	m_index_tables_generation(0),
+	m_hits(0),
+	m_misses(0),
+	m_coalesced_misses(0),
+	m_histograms(histograms),
+	m_lock_wait_histogram(lock_wait_histogram) {
+	m_lock.set_wait_histogram(histograms, lock_wait_histogram);
+
+	for (size_t i = 0; i < promotion_buffers_number; ++i) {
+		m_promotion_buffers[i].ids.reserve(promotion_buffer_size);
+	}
+
 	m_lifecheck = std::thread(std::bind(&slru_cache_t::life_check, this));
 }
 
@@ -55,19 +79,43 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 	const bool cache_only = (io->flags & DNET_IO_FLAGS_CACHE_ONLY);
 	const bool append = (io->flags & DNET_IO_FLAGS_APPEND);
 
+	scoped_latency_t latency(m_histograms, CACHE_HISTOGRAM_WRITE_MISS);
+
+	record_access(id);
+
 	react_start_action(ACTION_CACHE_LOCK);
-	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE WRITE: %p", dnet_dump_id_str(id), this);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "%s: CACHE WRITE: %p", dnet_dump_id_str(id), this);
 	react_stop_action(ACTION_CACHE_LOCK);
 
+	promote_deferred();
+	flush_index_table(id, true);
+
 	react_start_action(ACTION_CACHE_FIND);
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	react_stop_action(ACTION_CACHE_FIND);
 
+	if (it)
+		latency.set_histogram(CACHE_HISTOGRAM_WRITE_HIT);
+
 	if (!it && !cache) {
 		dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: not a cache call", dnet_dump_id_str(id));
 		return -ENOTSUP;
 	}
 
+	// Objects which are not worth caching are written directly to the backend
+	if (!it && !cache_only && !admit(id, io->size)) {
+		dnet_log(m_node, DNET_LOG_DEBUG, "%s: CACHE: object is not admitted", dnet_dump_id_str(id));
+		return -ENOTSUP;
+	}
+
+	if (!cache_only && m_max_dirty_size && m_dirty_size >= m_max_dirty_size) {
+		wait_for_sync(guard);
+
+		react_start_action(ACTION_CACHE_FIND);
+		it = m_index.find(id);
+		react_stop_action(ACTION_CACHE_FIND);
+	}
+
 	// Optimization for append-only commands
 	if (!cache_only) {
 		if (append && (!it || it->only_append())) {
@@ -80,15 +128,15 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 				it->set_only_append(true);
 				size_t previous_eventtime = it->eventtime();
 				it->set_synctime(time(NULL) + m_sync_timeout);
+				m_dirty_size += it->size();
 
 				if (previous_eventtime != it->eventtime()) {
 					react_start_action(ACTION_CACHE_DECREASE_KEY);
-					m_treap.decrease_key(it);
+					m_events.update(it);
 					react_stop_action(ACTION_CACHE_DECREASE_KEY);
 				}
 			}
 
-			auto &raw = it->data()->data();
 			size_t page_number = it->cache_page_number();
 			size_t new_page_number = page_number;
 			size_t new_size = it->size() + io->size;
@@ -105,8 +153,17 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 				m_cache_stats.size_of_objects_marked_for_deletion -= it->size();
 			}
 			m_cache_stats.size_of_objects -= it->size();
-			raw.insert(raw.end(), data, data + io->size);
+			m_object_sizes.remove(it->size());
+			if (it->synctime()) {
+				m_dirty_size -= it->size();
+			}
+			const size_t old_data_size = it->data()->size();
+			memcpy(it->resize_data(old_data_size + io->size) + old_data_size, data, io->size);
 			m_cache_stats.size_of_objects += it->size();
+			m_object_sizes.record(it->size());
+			if (it->synctime()) {
+				m_dirty_size += it->size();
+			}
 			if (it->remove_from_cache()) {
 				m_cache_stats.size_of_objects_marked_for_deletion += it->size();
 			}
@@ -128,6 +185,7 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 
 			int err = m_backend->cb->command_handler(st, m_backend->cb->command_private, cmd, io);
 
+			latency.set_histogram(CACHE_HISTOGRAM_WRITE_POPULATE);
 			it = populate_from_disk(guard, id, false, &err);
 
 			cmd->flags &= ~DNET_FLAGS_NEED_ACK;
@@ -141,6 +199,7 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 		// If file not found and CACHE flag is not set - fallback to backend request
 		if (!cache_only && io->offset != 0) {
 			int err = 0;
+			latency.set_histogram(CACHE_HISTOGRAM_WRITE_POPULATE);
 			it = populate_from_disk(guard, id, remove_from_disk, &err);
 			new_page = true;
 
@@ -155,16 +214,16 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 		}
 	}
 
-	raw_data_t &raw = *it->data();
+	const size_t old_data_size = it->data()->size();
 
 	if (io->flags & DNET_IO_FLAGS_COMPARE_AND_SWAP) {
 		react::action_guard cas_guard(ACTION_CACHE_CAS);
 
 		// Data is already in memory, so it's free to use it
-		// raw.size() is zero only if there is no such file on the server
-		if (raw.size() != 0) {
+		// Size is zero only if there is no such file on the server
+		if (old_data_size != 0) {
 			struct dnet_raw_id csum;
-			dnet_transform_node(m_node, raw.data().data(), raw.size(), csum.id, sizeof(csum.id));
+			dnet_transform_node(m_node, it->data()->data(), old_data_size, csum.id, sizeof(csum.id));
 
 			if (memcmp(csum.id, io->parent, DNET_ID_SIZE)) {
 				dnet_log(m_node, DNET_LOG_ERROR, "%s: cas: cache checksum mismatch", dnet_dump_id(&cmd->id));
@@ -178,7 +237,7 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 	size_t new_data_size = 0;
 
 	if (append) {
-		new_data_size = raw.size() + size;
+		new_data_size = old_data_size + size;
 	} else {
 		new_data_size = io->offset + io->size;
 	}
@@ -199,16 +258,17 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 		m_cache_stats.size_of_objects_marked_for_deletion -= it->size();
 	}
 	m_cache_stats.size_of_objects -= it->size();
+	m_object_sizes.remove(it->size());
+	if (it->synctime()) {
+		m_dirty_size -= it->size();
+	}
 
 	react_start_action(ACTION_CACHE_MODIFY);
-	if (append) {
-		raw.data().insert(raw.data().end(), data, data + size);
-	} else {
-		raw.data().resize(new_data_size);
-		memcpy(raw.data().data() + io->offset, data, size);
-	}
+	char *raw = it->resize_data(new_data_size);
+	memcpy(raw + (append ? old_data_size : io->offset), data, size);
 	react_stop_action(ACTION_CACHE_MODIFY);
 	m_cache_stats.size_of_objects += it->size();
+	m_object_sizes.record(it->size());
 
 	it->set_remove_from_cache(false);
 	insert_data_into_page(id, new_page_number, &*it);
@@ -221,13 +281,20 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 		it->set_synctime(time(NULL) + m_sync_timeout);
 	}
 
+	if (it->synctime()) {
+		m_dirty_size += it->size();
+
+		if (m_max_dirty_size && m_dirty_size > m_max_dirty_size / 2)
+			m_lifecheck_wait.notify_one();
+	}
+
 	if (lifetime) {
 		it->set_lifetime(lifetime + time(NULL));
 	}
 
 	if (previous_eventtime != it->eventtime()) {
 		react_start_action(ACTION_CACHE_DECREASE_KEY);
-		m_treap.decrease_key(it);
+		m_events.update(it);
 		react_stop_action(ACTION_CACHE_DECREASE_KEY);
 	}
 
@@ -235,35 +302,65 @@ int slru_cache_t::write(const unsigned char *id, dnet_net_state *st, dnet_cmd *c
 	it->set_user_flags(io->user_flags);
 
 	cmd->flags &= ~DNET_FLAGS_NEED_ACK;
-	return dnet_send_file_info_ts_without_fd(st, cmd, raw.data().data() + io->offset, io->size, &io->timestamp);
+	return dnet_send_file_info_ts_without_fd(st, cmd, raw + io->offset, io->size, &io->timestamp);
 }
 
-std::shared_ptr<raw_data_t> slru_cache_t::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
+raw_data_ptr_t slru_cache_t::read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io) {
 	react::action_guard read_guard(ACTION_CACHE_READ);
 
 	const bool cache = (io->flags & DNET_IO_FLAGS_CACHE);
 	const bool cache_only = (io->flags & DNET_IO_FLAGS_CACHE_ONLY);
 	(void) cmd;
 
+	scoped_latency_t latency(m_histograms, CACHE_HISTOGRAM_READ_MISS);
+
+	record_access(id);
+
+	raw_data_ptr_t data = read_shared(id, io);
+	if (data) {
+		++m_hits;
+		latency.set_histogram(CACHE_HISTOGRAM_READ_HIT);
+		return data;
+	}
+
 	react_start_action(ACTION_CACHE_LOCK);
-	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE READ: %p", dnet_dump_id_str(id), this);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "%s: CACHE READ: %p", dnet_dump_id_str(id), this);
 	react_stop_action(ACTION_CACHE_LOCK);
 
+	promote_deferred();
+	flush_index_table(id, false);
+
 	bool new_page = false;
 
 	react_start_action(ACTION_CACHE_FIND);
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	react_stop_action(ACTION_CACHE_FIND);
 
 	if (it && it->only_append()) {
-		sync_after_append(guard, true, &*it);
-		it = NULL;
+		it = merge_append_only(guard, it);
+	}
+
+	if (it) {
+		++m_hits;
+		latency.set_histogram(CACHE_HISTOGRAM_READ_HIT);
+	} else {
+		++m_misses;
 	}
 
 	if (!it && cache && !cache_only) {
 		int err = 0;
-		it = populate_from_disk(guard, id, false, &err);
+		std::shared_ptr<populate_request_t> rejected;
+		latency.set_histogram(CACHE_HISTOGRAM_READ_POPULATE);
+		it = populate_from_disk(guard, id, false, &err, &rejected);
 		new_page = true;
+
+		// Object is not worth caching, but it has already been read, so just hand it out
+		if (rejected) {
+			io->timestamp = rejected->timestamp;
+			io->user_flags = rejected->user_flags;
+			return raw_data_t::create(reinterpret_cast<char *>(rejected->data.data()),
+					rejected->data.size(), rejected->data.size());
+		}
 	}
 
 	if (it) {
@@ -286,7 +383,7 @@ std::shared_ptr<raw_data_t> slru_cache_t::read(const unsigned char *id, dnet_cmd
 		return it->data();
 	}
 
-	return std::shared_ptr<raw_data_t>();
+	return raw_data_ptr_t();
 }
 
 int slru_cache_t::remove(const unsigned char *id, dnet_io_attr *io) {
@@ -297,11 +394,13 @@ int slru_cache_t::remove(const unsigned char *id, dnet_io_attr *io) {
 	int err = -ENOENT;
 
 	react_start_action(ACTION_CACHE_LOCK);
-	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE REMOVE: %p", dnet_dump_id_str(id), this);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "%s: CACHE REMOVE: %p", dnet_dump_id_str(id), this);
 	react_stop_action(ACTION_CACHE_LOCK);
 
+	flush_index_table(id, true);
+
 	react_start_action(ACTION_CACHE_FIND);
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	react_stop_action(ACTION_CACHE_FIND);
 
 	if (it) {
@@ -310,11 +409,12 @@ int slru_cache_t::remove(const unsigned char *id, dnet_io_attr *io) {
 		remove_from_disk |= it->remove_from_disk();
 		if (it->synctime() && !cache_only) {
 			size_t previous_eventtime = it->eventtime();
+			m_dirty_size -= it->size();
 			it->clear_synctime();
 
 			if (previous_eventtime != it->eventtime()) {
 				react_start_action(ACTION_CACHE_DECREASE_KEY);
-				m_treap.decrease_key(it);
+				m_events.update(it);
 				react_stop_action(ACTION_CACHE_DECREASE_KEY);
 			}
 		}
@@ -348,14 +448,15 @@ int slru_cache_t::remove(const unsigned char *id, dnet_io_attr *io) {
 int slru_cache_t::lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd) {
 	react::action_guard lookup_guard(ACTION_CACHE_LOOKUP);
 
+	scoped_latency_t latency(m_histograms, CACHE_HISTOGRAM_LOOKUP_MISS);
 	int err = 0;
 
 	react_start_action(ACTION_CACHE_LOCK);
-	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "%s: CACHE LOOKUP: %p", dnet_dump_id_str(id), this);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "%s: CACHE LOOKUP: %p", dnet_dump_id_str(id), this);
 	react_stop_action(ACTION_CACHE_LOCK);
 
 	react_start_action(ACTION_CACHE_FIND);
-	data_t* it = m_treap.find(id);
+	data_t* it = m_index.find(id);
 	react_stop_action(ACTION_CACHE_FIND);
 
 	dnet_time timestamp;
@@ -363,6 +464,7 @@ int slru_cache_t::lookup(const unsigned char *id, dnet_net_state *st, dnet_cmd *
 
 	if (it) {
 		timestamp = it->timestamp();
+		latency.set_histogram(CACHE_HISTOGRAM_LOOKUP_HIT);
 	}
 
 	guard.unlock();
@@ -399,37 +501,313 @@ void slru_cache_t::clear() {
 	std::vector<size_t> cache_pages_max_sizes = m_cache_pages_max_sizes;
 
 	react_start_action(ACTION_CACHE_LOCK);
-	elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE CLEAR: %p", this);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "CACHE CLEAR: %p", this);
 	react_stop_action(ACTION_CACHE_LOCK);
 	m_clear_occured = true;
 
+	// Dirty tables are packed into objects, so that they are synced below
+	while (!m_index_tables_lru.empty()) {
+		index_table_t *table = &m_index_tables_lru.front();
+		if (table->dirty_time)
+			pack_index_table(table);
+		drop_index_table(table);
+	}
+
 	for (size_t page_number = 0; page_number < m_cache_pages_number; ++page_number) {
 		m_cache_pages_max_sizes[page_number] = 0;
 		resize_page((unsigned char *) "", page_number, 0);
 	}
 
-	while (!m_treap.empty()) {
-		data_t *obj = m_treap.top();
+	for (size_t i = 0; i < promotion_buffers_number; ++i) {
+		std::lock_guard<std::mutex> buffer_guard(m_promotion_buffers[i].lock);
+		m_promotion_buffers[i].ids.clear();
+	}
+
+	while (!m_index.empty()) {
+		size_t pos = 0;
+		data_t *obj;
 
-		sync_if_required(obj, guard);
-		obj->set_sync_state(data_t::sync_state_t::NOT_SYNCING);
+		while ((obj = m_index.next(pos)) != NULL) {
+			sync_if_required(obj, guard);
+			obj->set_sync_state(data_t::sync_state_t::NOT_SYNCING);
 
-		erase_element(obj);
+			erase_element(obj);
+		}
 	}
 
 	m_cache_pages_max_sizes = cache_pages_max_sizes;
 }
 
+/*
+ * Reads object from disk into page @page_number unless it is already cached,
+ * @size is set to number of bytes read.
+ */
+int slru_cache_t::warm_up(const unsigned char *id, size_t page_number, size_t *size) {
+	*size = 0;
+
+	react_start_action(ACTION_CACHE_LOCK);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "%s: CACHE WARM UP: %p", dnet_dump_id_str(id), this);
+	react_stop_action(ACTION_CACHE_LOCK);
+
+	promote_deferred();
+
+	if (m_index.find(id))
+		return 0;
+
+	int err = 0;
+	std::shared_ptr<populate_request_t> rejected;
+	data_t *it = populate_from_disk(guard, id, false, &err, &rejected);
+
+	if (rejected)
+		*size = rejected->data.size();
+	if (!it)
+		return err;
+
+	*size = it->data()->size();
+
+	page_number = std::min(page_number, m_cache_pages_number - 1);
+	move_data_between_pages(id, it->cache_page_number(), page_number, it);
+	return 0;
+}
+
+/*
+ * Appends ids of cached objects to @records page by page, from the least to the most recently used one
+ */
+void slru_cache_t::get_snapshot(std::vector<cache_snapshot_record_t> &records) {
+	react_start_action(ACTION_CACHE_LOCK);
+	elliptics_shared_lock guard(m_lock);
+	react_stop_action(ACTION_CACHE_LOCK);
+
+	for (size_t page_number = 0; page_number < m_cache_pages_number; ++page_number) {
+		const lru_list_t &lru = m_cache_pages_lru[page_number];
+
+		for (auto it = lru.begin(); it != lru.end(); ++it) {
+			if (it->only_append())
+				continue;
+
+			cache_snapshot_record_t record;
+			record.id = it->id();
+			record.page_number = page_number;
+			records.push_back(record);
+		}
+	}
+}
+
+/*
+ * Returns decoded table of index @id, table must not be modified by caller.
+ * @err is set to -ENOENT if index object does not exist.
+ */
+std::shared_ptr<const ioremap::elliptics::dnet_indexes> slru_cache_t::indexes_find(const unsigned char *id, int *err) {
+	react::action_guard find_guard(ACTION_CACHE_INDEXES_FIND);
+
+	*err = 0;
+
+	react_start_action(ACTION_CACHE_LOCK);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "%s: CACHE INDEXES FIND: %p", dnet_dump_id_str(id), this);
+	react_stop_action(ACTION_CACHE_LOCK);
+
+	index_table_t *table = load_index_table(guard, id, err);
+	if (!table)
+		return std::shared_ptr<const ioremap::elliptics::dnet_indexes>();
+
+	if (!table->exists) {
+		*err = -ENOENT;
+		return std::shared_ptr<const ioremap::elliptics::dnet_indexes>();
+	}
+
+	return table->table;
+}
+
+/*
+ * Applies @update to decoded table of index @id in place, @update returns false if it has not changed the table.
+ * Changed table is packed and written to the backend later by life check.
+ */
+int slru_cache_t::indexes_update(const unsigned char *id, const std::function<bool (ioremap::elliptics::dnet_indexes &)> &update) {
+	react::action_guard update_guard(ACTION_CACHE_INDEXES_UPDATE);
+
+	int err = 0;
+
+	react_start_action(ACTION_CACHE_LOCK);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "%s: CACHE INDEXES UPDATE: %p", dnet_dump_id_str(id), this);
+	react_stop_action(ACTION_CACHE_LOCK);
+
+	index_table_t *table = load_index_table(guard, id, &err);
+	if (!table)
+		return err;
+
+	// Finders may still iterate over the table
+	if (!table->table.unique())
+		table->table = std::make_shared<ioremap::elliptics::dnet_indexes>(*table->table);
+
+	if (!update(*table->table))
+		return 0;
+
+	table->exists = true;
+	update_index_table_size(table);
+
+	if (!table->dirty_time) {
+		table->dirty_time = time(NULL);
+		++m_dirty_index_tables;
+	}
+
+	shrink_index_tables();
+	return 0;
+}
+
 cache_stats slru_cache_t::get_cache_stats() const {
 	m_cache_stats.pages_sizes = m_cache_pages_sizes;
 	m_cache_stats.pages_max_sizes = m_cache_pages_max_sizes;
+	m_cache_stats.size_of_entries_slabs = m_entries.allocated_size();
+	m_cache_stats.hits = m_hits;
+	m_cache_stats.misses = m_misses;
+	m_cache_stats.coalesced_misses = m_coalesced_misses;
+	m_cache_stats.size_of_dirty_objects = m_dirty_size;
+	m_cache_stats.size_of_index_tables = m_index_tables_size;
+	m_cache_stats.object_sizes = log_histogram_t();
+	m_object_sizes.merge_into(m_cache_stats.object_sizes);
+	m_cache_stats.lock_wait = m_histograms->get(m_lock_wait_histogram);
 	return m_cache_stats;
 }
 
 // private:
 
+/*
+ * Serves cache hit under shared lock. Objects which need any modification to be read
+ * (appended ones, ones marked for removal) are left for exclusive path.
+ */
+raw_data_ptr_t slru_cache_t::read_shared(const unsigned char *id, dnet_io_attr *io) {
+	raw_data_ptr_t data;
+	bool promote = false;
+
+	{
+		react_start_action(ACTION_CACHE_LOCK);
+		elliptics_shared_lock guard(m_lock);
+		react_stop_action(ACTION_CACHE_LOCK);
+
+		// Object has to be updated from dirty index table first
+		if (m_dirty_index_tables) {
+			dnet_raw_id key;
+			memcpy(key.id, id, DNET_ID_SIZE);
+
+			auto table = m_index_tables.find(key);
+			if (table != m_index_tables.end() && table->second->dirty_time)
+				return data;
+		}
+
+		react_start_action(ACTION_CACHE_FIND);
+		data_t* it = m_index.find(id);
+		react_stop_action(ACTION_CACHE_FIND);
+
+		if (!it || it->only_append() || it->remove_from_cache())
+			return data;
+
+		io->timestamp = it->timestamp();
+		io->user_flags = it->user_flags();
+		data = it->data();
+		promote = get_next_page_number(it->cache_page_number()) != it->cache_page_number();
+	}
+
+	if (promote)
+		defer_promotion(id);
+
+	return data;
+}
+
+void slru_cache_t::defer_promotion(const unsigned char *id) {
+	size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % promotion_buffers_number;
+	promotion_buffer_t &buffer = m_promotion_buffers[index];
+	bool full;
+
+	{
+		std::lock_guard<std::mutex> guard(buffer.lock);
+
+		if (buffer.ids.size() < promotion_buffer_size * 4) {
+			dnet_raw_id raw;
+			memcpy(raw.id, id, DNET_ID_SIZE);
+			buffer.ids.push_back(raw);
+		}
+
+		full = buffer.ids.size() >= promotion_buffer_size;
+	}
+
+	/*
+	 * Full buffer is applied by whoever is able to take exclusive lock without waiting,
+	 * if lock is busy its owner or the next writer will do it. Hits are dropped if buffer
+	 * overflows meanwhile, promotion is only a hint anyway.
+	 */
+	if (full && m_lock.try_lock()) {
+		promote_deferred();
+		m_lock.unlock();
+	}
+}
+
+/*
+ * Does not need cache lock: admission policy records accesses lock-free, so it is called
+ * before lock is taken and may race with other readers and writers of the same shard
+ */
+void slru_cache_t::record_access(const unsigned char *id) {
+	if (m_admission)
+		m_admission->record(id);
+}
+
+/*
+ * Decides whether new object with @size bytes of data may be created in the last page.
+ * Objects are admitted unconditionally while the page has enough free space, otherwise
+ * admission policy compares them with the first object which would be evicted.
+ */
+bool slru_cache_t::admit(const unsigned char *id, size_t size) {
+	if (!m_admission)
+		return true;
+
+	const size_t last_page_number = m_cache_pages_number - 1;
+	const lru_list_t &lru = m_cache_pages_lru[last_page_number];
+	const size_t total_size = size + sizeof(data_t) + sizeof(raw_data_t);
+
+	if (lru.empty() || m_cache_pages_sizes[last_page_number] + total_size <= m_cache_pages_max_sizes[last_page_number])
+		return true;
+
+	if (m_admission->admit(id, lru.front().id().id)) {
+		m_cache_stats.admitted++;
+		return true;
+	}
+
+	m_cache_stats.rejected++;
+	return false;
+}
+
+/*
+ * Must be called under exclusive lock
+ */
+void slru_cache_t::promote_deferred(void) {
+	std::vector<dnet_raw_id> ids;
+
+	for (size_t i = 0; i < promotion_buffers_number; ++i) {
+		promotion_buffer_t &buffer = m_promotion_buffers[i];
+
+		{
+			std::lock_guard<std::mutex> guard(buffer.lock);
+			if (buffer.ids.empty())
+				continue;
+
+			ids.swap(buffer.ids);
+			buffer.ids.reserve(promotion_buffer_size);
+		}
+
+		for (auto id = ids.begin(); id != ids.end(); ++id) {
+			data_t *it = m_index.find(id->id);
+			if (!it || it->is_removed_from_page() || it->only_append() || it->remove_from_cache())
+				continue;
+
+			size_t page_number = it->cache_page_number();
+			move_data_between_pages(id->id, page_number, get_next_page_number(page_number), it);
+		}
+
+		ids.clear();
+	}
+}
+
 
-void slru_cache_t::sync_if_required(data_t* it, elliptics_unique_lock<std::mutex> &guard) {
+void slru_cache_t::sync_if_required(data_t* it, elliptics_unique_lock<shared_mutex_t> &guard) {
 	react::action_guard sync_if_required_guard(ACTION_CACHE_SYNC_BEFORE_OPERATION);
 
 	if (it && it->is_syncing()) {
@@ -437,12 +815,13 @@ void slru_cache_t::sync_if_required(data_t* it, elliptics_unique_lock<std::mutex
 		memset(&id, 0, sizeof(id));
 		memcpy(id.id, it->id().id, DNET_ID_SIZE);
 
-		std::vector<char> data;
+		// Holding reference to payload makes writers copy it instead of modifying it under our feet
+		raw_data_ptr_t data;
 		uint64_t user_flags;
 		dnet_time timestamp;
 
 		bool only_append = it->only_append();
-		data = it->data()->data();
+		data = it->data();
 		user_flags = it->user_flags();
 		timestamp = it->timestamp();
 
@@ -450,7 +829,7 @@ void slru_cache_t::sync_if_required(data_t* it, elliptics_unique_lock<std::mutex
 
 		// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
 		if (it->is_syncing()) {
-			sync_element(id, only_append, data, user_flags, timestamp);
+			sync_element(id, only_append, *data, user_flags, timestamp);
 			it->set_sync_state(data_t::sync_state_t::ERASE_PHASE);
 		}
 
@@ -499,51 +878,100 @@ data_t* slru_cache_t::create_data(const unsigned char *id, const char *data, siz
 
 	size_t last_page_number = m_cache_pages_number - 1;
 
-	data_t *raw = new data_t(id, 0, data, size, remove_from_disk);
+	data_t *raw = m_entries.create(id, 0, data, size, remove_from_disk);
 
 	insert_data_into_page(id, last_page_number, raw);
 
 	m_cache_stats.number_of_objects++;
 	m_cache_stats.size_of_objects += raw->size();
-	m_treap.insert(raw);
+	m_object_sizes.record(raw->size());
+	m_index.insert(raw);
 	return raw;
 }
 
-data_t* slru_cache_t::populate_from_disk(elliptics_unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err) {
+/*
+ * If @rejected is not NULL, admission policy is consulted before object is cached,
+ * disk read of rejected object is returned via @rejected then.
+ */
+data_t* slru_cache_t::populate_from_disk(elliptics_unique_lock<shared_mutex_t> &guard, const unsigned char *id, bool remove_from_disk, int *err,
+					 std::shared_ptr<populate_request_t> *rejected) {
 	react::action_guard populate_from_disk_guard(ACTION_CACHE_POPULATE_FROM_DISK);
 
-	if (guard.owns_lock()) {
-		guard.unlock();
+	if (!guard.owns_lock()) {
+		react_start_action(ACTION_CACHE_LOCK);
+		guard.lock();
+		react_stop_action(ACTION_CACHE_LOCK);
 	}
 
-	local_session sess(m_backend, m_node);
-	sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
+	dnet_raw_id key;
+	memcpy(key.id, id, DNET_ID_SIZE);
 
-	dnet_id raw_id;
-	memset(&raw_id, 0, sizeof(raw_id));
-	memcpy(raw_id.id, id, DNET_ID_SIZE);
+	std::shared_ptr<populate_request_t> request;
+	auto found = m_populate_requests.find(key);
 
-	uint64_t user_flags = 0;
-	dnet_time timestamp;
-	dnet_empty_time(&timestamp);
+	if (found != m_populate_requests.end()) {
+		// Someone is already reading this key from disk, share its result
+		++m_coalesced_misses;
+
+		request = found->second;
+		while (!request->done) {
+			request->wait.wait(guard);
+		}
+	} else {
+		request = std::make_shared<populate_request_t>();
+		m_populate_requests.emplace(key, request);
 
-	react_start_action(ACTION_CACHE_LOCAL_READ);
-	ioremap::elliptics::data_pointer data = sess.read(raw_id, &user_flags, &timestamp, err);
-	react_stop_action(ACTION_CACHE_LOCAL_READ);
+		guard.unlock();
 
-	react_start_action(ACTION_CACHE_LOCK);
-	guard.lock();
-	react_stop_action(ACTION_CACHE_LOCK);
+		local_session sess(m_backend, m_node);
+		sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
+
+		dnet_id raw_id;
+		memset(&raw_id, 0, sizeof(raw_id));
+		memcpy(raw_id.id, id, DNET_ID_SIZE);
+
+		auto complete = [&] () {
+			react_start_action(ACTION_CACHE_LOCK);
+			guard.lock();
+			react_stop_action(ACTION_CACHE_LOCK);
+
+			m_populate_requests.erase(key);
+			request->done = true;
+			request->wait.notify_all();
+		};
+
+		try {
+			react_start_action(ACTION_CACHE_LOCAL_READ);
+			request->data = sess.read(raw_id, &request->user_flags, &request->timestamp, &request->err);
+			react_stop_action(ACTION_CACHE_LOCAL_READ);
+		} catch (...) {
+			request->err = -EIO;
+			complete();
+			throw;
+		}
 
-	if (*err == 0) {
-		auto it = create_data(id, reinterpret_cast<char *>(data.data()), data.size(), remove_from_disk);
-		it->set_user_flags(user_flags);
-		it->set_timestamp(timestamp);
+		complete();
+	}
 
+	*err = request->err;
+	if (*err)
+		return NULL;
+
+	// Object may have been written or populated by the first waiter while we were not holding the lock
+	data_t *it = m_index.find(id);
+	if (it)
 		return it;
+
+	if (rejected && !admit(id, request->data.size())) {
+		*rejected = request;
+		return NULL;
 	}
 
-	return NULL;
+	it = create_data(id, reinterpret_cast<char *>(request->data.data()), request->data.size(), remove_from_disk);
+	it->set_user_flags(request->user_flags);
+	it->set_timestamp(request->timestamp);
+
+	return it;
 }
 
 bool slru_cache_t::have_enough_space(const unsigned char *id, size_t page_number, size_t reserve) {
@@ -580,7 +1008,7 @@ void slru_cache_t::resize_page(const unsigned char *id, size_t page_number, size
 					raw->set_synctime(1);
 					if (previous_eventtime != raw->eventtime()) {
 						react_start_action(ACTION_CACHE_DECREASE_KEY);
-						m_treap.decrease_key(raw);
+						m_events.update(raw);
 						react_stop_action(ACTION_CACHE_DECREASE_KEY);
 					}
 				}
@@ -607,13 +1035,16 @@ void slru_cache_t::erase_element(data_t *obj) {
 
 	m_cache_stats.number_of_objects--;
 	m_cache_stats.size_of_objects -= obj->size();
+	m_object_sizes.remove(obj->size());
 
 	size_t page_number = obj->cache_page_number();
 	remove_data_from_page(obj->id().id, page_number, obj);
-	m_treap.erase(obj);
+	m_index.erase(obj);
+	m_events.erase(obj);
 
 	if (obj->synctime()) {
 		sync_element(obj);
+		m_dirty_size -= obj->size();
 		obj->clear_synctime();
 	}
 
@@ -622,10 +1053,10 @@ void slru_cache_t::erase_element(data_t *obj) {
 		m_cache_stats.size_of_objects_marked_for_deletion -= obj->size();
 	}
 
-	delete obj;
+	m_entries.destroy(obj);
 }
 
-void slru_cache_t::sync_element(const dnet_id &raw, bool after_append, const std::vector<char> &data, uint64_t user_flags, const dnet_time &timestamp) {
+void slru_cache_t::sync_element(const dnet_id &raw, bool after_append, const raw_data_t &data, uint64_t user_flags, const dnet_time &timestamp) {
 	react::action_guard sync_guard(ACTION_CACHE_SYNC);
 
 	local_session sess(m_backend, m_node);
@@ -644,17 +1075,19 @@ void slru_cache_t::sync_element(data_t *obj) {
 	memset(&raw, 0, sizeof(struct dnet_id));
 	memcpy(raw.id, obj->id().id, DNET_ID_SIZE);
 
-	auto &data = obj->data()->data();
-
-	sync_element(raw, obj->only_append(), data, obj->user_flags(), obj->timestamp());
+	sync_element(raw, obj->only_append(), *obj->data(), obj->user_flags(), obj->timestamp());
 }
 
-void slru_cache_t::sync_after_append(elliptics_unique_lock<std::mutex> &guard, bool lock_guard, data_t *obj) {
+void slru_cache_t::sync_after_append(elliptics_unique_lock<shared_mutex_t> &guard, bool lock_guard, data_t *obj) {
 	react::action_guard sync_after_append_guard(ACTION_CACHE_SYNC_AFTER_APPEND);
 
-	std::shared_ptr<raw_data_t> raw_data = obj->data();
+	raw_data_ptr_t raw_data = obj->data();
 
+	if (obj->synctime()) {
+		m_dirty_size -= obj->size();
+	}
 	obj->clear_synctime();
+	m_events.update(obj);
 
 	dnet_id id;
 	memset(&id, 0, sizeof(id));
@@ -670,10 +1103,8 @@ void slru_cache_t::sync_after_append(elliptics_unique_lock<std::mutex> &guard, b
 	local_session sess(m_backend, m_node);
 	sess.set_ioflags(DNET_IO_FLAGS_NOCACHE | DNET_IO_FLAGS_APPEND);
 
-	auto &raw = raw_data->data();
-
 	react_start_action(ACTION_CACHE_LOCAL_WRITE);
-	int err = sess.write(id, raw.data(), raw.size(), user_flags, timestamp);
+	int err = sess.write(id, raw_data->data(), raw_data->size(), user_flags, timestamp);
 	react_stop_action(ACTION_CACHE_LOCAL_WRITE);
 
 	react_start_action(ACTION_CACHE_LOCK);
@@ -684,6 +1115,485 @@ void slru_cache_t::sync_after_append(elliptics_unique_lock<std::mutex> &guard, b
 	dnet_log(m_node, DNET_LOG_INFO, "%s: CACHE: sync after append, err: %d", dnet_dump_id_str(id.id), err);
 }
 
+/*
+ * Blocks writer until life check syncs enough dirty objects or for at most a second,
+ * writer may hold oplock of an object life check is going to sync, so it can not wait forever.
+ */
+void slru_cache_t::wait_for_sync(elliptics_unique_lock<shared_mutex_t> &guard) {
+	react::action_guard wait_guard(ACTION_CACHE_WAIT_FOR_SYNC);
+
+	m_lifecheck_wait.notify_one();
+
+	for (int i = 0; i < 10 && m_dirty_size >= m_max_dirty_size && !need_exit(); ++i) {
+		m_dirty_wait.wait_for(guard, std::chrono::milliseconds(100));
+	}
+}
+
+/*
+ * Moves object into sync phase and remembers what has to be written,
+ * holding reference to payload makes writers copy it instead of modifying it under our feet
+ */
+void slru_cache_t::prepare_sync(data_t *obj, std::vector<sync_job_t> &jobs) {
+	sync_job_t job;
+	job.obj = obj;
+	memset(&job.id, 0, sizeof(job.id));
+	memcpy(job.id.id, obj->id().id, DNET_ID_SIZE);
+	job.data = obj->data();
+	job.only_append = obj->only_append();
+	job.user_flags = obj->user_flags();
+	job.timestamp = obj->timestamp();
+	job.size = obj->size();
+	jobs.push_back(job);
+
+	size_t previous_eventtime = obj->eventtime();
+	obj->clear_synctime();
+	obj->set_sync_state(data_t::sync_state_t::SYNC_PHASE);
+
+	if (previous_eventtime != obj->eventtime()) {
+		react_start_action(ACTION_CACHE_DECREASE_KEY);
+		m_events.update(obj);
+		react_stop_action(ACTION_CACHE_DECREASE_KEY);
+	}
+}
+
+/*
+ * Picks dirty objects which are not due yet until dirty size minus @sync_size of already picked ones
+ * drops to half of the limit, index is scanned round-robin so every object gets its turn
+ */
+void slru_cache_t::prepare_early_sync(std::vector<sync_job_t> &jobs, size_t sync_size) {
+	const size_t target_size = m_max_dirty_size / 2;
+	size_t scanned = 0;
+
+	while (m_dirty_size - sync_size > target_size && scanned < m_index.size()) {
+		data_t *obj = m_index.next(m_flush_pos);
+		if (!obj) {
+			m_flush_pos = 0;
+			continue;
+		}
+
+		++scanned;
+
+		if (!obj->synctime() || obj->will_be_erased() || obj->only_append())
+			continue;
+
+		sync_size += obj->size();
+		prepare_sync(obj, jobs);
+	}
+}
+
+void slru_cache_t::run_sync_job(sync_job_t &job) {
+	if (m_clear_occured)
+		return;
+
+	react_start_action(ACTION_CACHE_DNET_OPLOCK);
+	dnet_oplock(m_node, &job.id);
+	react_stop_action(ACTION_CACHE_DNET_OPLOCK);
+
+	// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
+	if (job.obj->is_syncing()) {
+		try {
+			sync_element(job.id, job.only_append, *job.data, job.user_flags, job.timestamp);
+		} catch (const std::exception &e) {
+			dnet_log(m_node, DNET_LOG_ERROR, "%s: CACHE: sync failed: %s", dnet_dump_id_str(job.id.id), e.what());
+		}
+		job.obj->set_sync_state(data_t::sync_state_t::ERASE_PHASE);
+	}
+
+	dnet_opunlock(m_node, &job.id);
+}
+
+/*
+ * Cached data of append-only object is only its tail which has not been appended to the disk yet.
+ * Object is turned into regular one by prepending data read from disk to the tail,
+ * so that it is served from the cache and later synced by single write instead of being synced on every read.
+ * If object is changed while disk is read, its tail is synced and NULL is returned as before.
+ */
+data_t *slru_cache_t::merge_append_only(elliptics_unique_lock<shared_mutex_t> &guard, data_t *obj) {
+	react::action_guard merge_guard(ACTION_CACHE_MERGE_APPEND_ONLY);
+
+	const dnet_raw_id key = obj->id();
+	// Holding reference to the tail makes appenders copy it, so any change of the object is noticed
+	const raw_data_ptr_t tail = obj->data();
+	ioremap::elliptics::data_pointer head;
+	int err = -EAGAIN;
+
+	if (!obj->will_be_erased()) {
+		guard.unlock();
+
+		local_session sess(m_backend, m_node);
+		sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
+
+		dnet_id raw_id;
+		memset(&raw_id, 0, sizeof(raw_id));
+		memcpy(raw_id.id, key.id, DNET_ID_SIZE);
+
+		uint64_t user_flags;
+		dnet_time timestamp;
+
+		try {
+			react_start_action(ACTION_CACHE_LOCAL_READ);
+			head = sess.read(raw_id, &user_flags, &timestamp, &err);
+			react_stop_action(ACTION_CACHE_LOCAL_READ);
+		} catch (...) {
+			err = -EIO;
+		}
+
+		react_start_action(ACTION_CACHE_LOCK);
+		guard.lock();
+		react_stop_action(ACTION_CACHE_LOCK);
+
+		if (err == -ENOENT) {
+			head = ioremap::elliptics::data_pointer();
+			err = 0;
+		}
+	}
+
+	data_t *it = m_index.find(key.id);
+
+	if (err || it != obj || it->data() != tail || !it->only_append() || it->will_be_erased()) {
+		// Object picked by life check meanwhile has its tail appended by pending sync job
+		if (it && it->only_append() && !it->will_be_erased())
+			sync_after_append(guard, true, it);
+		return NULL;
+	}
+
+	const size_t head_size = head.size();
+	const size_t tail_size = tail->size();
+	const size_t page_number = it->cache_page_number();
+
+	remove_data_from_page(key.id, page_number, it);
+	resize_page(key.id, page_number, 2 * (head_size + tail_size + it->overhead_size()));
+
+	if (it->remove_from_cache()) {
+		m_cache_stats.size_of_objects_marked_for_deletion -= it->size();
+	}
+	m_cache_stats.size_of_objects -= it->size();
+	m_object_sizes.remove(it->size());
+	if (it->synctime()) {
+		m_dirty_size -= it->size();
+	}
+
+	char *raw = it->resize_data(head_size + tail_size);
+	memmove(raw + head_size, raw, tail_size);
+	memcpy(raw, head.data(), head_size);
+	it->set_only_append(false);
+
+	m_cache_stats.size_of_objects += it->size();
+	m_object_sizes.record(it->size());
+	if (it->synctime()) {
+		m_dirty_size += it->size();
+	}
+	if (it->remove_from_cache()) {
+		m_cache_stats.size_of_objects_marked_for_deletion += it->size();
+	}
+
+	insert_data_into_page(key.id, page_number, it);
+	return it;
+}
+
+/*
+ * Returns table of index @id loading it from cached object or from disk if needed, NULL on error.
+ * Lock is released while table is read and unpacked.
+ */
+slru_cache_t::index_table_t *slru_cache_t::load_index_table(elliptics_unique_lock<shared_mutex_t> &guard, const unsigned char *id, int *err) {
+	dnet_raw_id key;
+	memcpy(key.id, id, DNET_ID_SIZE);
+
+	dnet_id raw_id;
+	memset(&raw_id, 0, sizeof(raw_id));
+	memcpy(raw_id.id, id, DNET_ID_SIZE);
+
+	bool loaded = false;
+
+	for (;;) {
+		auto found = m_index_tables.find(key);
+		if (found != m_index_tables.end()) {
+			index_table_t *table = found->second.get();
+			m_index_tables_lru.erase(m_index_tables_lru.iterator_to(*table));
+			m_index_tables_lru.push_back(*table);
+
+			if (!loaded)
+				m_cache_stats.index_table_hits++;
+			return table;
+		}
+
+		data_t *it = m_index.find(id);
+		if (it && it->only_append()) {
+			sync_after_append(guard, true, it);
+			continue;
+		}
+
+		react::action_guard load_guard(ACTION_CACHE_LOAD_INDEX_TABLE);
+
+		if (!loaded)
+			m_cache_stats.index_table_misses++;
+		loaded = true;
+
+		const uint64_t generation = m_index_tables_generation;
+		++m_index_tables_loading;
+
+		// Holding reference to payload makes writers copy it instead of modifying it under our feet
+		raw_data_ptr_t raw;
+		ioremap::elliptics::data_pointer data;
+		bool exists = true;
+		*err = 0;
+
+		if (it) {
+			raw = it->data();
+			data = ioremap::elliptics::data_pointer::from_raw(raw->data(), raw->size());
+		}
+
+		guard.unlock();
+
+		std::unique_ptr<index_table_t> table;
+
+		try {
+			if (!raw) {
+				local_session sess(m_backend, m_node);
+				sess.set_ioflags(DNET_IO_FLAGS_NOCACHE);
+
+				react_start_action(ACTION_CACHE_LOCAL_READ);
+				data = sess.read(raw_id, err);
+				react_stop_action(ACTION_CACHE_LOCAL_READ);
+
+				if (*err == -ENOENT) {
+					exists = false;
+					*err = 0;
+				}
+			}
+
+			if (!*err) {
+				table.reset(new index_table_t);
+				table->id = key;
+				table->table = std::make_shared<ioremap::elliptics::dnet_indexes>();
+				table->exists = exists;
+				table->dirty_time = 0;
+				table->size = 0;
+				table->entry_size = sizeof(ioremap::elliptics::dnet_index_entry);
+
+				if (exists) {
+					ioremap::elliptics::indexes_unpack(m_node, &raw_id, data, table->table.get(), "load_index_table");
+
+					const std::vector<ioremap::elliptics::dnet_index_entry> &entries = table->table->indexes;
+					if (!entries.empty()) {
+						size_t data_size = 0;
+						for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+							data_size += entry->data.size();
+						}
+						table->entry_size += data_size / entries.size();
+					}
+				}
+			}
+		} catch (...) {
+			*err = -EIO;
+		}
+
+		react_start_action(ACTION_CACHE_LOCK);
+		guard.lock();
+		react_stop_action(ACTION_CACHE_LOCK);
+
+		--m_index_tables_loading;
+
+		if (*err)
+			return NULL;
+
+		if (generation != m_index_tables_generation || m_index_tables.find(key) != m_index_tables.end())
+			continue;
+
+		index_table_t *result = table.get();
+		m_index_tables.emplace(key, std::move(table));
+		m_index_tables_lru.push_back(*result);
+		m_cache_stats.number_of_index_tables++;
+
+		update_index_table_size(result);
+		shrink_index_tables();
+		return result;
+	}
+}
+
+void slru_cache_t::update_index_table_size(index_table_t *table) {
+	m_index_tables_size -= table->size;
+	table->size = sizeof(index_table_t) + sizeof(ioremap::elliptics::dnet_indexes) +
+		table->table->indexes.size() * table->entry_size;
+	m_index_tables_size += table->size;
+}
+
+/*
+ * Stores dirty table into cached object, so that it is served to raw reads and synced as usual
+ */
+void slru_cache_t::pack_index_table(index_table_t *table) {
+	react::action_guard pack_guard(ACTION_CACHE_PACK_INDEX_TABLE);
+
+	const ioremap::elliptics::data_pointer data = ioremap::elliptics::indexes_pack(*table->table,
+		m_node->flags & DNET_CFG_FIXED_WIDTH_INDEXES);
+	store_data(table->id.id, data.data<char>(), data.size());
+
+	table->dirty_time = 0;
+	--m_dirty_index_tables;
+}
+
+/*
+ * Packs dirty table of index @id before the object is accessed by raw command,
+ * if @drop is set the table is also dropped as the object is going to be changed
+ */
+void slru_cache_t::flush_index_table(const unsigned char *id, bool drop) {
+	if (drop && m_index_tables_loading)
+		++m_index_tables_generation;
+
+	if (m_index_tables.empty())
+		return;
+
+	dnet_raw_id key;
+	memcpy(key.id, id, DNET_ID_SIZE);
+
+	auto found = m_index_tables.find(key);
+	if (found == m_index_tables.end())
+		return;
+
+	index_table_t *table = found->second.get();
+	if (table->dirty_time)
+		pack_index_table(table);
+	if (drop)
+		drop_index_table(table);
+}
+
+/*
+ * Changes of dirty table are lost, so it has to be packed first unless the object is being overwritten
+ */
+void slru_cache_t::drop_index_table(index_table_t *table) {
+	const dnet_raw_id key = table->id;
+
+	if (table->dirty_time)
+		--m_dirty_index_tables;
+
+	m_index_tables_size -= table->size;
+	m_cache_stats.number_of_index_tables--;
+	m_index_tables_lru.erase(m_index_tables_lru.iterator_to(*table));
+	m_index_tables.erase(key);
+}
+
+/*
+ * Drops the least recently used tables until they fit into the limit,
+ * the most recently used table is kept as it is being accessed now
+ */
+void slru_cache_t::shrink_index_tables(void) {
+	while (m_index_tables_size > m_max_index_tables_size && m_index_tables_lru.size() > 1) {
+		index_table_t *table = &m_index_tables_lru.front();
+		if (table->dirty_time)
+			pack_index_table(table);
+		drop_index_table(table);
+	}
+}
+
+/*
+ * Packs all dirty tables without holding the lock, table which is changed meanwhile is left dirty
+ * and is packed again by the next pass
+ */
+void slru_cache_t::pack_dirty_index_tables(void) {
+	struct packed_table_t {
+		dnet_raw_id id;
+		std::shared_ptr<const ioremap::elliptics::dnet_indexes> table;
+		ioremap::elliptics::data_pointer data;
+	};
+
+	std::vector<packed_table_t> tables;
+
+	if (!m_max_index_tables_size)
+		return;
+
+	{
+		react_start_action(ACTION_CACHE_LOCK);
+		elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "CACHE PACK INDEX TABLES: %p", this);
+		react_stop_action(ACTION_CACHE_LOCK);
+
+		if (!m_dirty_index_tables)
+			return;
+
+		for (auto it = m_index_tables_lru.begin(); it != m_index_tables_lru.end(); ++it) {
+			if (!it->dirty_time)
+				continue;
+
+			packed_table_t packed;
+			packed.id = it->id;
+			// Holding reference to the table makes updaters copy it instead of modifying it under our feet
+			packed.table = it->table;
+			tables.push_back(packed);
+
+			it->dirty_time = 0;
+		}
+
+		m_dirty_index_tables = 0;
+	}
+
+	react_start_action(ACTION_CACHE_PACK_INDEX_TABLE);
+	for (auto it = tables.begin(); it != tables.end(); ++it) {
+		it->data = ioremap::elliptics::indexes_pack(*it->table, m_node->flags & DNET_CFG_FIXED_WIDTH_INDEXES);
+	}
+	react_stop_action(ACTION_CACHE_PACK_INDEX_TABLE);
+
+	react_start_action(ACTION_CACHE_LOCK);
+	elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "CACHE STORE INDEX TABLES: %p", this);
+	react_stop_action(ACTION_CACHE_LOCK);
+
+	for (auto it = tables.begin(); it != tables.end(); ++it) {
+		// Table has been dropped by raw command, or it has been changed and may already be stored by raw read
+		auto found = m_index_tables.find(it->id);
+		if (found == m_index_tables.end() || found->second->table != it->table)
+			continue;
+
+		store_data(it->id.id, it->data.data<char>(), it->data.size());
+	}
+}
+
+/*
+ * Replaces data of object @id by @size bytes of @data and marks it dirty, object is created if it is not cached
+ */
+void slru_cache_t::store_data(const unsigned char *id, const char *data, size_t size) {
+	data_t *it = m_index.find(id);
+
+	if (!it) {
+		it = create_data(id, data, size, false);
+	} else {
+		const size_t page_number = it->cache_page_number();
+
+		remove_data_from_page(id, page_number, it);
+		resize_page(id, page_number, 2 * (size + it->overhead_size()));
+
+		if (it->remove_from_cache()) {
+			m_cache_stats.size_of_objects_marked_for_deletion -= it->size();
+		}
+		m_cache_stats.size_of_objects -= it->size();
+		m_object_sizes.remove(it->size());
+		if (it->synctime()) {
+			m_dirty_size -= it->size();
+		}
+
+		memcpy(it->resize_data(size), data, size);
+		m_cache_stats.size_of_objects += it->size();
+		m_object_sizes.record(it->size());
+
+		it->set_remove_from_cache(false);
+		insert_data_into_page(id, page_number, it);
+	}
+
+	size_t previous_eventtime = it->eventtime();
+
+	if (!it->synctime()) {
+		it->set_synctime(time(NULL) + m_sync_timeout);
+	}
+	m_dirty_size += it->size();
+
+	if (previous_eventtime != it->eventtime()) {
+		react_start_action(ACTION_CACHE_DECREASE_KEY);
+		m_events.update(it);
+		react_stop_action(ACTION_CACHE_DECREASE_KEY);
+	}
+
+	dnet_time timestamp;
+	dnet_current_time(&timestamp);
+	it->set_timestamp(timestamp);
+}
+
 void slru_cache_t::life_check(void) {
 
 	dnet_set_name("dnet_cache_%zu", m_backend->backend_id);
@@ -695,26 +1605,28 @@ void slru_cache_t::life_check(void) {
 		{
 			react_start_action(ACTION_CACHE_LIFECHECK);
 
+			pack_dirty_index_tables();
+
 			std::deque<struct dnet_id> remove;
-			std::deque<data_t*> elements_for_sync;
+			std::vector<sync_job_t> elements_for_sync;
+			size_t sync_size = 0;
 			size_t last_time = 0;
 			dnet_id id;
 			memset(&id, 0, sizeof(id));
 
 			{
 				react_start_action(ACTION_CACHE_LOCK);
-				elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE LIFE: %p", this);
+				elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "CACHE LIFE: %p", this);
 				react_stop_action(ACTION_CACHE_LOCK);
 
+				promote_deferred();
+
 				react_start_action(ACTION_CACHE_PREPARE_SYNC);
-				while (!need_exit() && !m_treap.empty()) {
+				while (!need_exit() && !m_events.empty()) {
 					size_t time = ::time(NULL);
 					last_time = time;
 
-					if (m_treap.empty())
-						break;
-
-					data_t* it = m_treap.top();
+					data_t* it = m_events.top();
 					if (it->eventtime() > time)
 						break;
 
@@ -730,42 +1642,26 @@ void slru_cache_t::life_check(void) {
 					}
 					else if (it->eventtime() == it->synctime())
 					{
-						elements_for_sync.push_back(it);
-
-						size_t previous_eventtime = it->eventtime();
-						it->clear_synctime();
-						it->set_sync_state(data_t::sync_state_t::SYNC_PHASE);
-
-						if (previous_eventtime != it->eventtime()) {
-							react_start_action(ACTION_CACHE_DECREASE_KEY);
-							m_treap.decrease_key(it);
-							react_stop_action(ACTION_CACHE_DECREASE_KEY);
-						}
+						sync_size += it->size();
+						prepare_sync(it, elements_for_sync);
 					}
 				}
+
+				if (m_max_dirty_size && m_dirty_size - sync_size > m_max_dirty_size / 2) {
+					prepare_early_sync(elements_for_sync, sync_size);
+				}
 				react_stop_action(ACTION_CACHE_PREPARE_SYNC);
 			}
 
+			// All objects are written concurrently, each one is protected by its own oplock
 			react_start_action(ACTION_CACHE_SYNC_ITERATE);
+			std::vector<std::function<void ()>> tasks;
+			tasks.reserve(elements_for_sync.size());
 			for (auto it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
-				if (m_clear_occured)
-					break;
-
-				data_t *elem = *it;
-				memcpy(id.id, elem->id().id, DNET_ID_SIZE);
-
-				react_start_action(ACTION_CACHE_DNET_OPLOCK);
-				dnet_oplock(m_node, &id);
-				react_stop_action(ACTION_CACHE_DNET_OPLOCK);
-
-				// sync_element uses local_session which always uses DNET_FLAGS_NOLOCK
-				if (elem->is_syncing()) {
-					sync_element(id, elem->only_append(), elem->data()->data(), elem->user_flags(), elem->timestamp());
-					elem->set_sync_state(data_t::sync_state_t::ERASE_PHASE);
-				}
-
-				dnet_opunlock(m_node, &id);
+				sync_job_t *job = &*it;
+				tasks.emplace_back([this, job] () { run_sync_job(*job); });
 			}
+			m_sync_pool->run(tasks);
 			react_stop_action(ACTION_CACHE_SYNC_ITERATE);
 			react_start_action(ACTION_CACHE_REMOVE_LOCAL);
 			for (std::deque<struct dnet_id>::iterator it = remove.begin(); it != remove.end(); ++it) {
@@ -775,13 +1671,18 @@ void slru_cache_t::life_check(void) {
 
 			{
 				react_start_action(ACTION_CACHE_LOCK);
-				elliptics_unique_lock<std::mutex> guard(m_lock, m_node, "CACHE CLEAR PAGES: %p", this);
+				elliptics_unique_lock<shared_mutex_t> guard(m_lock, m_node, "CACHE CLEAR PAGES: %p", this);
 				react_stop_action(ACTION_CACHE_LOCK);
 
+				for (auto it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
+					m_dirty_size -= it->size;
+				}
+				m_dirty_wait.notify_all();
+
 				if (!m_clear_occured) {
 					react_start_action(ACTION_CACHE_ERASE_ITERATE);
-					for (std::deque<data_t*>::iterator it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
-						data_t *elem = *it;
+					for (auto it = elements_for_sync.begin(); it != elements_for_sync.end(); ++it) {
+						data_t *elem = it->obj;
 						elem->set_sync_state(data_t::sync_state_t::NOT_SYNCING);
 						if (elem->synctime() <= last_time) {
 							if (elem->only_append() || elem->remove_from_cache()) {
@@ -799,7 +1700,9 @@ void slru_cache_t::life_check(void) {
 		if (m_node->monitor) {
 			react_deactivate();
 		}
-		std::this_thread::sleep_for( std::chrono::milliseconds(1000) );
+
+		std::unique_lock<std::mutex> lifecheck_guard(m_lifecheck_lock);
+		m_lifecheck_wait.wait_for(lifecheck_guard, std::chrono::milliseconds(1000));
 	}
 
 }
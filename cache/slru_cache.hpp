@@ -26,13 +26,15 @@ using namespace react;
 
 class slru_cache_t {
 public:
-	slru_cache_t(struct dnet_backend_io *backend, struct dnet_node *n, const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout);
+	slru_cache_t(struct dnet_backend_io *backend, struct dnet_node *n, const std::vector<size_t> &cache_pages_max_sizes, unsigned sync_timeout,
+		std::unique_ptr<admission_policy_t> admission, sync_pool_t *sync_pool, size_t max_dirty_size,
+		size_t max_index_tables_size, histogram_set_t *histograms, size_t lock_wait_histogram);
 
 	~slru_cache_t();
 
 	int write(const unsigned char *id, dnet_net_state *st, dnet_cmd *cmd, dnet_io_attr *io, const char *data);
 
-	std::shared_ptr<raw_data_t> read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
+	raw_data_ptr_t read(const unsigned char *id, dnet_cmd *cmd, dnet_io_attr *io);
 
 	int remove(const unsigned char *id, dnet_io_attr *io);
 
@@ -40,21 +42,146 @@ public:
 
 	void clear();
 
+	int warm_up(const unsigned char *id, size_t page_number, size_t *size);
+
+	void get_snapshot(std::vector<cache_snapshot_record_t> &records);
+
+	std::shared_ptr<const ioremap::elliptics::dnet_indexes> indexes_find(const unsigned char *id, int *err);
+
+	int indexes_update(const unsigned char *id, const std::function<bool (ioremap::elliptics::dnet_indexes &)> &update);
+
 	cache_stats get_cache_stats() const;
 
 private:
 	struct dnet_backend_io *m_backend;
 	struct dnet_node *m_node;
-	std::mutex m_lock;
+	shared_mutex_t m_lock;
 	size_t m_cache_pages_number;
 	std::vector<size_t> m_cache_pages_max_sizes;
 	std::vector<size_t> m_cache_pages_sizes;
 	std::unique_ptr<lru_list_t[]> m_cache_pages_lru;
 	std::thread m_lifecheck;
-	treap_t m_treap;
+	hash_index_t m_index;
+	event_heap_t m_events;
+	object_slab<data_t> m_entries;
 	mutable cache_stats m_cache_stats;
-	bool m_clear_occured;
+	// read by sync pool threads without cache lock
+	std::atomic<bool> m_clear_occured;
 	unsigned m_sync_timeout;
+	// empty if every object is admitted
+	std::unique_ptr<admission_policy_t> m_admission;
+
+	/*
+	 * Dirty objects are written to the backend by life check in batches through pool shared by all shards.
+	 * Size of dirty objects includes ones which are being synced, writers wait for life check
+	 * once it exceeds m_max_dirty_size, life check syncs objects before their synctime once it exceeds half of the limit.
+	 */
+	sync_pool_t *m_sync_pool;
+	size_t m_max_dirty_size;
+	size_t m_dirty_size;
+	std::condition_variable_any m_dirty_wait;
+	// position in index where the next early sync starts looking for dirty objects
+	size_t m_flush_pos;
+	std::mutex m_lifecheck_lock;
+	std::condition_variable m_lifecheck_wait;
+
+	struct sync_job_t {
+		data_t *obj;
+		dnet_id id;
+		raw_data_ptr_t data;
+		bool only_append;
+		uint64_t user_flags;
+		dnet_time timestamp;
+		size_t size;
+	};
+
+	/*
+	 * Cache hits are served under shared lock, so they can not reorder lru lists.
+	 * Ids of hit objects are collected into these buffers instead and are promoted
+	 * in batches by the next exclusive lock owner.
+	 */
+	struct promotion_buffer_t {
+		std::mutex lock;
+		std::vector<dnet_raw_id> ids;
+	};
+	static const size_t promotion_buffers_number = 16;
+	static const size_t promotion_buffer_size = 64;
+	std::unique_ptr<promotion_buffer_t[]> m_promotion_buffers;
+
+	/*
+	 * Disk read issued by populate_from_disk(), other requests which miss the same key
+	 * wait for it instead of reading the key again.
+	 */
+	struct populate_request_t {
+		populate_request_t() : err(0), done(false), user_flags(0) {
+			dnet_empty_time(&timestamp);
+		}
+
+		std::condition_variable_any wait;
+		int err;
+		bool done;
+		ioremap::elliptics::data_pointer data;
+		uint64_t user_flags;
+		dnet_time timestamp;
+	};
+
+	struct raw_id_hash {
+		size_t operator() (const dnet_raw_id &id) const {
+			size_t hash;
+			memcpy(&hash, id.id, sizeof(hash));
+			return hash;
+		}
+	};
+
+	struct raw_id_equal {
+		bool operator() (const dnet_raw_id &lhs, const dnet_raw_id &rhs) const {
+			return dnet_id_cmp_str(lhs.id, rhs.id) == 0;
+		}
+	};
+
+	std::unordered_map<dnet_raw_id, std::shared_ptr<populate_request_t>, raw_id_hash, raw_id_equal> m_populate_requests;
+
+	/*
+	 * Decoded tables of secondary indexes, so that index updates and finds do not unpack and pack
+	 * whole table every time. Dirty table is the only up-to-date copy of index object, life check packs it
+	 * into regular cached object which is synced to the backend as any other one. Raw reads of the object
+	 * pack its dirty table first, raw writes and removals drop the table.
+	 */
+	struct index_table_t : public boost::intrusive::list_base_hook<> {
+		dnet_raw_id id;
+		// tables handed out to finders are never modified, updater copies shared table first
+		std::shared_ptr<ioremap::elliptics::dnet_indexes> table;
+		// false until the first update if index object does not exist
+		bool exists;
+		// time of the first update since table was packed last, 0 if table is clean
+		size_t dirty_time;
+		// estimated memory taken by the table and average size of its entry
+		size_t size;
+		size_t entry_size;
+	};
+
+	std::unordered_map<dnet_raw_id, std::unique_ptr<index_table_t>, raw_id_hash, raw_id_equal> m_index_tables;
+	// the least recently used table goes first
+	boost::intrusive::list<index_table_t> m_index_tables_lru;
+	size_t m_index_tables_size;
+	size_t m_max_index_tables_size;
+	size_t m_dirty_index_tables;
+	/*
+	 * Tables are loaded without lock, raw writes and removals which happen meanwhile increase generation,
+	 * so that table is loaded again instead of being inserted over newer data
+	 */
+	size_t m_index_tables_loading;
+	uint64_t m_index_tables_generation;
+
+	std::atomic<size_t> m_hits;
+	std::atomic<size_t> m_misses;
+	std::atomic<size_t> m_coalesced_misses;
+
+	// latencies of operations and lock waits are recorded into histograms shared by all shards
+	histogram_set_t *m_histograms;
+	size_t m_lock_wait_histogram;
+	// sizes of cached objects, changed under exclusive lock only
+	atomic_histogram_t m_object_sizes;
 
 	slru_cache_t(const slru_cache_t &) = delete;
 
@@ -74,7 +201,17 @@ private:
 		return page_number + 1;
 	}
 
-	void sync_if_required(data_t* it, elliptics_unique_lock<std::mutex> &guard);
+	raw_data_ptr_t read_shared(const unsigned char *id, dnet_io_attr *io);
+
+	void defer_promotion(const unsigned char *id);
+
+	void record_access(const unsigned char *id);
+
+	bool admit(const unsigned char *id, size_t size);
+
+	void promote_deferred(void);
+
+	void sync_if_required(data_t* it, elliptics_unique_lock<shared_mutex_t> &guard);
 
 	void insert_data_into_page(const unsigned char *id, size_t page_number, data_t *data);
 
@@ -87,7 +224,8 @@ private:
 
 	data_t* create_data(const unsigned char *id, const char *data, size_t size, bool remove_from_disk);
 
-	data_t* populate_from_disk(elliptics_unique_lock<std::mutex> &guard, const unsigned char *id, bool remove_from_disk, int *err);
+	data_t* populate_from_disk(elliptics_unique_lock<shared_mutex_t> &guard, const unsigned char *id, bool remove_from_disk, int *err,
+				   std::shared_ptr<populate_request_t> *rejected = NULL);
 
 	bool have_enough_space(const unsigned char *id, size_t page_number, size_t reserve);
 
@@ -95,11 +233,37 @@ private:
 
 	void erase_element(data_t *obj);
 
-	void sync_element(const dnet_id &raw, bool after_append, const std::vector<char> &data, uint64_t user_flags, const dnet_time &timestamp);
+	void sync_element(const dnet_id &raw, bool after_append, const raw_data_t &data, uint64_t user_flags, const dnet_time &timestamp);
 
 	void sync_element(data_t *obj);
 
-	void sync_after_append(elliptics_unique_lock<std::mutex> &guard, bool lock_guard, data_t *obj);
+	void sync_after_append(elliptics_unique_lock<shared_mutex_t> &guard, bool lock_guard, data_t *obj);
+
+	data_t *merge_append_only(elliptics_unique_lock<shared_mutex_t> &guard, data_t *obj);
+
+	void wait_for_sync(elliptics_unique_lock<shared_mutex_t> &guard);
+
+	void prepare_sync(data_t *obj, std::vector<sync_job_t> &jobs);
+
+	void prepare_early_sync(std::vector<sync_job_t> &jobs, size_t sync_size);
+
+	void run_sync_job(sync_job_t &job);
+
+	index_table_t *load_index_table(elliptics_unique_lock<shared_mutex_t> &guard, const unsigned char *id, int *err);
+
+	void update_index_table_size(index_table_t *table);
+
+	void pack_index_table(index_table_t *table);
+
+	void flush_index_table(const unsigned char *id, bool drop);
+
+	void drop_index_table(index_table_t *table);
+
+	void shrink_index_tables(void);
+
+	void pack_dirty_index_tables(void);
+
+	void store_data(const unsigned char *id, const char *data, size_t size);
 
 	void life_check(void);
 };
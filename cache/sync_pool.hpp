@@ -0,0 +1,150 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SYNC_POOL_HPP
+#define SYNC_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "library/elliptics.h"
+
+namespace ioremap { namespace cache {
+
+/*!
+ * Fixed set of threads which cache shards use to write dirty objects to the backend concurrently.
+ * Shard submits all objects it syncs during single life check pass as one batch and waits for the whole batch,
+ * thread which has submitted the batch executes its tasks as well.
+ */
+class sync_pool_t {
+public:
+	sync_pool_t(size_t threads_number, size_t backend_id) : m_need_exit(false) {
+		for (size_t i = 0; i < threads_number; ++i) {
+			m_threads.emplace_back(std::bind(&sync_pool_t::worker, this, backend_id));
+		}
+	}
+
+	~sync_pool_t() {
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_need_exit = true;
+		}
+		m_wait.notify_all();
+
+		for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+			it->join();
+		}
+	}
+
+	sync_pool_t(const sync_pool_t &) = delete;
+	sync_pool_t &operator =(const sync_pool_t &) = delete;
+
+	/*!
+	 * Runs all @tasks concurrently, returns when every one of them is completed.
+	 * Tasks must not throw.
+	 */
+	void run(const std::vector<std::function<void ()>> &tasks) {
+		if (tasks.empty())
+			return;
+
+		batch_t batch(tasks);
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		if (!m_threads.empty()) {
+			m_batches.push_back(&batch);
+			m_wait.notify_all();
+		}
+
+		while (batch.next < batch.tasks.size()) {
+			run_next(guard, &batch);
+		}
+
+		while (batch.remaining) {
+			batch.done.wait(guard);
+		}
+	}
+
+	size_t threads_number() const {
+		return m_threads.size();
+	}
+
+private:
+	struct batch_t {
+		batch_t(const std::vector<std::function<void ()>> &tasks) : tasks(tasks), next(0), remaining(tasks.size()) {
+		}
+
+		const std::vector<std::function<void ()>> &tasks;
+		// index of the first task nobody has taken yet
+		size_t next;
+		size_t remaining;
+		std::condition_variable done;
+	};
+
+	std::mutex m_lock;
+	std::condition_variable m_wait;
+	// batches with not yet taken tasks
+	std::deque<batch_t *> m_batches;
+	bool m_need_exit;
+	std::vector<std::thread> m_threads;
+
+	/*!
+	 * Takes next task of @batch and executes it with m_lock released
+	 */
+	void run_next(std::unique_lock<std::mutex> &guard, batch_t *batch) {
+		const size_t index = batch->next++;
+
+		if (batch->next == batch->tasks.size()) {
+			for (auto it = m_batches.begin(); it != m_batches.end(); ++it) {
+				if (*it == batch) {
+					m_batches.erase(it);
+					break;
+				}
+			}
+		}
+
+		guard.unlock();
+		batch->tasks[index]();
+		guard.lock();
+
+		if (--batch->remaining == 0)
+			batch->done.notify_all();
+	}
+
+	void worker(size_t backend_id) {
+		dnet_set_name("dnet_cache_sync_%zu", backend_id);
+
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		while (!m_need_exit) {
+			if (m_batches.empty()) {
+				m_wait.wait(guard);
+				continue;
+			}
+
+			run_next(guard, m_batches.front());
+		}
+	}
+};
+
+}}
+
+#endif // SYNC_POOL_HPP
@@ -258,6 +258,7 @@ void parse_options(config_data *data, const config &options)
 	data->cfg_state.stall_count = options.at("stall_count", 0l);
 	data->cfg_state.flags |= (options.at("join", false) ? DNET_CFG_JOIN_NETWORK : 0);
 	data->cfg_state.flags |= (options.at("flags", 0) & ~DNET_CFG_JOIN_NETWORK);
+	data->cfg_state.flags |= (options.at("fixed_width_indexes", false) ? DNET_CFG_FIXED_WIDTH_INDEXES : 0);
 	data->cfg_state.io_thread_num = options.at<unsigned>("io_thread_num");
 	data->cfg_state.nonblocking_io_thread_num = options.at<unsigned>("nonblocking_io_thread_num");
 	data->cfg_state.net_thread_num = options.at<unsigned>("net_thread_num");
@@ -267,6 +268,7 @@ void parse_options(config_data *data, const config &options)
 	data->cfg_state.server_prio = options.at("server_net_prio", 0);
 	data->cfg_state.client_prio = options.at("client_net_prio", 0);
 	data->cfg_state.indexes_shard_count = options.at("indexes_shard_count", 0);
+	data->cfg_state.indexes_log_compact_size = options.at("indexes_log_compact_size", 0);
 	data->daemon_mode = options.at("daemon", false);
 	data->parallel_start = options.at("parallel", true);
 	snprintf(data->cfg_state.cookie, DNET_AUTH_COOKIE_SIZE, "%s", options.at<std::string>("auth_cookie").c_str());
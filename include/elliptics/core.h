@@ -77,10 +77,30 @@
 
 #define DNET_DEFAULT_CACHE_SYNC_TIMEOUT_SEC 30
 
+#define DNET_DEFAULT_CACHE_SNAPSHOT_INTERVAL_SEC 600
+
+#define DNET_DEFAULT_CACHE_SYNC_THREADS 4
+
+/*
+ * Default percentage of cache size which may be taken by not yet synced objects before writers are blocked,
+ * 0 means unlimited
+ */
+#define DNET_DEFAULT_CACHE_DIRTY_RATIO 0
+
+/*
+ * Default limit of disk read rate in bytes per second while cache is warmed up from its snapshot
+ */
+#define DNET_DEFAULT_CACHE_WARM_UP_RATE (32 * 1024 * 1024)
+
 #define DNET_DEFAULT_STALL_TRANSACTIONS 3
 
 #define DNET_DEFAULT_INDEXES_SHARD_COUNT 16
 
+/*
+ * Default size of delta log of index shard which makes the shard be compacted
+ */
+#define DNET_DEFAULT_INDEXES_LOG_COMPACT_SIZE (64 * 1024)
+
 #define DNET_DEFAULT_CACHES_NUMBER 16
 
 #define DNET_DEFAULT_CACHE_PAGES_NUMBER 1
@@ -173,6 +173,8 @@ int __attribute__((weak)) dnet_send_read_data(void *state, struct dnet_cmd *cmd,
 #define DNET_CFG_NO_CSUM		(1<<3)		/* globally disable checksum verification and update */
 #define DNET_CFG_RANDOMIZE_STATES	(1<<5)		/* randomize states for read requests */
 #define DNET_CFG_KEEPS_IDS_IN_CLUSTER	(1<<6)		/* keeps ids in elliptics cluster */
+#define DNET_CFG_PER_CORE_NET_THREADS	(1<<7)		/* pin net threads to CPUs, every one owns its listening socket and connections */
+#define DNET_CFG_FIXED_WIDTH_INDEXES	(1<<8)		/* write index shards in fixed-width layout, which older versions can not read */
 
 static inline const char *dnet_flags_dump_cfgflags(uint64_t flags)
 {
@@ -184,6 +186,8 @@ static inline const char *dnet_flags_dump_cfgflags(uint64_t flags)
 		{ DNET_CFG_NO_CSUM, "n_ocsum" },
 		{ DNET_CFG_RANDOMIZE_STATES, "randomize_states" },
 		{ DNET_CFG_KEEPS_IDS_IN_CLUSTER, "keeps_ids_in_cluster" },
+		{ DNET_CFG_PER_CORE_NET_THREADS, "per_core_net_threads" },
+		{ DNET_CFG_FIXED_WIDTH_INDEXES, "fixed_width_indexes" },
 	};
 
 	dnet_flags_dump_raw(buffer, sizeof(buffer), flags, infos, sizeof(infos) / sizeof(infos[0]));
@@ -331,7 +335,10 @@ struct dnet_config
 
 	struct srw_init_ctl	srw;
 
-	int			reserved_for_future_use_2[5];
+	/* Size of delta log of index shard which makes the shard be rewritten as a single base segment */
+	int			indexes_log_compact_size;
+
+	int			reserved_for_future_use_2[4];
 	int			*reserved_for_future_use_3[1];
 
 	/*
@@ -380,6 +387,7 @@ void dnet_session_set_user_flags(struct dnet_session *s, uint64_t user_flags);
 uint64_t dnet_session_get_user_flags(struct dnet_session *s);
 
 void dnet_session_set_timeout(struct dnet_session *s, long wait_timeout);
+void dnet_session_set_timeout_ms(struct dnet_session *s, long wait_timeout_ms);
 struct timespec *dnet_session_get_timeout(struct dnet_session *s);
 
 void dnet_set_keepalive(struct dnet_node *n, int idle, int cnt, int interval);
@@ -1039,6 +1039,9 @@ struct dnet_indexes_request_entry
 
 /*
  * Indexes request
+ *
+ * If data of the first entry of DNET_CMD_INDEXES_FIND request is DNET_ID_SIZE bytes long,
+ * it is id of the last object of previous page and only objects with greater ids are found.
  */
 struct dnet_indexes_request
 {
@@ -1046,7 +1049,8 @@ struct dnet_indexes_request
 	uint32_t			flags;
 	uint32_t			shard_id;
 	uint32_t			shard_count;
-	uint64_t			reserved[5];
+	uint64_t			limit;		/* Max number of found objects, 0 means no limit */
+	uint64_t			reserved[4];
 	uint64_t			entries_count;	/* Count of indexes */
 	struct dnet_indexes_request_entry	entries[0];	/* List of indexes to set */
 } __attribute__ ((packed));
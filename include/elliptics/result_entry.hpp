@@ -251,6 +251,39 @@ struct find_indexes_result_entry
 	std::vector<index_entry> indexes;
 };
 
+/*!
+ * \brief Position of paginated find_all_indexes() and find_any_indexes() requests
+ *
+ * Default cursor points to the first page, cursor made of id of the last object
+ * of some page points to the next one.
+ */
+class find_indexes_cursor
+{
+public:
+	find_indexes_cursor() : m_started(false)
+	{
+		memset(&m_last, 0, sizeof(m_last));
+	}
+
+	explicit find_indexes_cursor(const dnet_raw_id &last) : m_started(true), m_last(last)
+	{
+	}
+
+	bool started() const
+	{
+		return m_started;
+	}
+
+	const dnet_raw_id &last() const
+	{
+		return m_last;
+	}
+
+private:
+	bool m_started;
+	dnet_raw_id m_last;
+};
+
 /*!
  * \brief Holds index metadata
  * In case when msgpack with index metadata is incorrect field is_valid will set to false
@@ -376,6 +376,11 @@ class session
 		void			set_timeout(long timeout);
 		long			get_timeout() const;
 
+		/*!
+		 * Sets transaction timeout in milliseconds, allows sub-second timeouts
+		 */
+		void			set_timeout_ms(long timeout_ms);
+
 		/*!
 		 * Sets/gets trace_id for all elliptics commands
 		 */
@@ -840,6 +845,22 @@ class session
 		 * \overload
 		 */
 		async_find_indexes_result find_all_indexes(const std::vector<std::string> &indexes);
+		/*!
+		 * \brief Find at most \a limit objects which contain all indexes from \a indexes
+		 * and follow the object \a cursor points to.
+		 *
+		 * Objects are sorted by their ids, so id of the last one makes cursor of the next page.
+		 * Zero \a limit means no limit. Empty result means there are no more objects.
+		 *
+		 * Returns async_find_indexes_result.
+		 */
+		async_find_indexes_result find_all_indexes(const std::vector<dnet_raw_id> &indexes,
+			const find_indexes_cursor &cursor, size_t limit);
+		/*!
+		 * \overload
+		 */
+		async_find_indexes_result find_all_indexes(const std::vector<std::string> &indexes,
+			const find_indexes_cursor &cursor, size_t limit);
 		/*!
 		 * \brief Find all objects which contain at least one of indexes from \a indexes.
 		 *
@@ -850,6 +871,21 @@ class session
 		 * \overload
 		 */
 		async_find_indexes_result find_any_indexes(const std::vector<std::string> &indexes);
+		/*!
+		 * \brief Find at most \a limit objects which contain at least one of indexes from \a indexes
+		 * and follow the object \a cursor points to.
+		 *
+		 * Pages are the same as of paginated find_all_indexes().
+		 *
+		 * Returns async_find_indexes_result.
+		 */
+		async_find_indexes_result find_any_indexes(const std::vector<dnet_raw_id> &indexes,
+			const find_indexes_cursor &cursor, size_t limit);
+		/*!
+		 * \overload
+		 */
+		async_find_indexes_result find_any_indexes(const std::vector<std::string> &indexes,
+			const find_indexes_cursor &cursor, size_t limit);
 
 		/*!
 		 * \brief List all indexes where \a id is added.
@@ -905,7 +941,8 @@ class session
 
 		async_exec_result request(dnet_id *id, const exec_context &context);
 		async_iterator_result iterator(const key &id, const data_pointer& request);
-		async_find_indexes_result find_indexes_internal(const std::vector<dnet_raw_id> &indexes, bool intersect);
+		async_find_indexes_result find_indexes_internal(const std::vector<dnet_raw_id> &indexes, bool intersect,
+			const find_indexes_cursor &cursor, size_t limit);
 
 		error_info mix_states(const key &id, std::vector<int> &groups) __attribute__((warn_unused_result));
 };
@@ -0,0 +1,191 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ELLIPTICS_FIND_INDEXES_HPP
+#define ELLIPTICS_FIND_INDEXES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "elliptics/packet.h"
+
+namespace ioremap { namespace elliptics {
+
+/*!
+ * Sorted id set kernels used by INDEXES_FIND.
+ *
+ * Tables are any types which provide size() and id(index) over ids sorted in memcmp() order.
+ * Ids are compared by their first 8 bytes loaded as single big-endian number, which orders
+ * them the same way as memcmp() and almost always decides, so the rest of id is compared
+ * only for equal prefixes.
+ */
+
+static inline uint64_t find_id_prefix(const dnet_raw_id &id)
+{
+	uint64_t prefix;
+	memcpy(&prefix, id.id, sizeof(prefix));
+#ifndef WORDS_BIGENDIAN
+	prefix = __builtin_bswap64(prefix);
+#endif
+	return prefix;
+}
+
+static inline int find_id_compare(const dnet_raw_id &a, uint64_t a_prefix, const dnet_raw_id &b, uint64_t b_prefix)
+{
+	if (a_prefix != b_prefix)
+		return a_prefix < b_prefix ? -1 : 1;
+
+	return memcmp(a.id + sizeof(uint64_t), b.id + sizeof(uint64_t), DNET_ID_SIZE - sizeof(uint64_t));
+}
+
+static inline int find_id_compare(const dnet_raw_id &a, const dnet_raw_id &b)
+{
+	return find_id_compare(a, find_id_prefix(a), b, find_id_prefix(b));
+}
+
+/*!
+ * Returns position of the first id of @table at or after @first, which is not less than @id.
+ * Probes positions @first + 1, 3, 7... and then searches binary between last two of them,
+ * so cost is logarithmic in distance from @first to the result instead of size of @table.
+ */
+template <typename Table>
+size_t find_ids_gallop(const Table &table, const dnet_raw_id &id, size_t first)
+{
+	const size_t size = table.size();
+	const uint64_t prefix = find_id_prefix(id);
+
+	auto less = [&] (size_t index) {
+		const dnet_raw_id &other = table.id(index);
+		return find_id_compare(other, find_id_prefix(other), id, prefix) < 0;
+	};
+
+	size_t low = first;
+	size_t high = first;
+	size_t step = 1;
+	while (high < size && less(high)) {
+		low = high + 1;
+		high += step;
+		step *= 2;
+	}
+	high = std::min(high, size);
+
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2;
+		if (less(middle))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/*!
+ * Calls @match(i, j) in increasing order for every id which is stored at position i of @lhs
+ * and at position j of @rhs.
+ *
+ * Both sides gallop over each other, so intersection of similar tables costs as linear merge
+ * and intersection of m ids with n >> m ids costs O(m * log(n / m)).
+ */
+template <typename Lhs, typename Rhs, typename Match>
+void find_ids_intersect(const Lhs &lhs, const Rhs &rhs, Match match)
+{
+	size_t i = 0;
+	size_t j = 0;
+
+	while (i < lhs.size() && j < rhs.size()) {
+		const int cmp = find_id_compare(lhs.id(i), rhs.id(j));
+		if (cmp == 0) {
+			match(i, j);
+			++i;
+			++j;
+		} else if (cmp < 0) {
+			i = find_ids_gallop(lhs, rhs.id(j), i + 1);
+		} else {
+			j = find_ids_gallop(rhs, lhs.id(i), j + 1);
+		}
+	}
+}
+
+/*!
+ * Merges all @tables into single sorted sequence of distinct ids.
+ * For every id calls @unique(id) once and then @add(table, index) for every table which contains it,
+ * in order of @tables. Merge stops when @unique returns false.
+ *
+ * Heads of tables are kept in binary heap ordered by their ids and positions of tables,
+ * so k tables of n ids in total are merged with O(n * log(k)) comparisons.
+ */
+template <typename Table, typename Unique, typename Add>
+void find_ids_unite(const std::vector<Table> &tables, Unique unique, Add add)
+{
+	struct cursor
+	{
+		uint64_t prefix;
+		size_t table;
+		size_t index;
+	};
+
+	auto greater = [&tables] (const cursor &a, const cursor &b) {
+		const int cmp = find_id_compare(tables[a.table].id(a.index), a.prefix, tables[b.table].id(b.index), b.prefix);
+		if (cmp != 0)
+			return cmp > 0;
+		return a.table > b.table;
+	};
+
+	std::vector<cursor> heap;
+	heap.reserve(tables.size());
+
+	for (size_t i = 0; i < tables.size(); ++i) {
+		if (tables[i].size() > 0) {
+			cursor head = { find_id_prefix(tables[i].id(0)), i, 0 };
+			heap.push_back(head);
+		}
+	}
+	std::make_heap(heap.begin(), heap.end(), greater);
+
+	const dnet_raw_id *last = NULL;
+	uint64_t last_prefix = 0;
+
+	while (!heap.empty()) {
+		std::pop_heap(heap.begin(), heap.end(), greater);
+		cursor &head = heap.back();
+
+		const dnet_raw_id &id = tables[head.table].id(head.index);
+		if (!last || find_id_compare(*last, last_prefix, id, head.prefix) != 0) {
+			if (!unique(id))
+				break;
+			last = &id;
+			last_prefix = head.prefix;
+		}
+
+		add(head.table, head.index);
+
+		if (++head.index < tables[head.table].size()) {
+			head.prefix = find_id_prefix(tables[head.table].id(head.index));
+			std::push_heap(heap.begin(), heap.end(), greater);
+		} else {
+			heap.pop_back();
+		}
+	}
+}
+
+}} /* namespace ioremap::elliptics */
+
+#endif // ELLIPTICS_FIND_INDEXES_HPP
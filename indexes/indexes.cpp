@@ -25,11 +25,16 @@
 #include "../library/elliptics.h"
 #include "../bindings/cpp/functional_p.h"
 #include "local_session.h"
+#include "find_indexes.hpp"
+#include "../cache/cache.hpp"
 
 #include "elliptics/debug.hpp"
 
 #include "react/elliptics_react.hpp"
 
+#include <condition_variable>
+#include <deque>
+#include <limits>
 #include <mutex>
 
 namespace {
@@ -39,6 +44,7 @@ namespace {
 #endif
 
 using namespace ioremap::elliptics;
+using ioremap::cache::cache_manager;
 
 struct update_indexes_functor : public std::enable_shared_from_this<update_indexes_functor>
 {
@@ -467,192 +473,549 @@ err_out_complete:
 	}
 };
 
-static bool entry_time_less_than(const dnet_index_entry &first, const dnet_index_entry &second)
+/*
+ * Accessors of decoded entries and of entries packed in place (dnet_index_entry_ref),
+ * so that the same update code works for both of them
+ */
+static inline const uint8_t *entry_id(const dnet_index_entry &entry)
+{
+	return entry.index.id;
+}
+
+static inline const uint8_t *entry_id(const dnet_index_entry_ref &entry)
+{
+	return entry.id->id;
+}
+
+static inline const dnet_time &entry_time(const dnet_index_entry &entry)
+{
+	return entry.time;
+}
+
+static inline const dnet_time &entry_time(const dnet_index_entry_ref &entry)
+{
+	return entry.time;
+}
+
+static inline bool entry_data_equal(const dnet_index_entry &entry, const data_pointer &data)
+{
+	return entry.data == data;
+}
+
+static inline bool entry_data_equal(const dnet_index_entry_ref &entry, const data_pointer &data)
+{
+	return entry.size == data.size() && (!entry.size || !memcmp(entry.data, data.data(), entry.size));
+}
+
+static inline void entry_set_data(dnet_index_entry &entry, const data_pointer &data, const dnet_time &time)
+{
+	entry.data = data;
+	entry.time = time;
+}
+
+static inline void entry_set_data(dnet_index_entry_ref &entry, const data_pointer &data, const dnet_time &time)
+{
+	entry.data = data.data();
+	entry.size = data.size();
+	entry.time = time;
+}
+
+static inline void entry_make(dnet_index_entry &entry, const dnet_raw_id *id, const data_pointer &data, const dnet_time &time)
+{
+	entry.index = *id;
+	entry_set_data(entry, data, time);
+}
+
+static inline void entry_make(dnet_index_entry_ref &entry, const dnet_raw_id *id, const data_pointer &data, const dnet_time &time)
 {
-	return first.time.tsec < second.time.tsec ||
-		(first.time.tsec == second.time.tsec && first.time.tnsec < second.time.tnsec);
+	entry.id = id;
+	entry_set_data(entry, data, time);
+}
+
+template <typename Entry>
+static bool entry_time_less_than(const Entry &first, const Entry &second)
+{
+	const dnet_time &first_time = entry_time(first);
+	const dnet_time &second_time = entry_time(second);
+
+	return first_time.tsec < second_time.tsec ||
+		(first_time.tsec == second_time.tsec && first_time.tnsec < second_time.tnsec);
+}
+
+template <typename Entry>
+static bool entry_id_less_than(const Entry &entry, const dnet_raw_id &id)
+{
+	return memcmp(entry_id(entry), id.id, DNET_ID_SIZE) < 0;
 }
 
 /*!
- * Update data-object table for certain secondary index.
+ * Update sorted entries of data-object table for certain secondary index in place.
+ * Returns false if table is left untouched.
  *
- * @index_data is what client provided
- * @data is what was downloaded from the storage
+ * @index_data is what client provided, it and @request must outlive @entries
  */
-data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, const dnet_indexes_request *request,
-	const data_pointer &index_data, const data_pointer &data, uint32_t action,
-	std::vector<dnet_indexes_reply_entry> * &removed, const dnet_indexes_request_entry &entry)
+template <typename Entry>
+bool update_index_entries(const dnet_indexes_request *request, const data_pointer &index_data, uint32_t action,
+	std::vector<dnet_indexes_reply_entry> *removed, const dnet_indexes_request_entry &entry, std::vector<Entry> &entries)
 {
 	const uint32_t limit = entry.limit;
 
-	elliptics_timer timer;
-
-	dnet_indexes indexes;
-	if (!data.empty())
-		indexes_unpack(node, cmd_id, data, &indexes, "convert_index_table");
-
-	const int64_t timer_unpack = timer.restart();
-
 	// Construct index entry
-	dnet_index_entry request_index;
-	memcpy(request_index.index.id, request->id.id, sizeof(request_index.index.id));
-	request_index.data = index_data;
-	dnet_current_time(&request_index.time);
+	const dnet_raw_id *request_id = reinterpret_cast<const dnet_raw_id *>(request->id.id);
+	dnet_time request_time;
+	dnet_current_time(&request_time);
 
-	auto it = std::lower_bound(indexes.indexes.begin(), indexes.indexes.end(), request_index, dnet_raw_id_less_than<skip_data>());
+	auto it = std::lower_bound(entries.begin(), entries.end(), *request_id, entry_id_less_than<Entry>);
 
-	const int64_t timer_lower_bound = timer.restart();
-
-	if (it != indexes.indexes.end() && it->index == request_index.index) {
+	if (it != entries.end() && !memcmp(entry_id(*it), request_id->id, DNET_ID_SIZE)) {
 		// It's already there
 		if (action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
 			// Item exists, update it's data and time if it's capped collection
-			if (!removed && it->data == request_index.data) {
-				const int64_t timer_compare = timer.restart();
-				DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
-				typedef long long int lld;
-				dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, data size: %zu, new data size: %zu,"
-					 "unpack: %lld ms, lower_bound: %lld ms, compare: %lld ms",
-					 id_str, data.size(), data.size(), lld(timer_unpack), lld(timer_lower_bound),
-					 lld(timer_compare));
+			if (!removed && entry_data_equal(*it, index_data)) {
 				// All's ok, keep it untouched
-				return data;
+				return false;
 			}
-			it->data = request_index.data;
-			it->time = request_index.time;
+			entry_set_data(*it, index_data, request_time);
 		} else {
 			// Anyway, destroy it
-			indexes.indexes.erase(it);
+			entries.erase(it);
 		}
 	} else {
 		// Index is not created yet
 		if (action == DNET_INDEXES_FLAGS_INTERNAL_INSERT) {
 			// Remove extra elements from capped collection
-			if (removed && limit != 0 && indexes.indexes.size() + 1 > limit) {
+			if (removed && limit != 0 && entries.size() + 1 > limit) {
 				dnet_indexes_reply_entry entry;
 				memset(&entry, 0, sizeof(entry));
 
-				auto position = it - indexes.indexes.begin();
+				auto position = it - entries.begin();
 
-				while (indexes.indexes.size() + 1 > limit && !indexes.indexes.empty()) {
-					auto jt = std::min_element(indexes.indexes.begin(), indexes.indexes.end(), entry_time_less_than);
+				while (entries.size() + 1 > limit && !entries.empty()) {
+					auto jt = std::min_element(entries.begin(), entries.end(), entry_time_less_than<Entry>);
 
 					// jt will be removed, so it should be modified to be still valid
-					if (position > jt - indexes.indexes.begin())
+					if (position > jt - entries.begin())
 						--position;
 
-					memcpy(entry.id.id, jt->index.id, DNET_ID_SIZE);
+					memcpy(entry.id.id, entry_id(*jt), DNET_ID_SIZE);
 					entry.status = DNET_INDEXES_CAPPED_REMOVED;
 
-					indexes.indexes.erase(jt);
+					entries.erase(jt);
 					removed->push_back(entry);
 				}
 
-				it = indexes.indexes.begin() + position;
+				it = entries.begin() + position;
 			}
 			// And just insert new index
-			indexes.indexes.insert(it, 1, request_index);
+			Entry request_index;
+			entry_make(request_index, request_id, index_data, request_time);
+			entries.insert(it, 1, request_index);
 		} else {
-			const int64_t timer_compare = timer.restart();
-			DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
-			typedef long long int lld;
-			dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, data size: %zu, new data size: %zu,"
-				 "unpack: %lld ms, lower_bound: %lld ms, compare: %lld ms",
-				 id_str, data.size(), data.size(), lld(timer_unpack), lld(timer_lower_bound),
-				 lld(timer_compare));
 			// All's ok, keep it untouched
-			return data;
+			return false;
 		}
 	}
 
-	const int64_t timer_update = timer.restart();
+	return true;
+}
 
-	indexes.shard_id = entry.shard_id;
-	indexes.shard_count = entry.shard_count;
+/*!
+ * Pending update of index shard, see index_update_batcher
+ */
+struct index_update
+{
+	const dnet_indexes_request *request;
+	const dnet_indexes_request_entry *entry;
+	// what client provided
+	data_pointer data;
+	uint32_t action;
+	bool capped;
+	// entries evicted from capped collection
+	std::vector<dnet_indexes_reply_entry> removed;
+	int status;
+	bool done;
+};
 
-	msgpack::sbuffer buffer;
-	msgpack::pack(&buffer, indexes);
+typedef std::vector<index_update *> index_updates;
 
-	const int64_t timer_pack = timer.restart();
+/*!
+ * Apply all @updates to sorted entries of data-object table in their order.
+ * Returns false if table is left untouched.
+ */
+template <typename Entry>
+bool update_index_entries(const index_updates &updates, std::vector<Entry> &entries, int *shard_id, int *shard_count)
+{
+	bool changed = false;
 
-	data_buffer new_buffer(DNET_INDEX_TABLE_MAGIC_SIZE + buffer.size());
-	new_buffer.write(dnet_bswap64(DNET_INDEX_TABLE_MAGIC));
-	new_buffer.write(buffer.data(), buffer.size());
+	for (auto it = updates.begin(); it != updates.end(); ++it) {
+		index_update *update = *it;
+		std::vector<dnet_indexes_reply_entry> *removed = update->capped ? &update->removed : NULL;
 
-	const int64_t timer_write = timer.restart();
+		if (update_index_entries(update->request, update->data, update->action, removed, *update->entry, entries)) {
+			*shard_id = update->entry->shard_id;
+			*shard_count = update->entry->shard_count;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+bool update_index_table(const index_updates &updates, dnet_indexes &indexes)
+{
+	return update_index_entries(updates, indexes.indexes, &indexes.shard_id, &indexes.shard_count);
+}
+
+/*!
+ * Update data-object table for certain secondary index and pack it into new base segment.
+ *
+ * Entries of fixed-width base segment are neither decoded nor copied except into the result,
+ * only delta log is decoded. Tables in msgpack format are decoded.
+ * New base segment is written in fixed-width layout only if node has DNET_CFG_FIXED_WIDTH_INDEXES flag,
+ * otherwise it is msgpacked, so that nodes and clients of older versions are able to read it.
+ * Returns @data itself if it is fixed-width table without delta log and it is left untouched.
+ *
+ * @data is what was downloaded from the storage
+ */
+data_pointer convert_index_table(dnet_node *node, dnet_id *cmd_id, const index_updates &updates, const data_pointer &data)
+{
+	elliptics_timer timer;
 
 	DNET_DUMP_ID_LEN(id_str, cmd_id, DNET_DUMP_NUM);
 	typedef long long int lld;
-	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, data size: %zu, new data size: %zu,"
-		 "unpack: %lld ms, lower_bound: %lld ms, update: %lld ms, pack: %lld ms, write: %lld ms",
-		 id_str, data.size(), new_buffer.size(), lld(timer_unpack), lld(timer_lower_bound),
-		 lld(timer_update), lld(timer_pack), lld(timer_write));
 
-	return std::move(new_buffer);
+	const bool pack_flat = node->flags & DNET_CFG_FIXED_WIDTH_INDEXES;
+
+	index_table_view view;
+	std::vector<dnet_index_entry_ref> refs;
+	std::vector<dnet_index_delta> deltas;
+	bool flat = false;
+
+	try {
+		flat = view.parse(data);
+		if (flat) {
+			refs = indexes_refs(view);
+			indexes_unpack_deltas(data, view.base_size(), &deltas);
+		}
+	} catch (const std::exception &e) {
+		dnet_log(node, DNET_LOG_ERROR, "%s: convert_index_table: unpack exception: %s, file-size: %zu",
+			id_str, e.what(), data.size());
+		flat = false;
+	}
+
+	if (flat) {
+		int shard_id = view.shard_id();
+		int shard_count = view.shard_count();
+
+		if (!deltas.empty()) {
+			shard_id = deltas.back().shard_id;
+			shard_count = deltas.back().shard_count;
+			indexes_apply_deltas(refs, deltas);
+		}
+
+		const int64_t timer_unpack = timer.restart();
+
+		const bool changed = update_index_entries(updates, refs, &shard_id, &shard_count);
+
+		const int64_t timer_update = timer.restart();
+
+		if (!changed && deltas.empty()) {
+			dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, updates: %zu, entries: %zu, "
+				 "data size: %zu, new data size: %zu, view: %lld ms, update: %lld ms",
+				 id_str, updates.size(), refs.size(), data.size(), data.size(),
+				 lld(timer_unpack), lld(timer_update));
+			return data;
+		}
+
+		data_pointer new_data = indexes_pack_refs(shard_id, shard_count, refs, pack_flat);
+
+		const int64_t timer_pack = timer.restart();
+
+		dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, updates: %zu, deltas: %zu, entries: %zu, "
+			 "data size: %zu, new data size: %zu, view: %lld ms, update: %lld ms, pack: %lld ms",
+			 id_str, updates.size(), deltas.size(), refs.size(), data.size(), new_data.size(),
+			 lld(timer_unpack), lld(timer_update), lld(timer_pack));
+
+		return new_data;
+	}
+
+	dnet_indexes indexes;
+	if (!data.empty())
+		indexes_unpack(node, cmd_id, data, &indexes, "convert_index_table");
+
+	const int64_t timer_unpack = timer.restart();
+
+	const bool changed = update_index_table(updates, indexes);
+
+	const int64_t timer_update = timer.restart();
+
+	if (!changed && data.empty()) {
+		dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, updates: %zu, data size: %zu, new data size: %zu,"
+			 "unpack: %lld ms, update: %lld ms",
+			 id_str, updates.size(), data.size(), data.size(), lld(timer_unpack), lld(timer_update));
+		return data;
+	}
+
+	data_pointer new_data = indexes_pack(indexes, pack_flat);
+
+	const int64_t timer_pack = timer.restart();
+
+	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: convert: id: %s, updates: %zu, data size: %zu, new data size: %zu,"
+		 "unpack: %lld ms, update: %lld ms, pack: %lld ms",
+		 id_str, updates.size(), data.size(), new_data.size(), lld(timer_unpack), lld(timer_update), lld(timer_pack));
+
+	return new_data;
 }
 
-int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *node, const dnet_indexes_request &request,
-	dnet_indexes_request_entry &entry, std::vector<dnet_indexes_reply_entry> * &removed)
+/*
+ * Index shards which are neither capped nor cached are updated by appending delta records
+ * to their stored objects instead of rewriting them. Shard is compacted, i.e. rewritten
+ * as a single sorted base segment, by the update which makes its delta log larger than
+ * node's indexes_log_compact_size and a half of the base segment.
+ */
+
+/*
+ * Sizes of base segments and delta logs of index shards, so that shards are not read on every update.
+ * They are only hints: lost or stale entry makes shard be compacted a bit earlier or later.
+ * Shards are keyed by backend which stores them: shard ids are the same in every group
+ * and every node in the process has its own backends.
+ */
+class index_log_sizes
 {
-	elliptics_timer timer;
+public:
+	struct sizes_t
+	{
+		size_t base_size;
+		size_t log_size;
+	};
 
-	local_session sess(backend, node);
+	static index_log_sizes &instance()
+	{
+		static index_log_sizes sizes;
+		return sizes;
+	}
 
-	dnet_id id;
-	memset(&id, 0, sizeof(id));
-	memcpy(id.id, entry.id.id, DNET_ID_SIZE);
+	bool get(struct dnet_backend_io *backend, const dnet_raw_id &id, sizes_t *sizes)
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
 
-	const data_pointer entry_data = data_pointer::from_raw(entry.data, entry.size);
+		auto it = m_sizes.find(std::make_pair(backend, id));
+		if (it == m_sizes.end())
+			return false;
 
-	if (dnet_log_enabled(node->log, DNET_LOG_DEBUG)) {
-		char index_buffer[DNET_ID_SIZE * 2 + 1];
-		char object_buffer[DNET_DUMP_NUM * 2 + 1];
+		*sizes = it->second;
+		return true;
+	}
 
-		dnet_log(node, DNET_LOG_DEBUG, "INDEXES_INTERNAL: index: %s, object: %s, flags: %s",
-			dnet_dump_id_len_raw(entry.id.id, DNET_ID_SIZE, index_buffer),
-			dnet_dump_id_len_raw(request.id.id, DNET_DUMP_NUM, object_buffer),
-			dnet_flags_dump_indexes_internal(entry.flags));
+	void set(struct dnet_backend_io *backend, const dnet_raw_id &id, const sizes_t &sizes)
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+
+		if (m_sizes.size() >= max_shards)
+			m_sizes.clear();
+
+		m_sizes[std::make_pair(backend, id)] = sizes;
 	}
 
-	uint32_t action = entry.flags & (DNET_INDEXES_FLAGS_INTERNAL_INSERT
-		| DNET_INDEXES_FLAGS_INTERNAL_REMOVE | DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL);
-	const bool capped = entry.flags & DNET_INDEXES_FLAGS_INTERNAL_CAPPED_COLLECTION;
+	void remove(struct dnet_backend_io *backend, const dnet_raw_id &id)
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_sizes.erase(std::make_pair(backend, id));
+	}
 
-	if (!capped)
-		removed = NULL;
+private:
+	static const size_t max_shards = 1024 * 1024;
 
-	switch (action) {
-		case DNET_INDEXES_FLAGS_INTERNAL_INSERT:
-		case DNET_INDEXES_FLAGS_INTERNAL_REMOVE:
-			break;
-		case DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL: {
-			const int64_t timer_checks = timer.restart();
-			int err = sess.remove(id);
-			const int64_t timer_remove = timer.restart();
+	typedef std::pair<struct dnet_backend_io *, dnet_raw_id> key_t;
 
-			DNET_DUMP_ID_LEN(id_str, &id, DNET_DUMP_NUM);
-			typedef long long int lld;
-			dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, checks: %lld ms, remove: %lld ms",
-				 id_str, lld(timer_checks), lld(timer_remove));
+	struct key_less_than
+	{
+		bool operator() (const key_t &first, const key_t &second) const
+		{
+			if (first.first != second.first)
+				return std::less<struct dnet_backend_io *>()(first.first, second.first);
+			return memcmp(first.second.id, second.second.id, DNET_ID_SIZE) < 0;
+		}
+	};
 
-			removed = NULL;
+	std::mutex m_lock;
+	std::map<key_t, sizes_t, key_less_than> m_sizes;
+};
+
+/*!
+ * Appends @updates of index shard to its stored object as delta records,
+ * or compacts shard with them applied if its delta log has grown too large.
+ */
+int append_index_deltas(struct dnet_backend_io *backend, local_session &sess, dnet_node *node, dnet_id *id,
+		const index_updates &updates)
+{
+	elliptics_timer timer;
+
+	index_log_sizes &log_sizes = index_log_sizes::instance();
+	const dnet_raw_id &shard = updates.front()->entry->id;
+
+	std::vector<data_pointer> deltas;
+	size_t deltas_size = 0;
+	bool remove_only = true;
+
+	for (auto it = updates.begin(); it != updates.end(); ++it) {
+		const index_update *update = *it;
+
+		dnet_index_delta delta;
+		delta.action = update->action;
+		memcpy(delta.entry.index.id, update->request->id.id, DNET_ID_SIZE);
+		delta.entry.data = update->data;
+		dnet_current_time(&delta.entry.time);
+		delta.shard_id = update->entry->shard_id;
+		delta.shard_count = update->entry->shard_count;
+
+		deltas.emplace_back(indexes_pack_delta(delta));
+		deltas_size += deltas.back().size();
+
+		if (update->action != DNET_INDEXES_FLAGS_INTERNAL_REMOVE)
+			remove_only = false;
+	}
+
+	data_buffer buffer(deltas_size);
+	for (auto it = deltas.begin(); it != deltas.end(); ++it)
+		buffer.write(it->data<char>(), it->size());
+
+	const data_pointer delta_data = std::move(buffer);
+
+	int err = 0;
+	bool read = false;
+	data_pointer data;
+	index_log_sizes::sizes_t sizes;
+
+	if (!log_sizes.get(backend, shard, &sizes)) {
+		// Shard is not known yet, it is read once to find out where its delta log starts
+		data = sess.read(*id, &err);
+		if (err && err != -ENOENT)
 			return err;
+
+		if (err == -ENOENT && remove_only)
+			return 0;
+
+		read = true;
+
+		try {
+			sizes.base_size = indexes_base_size(data);
+		} catch (const std::exception &) {
+			// Broken base segment is dropped by compaction below
+			sizes.base_size = 0;
 		}
-		default: {
-			dnet_log(node, DNET_LOG_ERROR, "INDEXES_INTERNAL: invalid flags: %s",
-				dnet_flags_dump_indexes_internal(entry.flags));
-			removed = NULL;
-			return -EINVAL;
+		sizes.log_size = data.size() - sizes.base_size;
+	}
+
+	const int64_t timer_read = timer.restart();
+
+	DNET_DUMP_ID_LEN(id_str, id, DNET_DUMP_NUM);
+	typedef long long int lld;
+
+	const size_t compact_size = std::max<size_t>(node->indexes_log_compact_size, sizes.base_size / 2);
+
+	if (sizes.log_size + delta_data.size() <= compact_size) {
+		sess.set_ioflags(DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_APPEND);
+		err = sess.write(*id, delta_data);
+		sess.set_ioflags(DNET_IO_FLAGS_CACHE);
+
+		if (err) {
+			log_sizes.remove(backend, shard);
+		} else {
+			sizes.log_size += delta_data.size();
+			log_sizes.set(backend, shard, sizes);
 		}
+
+		const int64_t timer_append = timer.restart();
+
+		dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, deltas: %zu, delta size: %zu, base size: %zu, log size: %zu, "
+			 "read: %lld ms, append: %lld ms, err: %d",
+			 id_str, updates.size(), delta_data.size(), sizes.base_size, sizes.log_size,
+			 lld(timer_read), lld(timer_append), err);
+
+		return err;
+	}
+
+	if (!read) {
+		data = sess.read(*id, &err);
+		if (err && err != -ENOENT)
+			return err;
+	}
+
+	const data_pointer new_data = convert_index_table(node, id, updates, data);
+	const int64_t timer_convert = timer.restart();
+
+	// Table is returned as is if it has nothing to compact and updates do not change it
+	err = 0;
+	if (new_data.data() != data.data() || new_data.size() != data.size())
+		err = sess.write(*id, new_data);
+
+	if (err) {
+		log_sizes.remove(backend, shard);
+	} else {
+		sizes.base_size = new_data.size();
+		sizes.log_size = 0;
+		log_sizes.set(backend, shard, sizes);
+	}
+
+	const int64_t timer_write = timer.restart();
+
+	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, compacted, updates: %zu, data size: %zu, new data size: %zu, "
+		 "read: %lld ms, convert: %lld ms, write: %lld ms, err: %d",
+		 id_str, updates.size(), data.size(), new_data.size(),
+		 lld(timer_read), lld(timer_convert), lld(timer_write), err);
+
+	return err;
+}
+
+/*!
+ * Applies group of insert and remove @updates of index shard @id with one read-modify-write cycle
+ */
+int apply_index_updates(struct dnet_backend_io *backend, dnet_node *node, dnet_id *id, const index_updates &updates)
+{
+	elliptics_timer timer;
+
+	local_session sess(backend, node);
+
+	/*
+	 * Decoded table is updated in place if index tables are cached,
+	 * it is packed and written to the backend by cache later
+	 */
+	cache_manager *cache = static_cast<cache_manager *>(backend->cache);
+	if (cache && cache->indexes_enabled()) {
+		bool changed = false;
+		int err = cache->indexes_update(id->id, [&] (dnet_indexes &indexes) {
+			changed = update_index_table(updates, indexes);
+			return changed;
+		});
+		const int64_t timer_update = timer.restart();
+
+		DNET_DUMP_ID_LEN(id_str, id, DNET_DUMP_NUM);
+		typedef long long int lld;
+		dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, cached table, updates: %zu, changed: %d, update: %lld ms, err: %d",
+			 id_str, updates.size(), int(changed), lld(timer_update), err);
+
+		return err;
 	}
 
-	const int64_t timer_checks = timer.restart();
+	/*
+	 * Capped collections have to know all their entries to evict the oldest ones,
+	 * so only they are still read, updated and written back as a whole
+	 */
+	bool capped = false;
+	for (auto it = updates.begin(); it != updates.end(); ++it)
+		capped |= (*it)->capped;
+
+	if (!capped)
+		return append_index_deltas(backend, sess, node, id, updates);
+
+	index_log_sizes::instance().remove(backend, updates.front()->entry->id);
 
 	int err = 0;
-	data_pointer data = sess.read(id, &err);
+	data_pointer data = sess.read(*id, &err);
 	const int64_t timer_read = timer.restart();
 
-	data_pointer new_data = convert_index_table(node, &id, &request, entry_data, data, action, removed, entry);
+	data_pointer new_data = convert_index_table(node, id, updates, data);
 	const int64_t timer_convert = timer.restart();
 
 	const bool data_equal = data == new_data;
@@ -666,20 +1029,256 @@ int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *n
 		err = 0;
 	} else {
 		dnet_log(node, DNET_LOG_DEBUG, "INDEXES_INTERNAL: data is different");
-		err = sess.write(id, new_data);
+		err = sess.write(*id, new_data);
 		timer_write = timer.restart();
 	}
 
-	DNET_DUMP_ID_LEN(id_str, &id, DNET_DUMP_NUM);
+	DNET_DUMP_ID_LEN(id_str, id, DNET_DUMP_NUM);
 	typedef long long int lld;
-	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, data size: %zu, new data size: %zu, checks: %lld ms, "
+	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, updates: %zu, data size: %zu, new data size: %zu, "
 		 "read: %lld ms, convert: %lld ms, compare: %lld ms, write: %lld ms",
-		 id_str, data.size(), new_data.size(), lld(timer_checks), lld(timer_read),
+		 id_str, updates.size(), data.size(), new_data.size(), lld(timer_read),
 		 lld(timer_convert), lld(timer_compare), lld(timer_write));
 
 	return err;
 }
 
+/*!
+ * Commits @group of updates of index shard @shard in their order, sets status of every update
+ */
+void commit_index_updates(struct dnet_backend_io *backend, dnet_node *node, const dnet_raw_id &shard, const index_updates &group)
+{
+	dnet_id id;
+	memset(&id, 0, sizeof(id));
+	memcpy(id.id, shard.id, DNET_ID_SIZE);
+
+	auto begin = group.begin();
+	while (begin != group.end()) {
+		if ((*begin)->action == DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL) {
+			elliptics_timer timer;
+
+			local_session sess(backend, node);
+			int err = sess.remove(id);
+			const int64_t timer_remove = timer.restart();
+
+			index_log_sizes::instance().remove(backend, shard);
+
+			DNET_DUMP_ID_LEN(id_str, &id, DNET_DUMP_NUM);
+			typedef long long int lld;
+			dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, remove: %lld ms",
+				 id_str, lld(timer_remove));
+
+			(*begin)->status = err;
+			++begin;
+			continue;
+		}
+
+		auto end = begin;
+		while (end != group.end() && (*end)->action != DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL)
+			++end;
+
+		const index_updates updates(begin, end);
+
+		int err;
+		try {
+			err = apply_index_updates(backend, node, &id, updates);
+		} catch (const std::bad_alloc &) {
+			err = -ENOMEM;
+		} catch (const std::exception &e) {
+			dnet_log(node, DNET_LOG_ERROR, "%s: INDEXES_INTERNAL: update failed: %s", dnet_dump_id(&id), e.what());
+			err = -EINVAL;
+		}
+
+		for (auto it = updates.begin(); it != updates.end(); ++it)
+			(*it)->status = err;
+
+		begin = end;
+	}
+}
+
+/*
+ * Group commit of concurrent updates of the same index shard.
+ *
+ * Every update is queued to its shard, the first thread which finds shard idle becomes committer
+ * and applies up to max_group_size queued updates with one read-modify-write cycle (or one append),
+ * then wakes up threads of these updates to reply. Updates queued while group is being committed
+ * make the next group, which is committed by one of their threads.
+ * Queues are kept per backend: shard ids are the same in every group and every node
+ * in the process has its own backends, committer applies the group through its own backend.
+ */
+class index_update_batcher
+{
+public:
+	static index_update_batcher &instance()
+	{
+		static index_update_batcher batcher;
+		return batcher;
+	}
+
+	/*!
+	 * Blocks until @update of shard @shard is committed
+	 */
+	void process(struct dnet_backend_io *backend, dnet_node *node, const dnet_raw_id &shard, index_update *update)
+	{
+		const key_t key(backend, shard);
+
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		std::shared_ptr<shard_queue> &queue_ref = m_queues[key];
+		if (!queue_ref)
+			queue_ref = std::make_shared<shard_queue>();
+		const std::shared_ptr<shard_queue> queue = queue_ref;
+
+		update->done = false;
+		queue->pending.push_back(update);
+
+		while (!update->done) {
+			if (queue->committing) {
+				queue->wait.wait(guard);
+				continue;
+			}
+
+			const size_t size = std::min(queue->pending.size(), max_group_size);
+			const index_updates group(queue->pending.begin(), queue->pending.begin() + size);
+			queue->pending.erase(queue->pending.begin(), queue->pending.begin() + size);
+			queue->committing = true;
+
+			guard.unlock();
+			const int err = commit_group(backend, node, shard, group);
+			guard.lock();
+
+			for (auto it = group.begin(); it != group.end(); ++it) {
+				if (err)
+					(*it)->status = err;
+				(*it)->done = true;
+			}
+
+			queue->committing = false;
+			queue->wait.notify_all();
+		}
+
+		if (queue->pending.empty() && !queue->committing) {
+			auto it = m_queues.find(key);
+			if (it != m_queues.end() && it->second == queue)
+				m_queues.erase(it);
+		}
+	}
+
+private:
+	static const size_t max_group_size = 1024;
+
+	/*
+	 * Commits @group under oplock of shard object, so that commit is serialized with raw writes,
+	 * removes and recovery of the object. Command handlers of the updates have dropped their oplocks.
+	 * Returns error if commit has thrown, queue must be released anyway.
+	 */
+	static int commit_group(struct dnet_backend_io *backend, dnet_node *node, const dnet_raw_id &shard, const index_updates &group)
+	{
+		dnet_id id;
+		memset(&id, 0, sizeof(id));
+		memcpy(id.id, shard.id, DNET_ID_SIZE);
+
+		int err = 0;
+
+		dnet_oplock(node, &id);
+		try {
+			commit_index_updates(backend, node, shard, group);
+		} catch (const std::bad_alloc &) {
+			err = -ENOMEM;
+		} catch (const std::exception &e) {
+			dnet_log(node, DNET_LOG_ERROR, "%s: INDEXES_INTERNAL: group commit failed: %s", dnet_dump_id(&id), e.what());
+			err = -EINVAL;
+		}
+		dnet_opunlock(node, &id);
+
+		return err;
+	}
+
+	struct shard_queue
+	{
+		shard_queue() : committing(false)
+		{
+		}
+
+		std::deque<index_update *> pending;
+		bool committing;
+		std::condition_variable wait;
+	};
+
+	typedef std::pair<struct dnet_backend_io *, dnet_raw_id> key_t;
+
+	struct key_less_than
+	{
+		bool operator() (const key_t &first, const key_t &second) const
+		{
+			if (first.first != second.first)
+				return std::less<struct dnet_backend_io *>()(first.first, second.first);
+			return memcmp(first.second.id, second.second.id, DNET_ID_SIZE) < 0;
+		}
+	};
+
+	std::mutex m_lock;
+	std::map<key_t, std::shared_ptr<shard_queue>, key_less_than> m_queues;
+};
+
+int process_internal_indexes_entry(struct dnet_backend_io *backend, dnet_node *node, const dnet_indexes_request &request,
+	dnet_indexes_request_entry &entry, std::vector<dnet_indexes_reply_entry> * &removed)
+{
+	elliptics_timer timer;
+
+	if (dnet_log_enabled(node->log, DNET_LOG_DEBUG)) {
+		char index_buffer[DNET_ID_SIZE * 2 + 1];
+		char object_buffer[DNET_DUMP_NUM * 2 + 1];
+
+		dnet_log(node, DNET_LOG_DEBUG, "INDEXES_INTERNAL: index: %s, object: %s, flags: %s",
+			dnet_dump_id_len_raw(entry.id.id, DNET_ID_SIZE, index_buffer),
+			dnet_dump_id_len_raw(request.id.id, DNET_DUMP_NUM, object_buffer),
+			dnet_flags_dump_indexes_internal(entry.flags));
+	}
+
+	index_update update;
+	update.request = &request;
+	update.entry = &entry;
+	update.data = data_pointer::from_raw(entry.data, entry.size);
+	update.action = entry.flags & (DNET_INDEXES_FLAGS_INTERNAL_INSERT
+		| DNET_INDEXES_FLAGS_INTERNAL_REMOVE | DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL);
+	update.capped = entry.flags & DNET_INDEXES_FLAGS_INTERNAL_CAPPED_COLLECTION;
+	update.status = 0;
+
+	switch (update.action) {
+		case DNET_INDEXES_FLAGS_INTERNAL_INSERT:
+		case DNET_INDEXES_FLAGS_INTERNAL_REMOVE:
+			break;
+		case DNET_INDEXES_FLAGS_INTERNAL_REMOVE_ALL:
+			update.capped = false;
+			break;
+		default: {
+			dnet_log(node, DNET_LOG_ERROR, "INDEXES_INTERNAL: invalid flags: %s",
+				dnet_flags_dump_indexes_internal(entry.flags));
+			removed = NULL;
+			return -EINVAL;
+		}
+	}
+
+	index_update_batcher::instance().process(backend, node, entry.id, &update);
+
+	if (update.capped)
+		removed->swap(update.removed);
+	else
+		removed = NULL;
+
+	dnet_id id;
+	memset(&id, 0, sizeof(id));
+	memcpy(id.id, entry.id.id, DNET_ID_SIZE);
+
+	DNET_DUMP_ID_LEN(id_str, &id, DNET_DUMP_NUM);
+	typedef long long int lld;
+	dnet_log(node, DNET_LOG_INFO, "INDEXES_INTERNAL: id: %s, committed: %lld ms, err: %d",
+		 id_str, lld(timer.restart()), update.status);
+
+	return update.status;
+}
+
 int process_internal_indexes(struct dnet_backend_io *backend, dnet_net_state *state, dnet_cmd *cmd, dnet_indexes_request *request)
 {
 	if (request->entries_count == 0) {
@@ -703,6 +1302,16 @@ int process_internal_indexes(struct dnet_backend_io *backend, dnet_net_state *st
 
 	int err = -1;
 
+	/*
+	 * Updates of the same shard are queued by index_update_batcher, which commits every group
+	 * under oplock of the shard. Oplock taken for this command is dropped like in BULK_READ,
+	 * otherwise concurrent updates of the shard would wait for it instead of being queued
+	 * to the group being committed.
+	 */
+	const bool locked = !(cmd->flags & DNET_FLAGS_NOLOCK);
+	if (locked)
+		dnet_opunlock(state->n, &cmd->id);
+
 	for (uint64_t i = 0; i < request->entries_count; ++i) {
 		dnet_indexes_request_entry &entry = request->entries[i];
 		removed.clear();
@@ -727,11 +1336,14 @@ int process_internal_indexes(struct dnet_backend_io *backend, dnet_net_state *st
 		}
 	}
 
+	if (locked)
+		dnet_oplock(state->n, &cmd->id);
+
 	if (!err) {
 		data_pointer reply_data = std::move(buffer);
 		reply_data.data<dnet_indexes_reply>()->entries_count = entries_count;
 
-		cmd->flags &= (DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE);
+		cmd->flags &= (DNET_FLAGS_NEED_ACK | DNET_FLAGS_MORE | DNET_FLAGS_NOLOCK);
 
 		dnet_send_reply(state, cmd, reply_data.data(), reply_data.size(), 0);
 		return 0;
@@ -740,6 +1352,220 @@ int process_internal_indexes(struct dnet_backend_io *backend, dnet_net_state *st
 	return err;
 }
 
+/*
+ * Index table found by INDEXES_FIND, either fixed-width one searched in place or decoded one
+ */
+class find_indexes_table
+{
+public:
+	find_indexes_table(const dnet_raw_id &index, const index_table_view &view) :
+		m_index(index), m_view(view), m_first(0)
+	{
+	}
+
+	find_indexes_table(const dnet_raw_id &index, const std::shared_ptr<const dnet_indexes> &table) :
+		m_index(index), m_table(table), m_first(0)
+	{
+	}
+
+	/*!
+	 * Hides all objects whose ids are not greater than @id
+	 */
+	void skip_until_after(const dnet_raw_id &id)
+	{
+		m_first = 0;
+		m_first = find_ids_gallop(*this, id, 0);
+		if (size() > 0 && !memcmp(this->id(0).id, id.id, DNET_ID_SIZE))
+			++m_first;
+	}
+
+	const dnet_raw_id &index() const
+	{
+		return m_index;
+	}
+
+	size_t size() const
+	{
+		return (m_table ? m_table->indexes.size() : m_view.size()) - m_first;
+	}
+
+	const dnet_raw_id &id(size_t index) const
+	{
+		index += m_first;
+		return m_table ? m_table->indexes[index].index : m_view.id(index);
+	}
+
+	data_pointer data(size_t index) const
+	{
+		index += m_first;
+		return m_table ? m_table->indexes[index].data : m_view.data(index);
+	}
+
+private:
+	dnet_raw_id m_index;
+	index_table_view m_view;
+	std::shared_ptr<const dnet_indexes> m_table;
+	size_t m_first;
+};
+
+/*
+ * Ids of intermediate result of intersection in terms of find_ids_intersect()
+ */
+class find_indexes_result_ids
+{
+public:
+	find_indexes_result_ids(const std::vector<find_indexes_result_entry> &result) : m_result(result)
+	{
+	}
+
+	size_t size() const
+	{
+		return m_result.size();
+	}
+
+	const dnet_raw_id &id(size_t index) const
+	{
+		return m_result[index].id;
+	}
+
+private:
+	const std::vector<find_indexes_result_entry> &m_result;
+};
+
+/*!
+ * Fills @result by objects presented in every table of @tables.
+ * Tables are intersected from the smallest one, which bounds size of every intermediate result,
+ * and data of every index is put at position of its table in request.
+ */
+static void find_indexes_intersect(const std::vector<find_indexes_table> &tables, std::vector<find_indexes_result_entry> &result)
+{
+	if (tables.empty())
+		return;
+
+	std::vector<size_t> order(tables.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&tables] (size_t a, size_t b) {
+		return tables[a].size() < tables[b].size();
+	});
+
+	const find_indexes_table &smallest = tables[order[0]];
+	result.resize(smallest.size());
+	for (size_t j = 0; j < smallest.size(); ++j) {
+		auto &entry = result[j];
+		entry.id = smallest.id(j);
+		entry.indexes.resize(tables.size());
+		entry.indexes[order[0]].index = smallest.index();
+		entry.indexes[order[0]].data = smallest.data(j);
+	}
+
+	for (size_t k = 1; k < order.size() && !result.empty(); ++k) {
+		const size_t position = order[k];
+		const find_indexes_table &table = tables[position];
+		size_t out = 0;
+
+		find_ids_intersect(find_indexes_result_ids(result), table, [&] (size_t i, size_t j) {
+			auto &entry = result[i];
+			entry.indexes[position].index = table.index();
+			entry.indexes[position].data = table.data(j);
+			if (out != i)
+				result[out] = std::move(entry);
+			++out;
+		});
+
+		result.erase(result.begin() + out, result.end());
+	}
+}
+
+/*!
+ * Fills @result by at most @limit objects presented in any table of @tables by k-way merge of them,
+ * so objects are sorted by their ids and their indexes follow order of request.
+ */
+static void find_indexes_unite(const std::vector<find_indexes_table> &tables, size_t limit, std::vector<find_indexes_result_entry> &result)
+{
+	size_t max_size = 0;
+	for (auto it = tables.begin(); it != tables.end(); ++it)
+		max_size = std::max(max_size, it->size());
+	result.reserve(std::min(max_size, limit));
+
+	find_ids_unite(tables, [&result, limit] (const dnet_raw_id &id) {
+		if (result.size() >= limit)
+			return false;
+
+		result.resize(result.size() + 1);
+		result.back().id = id;
+		return true;
+	}, [&tables, &result] (size_t table, size_t index) {
+		index_entry result_entry = { tables[table].index(), tables[table].data(index) };
+		result.back().indexes.push_back(result_entry);
+	});
+}
+
+/*
+ * Results of INDEXES_FIND are sent by chunks of about this size,
+ * so neither side has to hold whole result packed into single buffer
+ */
+static const size_t find_indexes_reply_chunk_size = 1024 * 1024;
+
+static size_t find_indexes_result_entry_size(const find_indexes_result_entry &entry)
+{
+	size_t size = sizeof(entry.id);
+	for (auto it = entry.indexes.begin(); it != entry.indexes.end(); ++it)
+		size += sizeof(it->index) + it->data.size();
+	return size;
+}
+
+/*!
+ * Sends @result as msgpacked arrays of its entries of about find_indexes_reply_chunk_size bytes each.
+ * All chunks but the last one are sent with DNET_FLAGS_MORE wrt send queue watermarks,
+ * the last one finishes reply to the request.
+ */
+static int send_find_indexes_result(dnet_net_state *state, dnet_cmd *cmd, const dnet_id &request_id,
+	const std::vector<find_indexes_result_entry> &result, bool more)
+{
+	size_t begin = 0;
+
+	for (;;) {
+		size_t end = begin;
+		size_t chunk_size = 0;
+		while (end < result.size() && chunk_size < find_indexes_reply_chunk_size)
+			chunk_size += find_indexes_result_entry_size(result[end++]);
+
+		msgpack::sbuffer buffer;
+		msgpack::packer<msgpack::sbuffer> packer(buffer);
+		packer.pack_array(end - begin);
+		for (size_t i = begin; i < end; ++i)
+			packer.pack(result[i]);
+
+		if (end == result.size() && !more) {
+			/*
+			 * Unset NEED_ACK flag if and only if it is the last reply.
+			 * We have to send positive reply in such case, also we don't want to send
+			 * useless acknowledge packet.
+			 */
+			cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+		}
+
+		dnet_cmd cmd_copy = *cmd;
+		dnet_setup_id(&cmd_copy.id, cmd->id.group_id, request_id.id);
+
+		if (end == result.size()) {
+			dnet_send_reply(state, &cmd_copy, buffer.data(), buffer.size(), more);
+			return 0;
+		}
+
+		int err;
+		if (state == state->n->st)
+			err = dnet_send_reply(state, &cmd_copy, buffer.data(), buffer.size(), 1);
+		else
+			err = dnet_send_reply_threshold(state, &cmd_copy, buffer.data(), buffer.size(), 1);
+		if (err)
+			return err;
+
+		begin = end;
+	}
+}
+
 int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state, dnet_cmd *cmd, const dnet_id &request_id, dnet_indexes_request *request, bool more)
 {
 	local_session sess(backend, state->n);
@@ -755,11 +1581,16 @@ int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state,
 	}
 
 	std::vector<find_indexes_result_entry> result;
-	std::vector<data_pointer> data_cache;
+	std::vector<find_indexes_table> tables;
+	tables.reserve(request->entries_count);
 
-	std::map<dnet_raw_id, size_t, dnet_raw_id_less_than<> > result_map;
+	const size_t limit = request->limit ? request->limit : std::numeric_limits<size_t>::max();
+	dnet_raw_id cursor;
+	bool has_cursor = false;
 
-	dnet_indexes tmp;
+	cache_manager *cache = static_cast<cache_manager *>(backend->cache);
+	if (cache && !cache->indexes_enabled())
+		cache = NULL;
 
 	int err = -1;
 	dnet_id id = request_id;
@@ -770,11 +1601,40 @@ int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state,
 		dnet_indexes_request_entry &request_entry = *reinterpret_cast<dnet_indexes_request_entry *>(data_start + data_offset);
 		data_offset += sizeof(dnet_indexes_request_entry) + request_entry.size;
 
+		if (i == 0 && request_entry.size == sizeof(cursor)) {
+			memcpy(cursor.id, request_entry.data, sizeof(cursor.id));
+			has_cursor = true;
+		}
+
 		memcpy(id.id, request_entry.id.id, sizeof(id.id));
 
 		int ret = 0;
-		data_pointer data = sess.read(id, &ret);
-		data_cache.push_back(data);
+		std::shared_ptr<const dnet_indexes> table;
+		index_table_view view;
+		bool in_place = false;
+
+		if (cache) {
+			table = cache->indexes_find(id.id, &ret);
+		} else {
+			data_pointer data = sess.read(id, &ret);
+			if (!ret) {
+				/*
+				 * Fixed-width table without delta log is searched in place,
+				 * others are decoded with their logs applied
+				 */
+				try {
+					in_place = view.parse(data) && view.base_size() == data.size();
+				} catch (const std::exception &) {
+					in_place = false;
+				}
+
+				if (!in_place) {
+					auto tmp = std::make_shared<dnet_indexes>();
+					indexes_unpack(state->n, &id, data, tmp.get(), "process_find_indexes");
+					table = tmp;
+				}
+			}
+		}
 
 		if (ret) {
 			dnet_log(state->n, DNET_LOG_DEBUG, "%s: INDEXES_FIND, err: %d",
@@ -790,76 +1650,40 @@ int process_find_indexes(struct dnet_backend_io *backend, dnet_net_state *state,
 		}
 		err = 0;
 
-		tmp.indexes.clear();
-		indexes_unpack(state->n, &id, data, &tmp, "process_find_indexes");
-
-		if (unite) {
-			for (size_t j = 0; j < tmp.indexes.size(); ++j) {
-				const auto &entry = tmp.indexes[j];
-
-				auto it = result_map.find(entry.index);
-				if (it == result_map.end()) {
-					it = result_map.insert(std::make_pair(entry.index, result.size())).first;
-					result.resize(result.size() + 1);
-					result.back().id = entry.index;
-				}
+		if (in_place)
+			tables.emplace_back(request_entry.id, view);
+		else
+			tables.emplace_back(request_entry.id, table);
 
-				index_entry result_entry = { request_entry.id, entry.data };
-				result[it->second].indexes.push_back(result_entry);
-			}
-		} else if (intersection && i == 0) {
-			result.resize(tmp.indexes.size());
-			for (size_t j = 0; j < tmp.indexes.size(); ++j) {
-				auto &entry = result[j];
-				entry.id = tmp.indexes[j].index;
-				index_entry result_entry = { request_entry.id, tmp.indexes[j].data };
-				entry.indexes.push_back(result_entry);
-			}
-		} else if (intersection) {
-			// Remove all objects from result, which are not presented for this index
-			auto it = std::set_intersection(result.begin(), result.end(),
-				tmp.indexes.begin(), tmp.indexes.end(),
-				result.begin(),
-				dnet_raw_id_less_than<skip_data>());
-			result.resize(it - result.begin());
-
-			// Remove all objects from this index, which are not presented in result
-			std::set_intersection(tmp.indexes.begin(), tmp.indexes.end(),
-				result.begin(), result.end(),
-				tmp.indexes.begin(),
-				dnet_raw_id_less_than<skip_data>());
-
-			// As lists contain othe same objects - it's possible to add index data by one cycle
-			auto jt = tmp.indexes.begin();
-			for (auto kt = result.begin(); kt != result.end(); ++kt, ++jt) {
-				index_entry result_entry = { request_entry.id, jt->data };
-				kt->indexes.push_back(result_entry);
-			}
-		}
+		if (has_cursor)
+			tables.back().skip_until_after(cursor);
 	}
 
 	if (err != 0)
 		return err;
 
-	dnet_log(state->n, DNET_LOG_DEBUG, "%s: INDEXES_FIND: result of find: %zu objects",
-		dnet_dump_id(&id), result.size());
-
-	msgpack::sbuffer buffer;
-	msgpack::pack(&buffer, result);
-
-	if (!more) {
-		/*
-		 * Unset NEED_ACK flag if and only if it is the last reply.
-		 * We have to send positive reply in such case, also we don't want to send
-		 * useless acknowledge packet.
-		 */
-		cmd->flags &= ~DNET_FLAGS_NEED_ACK;
+	/*
+	 * Data of entries of tables searched in place are checked when they are put into the result
+	 */
+	try {
+		if (unite) {
+			find_indexes_unite(tables, limit, result);
+		} else {
+			find_indexes_intersect(tables, result);
+			if (result.size() > limit)
+				result.erase(result.begin() + limit, result.end());
+		}
+	} catch (const std::exception &e) {
+		dnet_log(state->n, DNET_LOG_ERROR, "%s: INDEXES_FIND: broken index table: %s",
+			dnet_dump_id(&id), e.what());
+		return -EINVAL;
 	}
-	dnet_cmd cmd_copy = *cmd;
-	dnet_setup_id(&cmd_copy.id, cmd->id.group_id, request_id.id);
-	dnet_send_reply(state, &cmd_copy, buffer.data(), buffer.size(), more);
 
-	return err;
+	dnet_log(state->n, DNET_LOG_DEBUG, "%s: INDEXES_FIND: result of find: %zu objects, limit: %llu, cursor: %s",
+		dnet_dump_id(&id), result.size(), (unsigned long long)request->limit,
+		has_cursor ? dnet_dump_id_str(cursor.id) : "none");
+
+	return send_find_indexes_result(state, cmd, request_id, result, more);
 }
 
 }
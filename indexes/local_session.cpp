@@ -307,6 +307,7 @@ int local_session::update_index_internal(const dnet_id &id, const dnet_raw_id &i
 	memcpy(cmd.id.id, index.id, sizeof(cmd.id.id));
 
 	cmd.cmd = DNET_CMD_INDEXES_INTERNAL;
+	cmd.flags |= m_cflags;
 	cmd.size = datap.size();
 
 	int err = dnet_process_cmd_raw(m_backend, m_state, &cmd, datap.data(), 0);
@@ -274,6 +274,8 @@ int dnet_backend_init(struct dnet_node *node, size_t backend_id, unsigned *state
 
 	dnet_log(node, DNET_LOG_INFO, "backend_init: backend: %zu, initialized, elapsed: %s", backend_id, elapsed(start));
 
+	dnet_cache_warm_up(backend.cache);
+
 	{
 		std::lock_guard<std::mutex> guard(*backend.state_mutex);
 		dnet_current_time(&backend.last_start);
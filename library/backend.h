@@ -25,6 +25,19 @@ struct cache_config
 	size_t			count;
 	unsigned		sync_timeout;
 	std::vector<size_t>	pages_proportions;
+	// admission policy for objects missing in the cache: "none" or "tinylfu"
+	std::string		admission;
+	// directory where list of cached ids is periodically saved to warm cache up after restart, empty if disabled
+	std::string		snapshot_dir;
+	unsigned		snapshot_interval;
+	// bytes per second read from disk while cache is warmed up, 0 if unlimited
+	size_t			warm_up_rate;
+	// number of threads writing dirty objects of all shards to the backend
+	size_t			sync_threads;
+	// percentage of cache size dirty objects may take before writers wait for them to be synced, 0 if unlimited
+	unsigned		dirty_ratio;
+	// memory taken by decoded tables of hot secondary indexes, 0 if index tables are not cached
+	size_t			indexes_size;
 
 	static std::unique_ptr<cache_config> parse(const ioremap::elliptics::config::config &cache);
 };
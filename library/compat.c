@@ -17,6 +17,10 @@
  * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -55,6 +59,85 @@ long dnet_get_id(void)
 {
 	return syscall(SYS_gettid);
 }
+
+#include <dirent.h>
+#include <sched.h>
+
+/*
+ * Fills @cpus with up to @num CPUs process is allowed to run on, returns their number.
+ */
+int dnet_allowed_cpus(int *cpus, int num)
+{
+	cpu_set_t set;
+	int cpu, pos = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return -errno;
+
+	for (cpu = 0; cpu < CPU_SETSIZE && pos < num; ++cpu) {
+		if (CPU_ISSET(cpu, &set))
+			cpus[pos++] = cpu;
+	}
+
+	return pos;
+}
+
+/*
+ * Returns NUMA node @cpu belongs to, sysfs exports it as nodeN entry of the cpu directory
+ */
+int dnet_cpu_numa_node(int cpu)
+{
+	char path[64];
+	struct dirent *ent;
+	DIR *dir;
+	int node = -ENOENT;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	dir = opendir(path);
+	if (!dir)
+		return -errno;
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (!strncmp(ent->d_name, "node", 4) && sscanf(ent->d_name + 4, "%d", &node) == 1)
+			break;
+	}
+
+	closedir(dir);
+	return node;
+}
+
+int dnet_set_cpu_affinity(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return -pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Restricts calling thread to allowed CPUs of NUMA @node
+ */
+int dnet_set_numa_affinity(int node)
+{
+	cpu_set_t set;
+	int cpu;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return -errno;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &set) && dnet_cpu_numa_node(cpu) != node)
+			CPU_CLR(cpu, &set);
+	}
+
+	if (!CPU_COUNT(&set))
+		return -ENOENT;
+
+	return -pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
 #else
 int dnet_set_name(char *format __attribute__ ((unused)), ...) { return 0; }
 
@@ -62,6 +145,11 @@ long dnet_get_id(void)
 {
 	return pthread_self();
 }
+
+int dnet_allowed_cpus(int *cpus __attribute__ ((unused)), int num __attribute__ ((unused))) { return -ENOTSUP; }
+int dnet_cpu_numa_node(int cpu __attribute__ ((unused))) { return -ENOTSUP; }
+int dnet_set_cpu_affinity(int cpu __attribute__ ((unused))) { return -ENOTSUP; }
+int dnet_set_numa_affinity(int node __attribute__ ((unused))) { return -ENOTSUP; }
 #endif
 
 #ifdef HAVE_SENDFILE4_SUPPORT
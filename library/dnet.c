@@ -1108,8 +1108,8 @@ int dnet_process_cmd_raw(struct dnet_backend_io *backend, struct dnet_net_state
 	return err;
 }
 
-int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
-		int fd, uint64_t offset, int on_exit)
+static int dnet_send_read_data_raw(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int on_exit, void *data_ref, void (* data_put)(void *data_ref))
 {
 	struct dnet_net_state *st = state;
 	struct dnet_node *n = st->n;
@@ -1126,15 +1126,17 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 	 * back to parental client, instead server will wrap data into
 	 * proper transaction reply next to this obscure packet.
 	 */
-	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING)
-		return 0;
+	if (io->flags & DNET_IO_FLAGS_SKIP_SENDING) {
+		err = 0;
+		goto err_out_put;
+	}
 
 	gettimeofday(&start_tv, NULL);
 
 	c = malloc(hsize);
 	if (!c) {
 		err = -ENOMEM;
-		goto err_out_exit;
+		goto err_out_put;
 	}
 
 	memset(c, 0, hsize);
@@ -1166,12 +1168,14 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 		}
 
 		if (err)
-			goto err_out_free;
+			goto err_out_free_put;
 	}
 
 	gettimeofday(&csum_tv, NULL);
 
-	if (data)
+	if (data && data_put)
+		err = dnet_send_data_ref(st, c, hsize, data, rio->size, data_ref, data_put);
+	else if (data)
 		err = dnet_send_data(st, c, hsize, data, rio->size);
 	else
 		err = dnet_send_fd(st, c, hsize, fd, offset, rio->size, on_exit);
@@ -1190,13 +1194,29 @@ int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *
 			(unsigned long long)io->offset,	(unsigned long long)io->size,
 			csum_time, send_time, total_time);
 
+	free(c);
+	return err;
 
-err_out_free:
+err_out_free_put:
 	free(c);
-err_out_exit:
+err_out_put:
+	if (data_put)
+		data_put(data_ref);
 	return err;
 }
 
+int dnet_send_read_data(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		int fd, uint64_t offset, int on_exit)
+{
+	return dnet_send_read_data_raw(state, cmd, io, data, fd, offset, on_exit, NULL, NULL);
+}
+
+int dnet_send_read_data_ref(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		void *data_ref, void (* data_put)(void *data_ref))
+{
+	return dnet_send_read_data_raw(state, cmd, io, data, -1, io->offset, 0, data_ref, data_put);
+}
+
 static void dnet_fill_state_addr(void *state, struct dnet_addr *addr)
 {
 	struct dnet_net_state *st = state;
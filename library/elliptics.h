@@ -123,6 +123,16 @@ struct dnet_io_req {
 	int			fd;
 	off_t			local_offset;
 	size_t			fsize;
+
+	/* Receive buffer pool this request was allocated from, NULL if it was allocated by malloc() */
+	struct dnet_io_req_pool	*pool;
+
+	/*
+	 * Reference to the owner of @data. If @data_put is set, @data is not copied when request is queued,
+	 * queued request holds the reference instead and releases it via @data_put(@data_ref) when freed.
+	 */
+	void			*data_ref;
+	void			(* data_put)(void *data_ref);
 };
 
 /*
@@ -136,15 +146,98 @@ struct dnet_io_req {
 /* Attached data should be discarded */
 #define DNET_IO_DROP		(1<<1)
 
+/* Size of per-state read-ahead buffer, larger reads go directly into request's buffer */
+#define DNET_RCV_BUFFER_SIZE	(16 * 1024)
+
+/*
+ * Maximum number of read-ahead buffers per network thread which are still referenced by queued commands
+ * after their states have moved to new buffers. Commands are copied out of the buffer while limit is reached,
+ * so IO backlog does not pin a whole buffer per small command and buffers keep being reused.
+ */
+#define DNET_RCV_BUFFER_PINNED_MAX	64
+
+/*
+ * Read-ahead buffer of network state. Commands which entirely lie in the buffer are not copied out of it,
+ * their requests hold a reference to the buffer, so it is freed after the last of them is processed.
+ */
+struct dnet_rcv_buffer {
+	atomic_t		refcnt;
+	/* counter of network thread's pinned buffers, set when state leaves the buffer to its commands */
+	atomic_t		*pinned;
+	char			data[DNET_RCV_BUFFER_SIZE];
+};
+
+void dnet_rcv_buffer_put(void *buf);
+
 #define DNET_STATE_DEFAULT_WEIGHT	1.0
 
 /* Iterator watermarks for sending data and sleeping */
 #define DNET_SEND_WATERMARK_HIGH	(1024 * 100)
 #define DNET_SEND_WATERMARK_LOW		(512 * 100)
 
+/* Maximum number of io vectors coalesced into single sendmsg() call */
+#define DNET_SEND_IOV_MAX		64
+
 /* Internal flag to ignore cache */
 #define DNET_IO_FLAGS_NOCACHE		(1<<28)
 
+/* Initial number of slots in the transaction table, it doubles when half full */
+#define DNET_TRANS_TABLE_MIN_SIZE	64
+
+/*
+ * Open-addressing (linear probing) hash of in-flight transactions keyed by transaction id.
+ * Protected by @dnet_net_state.trans_lock.
+ */
+struct dnet_trans;
+struct dnet_trans_table
+{
+	struct dnet_trans	**slots;
+	unsigned int		mask;
+	unsigned int		num;
+};
+
+/*
+ * Hierarchical timer wheel of transaction timeouts with millisecond ticks.
+ * Every level has DNET_TRANS_WHEEL_SIZE slots, each slot of the next level covers the whole previous level.
+ * Deadlines farther than the last level covers (~49 days) are clamped.
+ */
+#define DNET_TRANS_WHEEL_BITS		8
+#define DNET_TRANS_WHEEL_SIZE		(1 << DNET_TRANS_WHEEL_BITS)
+#define DNET_TRANS_WHEEL_MASK		(DNET_TRANS_WHEEL_SIZE - 1)
+#define DNET_TRANS_WHEEL_LEVELS		4
+
+/*
+ * Node has DNET_TRANS_WHEEL_SHARDS wheels, state's transactions live in the wheel selected by state's address,
+ * so arming and disarming timers of different states do not contend for the same lock.
+ */
+#define DNET_TRANS_WHEEL_SHARD_BITS	3
+#define DNET_TRANS_WHEEL_SHARDS		(1 << DNET_TRANS_WHEEL_SHARD_BITS)
+
+struct dnet_trans_wheel
+{
+	pthread_mutex_t		lock;
+
+	/* next tick to be processed, all earlier deadlines have been moved into @expired list */
+	uint64_t		now;
+	/* tick checking thread is going to sleep till after it has scanned this wheel, 0 if it does not sleep */
+	uint64_t		next_wakeup;
+	/* number of transactions in the slots and @expired list */
+	unsigned long		num;
+
+	struct list_head	expired;
+	struct list_head	slots[DNET_TRANS_WHEEL_LEVELS][DNET_TRANS_WHEEL_SIZE];
+};
+
+struct dnet_trans_timers
+{
+	/* protects @wakeup, checking thread sleeps on @wait until the next deadline or until earlier deadline is added */
+	pthread_mutex_t		lock;
+	pthread_cond_t		wait;
+	int			wakeup;
+
+	struct dnet_trans_wheel	wheels[DNET_TRANS_WHEEL_SHARDS];
+};
+
 struct dnet_net_epoll_data
 {
 	struct dnet_net_state *st;
@@ -170,6 +263,8 @@ struct dnet_net_state
 	int			__need_exit;
 
 	int			stall;
+	/* wheel tick of the last @stall increment, see dnet_trans_check_stall() */
+	uint64_t		stall_tick;
 
 	int			__join_state;
 	int			__ids_sent;
@@ -190,6 +285,22 @@ struct dnet_net_state
 	unsigned int		rcv_flags;
 	void			*rcv_data;
 
+	/*
+	 * Read-ahead buffer: as much data as socket has is read here,
+	 * complete commands are referenced in place, parts of commands
+	 * are copied out of it, bytes [rcv_buf_start, rcv_buf_end) are not yet consumed.
+	 */
+	struct dnet_rcv_buffer	*rcv_buf;
+	size_t			rcv_buf_start;
+	size_t			rcv_buf_end;
+
+	/*
+	 * IO pool which was full when the last command was queued,
+	 * state is put into its throttle list and stops reading until the pool drains.
+	 */
+	struct dnet_io_pool	*throttle_pool;
+	struct list_head	throttle_entry;
+
 	int			epoll_fd;
 	size_t			send_offset;
 	pthread_mutex_t		send_lock;
@@ -203,8 +314,7 @@ struct dnet_net_state
 	atomic_t		send_queue_size;
 
 	pthread_mutex_t		trans_lock;
-	struct rb_root		trans_root;
-	struct rb_root		timer_root;
+	struct dnet_trans_table	trans_table;
 
 
 	int			la;
@@ -396,10 +506,68 @@ struct dnet_transform
 int dnet_crypto_init(struct dnet_node *n);
 void dnet_crypto_cleanup(struct dnet_node *n);
 
+/*
+ * Receive buffers (dnet_io_req + dnet_cmd + attached data) are allocated from size classes
+ * cached per network thread. Only network thread allocates from its pool, buffers are returned
+ * into owner's @remote list by IO threads and are picked up by network thread in bulk.
+ * Requests which do not fit into the largest class are allocated by malloc().
+ */
+#define DNET_IO_REQ_POOL_CLASSES	5
+#define DNET_IO_REQ_POOL_MIN_SHIFT	9
+#define DNET_IO_REQ_POOL_CACHE_SIZE	(4 * 1024 * 1024)
+
+struct dnet_io_req_block;
+struct dnet_io_req_pool_class {
+	size_t				size;
+	int				max_cached;
+
+	/* accessed by owner network thread only */
+	struct dnet_io_req_block	*free;
+	int				free_num;
+	uint64_t			hits;
+	uint64_t			misses;
+
+	/* buffers returned by IO threads */
+	struct dnet_lock		remote_lock;
+	struct dnet_io_req_block	*remote;
+	int				remote_num;
+
+	/* number of buffers in both @free and @remote lists, limited by @max_cached */
+	atomic_t			cached;
+};
+
+struct dnet_io_req_pool {
+	struct dnet_io_req_pool_class	classes[DNET_IO_REQ_POOL_CLASSES];
+	/* number of requests which did not fit into any class */
+	uint64_t			oversized;
+	/* bytes allocated by pool and not yet returned to the system, both used and cached */
+	atomic_t			resident_size;
+};
+
+int dnet_io_req_pool_init(struct dnet_io_req_pool *pool);
+void dnet_io_req_pool_cleanup(struct dnet_io_req_pool *pool);
+struct dnet_io_req *dnet_io_req_pool_alloc(struct dnet_io_req_pool *pool, size_t size);
+void dnet_io_req_pool_free(struct dnet_io_req *r);
+
 struct dnet_net_io {
 	int			epoll_fd;
 	pthread_t		tid;
 	struct dnet_node	*n;
+	struct dnet_io_req_pool	req_pool;
+
+	/* CPU thread is pinned to and its NUMA node, -1 and 0 if net threads are not per-core */
+	int			cpu;
+	int			numa_node;
+
+	/* own SO_REUSEPORT listening socket of per-core net thread, -1 if there is none */
+	int			accept_s;
+	struct dnet_net_epoll_data	accept_data;
+
+	/* epoll events shuffling state, so that threads do not contend on rand() lock */
+	unsigned int		seed;
+
+	/* number of read-ahead buffers left to queued commands, see DNET_RCV_BUFFER_PINNED_MAX */
+	atomic_t		rcv_buf_pinned;
 };
 
 enum dnet_work_io_mode {
@@ -458,30 +626,81 @@ static inline void list_stat_reset(struct list_stat *st, struct timeval *time) {
 	st->time_base.tv_usec = time->tv_usec;
 }
 
+/*
+ * Work pool queue is split into shards to spread producers and consumers over different locks.
+ * Replies are put into shard selected by transaction id, so all replies for given transaction
+ * end up in the same shard and transaction affinity is maintained under that shard's lock.
+ * Other commands are distributed round-robin. IO threads look into their own shard first,
+ * then steal from the others.
+ */
+#define DNET_WORK_POOL_MAX_QUEUES	16
+
+struct dnet_work_queue {
+	pthread_mutex_t		lock;
+	struct list_head	list;
+	struct list_stat	list_stats;
+
+	/*
+	 * Open-addressing hash of IO threads which claimed transactions of this queue,
+	 * keyed by @dnet_work_io.trans. Each IO thread claims at most one transaction,
+	 * so table never holds more than number of IO threads entries.
+	 */
+	struct dnet_work_io	**owners;
+	unsigned int		owners_mask;
+} __attribute__ ((aligned(64)));
+
 struct dnet_backend_io;
 struct dnet_work_pool {
 	struct dnet_node	*n;
 	struct dnet_backend_io	*io;
 	int			mode;
 	int			num;
-	struct list_head	list;
-	struct list_stat	list_stats;
-	pthread_mutex_t		lock;
-	pthread_cond_t		wait;
+
+	int			queue_num;
+	struct dnet_work_queue	*queues;
+	atomic_t		queue_pos;
+	/* number of requests in all queues and IO threads' private lists */
+	atomic_t		queue_size;
+	/* queue @i and its IO threads belong to NUMA node @i % @numa_num */
+	int			numa_num;
+
+	/* futex word IO threads park on, it is changed every time new request is queued */
+	int			wait_seq;
+	atomic_t		sleepers;
+
 	struct dnet_work_io	*wio_list;
 };
 
+void dnet_work_pool_list_stat(struct dnet_work_pool *pool, struct list_stat *st);
+
 struct dnet_work_pool_place
 {
-	pthread_mutex_t		lock;
+	/* protects @pool pointer, is taken for writing only when pool is created or destroyed */
+	pthread_rwlock_t	lock;
 	pthread_cond_t		wait;
 	struct dnet_work_pool	*pool;
 };
 
+/*
+ * IO pool queues may hold up to this number of requests per thread,
+ * net threads stop reading from connections which send commands into more loaded pool.
+ */
+#define DNET_IO_POOL_QUEUE_LIMIT	1000
+
 struct dnet_io_pool
 {
 	struct dnet_work_pool_place	recv_pool;
 	struct dnet_work_pool_place	recv_pool_nb;
+
+	/*
+	 * States whose reads are suspended because they have queued a command into this pool
+	 * while it was full. IO threads resume them once queues drain to half of the limit.
+	 */
+	pthread_mutex_t			throttle_lock;
+	struct list_head		throttle_list;
+	int				throttled;
+	/* total number of times states have been throttled by this pool */
+	uint64_t			throttle_count;
 };
 
 struct dnet_backend_io
@@ -500,6 +719,11 @@ struct dnet_io {
 	int			net_thread_num, net_thread_pos;
 	struct dnet_net_io	*net;
 
+	/* DNET_CFG_PER_CORE_NET_THREADS was set at startup */
+	int			net_per_core;
+	/* number of NUMA nodes net threads run on, 1 if net threads are not per-core */
+	int			numa_num;
+
 
 	struct dnet_backend_io	*backends;
 	size_t			backends_count;
@@ -507,16 +731,19 @@ struct dnet_io {
 
 	struct dnet_io_pool	pool;
 
-	// condition variable for waiting when io pools are able to process packets
+	/* protects @output_stats */
 	pthread_mutex_t		full_lock;
-	pthread_cond_t		full_wait;
-	int			blocked;
 
 	struct list_stat	output_stats;
 };
 
-int dnet_state_accept_process(struct dnet_net_state *st, struct epoll_event *ev);
-int dnet_state_net_process(struct dnet_net_state *st, struct epoll_event *ev);
+int dnet_state_accept_process(struct dnet_net_state *orig, int s);
+struct dnet_net_io *dnet_net_io_current(void);
+int dnet_net_io_listen(struct dnet_node *n, struct dnet_addr *addr);
+int dnet_state_net_process(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev);
+int dnet_io_pool_throttle_init(struct dnet_io_pool *io);
+void dnet_io_pool_throttle_cleanup(struct dnet_node *n, struct dnet_io_pool *io);
+void dnet_io_pool_unthrottle(struct dnet_node *n, struct dnet_io_pool *io, int force);
 int dnet_backend_io_init(struct dnet_node *n, struct dnet_backend_io *io, int io_thread_num, int nonblocking_io_thread_num);
 void dnet_backend_io_cleanup(struct dnet_node *n, struct dnet_backend_io *io);
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg);
@@ -617,6 +844,8 @@ struct dnet_node
 	pthread_t		reconnect_tid;
 	long			stall_count;
 
+	struct dnet_trans_timers	trans_timers;
+
 	unsigned int		notify_hash_size;
 	struct dnet_notify_bucket	*notify_hash;
 
@@ -656,6 +885,7 @@ struct dnet_node
 	void			*srw;
 	void			*indexes;
 	int			indexes_shard_count;
+	int			indexes_log_compact_size;
 
 	int			server_prio;
 	int			client_prio;
@@ -770,8 +1000,15 @@ int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r);
  */
 int __attribute__((weak)) dnet_send_ack(struct dnet_net_state *st, struct dnet_cmd *cmd, int err, int recursive);
 int __attribute__((weak)) dnet_send_reply(void *state, struct dnet_cmd *cmd, const void *odata, unsigned int size, int more);
+
+/*
+ * Sends read reply with @data owned by @data_ref, reference is always consumed:
+ * it is either released via @data_put() or passed to the queued request.
+ */
+int dnet_send_read_data_ref(void *state, struct dnet_cmd *cmd, struct dnet_io_attr *io, void *data,
+		void *data_ref, void (* data_put)(void *data_ref));
 int __attribute__((weak)) dnet_send_reply_threshold(void *state, struct dnet_cmd *cmd, const void *odata, unsigned int size, int more);
-void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r);
+struct dnet_io_pool *dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r);
 
 struct dnet_config;
 
@@ -789,14 +1026,18 @@ int __attribute__((weak)) dnet_state_join(struct dnet_net_state *st);
 
 struct dnet_trans
 {
-	struct rb_node			trans_entry;
-	struct rb_node			timer_entry;
+	/* transaction is linked into its state's @trans_table */
+	int				trans_hashed;
+	/* entry in the state's wheel of node's @trans_timers, protected by wheel's lock */
+	struct list_head		timer_entry;
 
 	/* is used when checking thread moves transaction out of the above trees because of timeout */
 	struct list_head		trans_list_entry;
 
-	struct timeval			time, start;
+	struct timeval			start;
 	struct timespec			wait_ts;
+	/* timeout deadline, CLOCK_MONOTONIC milliseconds */
+	uint64_t			expires;
 
 	struct dnet_net_state		*orig; /* only for forward */
 	size_t				alloc_size;
@@ -837,10 +1078,16 @@ static inline void dnet_trans_put(struct dnet_trans *t)
 int dnet_trans_insert_nolock(struct dnet_net_state *st, struct dnet_trans *a);
 void dnet_trans_remove_nolock(struct dnet_net_state *st, struct dnet_trans *t);
 struct dnet_trans *dnet_trans_search(struct dnet_net_state *st, uint64_t trans);
+struct dnet_trans *dnet_trans_table_next_nolock(struct dnet_net_state *st, unsigned int *pos);
+void dnet_trans_table_cleanup(struct dnet_trans_table *table);
 
-int dnet_trans_insert_timer_nolock(struct dnet_net_state *st, struct dnet_trans *a);
+void dnet_trans_insert_timer_nolock(struct dnet_net_state *st, struct dnet_trans *a);
 void dnet_trans_remove_timer_nolock(struct dnet_net_state *st, struct dnet_trans *t);
 
+uint64_t dnet_trans_wheel_time(void);
+int dnet_trans_timers_init(struct dnet_trans_timers *tm);
+void dnet_trans_timers_destroy(struct dnet_trans_timers *tm);
+
 void dnet_trans_remove(struct dnet_trans *t);
 
 void dnet_trans_clean_list(struct list_head *head);
@@ -854,6 +1101,8 @@ int dnet_recv_list(struct dnet_node *n, struct dnet_net_state *st);
 ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 		int fd, uint64_t offset, uint64_t dsize, int on_exit);
 ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize);
+ssize_t dnet_send_data_ref(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void *data_ref, void (* data_put)(void *data_ref));
 ssize_t dnet_send(struct dnet_net_state *st, void *data, uint64_t size);
 ssize_t dnet_send_nolock(struct dnet_net_state *st, void *data, uint64_t size);
 
@@ -870,6 +1119,11 @@ void dnet_check_thread_stop(struct dnet_node *n);
 void dnet_reconnect_and_check_route_table(struct dnet_node *node);
 
 int dnet_set_name(const char *format, ...);
+
+int dnet_allowed_cpus(int *cpus, int num);
+int dnet_cpu_numa_node(int cpu);
+int dnet_set_cpu_affinity(int cpu);
+int dnet_set_numa_affinity(int node);
 int dnet_ioprio_set(long pid, int class_id, int prio);
 int dnet_ioprio_get(long pid);
 
@@ -895,6 +1149,7 @@ int dnet_cmd_exec_raw(struct dnet_net_state *st, struct dnet_cmd *cmd, struct sp
 
 void *dnet_cache_init(struct dnet_node *n, struct dnet_backend_io *backend, const void *config);
 void dnet_cache_cleanup(void *);
+void dnet_cache_warm_up(void *cache);
 int dnet_cmd_cache_io(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_io_attr *io, char *data);
 int dnet_cmd_cache_lookup(struct dnet_backend_io *backend, struct dnet_net_state *st, struct dnet_cmd *cmd);
 
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2008+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "elliptics.h"
+
+/*
+ * Every pooled buffer starts with this header, dnet_io_req follows it.
+ */
+struct dnet_io_req_block {
+	struct dnet_io_req_block	*next;
+	int				size_class;
+};
+
+int dnet_io_req_pool_init(struct dnet_io_req_pool *pool)
+{
+	struct dnet_io_req_pool_class *c;
+	int i, err;
+
+	memset(pool, 0, sizeof(struct dnet_io_req_pool));
+
+	atomic_init(&pool->resident_size, 0);
+
+	for (i = 0; i < DNET_IO_REQ_POOL_CLASSES; ++i) {
+		c = &pool->classes[i];
+
+		c->size = 1UL << (DNET_IO_REQ_POOL_MIN_SHIFT + i * 2);
+		c->max_cached = DNET_IO_REQ_POOL_CACHE_SIZE / c->size;
+		atomic_init(&c->cached, 0);
+
+		err = dnet_lock_init(&c->remote_lock);
+		if (err)
+			goto err_out_destroy;
+	}
+
+	return 0;
+
+err_out_destroy:
+	while (--i >= 0)
+		dnet_lock_destroy(&pool->classes[i].remote_lock);
+	return err;
+}
+
+static void dnet_io_req_block_list_free(struct dnet_io_req_block *b)
+{
+	struct dnet_io_req_block *next;
+
+	while (b) {
+		next = b->next;
+		free(b);
+		b = next;
+	}
+}
+
+void dnet_io_req_pool_cleanup(struct dnet_io_req_pool *pool)
+{
+	struct dnet_io_req_pool_class *c;
+	int i;
+
+	for (i = 0; i < DNET_IO_REQ_POOL_CLASSES; ++i) {
+		c = &pool->classes[i];
+
+		dnet_io_req_block_list_free(c->free);
+		dnet_io_req_block_list_free(c->remote);
+
+		c->free = c->remote = NULL;
+		c->free_num = c->remote_num = 0;
+		atomic_set(&c->cached, 0);
+
+		dnet_lock_destroy(&c->remote_lock);
+	}
+}
+
+/*
+ * Allocates request with @size bytes of memory right after it.
+ * Must only be called from the network thread which owns @pool.
+ */
+struct dnet_io_req *dnet_io_req_pool_alloc(struct dnet_io_req_pool *pool, size_t size)
+{
+	struct dnet_io_req_pool_class *c = NULL;
+	struct dnet_io_req_block *b;
+	struct dnet_io_req *r;
+	size_t total = sizeof(struct dnet_io_req_block) + sizeof(struct dnet_io_req) + size;
+	int i;
+
+	for (i = 0; i < DNET_IO_REQ_POOL_CLASSES; ++i) {
+		if (total <= pool->classes[i].size) {
+			c = &pool->classes[i];
+			break;
+		}
+	}
+
+	if (!c) {
+		r = malloc(sizeof(struct dnet_io_req) + size);
+		if (!r)
+			return NULL;
+
+		pool->oversized++;
+		memset(r, 0, sizeof(struct dnet_io_req));
+		return r;
+	}
+
+	if (!c->free && c->remote) {
+		dnet_lock_lock(&c->remote_lock);
+		c->free = c->remote;
+		c->free_num = c->remote_num;
+		c->remote = NULL;
+		c->remote_num = 0;
+		dnet_lock_unlock(&c->remote_lock);
+	}
+
+	if (c->free) {
+		b = c->free;
+		c->free = b->next;
+		c->free_num--;
+		atomic_dec(&c->cached);
+		c->hits++;
+	} else {
+		b = malloc(c->size);
+		if (!b)
+			return NULL;
+
+		c->misses++;
+		atomic_add(&pool->resident_size, c->size);
+	}
+
+	b->next = NULL;
+	b->size_class = i;
+
+	r = (struct dnet_io_req *)(b + 1);
+	memset(r, 0, sizeof(struct dnet_io_req));
+	r->pool = pool;
+
+	return r;
+}
+
+/*
+ * Returns request into its owner's pool, may be called from any thread.
+ * Buffer is released to the system if owner already caches enough of them in both lists.
+ * Only this function increases @cached and it does so under @remote_lock, so the limit is exact.
+ */
+void dnet_io_req_pool_free(struct dnet_io_req *r)
+{
+	struct dnet_io_req_pool *pool = r->pool;
+	struct dnet_io_req_block *b = (struct dnet_io_req_block *)r - 1;
+	struct dnet_io_req_pool_class *c = &pool->classes[b->size_class];
+
+	dnet_lock_lock(&c->remote_lock);
+	if (atomic_read(&c->cached) < c->max_cached) {
+		b->next = c->remote;
+		c->remote = b;
+		c->remote_num++;
+		atomic_inc(&c->cached);
+		b = NULL;
+	}
+	dnet_lock_unlock(&c->remote_lock);
+
+	if (b) {
+		atomic_sub(&pool->resident_size, c->size);
+		free(b);
+	}
+}
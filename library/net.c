@@ -105,17 +105,14 @@ int dnet_create_addr(struct dnet_addr *addr, const char *addr_str, int port, int
 
 void dnet_state_clean(struct dnet_net_state *st)
 {
-	struct rb_node *rb_node;
 	struct dnet_trans *t;
+	unsigned int pos = 0;
 	int num = 0;
 
 	while (1) {
-		t = NULL;
-
 		pthread_mutex_lock(&st->trans_lock);
-		rb_node = rb_first(&st->trans_root);
-		if (rb_node) {
-			t = rb_entry(rb_node, struct dnet_trans, trans_entry);
+		t = dnet_trans_table_next_nolock(st, &pos);
+		if (t) {
 			dnet_trans_get(t);
 
 			dnet_trans_remove_nolock(st, t);
@@ -141,7 +138,9 @@ static struct dnet_io_req *dnet_io_req_copy(struct dnet_net_state *st, struct dn
 	int offset = 0;
 	int err = 0;
 
-	buf = r = malloc(sizeof(struct dnet_io_req) + orig->dsize + orig->hsize);
+	size_t dsize = orig->data_put ? 0 : orig->dsize;
+
+	buf = r = malloc(sizeof(struct dnet_io_req) + dsize + orig->hsize);
 	if (!r) {
 		dnet_log(st->n, DNET_LOG_ERROR, "Not enough memory for io req queue fd: %d : %s %d", orig->fd, strerror(-err), err);
 		return NULL;
@@ -157,7 +156,10 @@ static struct dnet_io_req *dnet_io_req_copy(struct dnet_net_state *st, struct dn
 		memcpy(r->header, orig->header, r->hsize);
 	}
 
-	if (orig->data && orig->dsize) {
+	if (orig->data && orig->dsize && orig->data_put) {
+		r->data = orig->data;
+		r->dsize = orig->dsize;
+	} else if (orig->data && orig->dsize) {
 		r->data = buf + sizeof(struct dnet_io_req) + offset;
 		r->dsize = orig->dsize;
 
@@ -165,6 +167,9 @@ static struct dnet_io_req *dnet_io_req_copy(struct dnet_net_state *st, struct dn
 		memcpy(r->data, orig->data, r->dsize);
 	}
 
+	r->data_ref = orig->data_ref;
+	r->data_put = orig->data_put;
+
 	if (orig->fd >= 0 && orig->fsize) {
 		r->fd = orig->fd;
 		r->on_exit = orig->on_exit;
@@ -176,8 +181,9 @@ static struct dnet_io_req *dnet_io_req_copy(struct dnet_net_state *st, struct dn
 }
 
 /*
- * Eventually we may end up with proper reference counters here, but for now let's just copy the whole buf.
- * Large data blocks are being sent through sendfile anyway, so it should not be _that_ costly operation.
+ * Header and data are copied into queued request unless data is owned by a reference (@orig->data_put),
+ * in this case queued request takes over that reference and data is not copied.
+ * Large data blocks are being sent through sendfile anyway.
  */
 static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig)
 {
@@ -186,6 +192,8 @@ static int dnet_io_req_queue(struct dnet_net_state *st, struct dnet_io_req *orig
 
 	r = dnet_io_req_copy(st, orig);
 	if (!r) {
+		if (orig->data_put)
+			orig->data_put(orig->data_ref);
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
@@ -209,7 +217,14 @@ void dnet_io_req_free(struct dnet_io_req *r)
 		if (r->on_exit & DNET_IO_REQ_FLAGS_CLOSE)
 			close(r->fd);
 	}
-	free(r);
+
+	if (r->data_put)
+		r->data_put(r->data_ref);
+
+	if (r->pool)
+		dnet_io_req_pool_free(r);
+	else
+		free(r);
 }
 
 static int dnet_wait(struct dnet_net_state *st, unsigned int events, long timeout)
@@ -320,6 +335,23 @@ ssize_t dnet_send_data(struct dnet_net_state *st, void *header, uint64_t hsize,
 	return dnet_io_req_queue(st, &r);
 }
 
+ssize_t dnet_send_data_ref(struct dnet_net_state *st, void *header, uint64_t hsize, void *data, uint64_t dsize,
+		void *data_ref, void (* data_put)(void *data_ref))
+{
+	struct dnet_io_req r;
+
+	memset(&r, 0, sizeof(r));
+	r.header = header;
+	r.hsize = hsize;
+	r.data = data;
+	r.dsize = dsize;
+	r.fd = -1;
+	r.data_ref = data_ref;
+	r.data_put = data_put;
+
+	return dnet_io_req_queue(st, &r);
+}
+
 static ssize_t dnet_send_fd_nolock(struct dnet_net_state *st, int fd, uint64_t offset, uint64_t dsize)
 {
 	ssize_t err;
@@ -361,14 +393,10 @@ ssize_t dnet_send_fd(struct dnet_net_state *st, void *header, uint64_t hsize,
 
 static void dnet_trans_timestamp(struct dnet_net_state *st, struct dnet_trans *t)
 {
-	struct timespec *wait_ts = t->wait_ts.tv_sec ? &t->wait_ts : &st->n->wait_ts;
-
-	gettimeofday(&t->time, NULL);
+	struct timespec *wait_ts = (t->wait_ts.tv_sec || t->wait_ts.tv_nsec) ? &t->wait_ts : &st->n->wait_ts;
 
-	t->time.tv_sec += wait_ts->tv_sec;
-	t->time.tv_usec += wait_ts->tv_nsec / 1000;
+	t->expires = dnet_trans_wheel_time() + wait_ts->tv_sec * 1000 + wait_ts->tv_nsec / 1000000;
 
-	dnet_trans_remove_timer_nolock(st, t);
 	dnet_trans_insert_timer_nolock(st, t);
 }
 
@@ -537,7 +565,18 @@ static int dnet_trans_forward(struct dnet_trans *t, struct dnet_io_req *r,
 				(unsigned long long)t->rcv_trans, (unsigned long long)t->trans);
 	}
 
-	return dnet_trans_send(t, r);
+	/*
+	 * Received request may reference read-ahead buffer, that reference is released when request
+	 * is freed after processing, so forwarded request gets its own copy of data instead.
+	 */
+	{
+		struct dnet_io_req req = *r;
+
+		req.data_ref = NULL;
+		req.data_put = NULL;
+
+		return dnet_trans_send(t, &req);
+	}
 }
 
 static int dnet_process_update_ids(struct dnet_net_state *st, struct dnet_cmd *cmd, struct dnet_id_container *container)
@@ -820,6 +859,10 @@ void dnet_set_sockopt(struct dnet_node *n, int s)
 
 	setsockopt(s, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
 
+	/* Replies are sent in one piece via sendmsg(), do not let Nagle delay them */
+	opt = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &opt, 4);
+
 	fcntl(s, F_SETFD, FD_CLOEXEC);
 	fcntl(s, F_SETFL, O_NONBLOCK);
 }
@@ -828,13 +871,22 @@ int dnet_setup_control_nolock(struct dnet_net_state *st)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_io *io = n->io;
+	struct dnet_net_io *nio = NULL;
 	int err, pos;
 
 	if (st->epoll_fd == -1) {
-		pos = io->net_thread_pos;
-		if (++io->net_thread_pos >= io->net_thread_num)
-			io->net_thread_pos = 0;
-		st->epoll_fd = io->net[pos].epoll_fd;
+		/* per-core net thread owns connections it has accepted or created */
+		if (io->net_per_core)
+			nio = dnet_net_io_current();
+
+		if (!nio) {
+			pos = io->net_thread_pos;
+			if (++io->net_thread_pos >= io->net_thread_num)
+				io->net_thread_pos = 0;
+			nio = &io->net[pos];
+		}
+
+		st->epoll_fd = nio->epoll_fd;
 
 		pthread_mutex_lock(&st->send_lock);
 		err = dnet_schedule_recv(st);
@@ -918,9 +970,9 @@ int dnet_state_micro_init(struct dnet_net_state *st,
 	INIT_LIST_HEAD(&st->node_entry);
 	INIT_LIST_HEAD(&st->storage_state_entry);
 	INIT_LIST_HEAD(&st->idc_list);
+	INIT_LIST_HEAD(&st->throttle_entry);
 
-	st->trans_root = RB_ROOT;
-	st->timer_root = RB_ROOT;
+	memset(&st->trans_table, 0, sizeof(struct dnet_trans_table));
 
 	st->epoll_fd = -1;
 
@@ -1202,6 +1254,7 @@ void dnet_state_destroy(struct dnet_net_state *st)
 	}
 
 	dnet_state_clean(st);
+	dnet_trans_table_cleanup(&st->trans_table);
 
 	dnet_state_send_clean(st);
 
@@ -1212,23 +1265,25 @@ void dnet_state_destroy(struct dnet_net_state *st)
 		dnet_server_convert_dnet_addr(&st->addr), st->read_s, st->write_s, st->addr_num);
 
 	free(st->addrs);
+	dnet_rcv_buffer_put(st->rcv_buf);
 
 	memset(st, 0xff, sizeof(struct dnet_net_state));
 	free(st);
 }
 
+/*
+ * Sends single request starting from @st->send_offset.
+ *
+ * We do not destroy request here, it is postponed to caller.
+ * Network processing thread coalesces in-memory parts of queued requests into single sendmsg() call
+ * and uses this function to send attached files.
+ * Socket has TCP_NODELAY set (see dnet_set_sockopt()), there is no need to cork/uncork it,
+ * since every reply is handed to the kernel in one piece.
+ */
 int dnet_send_request(struct dnet_net_state *st, struct dnet_io_req *r)
 {
-	int cork;
 	int err = 0;
 	size_t offset = st->send_offset;
-	size_t total_size = r->dsize + r->hsize + r->fsize;
-
-	if (total_size > sizeof(struct dnet_cmd)) {
-		/* Use TCP_CORK to send headers and packet body in one piece */
-		cork = 1;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
-	}
 
 	if (1) {
 		struct dnet_cmd *cmd = r->header;
@@ -1285,24 +1340,6 @@ err_out_exit:
 			st->send_offset, r->dsize + r->hsize + r->fsize);
 	}
 
-	if (total_size > sizeof(struct dnet_cmd)) {
-		cork = 0;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_CORK, &cork, 4);
-	}
-
-	/*
-	 * Flush TCP output pipeline if we've sent whole request.
-	 *
-	 * We do not destroy request here, it is postponed to caller.
-	 * Function can be called without lock - default call path from network processing thread and dnet_process_send_single()
-	 * or under st->send_lock, if queue was empty and dnet_send*() caller directly invoked this function from dnet_io_req_queue()
-	 * instead of queueing.
-	 */
-	if (st->send_offset == r->dsize + r->hsize + r->fsize) {
-		int nodelay = 1;
-		setsockopt(st->write_s, IPPROTO_TCP, TCP_NODELAY, &nodelay, 4);
-	}
-
 	return err;
 }
 
@@ -317,6 +317,11 @@ static int dnet_socket_init(dnet_node *node, const dnet_addr *addr, dnet_addr_so
 	if (listening) {
 		err = 1;
 		setsockopt(result->s, SOL_SOCKET, SO_REUSEADDR, &err, 4);
+#ifdef SO_REUSEPORT
+		/* every per-core net thread listens at its own socket bound to the same address */
+		if (node->io && node->io->net_per_core)
+			setsockopt(result->s, SOL_SOCKET, SO_REUSEPORT, &err, 4);
+#endif
 
 		err = bind(result->s, sa, salen);
 		if (err) {
@@ -65,11 +65,17 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 		goto err_out_destroy_wait;
 	}
 
+	err = dnet_trans_timers_init(&n->trans_timers);
+	if (err) {
+		dnet_log_err(n, "Failed to initialize transaction timer wheels: err: %d", err);
+		goto err_out_destroy_counter;
+	}
+
 	err = pthread_mutex_init(&n->reconnect_lock, NULL);
 	if (err) {
 		err = -err;
 		dnet_log_err(n, "Failed to initialize reconnection lock: err: %d", err);
-		goto err_out_destroy_counter;
+		goto err_out_destroy_timers;
 	}
 
 	err = pthread_attr_init(&n->attr);
@@ -95,6 +101,8 @@ static struct dnet_node *dnet_node_alloc(struct dnet_config *cfg)
 
 err_out_destroy_reconnect_lock:
 	pthread_mutex_destroy(&n->reconnect_lock);
+err_out_destroy_timers:
+	dnet_trans_timers_destroy(&n->trans_timers);
 err_out_destroy_counter:
 	dnet_counter_destroy(n);
 err_out_destroy_wait:
@@ -610,6 +618,7 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 	n->removal_delay = cfg->removal_delay;
 	n->flags = cfg->flags;
 	n->indexes_shard_count = cfg->indexes_shard_count;
+	n->indexes_log_compact_size = cfg->indexes_log_compact_size;
 
 	if (!n->log)
 		dnet_log_init(n, cfg->log);
@@ -643,6 +652,12 @@ struct dnet_node *dnet_node_create(struct dnet_config *cfg)
 				n->indexes_shard_count);
 	}
 
+	if (n->indexes_log_compact_size <= 0) {
+		n->indexes_log_compact_size = DNET_DEFAULT_INDEXES_LOG_COMPACT_SIZE;
+		dnet_log(n, DNET_LOG_NOTICE, "Using default indexes log compaction size (%d bytes).",
+				n->indexes_log_compact_size);
+	}
+
 	err = dnet_crypto_init(n);
 	if (err)
 		goto err_out_free;
@@ -715,6 +730,7 @@ void dnet_node_destroy(struct dnet_node *n)
 
 	dnet_node_cleanup_common_resources(n);
 	dnet_counter_destroy(n);
+	dnet_trans_timers_destroy(&n->trans_timers);
 
 	free(n);
 }
@@ -893,11 +909,18 @@ uint64_t dnet_session_get_user_flags(struct dnet_session *s)
 void dnet_session_set_timeout(struct dnet_session *s, long wait_timeout)
 {
 	s->wait_ts.tv_sec = wait_timeout;
+	s->wait_ts.tv_nsec = 0;
+}
+
+void dnet_session_set_timeout_ms(struct dnet_session *s, long wait_timeout_ms)
+{
+	s->wait_ts.tv_sec = wait_timeout_ms / 1000;
+	s->wait_ts.tv_nsec = (wait_timeout_ms % 1000) * 1000000;
 }
 
 struct timespec *dnet_session_get_timeout(struct dnet_session *s)
 {
-	return s->wait_ts.tv_sec ? &s->wait_ts : &s->node->wait_ts;
+	return (s->wait_ts.tv_sec || s->wait_ts.tv_nsec) ? &s->wait_ts : &s->node->wait_ts;
 }
 
 void dnet_set_timeouts(struct dnet_node *n, long wait_timeout, long check_timeout)
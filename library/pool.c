@@ -18,6 +18,9 @@
  */
 
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/futex.h>
 #include <netinet/in.h>
 
 #include <stdio.h>
@@ -44,27 +47,44 @@ static char *dnet_work_io_mode_str(int mode)
 	return dnet_work_io_mode_string[mode];
 }
 
+static void dnet_work_pool_free_queues(struct dnet_work_pool *pool, int num)
+{
+	int i;
+
+	for (i = 0; i < num; ++i) {
+		pthread_mutex_destroy(&pool->queues[i].lock);
+		free(pool->queues[i].owners);
+	}
+
+	free(pool->queues);
+	pool->queues = NULL;
+}
+
 static void dnet_work_pool_cleanup(struct dnet_work_pool_place *place)
 {
 	int i;
 	struct dnet_io_req *r, *tmp;
 	struct dnet_work_io *wio;
+	struct dnet_work_pool *pool;
+
+	pthread_rwlock_wrlock(&place->lock);
 
-	pthread_mutex_lock(&place->lock);
+	pool = place->pool;
 
-	for (i = 0; i < place->pool->num; ++i) {
-		wio = &place->pool->wio_list[i];
+	for (i = 0; i < pool->num; ++i) {
+		wio = &pool->wio_list[i];
 		pthread_join(wio->tid, NULL);
 	}
 
-
-	list_for_each_entry_safe(r, tmp, &place->pool->list, req_entry) {
-		list_del(&r->req_entry);
-		dnet_io_req_free(r);
+	for (i = 0; i < pool->queue_num; ++i) {
+		list_for_each_entry_safe(r, tmp, &pool->queues[i].list, req_entry) {
+			list_del(&r->req_entry);
+			dnet_io_req_free(r);
+		}
 	}
 
-	for (i = 0; i < place->pool->num; ++i) {
-		wio = &place->pool->wio_list[i];
+	for (i = 0; i < pool->num; ++i) {
+		wio = &pool->wio_list[i];
 
 		list_for_each_entry_safe(r, tmp, &wio->list, req_entry) {
 			list_del(&r->req_entry);
@@ -72,15 +92,14 @@ static void dnet_work_pool_cleanup(struct dnet_work_pool_place *place)
 		}
 	}
 
-	pthread_mutex_destroy(&place->pool->lock);
-	pthread_cond_destroy(&place->pool->wait);
+	dnet_work_pool_free_queues(pool, pool->queue_num);
 
-	free(place->pool->wio_list);
-	free(place->pool);
+	free(pool->wio_list);
+	free(pool);
 
 	place->pool = NULL;
 
-	pthread_mutex_unlock(&place->lock);
+	pthread_rwlock_unlock(&place->lock);
 }
 
 static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool, int num, void *(* process)(void *))
@@ -88,8 +107,6 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 	int i = 0, j, err;
 	struct dnet_work_io *wio;
 
-	pthread_mutex_lock(&pool->lock);
-
 	pool->wio_list = malloc(num * sizeof(struct dnet_work_io));
 	if (!pool->wio_list) {
 		err = -ENOMEM;
@@ -103,6 +120,16 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 		wio->pool = pool;
 		wio->trans = ~0ULL;
 		INIT_LIST_HEAD(&wio->list);
+	}
+
+	/*
+	 * IO threads may look at each other's state as soon as they are started,
+	 * so all of them have to be initialized beforehand.
+	 */
+	pool->num = num;
+
+	for (i = 0; i < num; ++i) {
+		wio = &pool->wio_list[i];
 
 		err = pthread_create(&wio->tid, NULL, process, wio);
 		if (err) {
@@ -112,11 +139,8 @@ static int dnet_work_pool_grow(struct dnet_node *n, struct dnet_work_pool *pool,
 		}
 	}
 
-	dnet_log(n, DNET_LOG_INFO, "Grew %s pool by: %d -> %d IO threads",
-			dnet_work_io_mode_str(pool->mode), pool->num, pool->num + num);
-
-	pool->num = num;
-	pthread_mutex_unlock(&pool->lock);
+	dnet_log(n, DNET_LOG_INFO, "Grew %s pool by: %d -> %d IO threads, queues: %d",
+			dnet_work_io_mode_str(pool->mode), 0, num, pool->queue_num);
 
 	return 0;
 
@@ -126,10 +150,9 @@ err_out_io_threads:
 		pthread_join(wio->tid, NULL);
 	}
 
+	pool->num = 0;
 	free(pool->wio_list);
 
-	pthread_mutex_unlock(&pool->lock);
-
 	return err;
 }
 
@@ -138,7 +161,7 @@ static int dnet_work_pool_place_init(struct dnet_work_pool_place *pool)
 	int err;
 	memset(pool, 0, sizeof(struct dnet_work_pool_place));
 
-	err = pthread_mutex_init(&pool->lock, NULL);
+	err = pthread_rwlock_init(&pool->lock, NULL);
 	if (err) {
 		err = -err;
 		goto err_out_exit;
@@ -147,74 +170,155 @@ static int dnet_work_pool_place_init(struct dnet_work_pool_place *pool)
 	err = pthread_cond_init(&pool->wait, NULL);
 	if (err) {
 		err = -err;
-		goto err_out_mutex_destroy;
+		goto err_out_lock_destroy;
 	}
 
-err_out_mutex_destroy:
-	pthread_mutex_destroy(&pool->lock);
+	return 0;
+
+err_out_lock_destroy:
+	pthread_rwlock_destroy(&pool->lock);
 err_out_exit:
 	return err;
 }
 
 static void dnet_work_pool_place_cleanup(struct dnet_work_pool_place *pool)
 {
-	pthread_mutex_destroy(&pool->lock);
+	pthread_rwlock_destroy(&pool->lock);
 	pthread_cond_destroy(&pool->wait);
 }
 
 static int dnet_work_pool_alloc(struct dnet_work_pool_place *place, struct dnet_node *n,
 	struct dnet_backend_io *io, int num, int mode, void *(* process)(void *))
 {
-	int err;
+	struct dnet_work_pool *pool;
+	unsigned int owners_size;
+	int err, i;
 
-	pthread_mutex_lock(&place->lock);
+	pthread_rwlock_wrlock(&place->lock);
 
-	place->pool = malloc(sizeof(struct dnet_work_pool));
-	if (!place->pool) {
+	pool = malloc(sizeof(struct dnet_work_pool));
+	if (!pool) {
 		err = -ENOMEM;
 		goto err_out_exit;
 	}
 
-	memset(place->pool, 0, sizeof(struct dnet_work_pool));
+	memset(pool, 0, sizeof(struct dnet_work_pool));
 
-	err = pthread_mutex_init(&place->pool->lock, NULL);
-	if (err) {
-		err = -err;
+	pool->num = 0;
+	pool->mode = mode;
+	pool->n = n;
+	pool->io = io;
+
+	atomic_init(&pool->queue_pos, 0);
+	atomic_init(&pool->queue_size, 0);
+	atomic_init(&pool->sleepers, 0);
+
+	pool->queue_num = num;
+	if (pool->queue_num > DNET_WORK_POOL_MAX_QUEUES)
+		pool->queue_num = DNET_WORK_POOL_MAX_QUEUES;
+	if (pool->queue_num < 1)
+		pool->queue_num = 1;
+
+	pool->numa_num = n->io->numa_num;
+
+	pool->queues = malloc(pool->queue_num * sizeof(struct dnet_work_queue));
+	if (!pool->queues) {
+		err = -ENOMEM;
 		goto err_out_free;
 	}
 
-	err = pthread_cond_init(&place->pool->wait, NULL);
-	if (err) {
-		err = -err;
-		goto err_out_mutex_destroy;
-	}
+	/* keep owners tables at most half full, so probe sequences stay short */
+	for (owners_size = 2; owners_size < 2 * (unsigned int)num; owners_size <<= 1)
+		;
 
-	place->pool->num = 0;
-	place->pool->mode = mode;
-	place->pool->n = n;
-	place->pool->io = io;
-	INIT_LIST_HEAD(&place->pool->list);
-	list_stat_init(&place->pool->list_stats);
+	for (i = 0; i < pool->queue_num; ++i) {
+		struct dnet_work_queue *q = &pool->queues[i];
+
+		q->owners = calloc(owners_size, sizeof(struct dnet_work_io *));
+		if (!q->owners) {
+			err = -ENOMEM;
+			dnet_work_pool_free_queues(pool, i);
+			goto err_out_free;
+		}
+		q->owners_mask = owners_size - 1;
 
-	err = dnet_work_pool_grow(n, place->pool, num, process);
+		err = pthread_mutex_init(&q->lock, NULL);
+		if (err) {
+			err = -err;
+			free(q->owners);
+			dnet_work_pool_free_queues(pool, i);
+			goto err_out_free;
+		}
+
+		INIT_LIST_HEAD(&q->list);
+		list_stat_init(&q->list_stats);
+	}
+
+	err = dnet_work_pool_grow(n, pool, num, process);
 	if (err)
-		goto err_out_cond_destroy;
+		goto err_out_free_queues;
 
-	pthread_mutex_unlock(&place->lock);
+	place->pool = pool;
+	pthread_rwlock_unlock(&place->lock);
 
 	return err;
 
-err_out_cond_destroy:
-	pthread_cond_destroy(&place->pool->wait);
-err_out_mutex_destroy:
-	pthread_mutex_destroy(&place->pool->lock);
+err_out_free_queues:
+	dnet_work_pool_free_queues(pool, pool->queue_num);
 err_out_free:
-	free(place->pool);
+	free(pool);
 err_out_exit:
-	pthread_mutex_unlock(&place->lock);
+	pthread_rwlock_unlock(&place->lock);
 	return err;
 }
 
+/*
+ * Aggregates statistics of all pool's queues, min and max are summed, so they are upper estimations.
+ */
+void dnet_work_pool_list_stat(struct dnet_work_pool *pool, struct list_stat *st)
+{
+	struct dnet_work_queue *q;
+	int i;
+
+	memset(st, 0, sizeof(struct list_stat));
+
+	for (i = 0; i < pool->queue_num; ++i) {
+		q = &pool->queues[i];
+
+		pthread_mutex_lock(&q->lock);
+		st->list_size += q->list_stats.list_size;
+		st->volume += q->list_stats.volume;
+		if (q->list_stats.min_list_size != ~0ULL)
+			st->min_list_size += q->list_stats.min_list_size;
+		st->max_list_size += q->list_stats.max_list_size;
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+static void dnet_work_pool_wakeup(struct dnet_work_pool *pool)
+{
+	__sync_add_and_fetch(&pool->wait_seq, 1);
+
+	if (atomic_read(&pool->sleepers))
+		syscall(SYS_futex, &pool->wait_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * Parks IO thread until new request is queued or one second passes.
+ * @seq must be read before queues were checked for the last time, so that wakeup is not lost.
+ */
+static void dnet_work_pool_park(struct dnet_work_pool *pool, int seq)
+{
+	struct timespec ts;
+
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+
+	atomic_inc(&pool->sleepers);
+	syscall(SYS_futex, &pool->wait_seq, FUTEX_WAIT_PRIVATE, seq, &ts, NULL, 0);
+	atomic_dec(&pool->sleepers);
+}
+
 /* As an example (with hardcoded loglevel and one second interval) */
 static inline void list_stat_log(struct list_stat *st, struct dnet_node *node, const char *list_name, int nonblocking) {
 	struct timeval tv;
@@ -249,11 +353,220 @@ static int dnet_cmd_needs_backend(int command)
 }
 
 static void *dnet_io_process(void *data_);
-void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
+static inline unsigned int dnet_work_queue_owner_slot(struct dnet_work_queue *q, uint64_t trans)
+{
+	/* low bits of @trans select the queue, so mix high ones in */
+	return (unsigned int)((trans * 0x9e3779b97f4a7c15ULL) >> 32) & q->owners_mask;
+}
+
+/*
+ * Returns IO thread which claimed transaction @trans or NULL.
+ * Must be called under @q->lock, @q must be the queue @trans belongs to.
+ */
+static struct dnet_work_io *dnet_work_queue_trans_owner(struct dnet_work_queue *q, uint64_t trans)
+{
+	struct dnet_work_io *wio;
+	unsigned int pos;
+
+	for (pos = dnet_work_queue_owner_slot(q, trans); (wio = q->owners[pos]); pos = (pos + 1) & q->owners_mask) {
+		if (wio->trans == trans)
+			return wio;
+	}
+
+	return NULL;
+}
+
+static void dnet_work_queue_claim(struct dnet_work_queue *q, struct dnet_work_io *wio, uint64_t trans)
+{
+	unsigned int pos;
+
+	wio->trans = trans;
+
+	for (pos = dnet_work_queue_owner_slot(q, trans); q->owners[pos]; pos = (pos + 1) & q->owners_mask)
+		;
+
+	q->owners[pos] = wio;
+}
+
+/*
+ * Removes @wio from the owners table. Entries following it in the same probe sequence
+ * are shifted back, so lookups never need tombstones.
+ */
+static void dnet_work_queue_release(struct dnet_work_queue *q, struct dnet_work_io *wio)
+{
+	struct dnet_work_io *it;
+	unsigned int pos, next, home;
+
+	for (pos = dnet_work_queue_owner_slot(q, wio->trans); q->owners[pos] != wio; pos = (pos + 1) & q->owners_mask)
+		;
+
+	for (next = (pos + 1) & q->owners_mask; (it = q->owners[next]); next = (next + 1) & q->owners_mask) {
+		home = dnet_work_queue_owner_slot(q, it->trans);
+
+		/* @it may only be moved into @pos if @pos lies between its home slot and its current slot */
+		if (((next - home) & q->owners_mask) >= ((next - pos) & q->owners_mask)) {
+			q->owners[pos] = it;
+			pos = next;
+		}
+	}
+
+	q->owners[pos] = NULL;
+	wio->trans = ~0ULL;
+}
+
+/*
+ * Spreads requests over pool's queues round-robin. Per-core net thread only uses queues
+ * of its own NUMA node, if there are any, so that request is processed by IO thread next to it.
+ */
+static struct dnet_work_queue *dnet_work_pool_select_queue(struct dnet_work_pool *pool)
+{
+	unsigned long pos = (unsigned long)atomic_inc(&pool->queue_pos);
+	struct dnet_net_io *nio;
+	int node, local_num;
+
+	if (pool->numa_num > 1 && (nio = dnet_net_io_current()) != NULL) {
+		node = nio->numa_node % pool->numa_num;
+		local_num = (pool->queue_num - node + pool->numa_num - 1) / pool->numa_num;
+
+		if (local_num > 0)
+			return &pool->queues[node + pool->numa_num * (pos % local_num)];
+	}
+
+	return &pool->queues[pos % pool->queue_num];
+}
+
+static void dnet_check_work_pool_place(struct dnet_work_pool_place *place, uint64_t *list_size, uint64_t *threads_count)
+{
+	struct dnet_work_pool *pool;
+
+	pthread_rwlock_rdlock(&place->lock);
+	pool = place->pool;
+	if (pool) {
+		*list_size += atomic_read(&pool->queue_size);
+		*threads_count += pool->num;
+	}
+	pthread_rwlock_unlock(&place->lock);
+}
+
+static void dnet_check_io_pool(struct dnet_io_pool *io, uint64_t *list_size, uint64_t *threads_count)
+{
+	dnet_check_work_pool_place(&io->recv_pool, list_size, threads_count);
+	dnet_check_work_pool_place(&io->recv_pool_nb, list_size, threads_count);
+}
+
+/*
+ * Returns true if @io queues hold more than 1/@divisor of DNET_IO_POOL_QUEUE_LIMIT requests per thread
+ */
+static int dnet_io_pool_full(struct dnet_io_pool *io, int divisor)
+{
+	uint64_t list_size = 0;
+	uint64_t threads_count = 0;
+
+	dnet_check_io_pool(io, &list_size, &threads_count);
+
+	return list_size * divisor > threads_count * DNET_IO_POOL_QUEUE_LIMIT;
+}
+
+int dnet_io_pool_throttle_init(struct dnet_io_pool *io)
+{
+	int err;
+
+	err = pthread_mutex_init(&io->throttle_lock, NULL);
+	if (err)
+		return -err;
+
+	INIT_LIST_HEAD(&io->throttle_list);
+	io->throttled = 0;
+	io->throttle_count = 0;
+
+	return 0;
+}
+
+/*
+ * Stops reading from @st until its throttle pool drains.
+ * Returns 0 if state has been throttled, or -EAGAIN if pool has drained already and reading may continue.
+ */
+static int dnet_state_throttle(struct dnet_net_state *st)
+{
+	struct dnet_io_pool *io = st->throttle_pool;
+	int err = -EAGAIN;
+
+	st->throttle_pool = NULL;
+
+	pthread_mutex_lock(&io->throttle_lock);
+	/* IO threads resume throttled states under @throttle_lock, so pool can not drain unnoticed */
+	if (dnet_io_pool_full(io, 1)) {
+		epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->read_s, NULL);
+
+		list_add_tail(&st->throttle_entry, &io->throttle_list);
+		dnet_state_get(st);
+
+		io->throttled++;
+		io->throttle_count++;
+		err = 0;
+	}
+	pthread_mutex_unlock(&io->throttle_lock);
+
+	if (!err)
+		dnet_log(st->n, DNET_LOG_NOTICE, "%s: io pool queues are full, connection is throttled",
+				dnet_state_dump_addr(st));
+
+	return err;
+}
+
+/*
+ * Resumes reading from states throttled by @io.
+ * Unless @force is set, states are resumed only if @io has drained to half of the limit.
+ */
+void dnet_io_pool_unthrottle(struct dnet_node *n, struct dnet_io_pool *io, int force)
+{
+	struct dnet_net_state *st, *tmp;
+	LIST_HEAD(resumed);
+
+	if (!*(volatile int *)&io->throttled)
+		return;
+
+	pthread_mutex_lock(&io->throttle_lock);
+	if (!force && dnet_io_pool_full(io, 2)) {
+		pthread_mutex_unlock(&io->throttle_lock);
+		return;
+	}
+
+	list_splice_init(&io->throttle_list, &resumed);
+	io->throttled = 0;
+	pthread_mutex_unlock(&io->throttle_lock);
+
+	list_for_each_entry_safe(st, tmp, &resumed, throttle_entry) {
+		list_del_init(&st->throttle_entry);
+
+		if (!n->need_exit) {
+			pthread_mutex_lock(&st->send_lock);
+			dnet_schedule_recv(st);
+			pthread_mutex_unlock(&st->send_lock);
+		}
+
+		dnet_state_put(st);
+	}
+}
+
+void dnet_io_pool_throttle_cleanup(struct dnet_node *n, struct dnet_io_pool *io)
+{
+	dnet_io_pool_unthrottle(n, io, 1);
+	pthread_mutex_destroy(&io->throttle_lock);
+}
+
+
+/*
+ * Queues request into IO pool of its backend.
+ * Returns IO pool if it is full after this request, sender should be throttled then, NULL otherwise.
+ */
+struct dnet_io_pool *dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 {
 	struct dnet_work_pool_place *place = NULL;
 	struct dnet_work_pool_place *backend_place = NULL;
 	struct dnet_work_pool *pool = NULL;
+	struct dnet_work_queue *queue;
+	struct dnet_work_io *owner;
 	struct dnet_io_pool *io_pool = &n->io->pool;
 	struct dnet_cmd *cmd = r->header;
 	int nonblocking = !!(cmd->flags & DNET_FLAGS_NOLOCK);
@@ -289,9 +602,9 @@ void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 		}
 
 		if (place) {
-			pthread_mutex_lock(&place->lock);
+			pthread_rwlock_rdlock(&place->lock);
 			if (!place->pool) {
-				pthread_mutex_unlock(&place->lock);
+				pthread_rwlock_unlock(&place->lock);
 				io_pool = &n->io->pool;
 				place = NULL;
 			}
@@ -307,7 +620,7 @@ void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 			place = &io_pool->recv_pool;
 		}
 
-		pthread_mutex_lock(&place->lock);
+		pthread_rwlock_rdlock(&place->lock);
 	}
 
 	pool = place->pool;
@@ -325,16 +638,36 @@ void dnet_schedule_io(struct dnet_node *n, struct dnet_io_req *r)
 		backend_place && backend_place->pool->io ? (ssize_t)backend_place->pool->io->backend_id : (ssize_t)-1,
 		cmd->backend_id);
 
-	pthread_mutex_lock(&pool->lock);
+	if (cmd->flags & DNET_FLAGS_REPLY)
+		queue = &pool->queues[cmd->trans % pool->queue_num];
+	else
+		queue = dnet_work_pool_select_queue(pool);
+
+	pthread_mutex_lock(&queue->lock);
+
+	/*
+	 * Reply for transaction which is being processed by some IO thread goes directly into its private list.
+	 * IO thread never parks while it holds transaction, so there is no need to wake it up.
+	 */
+	owner = NULL;
+	if (cmd->flags & DNET_FLAGS_REPLY)
+		owner = dnet_work_queue_trans_owner(queue, cmd->trans);
+
+	list_add_tail(&r->req_entry, owner ? &owner->list : &queue->list);
+	list_stat_size_increase(&queue->list_stats, 1);
+	list_stat_log(&queue->list_stats, r->st->n, "input io queue", nonblocking);
+
+	pthread_mutex_unlock(&queue->lock);
 
-	list_add_tail(&r->req_entry, &pool->list);
-	list_stat_size_increase(&pool->list_stats, 1);
-	list_stat_log(&pool->list_stats, r->st->n, "input io queue", nonblocking);
+	atomic_inc(&pool->queue_size);
+	dnet_work_pool_wakeup(pool);
 
-	pthread_mutex_unlock(&pool->lock);
-	pthread_cond_signal(&pool->wait);
+	pthread_rwlock_unlock(&place->lock);
 
-	pthread_mutex_unlock(&place->lock);
+	if (dnet_io_pool_full(io_pool, 1))
+		return io_pool;
+
+	return NULL;
 }
 
 
@@ -349,7 +682,7 @@ void dnet_schedule_command(struct dnet_net_state *st)
 		dnet_log(st->n, DNET_LOG_DEBUG, "freed: size: %llu, trans: %llu, reply: %d, ptr: %p.",
 						(unsigned long long)c->size, tid, tid != c->trans, st->rcv_data);
 #endif
-		free(st->rcv_data);
+		dnet_io_req_free(st->rcv_data);
 		st->rcv_data = NULL;
 	}
 
@@ -357,7 +690,128 @@ void dnet_schedule_command(struct dnet_net_state *st)
 	st->rcv_offset = 0;
 }
 
-static int dnet_process_recv_single(struct dnet_net_state *st)
+void dnet_rcv_buffer_put(void *data)
+{
+	struct dnet_rcv_buffer *buf = data;
+
+	if (buf && atomic_dec_and_test(&buf->refcnt)) {
+		if (buf->pinned)
+			atomic_dec(buf->pinned);
+		free(buf);
+	}
+}
+
+static struct dnet_rcv_buffer *dnet_rcv_buffer_alloc(void)
+{
+	struct dnet_rcv_buffer *buf;
+
+	buf = malloc(sizeof(struct dnet_rcv_buffer));
+	if (buf) {
+		atomic_init(&buf->refcnt, 1);
+		buf->pinned = NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * Reads up to @size bytes into @data, behaves like recv().
+ *
+ * Data is served from state's read-ahead buffer, which is refilled with a single recv()
+ * of everything socket has (up to DNET_RCV_BUFFER_SIZE) when it is empty.
+ * Reads which are not smaller than read-ahead buffer bypass it.
+ */
+static ssize_t dnet_recv_buffered(struct dnet_net_io *nio, struct dnet_net_state *st, void *data, size_t size)
+{
+	ssize_t err;
+
+	if (st->rcv_buf_start == st->rcv_buf_end) {
+		st->rcv_buf_start = st->rcv_buf_end = 0;
+
+		/*
+		 * Buffer still referenced by queued commands can not be overwritten, it is left to them
+		 * and accounted as pinned until they are processed. Only this thread takes new references,
+		 * so nobody else holds the buffer if counter is 1.
+		 */
+		if (st->rcv_buf && atomic_read(&st->rcv_buf->refcnt) != 1) {
+			st->rcv_buf->pinned = &nio->rcv_buf_pinned;
+			atomic_inc(&nio->rcv_buf_pinned);
+			dnet_rcv_buffer_put(st->rcv_buf);
+			st->rcv_buf = NULL;
+		}
+
+		if (!st->rcv_buf && size < DNET_RCV_BUFFER_SIZE)
+			st->rcv_buf = dnet_rcv_buffer_alloc();
+
+		if (!st->rcv_buf || size >= DNET_RCV_BUFFER_SIZE)
+			return recv(st->read_s, data, size, 0);
+
+		err = recv(st->read_s, st->rcv_buf->data, DNET_RCV_BUFFER_SIZE, 0);
+		if (err <= 0)
+			return err;
+
+		st->rcv_buf_end = err;
+	}
+
+	if (size > st->rcv_buf_end - st->rcv_buf_start)
+		size = st->rcv_buf_end - st->rcv_buf_start;
+
+	memcpy(data, st->rcv_buf->data + st->rcv_buf_start, size);
+	st->rcv_buf_start += size;
+
+	return size;
+}
+
+/*
+ * Slices the next command out of read-ahead buffer if both its header and data are already there.
+ * Request points to them right in the buffer and holds reference to it instead of copying,
+ * header and data stay adjacent, as reply handlers expect. Returns NULL if command is not complete yet
+ * or network thread has too many pinned buffers, command is copied out of the buffer then.
+ */
+static struct dnet_io_req *dnet_recv_slice(struct dnet_net_io *nio, struct dnet_net_state *st)
+{
+	size_t available = st->rcv_buf_end - st->rcv_buf_start;
+	struct dnet_io_req *r;
+	struct dnet_cmd *c;
+
+	if (available < sizeof(struct dnet_cmd))
+		return NULL;
+
+	if (atomic_read(&nio->rcv_buf_pinned) >= DNET_RCV_BUFFER_PINNED_MAX)
+		return NULL;
+
+	c = (struct dnet_cmd *)(st->rcv_buf->data + st->rcv_buf_start);
+	if (available - sizeof(struct dnet_cmd) < dnet_bswap64(c->size))
+		return NULL;
+
+	r = dnet_io_req_pool_alloc(&nio->req_pool, 0);
+	if (!r)
+		return NULL;
+
+	dnet_convert_cmd(c);
+	st->rcv_buf_start += sizeof(struct dnet_cmd) + c->size;
+
+	r->header = c;
+	r->hsize = sizeof(struct dnet_cmd);
+	if (c->size) {
+		r->data = c + 1;
+		r->dsize = c->size;
+	}
+
+	atomic_inc(&st->rcv_buf->refcnt);
+	r->data_ref = st->rcv_buf;
+	r->data_put = dnet_rcv_buffer_put;
+
+	dnet_log(st->n, DNET_LOG_DEBUG, "%s: received trans: %llu / 0x%llx, "
+			"reply: %d, size: %llu, flags: %s, status: %d, sliced.",
+			dnet_dump_id(&c->id), (unsigned long long)c->trans, (unsigned long long)c->trans,
+			!!(c->flags & DNET_FLAGS_REPLY),
+			(unsigned long long)c->size, dnet_flags_dump_cflags(c->flags), c->status);
+
+	return r;
+}
+
+static int dnet_process_recv_single(struct dnet_net_io *nio, struct dnet_net_state *st)
 {
 	struct dnet_node *n = st->n;
 	struct dnet_io_req *r;
@@ -366,6 +820,22 @@ static int dnet_process_recv_single(struct dnet_net_state *st)
 	int err;
 
 again:
+	/*
+	 * Last command was queued into full IO pool, stop reading until it drains.
+	 * Commands which are already in read-ahead buffer are queued anyway, epoll would not report them.
+	 */
+	if (st->throttle_pool && st->rcv_buf_start == st->rcv_buf_end) {
+		err = dnet_state_throttle(st);
+		if (!err)
+			return 0;
+	}
+
+	if ((st->rcv_flags & DNET_IO_CMD) && !st->rcv_offset) {
+		r = dnet_recv_slice(nio, st);
+		if (r)
+			goto queue;
+	}
+
 	/*
 	 * Reading command first.
 	 */
@@ -377,7 +847,7 @@ again:
 	size = st->rcv_end - st->rcv_offset;
 
 	if (size) {
-		err = recv(st->read_s, data, size, 0);
+		err = dnet_recv_buffered(nio, st, data, size);
 		if (err < 0) {
 			err = -EAGAIN;
 			if (errno != EAGAIN && errno != EINTR) {
@@ -417,12 +887,11 @@ again:
 				!!(c->flags & DNET_FLAGS_REPLY),
 				(unsigned long long)c->size, dnet_flags_dump_cflags(c->flags), c->status);
 
-		r = malloc(c->size + sizeof(struct dnet_cmd) + sizeof(struct dnet_io_req));
+		r = dnet_io_req_pool_alloc(&nio->req_pool, c->size + sizeof(struct dnet_cmd));
 		if (!r) {
 			err = -ENOMEM;
 			goto out;
 		}
-		memset(r, 0, sizeof(struct dnet_io_req));
 
 		r->header = r + 1;
 		r->hsize = sizeof(struct dnet_cmd);
@@ -449,9 +918,18 @@ again:
 
 	dnet_schedule_command(st);
 
+queue:
 	r->st = dnet_state_get(st);
 
-	dnet_schedule_io(n, r);
+	st->throttle_pool = dnet_schedule_io(n, r);
+
+	/*
+	 * Read-ahead buffer may already contain next commands, parse them now,
+	 * epoll will not wake us up for data which has already been read from the socket.
+	 */
+	if (st->rcv_buf_start != st->rcv_buf_end || st->throttle_pool)
+		goto again;
+
 	return 0;
 
 out:
@@ -518,7 +996,11 @@ int dnet_local_addr_index(struct dnet_node *n, struct dnet_addr *addr)
 	return -1;
 }
 
-int dnet_state_accept_process(struct dnet_net_state *orig, struct epoll_event *ev __unused)
+/*
+ * Accepts connection at listening socket @s of @orig state.
+ * Per-core net thread takes ownership of the accepted connection, see dnet_setup_control_nolock().
+ */
+int dnet_state_accept_process(struct dnet_net_state *orig, int s)
 {
 	struct dnet_node *n = orig->n;
 	int err, cs, idx;
@@ -530,7 +1012,7 @@ int dnet_state_accept_process(struct dnet_net_state *orig, struct epoll_event *e
 	memset(&addr, 0, sizeof(addr));
 
 	salen = addr.addr_len = sizeof(addr.addr);
-	cs = accept(orig->accept_s, (struct sockaddr *)&addr.addr, &salen);
+	cs = accept(s, (struct sockaddr *)&addr.addr, &salen);
 	if (cs < 0) {
 		err = -errno;
 
@@ -603,17 +1085,122 @@ void dnet_unschedule_all(struct dnet_net_state *st)
 		epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, st->accept_s, NULL);
 }
 
+/*
+ * Fills @iov with not yet sent in-memory parts of queued requests, starting from the first one.
+ * Stops after request with attached file, since file data is sent by sendfile().
+ * @more is set in that case, so that kernel does not push out headers alone.
+ *
+ * Must be called with @st->send_lock held.
+ */
+static int dnet_send_fill_iov(struct dnet_net_state *st, struct iovec *iov, int *more)
+{
+	struct dnet_io_req *r;
+	size_t offset = st->send_offset;
+	int num = 0;
+
+	*more = 0;
+
+	list_for_each_entry(r, &st->send_list, req_entry) {
+		if (num + 2 > DNET_SEND_IOV_MAX)
+			break;
+
+		if (r->hsize && r->header && offset < r->hsize) {
+			iov[num].iov_base = r->header + offset;
+			iov[num].iov_len = r->hsize - offset;
+			++num;
+		}
+		offset = (offset > r->hsize) ? offset - r->hsize : 0;
+
+		if (r->dsize && r->data && offset < r->dsize) {
+			iov[num].iov_base = r->data + offset;
+			iov[num].iov_len = r->dsize - offset;
+			++num;
+		}
+		offset = 0;
+
+		if (r->fd >= 0 && r->fsize) {
+			*more = (num != 0);
+			break;
+		}
+	}
+
+	return num;
+}
+
+/*
+ * Accounts @size bytes sent from the head of the send queue and frees fully sent requests.
+ */
+static void dnet_send_advance(struct dnet_net_state *st, size_t size)
+{
+	struct dnet_io_req *r;
+	size_t mem_size, chunk;
+
+	while (1) {
+		r = NULL;
+
+		pthread_mutex_lock(&st->send_lock);
+		if (!list_empty(&st->send_list))
+			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
+		pthread_mutex_unlock(&st->send_lock);
+
+		if (!r)
+			break;
+
+		mem_size = r->hsize + r->dsize;
+		if (st->send_offset < mem_size) {
+			chunk = mem_size - st->send_offset;
+			if (chunk > size)
+				chunk = size;
+
+			st->send_offset += chunk;
+			size -= chunk;
+		}
+
+		if (st->send_offset != mem_size + r->fsize)
+			break;
+
+		pthread_mutex_lock(&st->send_lock);
+		list_del(&r->req_entry);
+		pthread_mutex_unlock(&st->send_lock);
+
+		pthread_mutex_lock(&st->n->io->full_lock);
+		list_stat_size_decrease(&st->n->io->output_stats, 1);
+		pthread_mutex_unlock(&st->n->io->full_lock);
+
+		if (atomic_read(&st->send_queue_size) > 0)
+			if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
+				dnet_log(st->n, DNET_LOG_DEBUG,
+						"State low_watermark reached: %s: %d, waking up",
+						dnet_server_convert_dnet_addr(&st->addr),
+						atomic_read(&st->send_queue_size));
+				pthread_cond_broadcast(&st->send_wait);
+			}
+
+		dnet_io_req_free(r);
+		st->send_offset = 0;
+	}
+}
+
+/*
+ * Sends queued requests: in-memory parts of as many requests as possible are coalesced
+ * into single sendmsg() call, attached files are sent via dnet_send_request().
+ */
 static int dnet_process_send_single(struct dnet_net_state *st)
 {
 	struct dnet_io_req *r = NULL;
-	int err;
+	struct iovec iov[DNET_SEND_IOV_MAX];
+	struct msghdr msg;
+	int iov_num, more;
+	ssize_t err;
 
 	while (1) {
 		r = NULL;
+		iov_num = 0;
 
 		pthread_mutex_lock(&st->send_lock);
 		if (!list_empty(&st->send_list)) {
 			r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
+			iov_num = dnet_send_fill_iov(st, iov, &more);
 		} else {
 			dnet_unschedule_send(st);
 		}
@@ -624,29 +1211,37 @@ static int dnet_process_send_single(struct dnet_net_state *st)
 			goto err_out_exit;
 		}
 
-		err = dnet_send_request(st, r);
-		if (st->send_offset == (r->dsize + r->hsize + r->fsize)) {
-			pthread_mutex_lock(&st->send_lock);
-			list_del(&r->req_entry);
-			pthread_mutex_unlock(&st->send_lock);
+		if (iov_num) {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = iov_num;
 
-			pthread_mutex_lock(&st->n->io->full_lock);
-			list_stat_size_decrease(&st->n->io->output_stats, 1);
-			pthread_mutex_unlock(&st->n->io->full_lock);
-
-			if (atomic_read(&st->send_queue_size) > 0)
-				if (atomic_dec(&st->send_queue_size) == DNET_SEND_WATERMARK_LOW) {
-					dnet_log(st->n, DNET_LOG_DEBUG,
-							"State low_watermark reached: %s: %d, waking up",
-							dnet_server_convert_dnet_addr(&st->addr),
-							atomic_read(&st->send_queue_size));
-					pthread_cond_broadcast(&st->send_wait);
-				}
+			err = sendmsg(st->write_s, &msg, more ? MSG_MORE : 0);
+			if (err < 0) {
+				err = -errno;
+				if (err != -EAGAIN)
+					dnet_log_err(st->n, "%s: failed to send %d io vectors, socket: %d",
+							dnet_state_dump_addr(st), iov_num, st->write_s);
+				goto err_out_exit;
+			}
 
-			dnet_io_req_free(r);
-			st->send_offset = 0;
+			if (err == 0) {
+				dnet_log(st->n, DNET_LOG_ERROR, "Peer %s has dropped the connection: socket: %d.",
+						dnet_state_dump_addr(st), st->write_s);
+				err = -ECONNRESET;
+				goto err_out_exit;
+			}
+
+			dnet_send_advance(st, err);
+			continue;
 		}
 
+		err = 0;
+		if (st->send_offset < r->hsize + r->dsize + r->fsize)
+			err = dnet_send_request(st, r);
+
+		dnet_send_advance(st, 0);
+
 		if (err)
 			goto err_out_exit;
 	}
@@ -709,9 +1304,6 @@ static int dnet_schedule_network_io(struct dnet_net_state *st, int send)
 		}
 	}
 
-	if (send)
-		pthread_cond_broadcast(&st->n->io->full_wait);
-
 	return err;
 }
 
@@ -725,12 +1317,12 @@ int dnet_schedule_recv(struct dnet_net_state *st)
 	return dnet_schedule_network_io(st, 0);
 }
 
-int dnet_state_net_process(struct dnet_net_state *st, struct epoll_event *ev)
+int dnet_state_net_process(struct dnet_net_io *nio, struct dnet_net_state *st, struct epoll_event *ev)
 {
 	int err = -ECONNRESET;
 
 	if (ev->events & EPOLLIN) {
-		err = dnet_process_recv_single(st);
+		err = dnet_process_recv_single(nio, st);
 		if (err && (err != -EAGAIN))
 			goto err_out_exit;
 	}
@@ -748,48 +1340,15 @@ err_out_exit:
 	return err;
 }
 
-static void dnet_check_work_pool_place(struct dnet_work_pool_place *place, uint64_t *list_size, uint64_t *threads_count)
-{
-	struct dnet_work_pool *pool;
-
-	pthread_mutex_lock(&place->lock);
-	pool = place->pool;
-	if (pool) {
-		pthread_mutex_lock(&pool->lock);
-		*list_size += pool->list_stats.list_size;
-		*threads_count += pool->num;
-		pthread_mutex_unlock(&pool->lock);
-	}
-	pthread_mutex_unlock(&place->lock);
-}
-
-static void dnet_check_io_pool(struct dnet_io_pool *io, uint64_t *list_size, uint64_t *threads_count)
-{
-	dnet_check_work_pool_place(&io->recv_pool, list_size, threads_count);
-	dnet_check_work_pool_place(&io->recv_pool_nb, list_size, threads_count);
-}
+/* net thread the calling thread is, NULL for any other thread */
+static __thread struct dnet_net_io *dnet_local_net_io;
 
-static int dnet_check_io(struct dnet_io *io)
+struct dnet_net_io *dnet_net_io_current(void)
 {
-	uint64_t list_size = 0;
-	uint64_t threads_count = 0;
-
-	dnet_check_io_pool(&io->pool, &list_size, &threads_count);
-
-	if (io->backends) {
-		size_t i;
-		for (i = 0; i < io->backends_count; ++i) {
-			dnet_check_io_pool(&io->backends[i].pool, &list_size, &threads_count);
-		}
-	}
-
-	if (list_size <= threads_count * 1000)
-		return 1;
-
-	return 0;
+	return dnet_local_net_io;
 }
 
-static void dnet_shuffle_epoll_events(struct epoll_event *evs, int size) {
+static void dnet_shuffle_epoll_events(struct dnet_net_io *nio, struct epoll_event *evs, int size) {
 	int i = 0, j = 0;
 	struct epoll_event tmp;
 
@@ -797,7 +1356,7 @@ static void dnet_shuffle_epoll_events(struct epoll_event *evs, int size) {
 		return;
 
 	for (i = 0; i < size - 1; ++i) {
-		j = i + rand() / (RAND_MAX / (size - i) + 1);
+		j = i + rand_r(&nio->seed) / (RAND_MAX / (size - i) + 1);
 
 		// In case if j == i we can't use memcpy because of the overlap
 		memcpy(&tmp, evs + j, sizeof(struct epoll_event));
@@ -818,20 +1377,25 @@ static void *dnet_io_process_network(void *data_)
 	int tmp = 0;
 	int err = 0;
 	int i = 0;
-	struct timeval prev_tv, curr_tv;
 
 	dnet_set_name("dnet_net");
 
-	dnet_log(n, DNET_LOG_NOTICE, "started net pool");
+	dnet_local_net_io = nio;
+
+	if (nio->cpu >= 0) {
+		err = dnet_set_cpu_affinity(nio->cpu);
+		if (err)
+			dnet_log(n, DNET_LOG_ERROR, "Failed to pin net thread to cpu: %d: %s [%d]",
+					nio->cpu, strerror(-err), err);
+	}
+
+	dnet_log(n, DNET_LOG_NOTICE, "started net pool, cpu: %d, numa node: %d", nio->cpu, nio->numa_node);
 
 	if (evs == NULL) {
 		dnet_log(n, DNET_LOG_ERROR, "Not enough memory to allocate epoll_events");
 		goto err_out_exit;
 	}
 
-	// get current timestamp for future outputting "Net pool is suspended..." logging
-	gettimeofday(&prev_tv, NULL);
-
 	while (!n->need_exit) {
 		// get current number of states
 		tmp = dnet_node_state_num(n);
@@ -859,26 +1423,22 @@ static void *dnet_io_process_network(void *data_)
 			break;
 		}
 
-		// tmp will counts number of send events
-		tmp = 0;
 		// suffles available epoll_events
-		dnet_shuffle_epoll_events(evs, err);
+		dnet_shuffle_epoll_events(nio, evs, err);
 		for (i = 0; i < err; ++i) {
 			data = evs[i].data.ptr;
 			st = data->st;
-			st->epoll_fd = nio->epoll_fd;
 
-			if (data->fd == st->accept_s) {
+			/* listening state is shared by all per-core net threads, it stays at its own epoll */
+			if (data != &nio->accept_data)
+				st->epoll_fd = nio->epoll_fd;
+
+			if (data == &st->accept_data || data == &nio->accept_data) {
 				// We have to accept new connection
-				++tmp;
-				err = dnet_state_accept_process(st, &evs[i]);
-			} else if ((evs[i].events & EPOLLOUT) || dnet_check_io(n->io)) {
-				// if event is send or io pool queues are not full then process it
-				++tmp;
-				err = dnet_state_net_process(st, &evs[i]);
+				err = dnet_state_accept_process(st, data->fd);
+			} else {
+				err = dnet_state_net_process(nio, st, &evs[i]);
 			}
-			else
-				continue;
 
 			if (err == 0)
 				continue;
@@ -916,22 +1476,6 @@ static void *dnet_io_process_network(void *data_)
 				continue;
 			}
 		}
-
-		// wait condition variable if no data was sended and io pool queues are still full
-		if (tmp == 0 && dnet_check_io(n->io) == 0) {
-			gettimeofday(&curr_tv, NULL);
-			// print log only if previous log was writed more then 1 seconds
-			if ((curr_tv.tv_sec - prev_tv.tv_sec) > 1) {
-				dnet_log(n, DNET_LOG_INFO, "Net pool is suspended bacause io pool queues is full");
-				prev_tv = curr_tv;
-			}
-			// wait condition variable - io queues has a free slot or some socket has something to send
-			pthread_mutex_lock(&n->io->full_lock);
-			n->io->blocked = 1;
-			pthread_cond_wait(&n->io->full_wait, &n->io->full_lock);
-			n->io->blocked = 0;
-			pthread_mutex_unlock(&n->io->full_lock);
-		}
 	}
 
 	free(evs);
@@ -956,48 +1500,86 @@ static void dnet_io_cleanup_states(struct dnet_node *n)
 	n->st = NULL;
 }
 
+/*
+ * Comment below is only related to client IO threads processing replies from the server.
+ *
+ * At any given moment of time it is forbidden for 2 IO threads to process replies for the same transaction.
+ * This may lead to the situation, when thread 1 processes final ack, while thread 2 is being handling received data.
+ * Thread 1 will free resources, which leads thread 2 to crash the whole process.
+ *
+ * Thus any transaction may only be processed on single thread at any given time.
+ * But it is possible to ping-pong transaction between multiple IO threads as long as each IO thread
+ * processes different transaction reply simultaneously.
+ *
+ * All replies for given transaction are queued into the same shard, IO thread claims transaction (@wio->trans)
+ * and releases it under that shard's lock. Claimed transactions are registered in the shard's owners hash,
+ * so finding the owner of the reply takes constant time. Replies for claimed transaction are put into claiming
+ * thread's private list, which is also protected by the lock of the shard transaction belongs to.
+ *
+ * IO thread releases its transaction (sets it to -1) when there are no more replies in its private list,
+ * so it can be assigned any transaction reply, if it is not already claimed by another thread.
+ * If we leave here previously processed transaction id, we might stuck, since all threads will wait for those
+ * transactions they are assigned to, thus not allowing any further process, since no thread will be able to
+ * process current request and move to the next one.
+ */
 static struct dnet_io_req *take_request(struct dnet_work_io *wio)
 {
 	struct dnet_work_pool *pool = wio->pool;
+	struct dnet_work_queue *q;
+	struct dnet_work_io *owner;
 	struct dnet_io_req *it = NULL, *tmp;
 	struct dnet_cmd *cmd;
-	uint64_t trans;
 	int i;
-	int ok;
-
-	if (!list_empty(&wio->list)) {
-		it = list_first_entry(&wio->list, struct dnet_io_req, req_entry);
-		cmd = it->header;
-		trans = cmd->trans;
-		wio->trans = trans;
-		return it;
-	}
-
-	list_for_each_entry_safe(it, tmp, &pool->list, req_entry) {
-		cmd = it->header;
-		trans = cmd->trans;
-		ok = 1;
-
-		/* This is not a transaction reply, process it right now */
-		if (!(cmd->flags & DNET_FLAGS_REPLY))
-			return it;
-
-		for (i = 0; i < pool->num; ++i) {
-			 /* Someone claimed transaction @tid */
-			if (pool->wio_list[i].trans == trans) {
-				list_move_tail(&it->req_entry, &pool->wio_list[i].list);
-				ok = 0;
-				break;
-			}
+
+	if (wio->trans != ~0ULL) {
+		q = &pool->queues[wio->trans % pool->queue_num];
+
+		pthread_mutex_lock(&q->lock);
+		if (!list_empty(&wio->list)) {
+			it = list_first_entry(&wio->list, struct dnet_io_req, req_entry);
+			goto out_found;
 		}
 
-		if (ok) {
-			wio->trans = trans;
-			return it;
+		dnet_work_queue_release(q, wio);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	for (i = 0; i < pool->queue_num; ++i) {
+		q = &pool->queues[(wio->thread_index + i) % pool->queue_num];
+
+		if (list_empty(&q->list))
+			continue;
+
+		pthread_mutex_lock(&q->lock);
+		list_for_each_entry_safe(it, tmp, &q->list, req_entry) {
+			cmd = it->header;
+
+			/* This is not a transaction reply, process it right now */
+			if (!(cmd->flags & DNET_FLAGS_REPLY))
+				goto out_found;
+
+			/* Someone claimed transaction @trans */
+			owner = dnet_work_queue_trans_owner(q, cmd->trans);
+			if (owner) {
+				list_move_tail(&it->req_entry, &owner->list);
+				continue;
+			}
+
+			dnet_work_queue_claim(q, wio, cmd->trans);
+			goto out_found;
 		}
+		pthread_mutex_unlock(&q->lock);
 	}
 
 	return NULL;
+
+out_found:
+	list_del_init(&it->req_entry);
+	list_stat_size_decrease(&q->list_stats, 1);
+	pthread_mutex_unlock(&q->lock);
+
+	atomic_dec(&pool->queue_size);
+	return it;
 }
 
 static void *dnet_io_process(void *data_)
@@ -1006,10 +1588,8 @@ static void *dnet_io_process(void *data_)
 	struct dnet_work_pool *pool = wio->pool;
 	struct dnet_node *n = pool->n;
 	struct dnet_net_state *st;
-	struct timespec ts;
-	struct timeval tv;
 	struct dnet_io_req *r;
-	int err;
+	int seq;
 	struct dnet_cmd *cmd;
 	int nonblocking = (pool->mode == DNET_WORK_IO_MODE_NONBLOCKING);
 
@@ -1018,54 +1598,33 @@ static void *dnet_io_process(void *data_)
 	else
 		dnet_set_name("dnet_%sio", nonblocking ? "nb_" : "");
 
+	/* keep IO thread on the NUMA node of its own queue */
+	if (pool->numa_num > 1) {
+		int node = (wio->thread_index % pool->queue_num) % pool->numa_num;
+		int err = dnet_set_numa_affinity(node);
+
+		if (err)
+			dnet_log(n, DNET_LOG_ERROR, "Failed to bind io thread #%d to NUMA node %d: %s [%d]",
+				wio->thread_index, node, strerror(-err), err);
+	}
+
 	dnet_log(n, DNET_LOG_NOTICE, "started io thread: #%d, nonblocking: %d, backend: %zd",
 		wio->thread_index, nonblocking, pool->io ? (ssize_t)pool->io->backend_id : -1);
 
 	while (!n->need_exit && (!pool->io || !pool->io->need_exit)) {
-		r = NULL;
-		err = 0;
-
-		gettimeofday(&tv, NULL);
-		ts.tv_sec = tv.tv_sec + 1;
-		ts.tv_nsec = tv.tv_usec * 1000;
-
-		pthread_mutex_lock(&pool->lock);
-
 		/*
-		 * Comment below is only related to client IO threads processing replies from the server.
-		 *
-		 * At any given moment of time it is forbidden for 2 IO threads to process replies for the same transaction.
-		 * This may lead to the situation, when thread 1 processes final ack, while thread 2 is being handling received data.
-		 * Thread 1 will free resources, which leads thread 2 to crash the whole process.
-		 *
-		 * Thus any transaction may only be processed on single thread at any given time.
-		 * But it is possible to ping-pong transaction between multiple IO threads as long as each IO thread
-		 * processes different transaction reply simultaneously.
-		 *
-		 * We must set current thread index to -1 to highlight that current thread currently does not perform any task,
-		 * so it can be assigned any transaction reply, if it is not already claimed by another thread.
-		 *
-		 * If we leave here previously processed transaction id, we might stuck, since all threads will wait for those
-		 * transactions they are assigned to, thus not allowing any further process, since no thread will be able to
-		 * process current request and move to the next one.
+		 * Wakeup sequence must be read before queues are checked,
+		 * otherwise request queued right after the check may be left unnoticed until timeout.
 		 */
-		wio->trans = ~0ULL;
-
-		if (!(r = take_request(wio))) {
-			err = pthread_cond_timedwait(&pool->wait, &pool->lock, &ts);
-			if ((r = take_request(wio)))
-				err = 0;
-		}
+		seq = *(volatile int *)&pool->wait_seq;
 
-		if (r) {
-			list_del_init(&r->req_entry);
-			list_stat_size_decrease(&pool->list_stats, 1);
-			pthread_cond_broadcast(&n->io->full_wait);
+		r = take_request(wio);
+		if (!r) {
+			dnet_work_pool_park(pool, seq);
+			continue;
 		}
-		pthread_mutex_unlock(&pool->lock);
 
-		if (!r || err)
-			continue;
+		dnet_io_pool_unthrottle(n, pool->io ? &pool->io->pool : &n->io->pool, 0);
 
 		st = r->st;
 		cmd = r->header;
@@ -1076,7 +1635,7 @@ static void *dnet_io_process(void *data_)
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, dnet_cmd_string(cmd->cmd), r->hsize, r->dsize, dnet_work_io_mode_str(pool->mode),
 			pool->io ? (ssize_t)pool->io->backend_id : (ssize_t)-1);
 
-		err = dnet_process_recv(pool->io, st, r);
+		dnet_process_recv(pool->io, st, r);
 
 		dnet_log(n, DNET_LOG_DEBUG, "%s: %s: processed IO event: %p, cmd: %s",
 			dnet_state_dump_addr(st), dnet_dump_id(r->header), r, dnet_cmd_string(cmd->cmd));
@@ -1093,9 +1652,86 @@ static void *dnet_io_process(void *data_)
 	return NULL;
 }
 
+/*
+ * Creates SO_REUSEPORT listening socket at @addr for every per-core net thread except the one,
+ * which already polls listening socket of the node's own state, so that kernel spreads incoming
+ * connections over net threads. Sockets are closed in dnet_io_exit().
+ */
+int dnet_net_io_listen(struct dnet_node *n, struct dnet_addr *addr)
+{
+	struct dnet_io *io = n->io;
+	struct epoll_event ev;
+	int i, s, err;
+
+	for (i = 0; i < io->net_thread_num; ++i) {
+		struct dnet_net_io *nio = &io->net[i];
+
+		if (nio->epoll_fd == n->st->epoll_fd)
+			continue;
+
+		s = dnet_socket_create_listening(n, addr);
+		if (s < 0) {
+			err = s;
+			goto err_out_exit;
+		}
+
+		nio->accept_s = s;
+		nio->accept_data.st = n->st;
+		nio->accept_data.fd = s;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = &nio->accept_data;
+
+		err = epoll_ctl(nio->epoll_fd, EPOLL_CTL_ADD, s, &ev);
+		if (err < 0) {
+			err = -errno;
+			dnet_log_err(n, "Failed to add listening socket to net thread: %d", i);
+			goto err_out_exit;
+		}
+	}
+
+	return 0;
+
+err_out_exit:
+	return err;
+}
+
+/*
+ * Assigns CPUs to per-core net threads, one thread per allowed CPU while there are enough of them.
+ */
+static void dnet_io_net_topology_init(struct dnet_node *n)
+{
+	struct dnet_io *io = n->io;
+	int cpus[1024];
+	int num, i, node;
+
+	num = dnet_allowed_cpus(cpus, ARRAY_SIZE(cpus));
+	if (num <= 0) {
+		dnet_log(n, DNET_LOG_ERROR, "Failed to get allowed CPUs, net threads will not be pinned: %d", num);
+		return;
+	}
+
+	for (i = 0; i < num; ++i) {
+		node = dnet_cpu_numa_node(cpus[i]);
+		if (node >= io->numa_num)
+			io->numa_num = node + 1;
+	}
+
+	for (i = 0; i < io->net_thread_num; ++i) {
+		struct dnet_net_io *nio = &io->net[i];
+
+		nio->cpu = cpus[i % num];
+		node = dnet_cpu_numa_node(nio->cpu);
+		nio->numa_node = node > 0 ? node : 0;
+	}
+
+	dnet_log(n, DNET_LOG_INFO, "Per-core net threads: %d, allowed CPUs: %d, NUMA nodes: %d",
+			io->net_thread_num, num, io->numa_num);
+}
+
 int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 {
-	int err, i;
+	int err, i, net_num = 0;
 	int io_size = sizeof(struct dnet_io) + sizeof(struct dnet_net_io) * cfg->net_thread_num;
 
 	n->io = malloc(io_size);
@@ -1110,16 +1746,10 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 		goto err_out_free;
 	}
 
-	err = pthread_cond_init(&n->io->full_wait, NULL);
-	if (err) {
-		err = -err;
-		goto err_out_free_mutex;
-	}
-
 	err = pthread_mutex_init(&n->io->backends_lock, NULL);
 	if (err) {
 		err = -err;
-		goto err_out_free_cond;
+		goto err_out_free_mutex;
 	}
 
 	list_stat_init(&n->io->output_stats);
@@ -1130,11 +1760,29 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 	n->io->net_thread_pos = 0;
 	n->io->net = (struct dnet_net_io *)(n->io + 1);
 
-	err = dnet_work_pool_place_init(&n->io->pool.recv_pool);
+	for (i = 0; i < n->io->net_thread_num; ++i) {
+		struct dnet_net_io *nio = &n->io->net[i];
+
+		nio->cpu = -1;
+		nio->accept_s = -1;
+		nio->seed = i + 1;
+	}
+
+	n->io->numa_num = 1;
+	n->io->net_per_core = !!(cfg->flags & DNET_CFG_PER_CORE_NET_THREADS);
+	if (n->io->net_per_core)
+		dnet_io_net_topology_init(n);
+
+	err = dnet_io_pool_throttle_init(&n->io->pool);
 	if (err) {
 		goto err_out_free_backends_lock;
 	}
 
+	err = dnet_work_pool_place_init(&n->io->pool.recv_pool);
+	if (err) {
+		goto err_out_cleanup_throttle;
+	}
+
 	err = dnet_work_pool_alloc(&n->io->pool.recv_pool, n, NULL, cfg->io_thread_num, DNET_WORK_IO_MODE_BLOCKING, dnet_io_process);
 	if (err) {
 		goto err_out_cleanup_recv_place;
@@ -1154,11 +1802,19 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 		struct dnet_net_io *nio = &n->io->net[i];
 
 		nio->n = n;
+		atomic_init(&nio->rcv_buf_pinned, 0);
+
+		err = dnet_io_req_pool_init(&nio->req_pool);
+		if (err) {
+			dnet_log(n, DNET_LOG_ERROR, "Failed to initialize receive buffer pool: %d", err);
+			goto err_out_net_destroy;
+		}
 
 		nio->epoll_fd = epoll_create(10000);
 		if (nio->epoll_fd < 0) {
 			err = -errno;
 			dnet_log_err(n, "Failed to create epoll fd");
+			dnet_io_req_pool_cleanup(&nio->req_pool);
 			goto err_out_net_destroy;
 		}
 
@@ -1168,6 +1824,7 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 		err = pthread_create(&nio->tid, NULL, dnet_io_process_network, nio);
 		if (err) {
 			close(nio->epoll_fd);
+			dnet_io_req_pool_cleanup(&nio->req_pool);
 			err = -err;
 			dnet_log(n, DNET_LOG_ERROR, "Failed to create network processing thread: %d", err);
 			goto err_out_net_destroy;
@@ -1178,6 +1835,7 @@ int dnet_io_init(struct dnet_node *n, struct dnet_config *cfg)
 
 err_out_net_destroy:
 	n->need_exit = 1;
+	net_num = i;
 	while (--i >= 0) {
 		pthread_join(n->io->net[i].tid, NULL);
 		close(n->io->net[i].epoll_fd);
@@ -1189,12 +1847,16 @@ err_out_cleanup_recv_place_nb:
 err_out_free_recv_pool:
 	n->need_exit = 1;
 	dnet_work_pool_cleanup(&n->io->pool.recv_pool);
+
+	/* requests queued to IO pools are returned into receive buffer pools, they go last */
+	for (i = 0; i < net_num; ++i)
+		dnet_io_req_pool_cleanup(&n->io->net[i].req_pool);
 err_out_cleanup_recv_place:
 	dnet_work_pool_place_cleanup(&n->io->pool.recv_pool);
+err_out_cleanup_throttle:
+	dnet_io_pool_throttle_cleanup(n, &n->io->pool);
 err_out_free_backends_lock:
 	pthread_mutex_destroy(&n->io->backends_lock);
-err_out_free_cond:
-	pthread_cond_destroy(&n->io->full_wait);
 err_out_free_mutex:
 	pthread_mutex_destroy(&n->io->full_lock);
 err_out_free:
@@ -1231,6 +1893,13 @@ int dnet_server_io_init(struct dnet_node *n)
 			dnet_work_pool_place_cleanup(&io->pool.recv_pool);
 			goto err_out_free_backends_io;
 		}
+
+		err = dnet_io_pool_throttle_init(&io->pool);
+		if (err) {
+			dnet_work_pool_place_cleanup(&io->pool.recv_pool_nb);
+			dnet_work_pool_place_cleanup(&io->pool.recv_pool);
+			goto err_out_free_backends_io;
+		}
 	}
 	return 0;
 
@@ -1243,6 +1912,7 @@ err_out_free_backends_io:
 		struct dnet_backend_io *io = &n->io->backends[k];
 		dnet_work_pool_cleanup(&io->pool.recv_pool);
 		dnet_work_pool_cleanup(&io->pool.recv_pool_nb);
+		dnet_io_pool_throttle_cleanup(n, &io->pool);
 	}
 	free(n->io->backends);
 err_out_exit:
@@ -1265,6 +1935,8 @@ void dnet_io_exit(struct dnet_node *n)
 	for (i=0; i<io->net_thread_num; ++i) {
 		pthread_join(io->net[i].tid, NULL);
 		close(io->net[i].epoll_fd);
+		if (io->net[i].accept_s >= 0)
+			dnet_sock_close(n, io->net[i].accept_s);
 	}
 
 	dnet_work_pool_cleanup(&n->io->pool.recv_pool_nb);
@@ -1272,6 +1944,7 @@ void dnet_io_exit(struct dnet_node *n)
 
 	dnet_work_pool_cleanup(&n->io->pool.recv_pool);
 	dnet_work_pool_place_cleanup(&n->io->pool.recv_pool);
+	dnet_io_pool_throttle_cleanup(n, &n->io->pool);
 
 	for (j = 0; j < n->io->backends_count; ++j) {
 		struct dnet_backend_io *io = &n->io->backends[j];
@@ -1281,10 +1954,18 @@ void dnet_io_exit(struct dnet_node *n)
 			dnet_work_pool_cleanup(&io->pool.recv_pool_nb);
 		dnet_work_pool_place_cleanup(&io->pool.recv_pool_nb);
 		dnet_work_pool_place_cleanup(&io->pool.recv_pool);
+		dnet_io_pool_throttle_cleanup(n, &io->pool);
 	}
 
 	dnet_io_cleanup_states(n);
 
+	/*
+	 * Requests are returned into receive buffer pools of network threads by IO threads,
+	 * so pools are freed only when every IO pool, including backends' ones, has been drained and joined
+	 */
+	for (i = 0; i < io->net_thread_num; ++i)
+		dnet_io_req_pool_cleanup(&io->net[i].req_pool);
+
 	free(io);
 	n->io = NULL;
 }
@@ -1314,8 +1995,9 @@ err_out_exit:
 
 void dnet_backend_io_cleanup(struct dnet_node *n, struct dnet_backend_io *io)
 {
-	(void) n;
-
 	dnet_work_pool_cleanup(&io->pool.recv_pool);
 	dnet_work_pool_cleanup(&io->pool.recv_pool_nb);
+
+	/* pool is gone, its commands are routed to the node pool now */
+	dnet_io_pool_unthrottle(n, &io->pool, 1);
 }
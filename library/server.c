@@ -171,6 +171,14 @@ struct dnet_node *dnet_server_node_create(struct dnet_config_data *cfg_data)
 			goto err_out_state_destroy;
 		}
 
+		if (n->io->net_per_core) {
+			err = dnet_net_io_listen(n, &la);
+			if (err) {
+				dnet_log(n, DNET_LOG_ERROR, "failed to create per-core listening sockets: %s %d", strerror(-err), err);
+				goto err_out_state_destroy;
+			}
+		}
+
 		err = dnet_backend_init_all(n);
 		if (err) {
 			dnet_log(n, DNET_LOG_ERROR, "failed to init backends: %s %d", strerror(-err), err);
@@ -239,6 +247,7 @@ void dnet_server_node_destroy(struct dnet_node *n)
 	dnet_srw_cleanup(n);
 
 	dnet_counter_destroy(n);
+	dnet_trans_timers_destroy(&n->trans_timers);
 	dnet_locks_destroy(n);
 	dnet_local_addr_cleanup(n);
 	dnet_notify_exit(n);
@@ -42,22 +42,64 @@ static inline int dnet_trans_cmp(uint64_t t2, uint64_t t1)
 	return 0;
 }
 
+/*
+ * Transaction ids are allocated sequentially, multiplicative hashing spreads them
+ * over the table even when every n-th id goes to the same state.
+ */
+static inline unsigned int dnet_trans_table_slot(struct dnet_trans_table *table, uint64_t trans)
+{
+	return (unsigned int)((trans * 0x9e3779b97f4a7c15ULL) >> 32) & table->mask;
+}
+
+static void dnet_trans_table_link(struct dnet_trans_table *table, struct dnet_trans *a)
+{
+	unsigned int pos;
+
+	for (pos = dnet_trans_table_slot(table, a->trans); table->slots[pos]; pos = (pos + 1) & table->mask)
+		;
+
+	table->slots[pos] = a;
+}
+
+static int dnet_trans_table_resize(struct dnet_trans_table *table, unsigned int size)
+{
+	struct dnet_trans **old = table->slots;
+	unsigned int i, old_size = old ? table->mask + 1 : 0;
+
+	table->slots = calloc(size, sizeof(struct dnet_trans *));
+	if (!table->slots) {
+		table->slots = old;
+		return -ENOMEM;
+	}
+
+	table->mask = size - 1;
+
+	for (i = 0; i < old_size; ++i) {
+		if (old[i])
+			dnet_trans_table_link(table, old[i]);
+	}
+
+	free(old);
+	return 0;
+}
+
+void dnet_trans_table_cleanup(struct dnet_trans_table *table)
+{
+	free(table->slots);
+	memset(table, 0, sizeof(struct dnet_trans_table));
+}
+
 struct dnet_trans *dnet_trans_search(struct dnet_net_state *st, uint64_t trans)
 {
-	struct rb_root *root = &st->trans_root;
-	struct rb_node *n = root->rb_node;
-	struct dnet_trans *t = NULL;
-	int cmp = 1;
+	struct dnet_trans_table *table = &st->trans_table;
+	struct dnet_trans *t;
+	unsigned int pos;
 
-	while (n) {
-		t = rb_entry(n, struct dnet_trans, trans_entry);
+	if (!table->num)
+		return NULL;
 
-		cmp = dnet_trans_cmp(t->trans, trans);
-		if (cmp < 0)
-			n = n->rb_left;
-		else if (cmp > 0)
-			n = n->rb_right;
-		else
+	for (pos = dnet_trans_table_slot(table, trans); (t = table->slots[pos]); pos = (pos + 1) & table->mask) {
+		if (t->trans == trans)
 			return dnet_trans_get(t);
 	}
 
@@ -66,22 +108,19 @@ struct dnet_trans *dnet_trans_search(struct dnet_net_state *st, uint64_t trans)
 
 int dnet_trans_insert_nolock(struct dnet_net_state *st, struct dnet_trans *a)
 {
-	struct rb_root *root = &st->trans_root;
-	struct rb_node **n = &root->rb_node, *parent = NULL;
+	struct dnet_trans_table *table = &st->trans_table;
 	struct dnet_trans *t;
-	int cmp;
-
-	while (*n) {
-		parent = *n;
+	unsigned int pos;
+	int err;
 
-		t = rb_entry(parent, struct dnet_trans, trans_entry);
+	if (!table->slots || (table->num + 1) * 2 > table->mask + 1) {
+		err = dnet_trans_table_resize(table, table->slots ? (table->mask + 1) * 2 : DNET_TRANS_TABLE_MIN_SIZE);
+		if (err)
+			return err;
+	}
 
-		cmp = dnet_trans_cmp(t->trans, a->trans);
-		if (cmp < 0)
-			n = &parent->rb_left;
-		else if (cmp > 0)
-			n = &parent->rb_right;
-		else
+	for (pos = dnet_trans_table_slot(table, a->trans); (t = table->slots[pos]); pos = (pos + 1) & table->mask) {
+		if (t->trans == a->trans)
 			return -EEXIST;
 	}
 
@@ -90,112 +129,235 @@ int dnet_trans_insert_nolock(struct dnet_net_state *st, struct dnet_trans *a)
 			dnet_dump_id(&a->cmd.id), (unsigned long long)a->trans,
 			dnet_server_convert_dnet_addr(&a->st->addr));
 
-	rb_link_node(&a->trans_entry, parent, n);
-	rb_insert_color(&a->trans_entry, root);
+	table->slots[pos] = a;
+	table->num++;
+	a->trans_hashed = 1;
 	return 0;
 }
 
-/**
- * Timer functinos are used for timeout check.
- * We insert transaction into timer tree ordered/indexed by time-to-timeout-death.
- *
- * Checking thread periodically looks at the begining of the timer tree and kills
- * those transactions which are past the deadline. When transaction reply has been
- * received transaction is removed from the timer tree, its time-to-timeout-death
- * is updated and transaction inserted into the timer tree again.
- *
- * It is possible, that multiple transaction were created at the same time with
- * the same time-to-timeout-death, in this case we compare them additionaly using
- * transaction number, which is unique for node.
- *
- * This particular trans2,trans1 order of arguments is very significant - argument order plus
- * the way they are compared below ends up with ascending timeout order, i.e. the smaller
- * timeout (the closer death-time) the closer transaction is to the begining of the timer tree
- * (do not confuse it with the tree root).
+/*
+ * Returns transaction stored at or after slot @*pos and updates @*pos to its slot, NULL if there are no more.
+ * Removing returned transaction may move another one into its slot, so caller must not advance @*pos then.
  */
-static inline int dnet_trans_cmp_timer(struct dnet_trans *trans2, struct dnet_trans *trans1)
+struct dnet_trans *dnet_trans_table_next_nolock(struct dnet_net_state *st, unsigned int *pos)
 {
-	struct timeval *t1 = &trans1->time;
-	struct timeval *t2 = &trans2->time;
+	struct dnet_trans_table *table = &st->trans_table;
 
-	if (t1->tv_sec > t2->tv_sec)
-		return 1;
-	if (t1->tv_sec < t2->tv_sec)
-		return -1;
-	if (t1->tv_usec > t2->tv_usec)
-		return 1;
-	if (t1->tv_usec < t2->tv_usec)
-		return -1;
+	if (!table->num)
+		return NULL;
+
+	/* backward shift may have wrapped entry from the beginning of the table to its end */
+	if (*pos > table->mask)
+		*pos = 0;
+
+	for (; *pos <= table->mask; ++*pos) {
+		if (table->slots[*pos])
+			return table->slots[*pos];
+	}
+
+	for (*pos = 0; *pos <= table->mask; ++*pos) {
+		if (table->slots[*pos])
+			return table->slots[*pos];
+	}
 
-	return dnet_trans_cmp(trans2->trans, trans1->trans);
+	return NULL;
 }
 
-struct dnet_trans *dnet_trans_search_timer(struct dnet_net_state *st, struct dnet_trans *trans)
+uint64_t dnet_trans_wheel_time(void)
 {
-	struct rb_root *root = &st->timer_root;
-	struct rb_node *n = root->rb_node;
-	struct dnet_trans *t = NULL;
-	int cmp = 1;
+	struct timespec ts;
 
-	while (n) {
-		t = rb_entry(n, struct dnet_trans, timer_entry);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-		cmp = dnet_trans_cmp_timer(t, trans);
-		if (cmp < 0)
-			n = n->rb_left;
-		else if (cmp > 0)
-			n = n->rb_right;
-		else
-			return dnet_trans_get(t);
+int dnet_trans_timers_init(struct dnet_trans_timers *tm)
+{
+	pthread_condattr_t attr;
+	struct dnet_trans_wheel *w;
+	uint64_t now = dnet_trans_wheel_time();
+	int err, i, j, k;
+
+	memset(tm, 0, sizeof(struct dnet_trans_timers));
+
+	err = pthread_mutex_init(&tm->lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_exit;
 	}
 
-	return NULL;
+	err = pthread_condattr_init(&attr);
+	if (err) {
+		err = -err;
+		goto err_out_destroy_lock;
+	}
+
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	err = pthread_cond_init(&tm->wait, &attr);
+	pthread_condattr_destroy(&attr);
+	if (err) {
+		err = -err;
+		goto err_out_destroy_lock;
+	}
+
+	for (k = 0; k < DNET_TRANS_WHEEL_SHARDS; ++k) {
+		w = &tm->wheels[k];
+
+		err = pthread_mutex_init(&w->lock, NULL);
+		if (err) {
+			err = -err;
+			goto err_out_destroy_wheels;
+		}
+
+		INIT_LIST_HEAD(&w->expired);
+		for (i = 0; i < DNET_TRANS_WHEEL_LEVELS; ++i) {
+			for (j = 0; j < DNET_TRANS_WHEEL_SIZE; ++j)
+				INIT_LIST_HEAD(&w->slots[i][j]);
+		}
+
+		w->now = now;
+	}
+
+	return 0;
+
+err_out_destroy_wheels:
+	while (--k >= 0)
+		pthread_mutex_destroy(&tm->wheels[k].lock);
+	pthread_cond_destroy(&tm->wait);
+err_out_destroy_lock:
+	pthread_mutex_destroy(&tm->lock);
+err_out_exit:
+	return err;
 }
 
-int dnet_trans_insert_timer_nolock(struct dnet_net_state *st, struct dnet_trans *a)
+void dnet_trans_timers_destroy(struct dnet_trans_timers *tm)
 {
-	struct rb_root *root = &st->timer_root;
-	struct rb_node **n = &root->rb_node, *parent = NULL;
-	struct dnet_trans *t;
-	int cmp;
+	int k;
 
-	while (*n) {
-		parent = *n;
+	for (k = 0; k < DNET_TRANS_WHEEL_SHARDS; ++k)
+		pthread_mutex_destroy(&tm->wheels[k].lock);
 
-		t = rb_entry(parent, struct dnet_trans, timer_entry);
+	pthread_cond_destroy(&tm->wait);
+	pthread_mutex_destroy(&tm->lock);
+}
 
-		cmp = dnet_trans_cmp_timer(t, a);
-		if (cmp < 0)
-			n = &parent->rb_left;
-		else if (cmp > 0)
-			n = &parent->rb_right;
-		else
-			return -EEXIST;
+static inline struct dnet_trans_wheel *dnet_trans_state_wheel(struct dnet_net_state *st)
+{
+	uint32_t hash = (uint32_t)((uintptr_t)st >> 4) * 2654435761U;
+
+	return &st->n->trans_timers.wheels[hash >> (32 - DNET_TRANS_WHEEL_SHARD_BITS)];
+}
+
+/*
+ * Wakes checking thread up, @tm->wakeup is set so that wakeup is not lost if thread is not sleeping yet.
+ */
+static void dnet_trans_timers_wakeup(struct dnet_trans_timers *tm)
+{
+	pthread_mutex_lock(&tm->lock);
+	tm->wakeup = 1;
+	pthread_cond_signal(&tm->wait);
+	pthread_mutex_unlock(&tm->lock);
+}
+
+/*
+ * Links transaction into the slot of the lowest level which covers its deadline relative to @w->now.
+ * Transactions in higher levels are moved (cascaded) down when wheel reaches their slot.
+ */
+static void dnet_trans_wheel_link(struct dnet_trans_wheel *w, struct dnet_trans *t)
+{
+	uint64_t expires = t->expires;
+	uint64_t delta;
+	int level;
+
+	if (expires < w->now) {
+		list_add_tail(&t->timer_entry, &w->expired);
+		return;
 	}
 
-	rb_link_node(&a->timer_entry, parent, n);
-	rb_insert_color(&a->timer_entry, root);
-	return 0;
+	delta = expires - w->now;
+	for (level = 0; level < DNET_TRANS_WHEEL_LEVELS - 1; ++level) {
+		if (delta < (1ULL << (DNET_TRANS_WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	if (delta >= (1ULL << (DNET_TRANS_WHEEL_BITS * DNET_TRANS_WHEEL_LEVELS)))
+		expires = w->now + (1ULL << (DNET_TRANS_WHEEL_BITS * DNET_TRANS_WHEEL_LEVELS)) - 1;
+
+	list_add_tail(&t->timer_entry,
+		&w->slots[level][(expires >> (DNET_TRANS_WHEEL_BITS * level)) & DNET_TRANS_WHEEL_MASK]);
+}
+
+/*
+ * (Re)arms transaction timer according to @a->expires.
+ * Called with @st->trans_lock held, lock of the state's wheel nests inside of it.
+ */
+void dnet_trans_insert_timer_nolock(struct dnet_net_state *st, struct dnet_trans *a)
+{
+	struct dnet_trans_wheel *w = dnet_trans_state_wheel(st);
+	int wakeup;
+
+	pthread_mutex_lock(&w->lock);
+	if (list_empty(&a->timer_entry))
+		w->num++;
+	else
+		list_del_init(&a->timer_entry);
+
+	dnet_trans_wheel_link(w, a);
+
+	/* wake checking thread up if it sleeps past the new deadline, only once per sleep */
+	wakeup = w->next_wakeup && a->expires < w->next_wakeup;
+	if (wakeup)
+		w->next_wakeup = 0;
+	pthread_mutex_unlock(&w->lock);
+
+	if (wakeup)
+		dnet_trans_timers_wakeup(&st->n->trans_timers);
 }
 
 void dnet_trans_remove_timer_nolock(struct dnet_net_state *st, struct dnet_trans *t)
 {
-	if (t->timer_entry.rb_parent_color) {
-		rb_erase(&t->timer_entry, &st->timer_root);
-		t->timer_entry.rb_parent_color = 0;
+	struct dnet_trans_wheel *w = dnet_trans_state_wheel(st);
+
+	pthread_mutex_lock(&w->lock);
+	if (!list_empty(&t->timer_entry)) {
+		list_del_init(&t->timer_entry);
+		w->num--;
 	}
+	pthread_mutex_unlock(&w->lock);
 }
 
+/*
+ * Entries following removed one in the same probe sequence are shifted back,
+ * so table never contains tombstones and lookups stop at the first empty slot.
+ */
 void dnet_trans_remove_nolock(struct dnet_net_state *st, struct dnet_trans *t)
 {
-	if (!t->trans_entry.rb_parent_color) {
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: trying to remove out-of-trans-tree transaction %llu.",
+	struct dnet_trans_table *table = &st->trans_table;
+	struct dnet_trans *it;
+	unsigned int pos, next, home;
+
+	if (!t->trans_hashed) {
+		dnet_log(st->n, DNET_LOG_ERROR, "%s: trying to remove out-of-trans-table transaction %llu.",
 			dnet_dump_id(&t->cmd.id), (unsigned long long)t->trans);
 		return;
 	}
 
-	rb_erase(&t->trans_entry, &st->trans_root);
-	t->trans_entry.rb_parent_color = 0;
+	for (pos = dnet_trans_table_slot(table, t->trans); table->slots[pos] != t; pos = (pos + 1) & table->mask)
+		;
+
+	for (next = (pos + 1) & table->mask; (it = table->slots[next]); next = (next + 1) & table->mask) {
+		home = dnet_trans_table_slot(table, it->trans);
+
+		/* @it may only be moved into @pos if @pos lies between its home slot and its current slot */
+		if (((next - home) & table->mask) >= ((next - pos) & table->mask)) {
+			table->slots[pos] = it;
+			pos = next;
+		}
+	}
+
+	table->slots[pos] = NULL;
+	table->num--;
+	t->trans_hashed = 0;
 
 	dnet_trans_remove_timer_nolock(st, t);
 }
@@ -226,6 +388,7 @@ struct dnet_trans *dnet_trans_alloc(struct dnet_node *n, uint64_t size)
 
 	atomic_init(&t->refcnt, 1);
 	INIT_LIST_HEAD(&t->trans_list_entry);
+	INIT_LIST_HEAD(&t->timer_entry);
 
 	gettimeofday(&t->start, NULL);
 
@@ -256,7 +419,7 @@ void dnet_trans_destroy(struct dnet_trans *t)
 		list_del_init(&t->trans_list_entry);
 		pthread_mutex_unlock(&st->trans_lock);
 
-		if (t->trans_entry.rb_parent_color)
+		if (t->trans_hashed)
 			dnet_trans_remove(t);
 	} else if (!list_empty(&t->trans_list_entry)) {
 		assert(0);
@@ -487,16 +650,37 @@ void dnet_trans_clean_list(struct list_head *head)
 	}
 }
 
-int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_head *head)
+static void dnet_trans_log_timeout(struct dnet_net_state *st, struct dnet_trans *t)
 {
-	struct dnet_trans *t;
-	struct rb_node *rb_node;
-	struct timeval tv;
-	int trans_moved = 0;
 	char str[64];
 	struct tm tm;
 
-	gettimeofday(&tv, NULL);
+	localtime_r((time_t *)&t->start.tv_sec, &tm);
+	strftime(str, sizeof(str), "%F %R:%S", &tm);
+
+	// TODO: We may use dnet_log_record_set_request_id here,
+	// but blackhole currently has higher priority for scoped attributes =(
+	dnet_node_set_trace_id(st->n->log, t->cmd.trace_id, t->cmd.flags & DNET_FLAGS_TRACE_BIT, -1);
+
+	dnet_log(st->n, DNET_LOG_ERROR, "%s: %s: backend: %d, trans: %llu TIMEOUT/need-exit: "
+			"stall-check wait-ts: %ld.%03ld, need-exit: %d, cmd: %s [%d], started: %s.%06lu",
+			dnet_state_dump_addr(st), dnet_dump_id(&t->cmd.id), t->cmd.backend_id, (unsigned long long)t->trans,
+			(long)t->wait_ts.tv_sec, (long)t->wait_ts.tv_nsec / 1000000,
+			st->__need_exit,
+			dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
+			str, t->start.tv_usec);
+
+	dnet_node_unset_trace_id();
+}
+
+/*
+ * Moves all transactions of the state being reset into @head list.
+ */
+int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_head *head)
+{
+	struct dnet_trans *t;
+	unsigned int pos = 0;
+	int trans_moved = 0;
 
 	while (1) {
 		/* lock is being locked/unlocked to get a chance for IO thread to process other transactions
@@ -504,35 +688,13 @@ int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_h
 		 */
 		pthread_mutex_lock(&st->trans_lock);
 
-		t = NULL;
-		rb_node = rb_first(&st->timer_root);
-		if (!rb_node) {
-			pthread_mutex_unlock(&st->trans_lock);
-			break;
-		}
-
-		t = rb_entry(rb_node, struct dnet_trans, timer_entry);
-		if ((t->time.tv_sec >= tv.tv_sec) && !st->__need_exit) {
+		t = dnet_trans_table_next_nolock(st, &pos);
+		if (!t) {
 			pthread_mutex_unlock(&st->trans_lock);
 			break;
 		}
 
-		localtime_r((time_t *)&t->start.tv_sec, &tm);
-		strftime(str, sizeof(str), "%F %R:%S", &tm);
-
-		// TODO: We may use dnet_log_record_set_request_id here,
-		// but blackhole currently has higher priority for scoped attributes =(
-		dnet_node_set_trace_id(st->n->log, t->cmd.trace_id, t->cmd.flags & DNET_FLAGS_TRACE_BIT, -1);
-
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: %s: backend: %d, trans: %llu TIMEOUT/need-exit: "
-				"stall-check wait-ts: %ld, need-exit: %d, cmd: %s [%d], started: %s.%06lu",
-				dnet_state_dump_addr(st), dnet_dump_id(&t->cmd.id), t->cmd.backend_id, (unsigned long long)t->trans,
-				(unsigned long)t->wait_ts.tv_sec,
-				st->__need_exit,
-				dnet_cmd_string(t->cmd.cmd), t->cmd.cmd,
-				str, t->start.tv_usec);
-
-		dnet_node_unset_trace_id();
+		dnet_trans_log_timeout(st, t);
 
 		trans_moved++;
 
@@ -556,34 +718,159 @@ int dnet_trans_iterate_move_transaction(struct dnet_net_state *st, struct list_h
 	return trans_moved;
 }
 
-static void dnet_trans_check_stall(struct dnet_net_state *st, struct list_head *head)
+/*
+ * Timeouts are checked every millisecond, but stall counter must count seconds with timeouts in a row
+ * like it did when states were checked once per second, so it is increased at most once per interval.
+ */
+#define DNET_TRANS_STALL_INTERVAL	1000
+
+/*
+ * Is called once per wheel advance for every state which has @trans_timeout timed out transactions.
+ */
+static void dnet_trans_check_stall(struct dnet_net_state *st, int trans_timeout, struct list_head *head)
 {
-	int trans_timeout = dnet_trans_iterate_move_transaction(st, head);
+	struct dnet_node *n = st->n;
+	uint64_t now = dnet_trans_wheel_time();
+
+	if (st->stall && now < st->stall_tick + DNET_TRANS_STALL_INTERVAL) {
+		dnet_log(n, DNET_LOG_ERROR, "%s: TIMEOUT: transactions: %d, stall counter: %d/%ld, weight: %f",
+				dnet_state_dump_addr(st), trans_timeout, st->stall, n->stall_count, st->weight);
+		return;
+	}
 
-	if (trans_timeout) {
-		st->stall++;
+	st->stall++;
+	st->stall_tick = now;
 
-		if (st->weight >= 2)
-			st->weight /= 10;
+	if (st->weight >= 2)
+		st->weight /= 10;
 
-		dnet_log(st->n, DNET_LOG_ERROR, "%s: TIMEOUT: transactions: %d, stall counter: %d/%u, weight: %f",
-				dnet_state_dump_addr(st), trans_timeout, st->stall, DNET_DEFAULT_STALL_TRANSACTIONS, st->weight);
+	dnet_log(n, DNET_LOG_ERROR, "%s: TIMEOUT: transactions: %d, stall counter: %d/%ld, weight: %f",
+			dnet_state_dump_addr(st), trans_timeout, st->stall, n->stall_count, st->weight);
 
-		if (st->stall >= st->n->stall_count && st != st->n->st)
-			dnet_state_reset_nolock_noclean(st, -ETIMEDOUT, head);
+	if (st->stall >= n->stall_count && st != n->st) {
+		pthread_mutex_lock(&n->state_lock);
+		dnet_state_reset_nolock_noclean(st, -ETIMEDOUT, head);
+		pthread_mutex_unlock(&n->state_lock);
 	}
 }
 
-static void dnet_check_all_states(struct dnet_node *n)
+/*
+ * Moves wheel forward up to and including @time tick, transactions whose deadline has passed are put into @w->expired.
+ * Idle wheel jumps right to @time.
+ */
+static void dnet_trans_wheel_advance(struct dnet_trans_wheel *w, uint64_t time)
 {
-	struct dnet_net_state *st, *tmp;
+	struct dnet_trans *t, *tmp;
+	struct list_head *slot;
+	unsigned int idx;
+	int level;
+
+	if (!w->num) {
+		if (w->now <= time)
+			w->now = time + 1;
+		return;
+	}
+
+	while (w->now <= time) {
+		idx = w->now & DNET_TRANS_WHEEL_MASK;
+
+		/* wheel has made full turn at the previous level, move next level's slot down */
+		for (level = 1; !idx && level < DNET_TRANS_WHEEL_LEVELS; ++level) {
+			idx = (w->now >> (DNET_TRANS_WHEEL_BITS * level)) & DNET_TRANS_WHEEL_MASK;
+			slot = &w->slots[level][idx];
+
+			list_for_each_entry_safe(t, tmp, slot, timer_entry) {
+				list_del(&t->timer_entry);
+				dnet_trans_wheel_link(w, t);
+			}
+		}
+
+		list_splice_init(&w->slots[0][w->now & DNET_TRANS_WHEEL_MASK], w->expired.prev);
+		w->now++;
+	}
+}
+
+/*
+ * Returns tick checking thread has to wake up at: the first non-empty slot or the next cascade,
+ * but no later than in a second, so that node exit is noticed.
+ */
+static uint64_t dnet_trans_wheel_next_tick(struct dnet_trans_wheel *w)
+{
+	uint64_t tick;
+
+	if (!w->num)
+		return w->now + 1000;
+
+	for (tick = w->now; tick < w->now + 1000; ++tick) {
+		if (tick != w->now && !(tick & DNET_TRANS_WHEEL_MASK))
+			break;
+		if (!list_empty(&w->slots[0][tick & DNET_TRANS_WHEEL_MASK]))
+			break;
+	}
+
+	return tick;
+}
+
+static void dnet_trans_wheel_expire(struct dnet_node *n)
+{
+	struct dnet_trans_wheel *w;
+	struct dnet_net_state *st;
+	struct dnet_trans *t, *tmp;
+	LIST_HEAD(timedout);
 	LIST_HEAD(head);
+	int timeout, k = 0;
+
+	while (k < DNET_TRANS_WHEEL_SHARDS) {
+		w = &n->trans_timers.wheels[k];
+
+		pthread_mutex_lock(&w->lock);
+		if (list_empty(&w->expired)) {
+			pthread_mutex_unlock(&w->lock);
+			k++;
+			continue;
+		}
 
-	pthread_mutex_lock(&n->state_lock);
-	list_for_each_entry_safe(st, tmp, &n->dht_state_list, node_entry) {
-		dnet_trans_check_stall(st, &head);
+		t = list_first_entry(&w->expired, struct dnet_trans, timer_entry);
+		list_del_init(&t->timer_entry);
+		w->num--;
+		dnet_trans_get(t);
+		pthread_mutex_unlock(&w->lock);
+
+		/*
+		 * Transaction may have been completed or received reply with DNET_FLAGS_MORE and rearmed
+		 * its timer while wheel lock was dropped, it has not timed out in both cases.
+		 */
+		st = t->st;
+		pthread_mutex_lock(&st->trans_lock);
+		timeout = t->trans_hashed && list_empty(&t->timer_entry);
+		if (timeout) {
+			dnet_trans_log_timeout(st, t);
+			dnet_trans_remove_nolock(st, t);
+			list_add_tail(&t->trans_list_entry, &timedout);
+		}
+		pthread_mutex_unlock(&st->trans_lock);
+
+		dnet_trans_put(t);
+	}
+
+	/*
+	 * Timed out transactions hold references to their states, so states stay alive
+	 * until @head is cleaned.
+	 */
+	while (!list_empty(&timedout)) {
+		st = list_first_entry(&timedout, struct dnet_trans, trans_list_entry)->st;
+		timeout = 0;
+
+		list_for_each_entry_safe(t, tmp, &timedout, trans_list_entry) {
+			if (t->st != st)
+				continue;
+
+			list_move_tail(&t->trans_list_entry, &head);
+			timeout++;
+		}
+
+		dnet_trans_check_stall(st, timeout, &head);
 	}
-	pthread_mutex_unlock(&n->state_lock);
 
 	dnet_trans_clean_list(&head);
 }
@@ -625,15 +912,69 @@ static void *dnet_reconnect_process(void *data)
 }
 
 
+/*
+ * Advances every wheel, each wheel's lock is held only while that wheel is advanced.
+ * Returns non-zero if there are expired transactions, otherwise @tick is set to the earliest tick
+ * checking thread has to wake up at.
+ */
+static int dnet_trans_timers_advance(struct dnet_trans_timers *tm, uint64_t *tick)
+{
+	struct dnet_trans_wheel *w;
+	uint64_t time = dnet_trans_wheel_time();
+	uint64_t next;
+	int k, expired = 0;
+
+	*tick = time + 1000;
+
+	for (k = 0; k < DNET_TRANS_WHEEL_SHARDS; ++k) {
+		w = &tm->wheels[k];
+
+		pthread_mutex_lock(&w->lock);
+		dnet_trans_wheel_advance(w, time);
+
+		if (list_empty(&w->expired)) {
+			next = dnet_trans_wheel_next_tick(w);
+			if (next < *tick)
+				*tick = next;
+
+			w->next_wakeup = next;
+		} else {
+			w->next_wakeup = 0;
+			expired = 1;
+		}
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	return expired;
+}
+
 static void *dnet_check_process(void *data)
 {
 	struct dnet_node *n = data;
+	struct dnet_trans_timers *tm = &n->trans_timers;
+	struct timespec ts;
+	uint64_t tick;
 
 	dnet_set_name("dnet_check");
 
 	while (!n->need_exit) {
-		dnet_check_all_states(n);
-		sleep(1);
+		/* earlier deadline added while wheels are being advanced sets @tm->wakeup again */
+		pthread_mutex_lock(&tm->lock);
+		tm->wakeup = 0;
+		pthread_mutex_unlock(&tm->lock);
+
+		if (dnet_trans_timers_advance(tm, &tick)) {
+			dnet_trans_wheel_expire(n);
+			continue;
+		}
+
+		ts.tv_sec = tick / 1000;
+		ts.tv_nsec = (tick % 1000) * 1000000;
+
+		pthread_mutex_lock(&tm->lock);
+		if (!tm->wakeup)
+			pthread_cond_timedwait(&tm->wait, &tm->lock, &ts);
+		pthread_mutex_unlock(&tm->lock);
 	}
 
 	return NULL;
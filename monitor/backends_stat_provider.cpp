@@ -63,6 +63,17 @@ static void dump_list_stats(rapidjson::Value &stat, list_stat &list_stats, rapid
 	    .AddMember("volume", list_stats.volume, allocator);
 }
 
+static void dump_pool_stats(rapidjson::Value &stat, struct dnet_work_pool *pool, rapidjson::Document::AllocatorType &allocator) {
+	list_stat list_stats;
+	dnet_work_pool_list_stat(pool, &list_stats);
+	dump_list_stats(stat, list_stats, allocator);
+}
+
+static void dump_throttle_stats(rapidjson::Value &stat, const struct dnet_io_pool &pool, rapidjson::Document::AllocatorType &allocator) {
+	stat.AddMember("throttled_states", pool.throttled, allocator)
+	    .AddMember("throttle_count", pool.throttle_count, allocator);
+}
+
 /*
  * Fills io section of one backend
  */
@@ -72,13 +83,17 @@ static void fill_backend_io(rapidjson::Value &stat_value,
 	rapidjson::Value io_value(rapidjson::kObjectType);
 
 	rapidjson::Value blocking_stat(rapidjson::kObjectType);
-	dump_list_stats(blocking_stat, backend.pool.recv_pool.pool->list_stats, allocator);
+	dump_pool_stats(blocking_stat, backend.pool.recv_pool.pool, allocator);
 	io_value.AddMember("blocking", blocking_stat, allocator);
 
 	rapidjson::Value nonblocking_stat(rapidjson::kObjectType);
-	dump_list_stats(nonblocking_stat, backend.pool.recv_pool_nb.pool->list_stats, allocator);
+	dump_pool_stats(nonblocking_stat, backend.pool.recv_pool_nb.pool, allocator);
 	io_value.AddMember("nonblocking", nonblocking_stat, allocator);
 
+	rapidjson::Value throttle_stat(rapidjson::kObjectType);
+	dump_throttle_stats(throttle_stat, backend.pool, allocator);
+	io_value.AddMember("throttle", throttle_stat, allocator);
+
 	stat_value.AddMember("io", io_value, allocator);
 }
 
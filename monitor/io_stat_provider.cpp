@@ -32,6 +32,12 @@ void dump_list_stats(rapidjson::Value &stat, list_stat &list_stats, rapidjson::D
 	    .AddMember("volume", list_stats.volume, allocator);
 }
 
+void dump_pool_stats(rapidjson::Value &stat, struct dnet_work_pool *pool, rapidjson::Document::AllocatorType &allocator) {
+	list_stat list_stats;
+	dnet_work_pool_list_stat(pool, &list_stats);
+	dump_list_stats(stat, list_stats, allocator);
+}
+
 void dump_states_stats(rapidjson::Value &stat, struct dnet_node *n, rapidjson::Document::AllocatorType &allocator) {
 	struct dnet_net_state *st;
 
@@ -51,6 +57,58 @@ void dump_states_stats(rapidjson::Value &stat, struct dnet_node *n, rapidjson::D
 	pthread_mutex_unlock(&n->state_lock);
 }
 
+void dump_recv_buffers_stats(rapidjson::Value &stat, struct dnet_io *io, rapidjson::Document::AllocatorType &allocator) {
+	uint64_t total_hits = 0, total_misses = 0, oversized = 0;
+	int64_t resident_size = 0, cached_size = 0;
+
+	rapidjson::Value classes(rapidjson::kArrayType);
+
+	for (int i = 0; i < DNET_IO_REQ_POOL_CLASSES; ++i) {
+		uint64_t hits = 0, misses = 0, cached = 0;
+		size_t size = 0;
+
+		for (int j = 0; j < io->net_thread_num; ++j) {
+			struct dnet_io_req_pool_class *c = &io->net[j].req_pool.classes[i];
+
+			size = c->size;
+			hits += c->hits;
+			misses += c->misses;
+			cached += (uint64_t)atomic_read(&c->cached) * c->size;
+		}
+
+		rapidjson::Value class_stat(rapidjson::kObjectType);
+		class_stat.AddMember("size", (uint64_t)size, allocator)
+		          .AddMember("hits", hits, allocator)
+		          .AddMember("misses", misses, allocator)
+		          .AddMember("cached_size", cached, allocator);
+		classes.PushBack(class_stat, allocator);
+
+		total_hits += hits;
+		total_misses += misses;
+		cached_size += cached;
+	}
+
+	for (int j = 0; j < io->net_thread_num; ++j) {
+		oversized += io->net[j].req_pool.oversized;
+		resident_size += atomic_read(&io->net[j].req_pool.resident_size);
+	}
+
+	const uint64_t total = total_hits + total_misses + oversized;
+
+	stat.AddMember("hits", total_hits, allocator)
+	    .AddMember("misses", total_misses, allocator)
+	    .AddMember("oversized", oversized, allocator)
+	    .AddMember("hit_rate", total ? (double)total_hits / total : 0., allocator)
+	    .AddMember("resident_size", resident_size, allocator)
+	    .AddMember("cached_size", cached_size, allocator)
+	    .AddMember("classes", classes, allocator);
+}
+
+static void dump_throttle_stats(rapidjson::Value &stat, const struct dnet_io_pool &pool, rapidjson::Document::AllocatorType &allocator) {
+	stat.AddMember("throttled_states", pool.throttled, allocator)
+	    .AddMember("throttle_count", pool.throttle_count, allocator);
+}
+
 std::string io_stat_provider::json(uint64_t categories) const {
 	if (!(categories & DNET_MONITOR_IO))
 		return std::string();
@@ -60,11 +118,11 @@ std::string io_stat_provider::json(uint64_t categories) const {
 	auto &allocator = doc.GetAllocator();
 
 	rapidjson::Value blocking_stat(rapidjson::kObjectType);
-	dump_list_stats(blocking_stat, m_node->io->pool.recv_pool.pool->list_stats, allocator);
+	dump_pool_stats(blocking_stat, m_node->io->pool.recv_pool.pool, allocator);
 	doc.AddMember("blocking", blocking_stat, allocator);
 
 	rapidjson::Value nonblocking_stat(rapidjson::kObjectType);
-	dump_list_stats(nonblocking_stat, m_node->io->pool.recv_pool_nb.pool->list_stats, allocator);
+	dump_pool_stats(nonblocking_stat, m_node->io->pool.recv_pool_nb.pool, allocator);
 	doc.AddMember("nonblocking", nonblocking_stat, allocator);
 
 	rapidjson::Value output_stat(rapidjson::kObjectType);
@@ -75,7 +133,16 @@ std::string io_stat_provider::json(uint64_t categories) const {
 	dump_states_stats(states_stat, m_node, allocator);
 	doc.AddMember("states", states_stat, allocator);
 
-	doc.AddMember("blocked", m_node->io->blocked == 1, allocator);
+	rapidjson::Value recv_buffers_stat(rapidjson::kObjectType);
+	dump_recv_buffers_stats(recv_buffers_stat, m_node->io, allocator);
+	doc.AddMember("recv_buffers", recv_buffers_stat, allocator);
+
+	rapidjson::Value throttle_stat(rapidjson::kObjectType);
+	dump_throttle_stats(throttle_stat, m_node->io->pool, allocator);
+	doc.AddMember("throttle", throttle_stat, allocator);
+
+	/* net threads are not suspended anymore, connections are throttled per io pool instead */
+	doc.AddMember("blocked", m_node->io->pool.throttled != 0, allocator);
 
 	rapidjson::StringBuffer buffer;
 	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -76,6 +76,12 @@ DEFINE_ACTION(CACHE_SYNC_BEFORE_OPERATION);
 DEFINE_ACTION(CACHE_ERASE_ITERATE);
 DEFINE_ACTION(CACHE_SYNC_ITERATE);
 DEFINE_ACTION(CACHE_DNET_OPLOCK);
+DEFINE_ACTION(CACHE_WAIT_FOR_SYNC);
+DEFINE_ACTION(CACHE_MERGE_APPEND_ONLY);
+DEFINE_ACTION(CACHE_INDEXES_FIND);
+DEFINE_ACTION(CACHE_INDEXES_UPDATE);
+DEFINE_ACTION(CACHE_LOAD_INDEX_TABLE);
+DEFINE_ACTION(CACHE_PACK_INDEX_TABLE);
 DEFINE_ACTION(CACHE_DESTRUCT);
 
 DEFINE_ACTION(BACKEND_EBLOB);
@@ -0,0 +1,223 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares key lookup structures of cache shard at large number of resident objects:
+ *  - hash_index: open addressing table with fingerprinted cache line sized chunks (current cache index)
+ *  - ordered tree keyed by 64-byte ids, which is how treap used to find objects
+ * and measures event heap which keeps lifetime/sync events of objects.
+ */
+
+#include "../cache/hash_index.hpp"
+#include "../cache/event_heap.hpp"
+
+#include <elliptics/timer.hpp>
+
+#include <boost/program_options.hpp>
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace ioremap;
+
+struct bench_node : public cache::event_heap_node_t
+{
+	dnet_raw_id m_id;
+	size_t m_eventtime;
+
+	const dnet_raw_id &id() const {
+		return m_id;
+	}
+
+	size_t eventtime() const {
+		return m_eventtime;
+	}
+};
+
+struct id_less
+{
+	bool operator() (const unsigned char *lhs, const unsigned char *rhs) const {
+		return memcmp(lhs, rhs, DNET_ID_SIZE) < 0;
+	}
+};
+
+static void report(const char *name, size_t operations, int64_t msecs)
+{
+	printf("%-28s operations: %zu, time: %lld ms, %.1f ns/op\n",
+			name, operations, (long long)msecs, (double)msecs * 1000000 / operations);
+}
+
+static void check(bool condition, const char *what)
+{
+	if (!condition)
+		throw std::runtime_error(what);
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Cache index benchmark options");
+
+	size_t objects_number, lookups_number;
+	bool with_tree;
+
+	generic.add_options()
+		("help", "This help message")
+		("objects", bpo::value<size_t>(&objects_number)->default_value(10000000), "Number of resident objects")
+		("lookups", bpo::value<size_t>(&lookups_number)->default_value(10000000), "Number of lookups of every kind")
+		("without-tree", "Do not measure ordered tree, it takes roughly as much memory as objects themselves")
+		;
+
+	bpo::variables_map vm;
+
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(generic).run(), vm);
+
+		if (vm.count("help")) {
+			std::cout << generic << std::endl;
+			return 0;
+		}
+
+		bpo::notify(vm);
+
+		if (objects_number == 0 || lookups_number == 0)
+			throw std::invalid_argument("objects and lookups must be positive");
+
+		with_tree = !vm.count("without-tree");
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	try {
+		std::mt19937_64 rng(0);
+		std::vector<bench_node> nodes(objects_number);
+		std::vector<dnet_raw_id> missing(1024);
+
+		for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+			for (size_t i = 0; i < DNET_ID_SIZE; i += sizeof(uint64_t)) {
+				uint64_t value = rng();
+				memcpy(it->m_id.id + i, &value, sizeof(value));
+			}
+			it->m_eventtime = std::numeric_limits<size_t>::max();
+		}
+
+		for (auto it = missing.begin(); it != missing.end(); ++it) {
+			for (size_t i = 0; i < DNET_ID_SIZE; i += sizeof(uint64_t)) {
+				uint64_t value = rng();
+				memcpy(it->id + i, &value, sizeof(value));
+			}
+		}
+
+		std::vector<size_t> order(lookups_number);
+		for (auto it = order.begin(); it != order.end(); ++it)
+			*it = rng() % objects_number;
+
+		printf("objects: %zu, lookups: %zu\n", objects_number, lookups_number);
+
+		{
+			cache::hash_index<bench_node> index;
+			elliptics::timer tm;
+
+			for (auto it = nodes.begin(); it != nodes.end(); ++it)
+				index.insert(&*it);
+			report("hash_index insert", objects_number, tm.restart());
+
+			size_t found = 0;
+			for (auto it = order.begin(); it != order.end(); ++it)
+				found += index.find(nodes[*it].m_id.id) == &nodes[*it];
+			report("hash_index lookup hit", lookups_number, tm.restart());
+			check(found == lookups_number, "hash_index: existing object was not found");
+
+			found = 0;
+			for (size_t i = 0; i < lookups_number; ++i)
+				found += index.find(missing[i % missing.size()].id) != NULL;
+			report("hash_index lookup miss", lookups_number, tm.restart());
+			check(found == 0, "hash_index: missing object was found");
+
+			for (size_t i = 0; i < objects_number; i += 2)
+				index.erase(&nodes[i]);
+			report("hash_index erase", (objects_number + 1) / 2, tm.restart());
+
+			for (size_t i = 0; i < objects_number; ++i)
+				check(index.find(nodes[i].m_id.id) == (i % 2 ? &nodes[i] : NULL), "hash_index: erase broke lookup");
+			check(index.size() == objects_number / 2, "hash_index: invalid size after erase");
+		}
+
+		if (with_tree) {
+			std::map<const unsigned char *, bench_node *, id_less> tree;
+			elliptics::timer tm;
+
+			for (auto it = nodes.begin(); it != nodes.end(); ++it)
+				tree.insert(std::make_pair(it->m_id.id, &*it));
+			report("ordered tree insert", objects_number, tm.restart());
+
+			size_t found = 0;
+			for (auto it = order.begin(); it != order.end(); ++it)
+				found += tree.find(nodes[*it].m_id.id) != tree.end();
+			report("ordered tree lookup hit", lookups_number, tm.restart());
+			check(found == lookups_number, "tree: existing object was not found");
+
+			found = 0;
+			for (size_t i = 0; i < lookups_number; ++i)
+				found += tree.find(missing[i % missing.size()].id) != tree.end();
+			report("ordered tree lookup miss", lookups_number, tm.restart());
+			check(found == 0, "tree: missing object was found");
+		}
+
+		{
+			// every tenth object has sync or lifetime event scheduled, like dirty objects of write-heavy cache
+			cache::event_heap<bench_node> events;
+			elliptics::timer tm;
+			size_t scheduled = 0;
+
+			for (size_t i = 0; i < objects_number; i += 10, ++scheduled) {
+				nodes[i].m_eventtime = rng() % 3600;
+				events.update(&nodes[i]);
+			}
+			report("event_heap schedule", scheduled, tm.restart());
+
+			for (size_t i = 0; i < lookups_number; ++i) {
+				bench_node *node = &nodes[order[i] / 10 * 10];
+				node->m_eventtime = rng() % 3600;
+				events.update(node);
+			}
+			report("event_heap reschedule", lookups_number, tm.restart());
+
+			size_t prev = 0;
+			while (!events.empty()) {
+				bench_node *node = events.top();
+				check(node->m_eventtime >= prev, "event_heap: events are out of order");
+				prev = node->m_eventtime;
+
+				node->m_eventtime = std::numeric_limits<size_t>::max();
+				events.update(node);
+			}
+			report("event_heap expire", scheduled, tm.restart());
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "Exception caught: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
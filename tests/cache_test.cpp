@@ -17,8 +17,10 @@
 #include "test_base.hpp"
 #include "../cache/cache.hpp"
 
+#include <atomic>
 #include <list>
 #include <stdexcept>
+#include <thread>
 
 #define BOOST_TEST_NO_MAIN
 #include <boost/test/included/unit_test.hpp>
@@ -44,6 +46,7 @@ static void configure_nodes(const std::string &path)
 			("group", 5)
 			("cache_size", 100000)
 			("cache_shards", 1)
+			("cache_indexes_size", 1024 * 1024)
 		)
 	}), path);
 }
@@ -249,6 +252,201 @@ static void test_cache_lru_eviction(session &sess)
 
 /*! \} */ //test_cache_lru_eviction group
 
+/*!
+ * Checks that concurrent reads of cached objects, which are served under shared lock,
+ * return right data and are counted as hits, and that the next writer, which takes exclusive
+ * lock and applies deferred promotions, keeps all objects in the cache.
+ * Test node runs single cache page, so hits do not defer promotions here.
+ */
+static void test_cache_concurrent_reads(session &sess)
+{
+	dnet_node *node = global_data->nodes[0].get_native();
+	ioremap::cache::cache_manager *cache = (ioremap::cache::cache_manager*) node->io->backends[0].cache;
+
+	const size_t keys_number = 32;
+	const size_t reads_per_thread = 1000;
+	const size_t threads_number = 4;
+
+	cache->clear();
+
+	std::vector<std::string> datas;
+	std::vector<dnet_raw_id> ids;
+	for (size_t i = 0; i < keys_number; ++i) {
+		std::string name = "concurrent_reads_" + boost::lexical_cast<std::string>(i);
+		key id_key(name);
+		ELLIPTICS_REQUIRE(write_result, sess.write_cache(id_key, name, 3000));
+
+		id_key.transform(sess);
+		ids.push_back(id_key.raw_id());
+		datas.push_back(name);
+	}
+
+	const size_t hits_before = cache->get_total_cache_stats().hits;
+
+	std::atomic<size_t> errors(0);
+	std::vector<std::thread> threads;
+
+	for (size_t thread = 0; thread < threads_number; ++thread) {
+		threads.emplace_back([&, thread] () {
+			dnet_cmd cmd;
+			dnet_io_attr io;
+			memset(&cmd, 0, sizeof(cmd));
+			memset(&io, 0, sizeof(io));
+
+			for (size_t i = 0; i < reads_per_thread; ++i) {
+				const size_t index = (i + thread) % keys_number;
+
+				io.flags = DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY;
+				ioremap::cache::raw_data_ptr_t data = cache->read(ids[index].id, &cmd, &io);
+				if (!data || std::string(data->data(), data->size()) != datas[index])
+					++errors;
+			}
+		});
+	}
+
+	for (auto it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+
+	BOOST_REQUIRE_EQUAL(errors.load(), 0);
+	BOOST_REQUIRE_EQUAL(cache->get_total_cache_stats().hits - hits_before, threads_number * reads_per_thread);
+
+	// Write takes exclusive lock and applies promotions deferred by the readers
+	ELLIPTICS_REQUIRE(write_result, sess.write_cache(key(datas[0]), datas[0], 3000));
+	BOOST_REQUIRE_EQUAL(cache->get_total_cache_stats().number_of_objects, keys_number);
+
+	for (size_t i = 0; i < keys_number; ++i) {
+		ELLIPTICS_REQUIRE(read_result, sess.read_data(key(datas[i]), 0, 0));
+		BOOST_REQUIRE_EQUAL(read_result.get_one().file().to_string(), datas[i]);
+	}
+}
+
+/*!
+ * Checks that TinyLFU admission prefers frequently accessed ids and forgets old popularity.
+ */
+static void test_cache_admission_filter(session &)
+{
+	ioremap::cache::tinylfu_admission_t admission(4096);
+
+	dnet_raw_id hot, cold, scan;
+	for (size_t i = 0; i < DNET_ID_SIZE; ++i) {
+		hot.id[i] = rand();
+		cold.id[i] = rand();
+	}
+
+	for (size_t i = 0; i < 10; ++i)
+		admission.record(hot.id);
+	admission.record(cold.id);
+
+	BOOST_REQUIRE(admission.admit(hot.id, cold.id));
+	BOOST_REQUIRE(!admission.admit(cold.id, hot.id));
+
+	// single pass over many cold ids must not look more popular than the hot one
+	for (size_t i = 0; i < 1000; ++i) {
+		for (size_t j = 0; j < DNET_ID_SIZE; ++j)
+			scan.id[j] = rand();
+
+		admission.record(scan.id);
+		BOOST_REQUIRE(!admission.admit(scan.id, hot.id));
+	}
+
+	// sketch is periodically halved, so hot id is forgotten after long enough time without accesses
+	for (size_t i = 0; i < 4096 * 10 * 4; ++i) {
+		for (size_t j = 0; j < DNET_ID_SIZE; ++j)
+			scan.id[j] = rand();
+
+		admission.record(scan.id);
+	}
+
+	BOOST_REQUIRE(!admission.admit(hot.id, scan.id));
+}
+
+static void test_cache_histograms(session &sess)
+{
+	using ioremap::cache::log_buckets;
+
+	// Bucket of every value holds it and is narrower than eighth of the value
+	const uint64_t values[] = { 0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 65535, 123456789, 1ULL << 39 };
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+		const size_t index = log_buckets::index(values[i]);
+		const uint64_t lower_bound = log_buckets::lower_bound(index);
+		const uint64_t upper_bound = log_buckets::upper_bound(index);
+
+		BOOST_REQUIRE_LT(index, log_buckets::number);
+		BOOST_REQUIRE_LE(lower_bound, values[i]);
+		BOOST_REQUIRE_GE(upper_bound, values[i]);
+		BOOST_REQUIRE_LE((upper_bound - lower_bound) * log_buckets::sub_buckets_number, values[i]);
+	}
+
+	ioremap::cache::log_histogram_t histogram;
+	for (uint64_t value = 1; value <= 1000; ++value)
+		histogram.add(log_buckets::index(value), 1);
+
+	BOOST_REQUIRE_EQUAL(histogram.count(), 1000);
+	BOOST_REQUIRE_GE(histogram.percentile(50), 500);
+	BOOST_REQUIRE_LE(histogram.percentile(50), 500 + 500 / log_buckets::sub_buckets_number);
+	BOOST_REQUIRE_GE(histogram.percentile(100), 1000);
+
+	dnet_node *node = global_data->nodes[0].get_native();
+	ioremap::cache::cache_manager *cache = (ioremap::cache::cache_manager*) node->io->backends[0].cache;
+
+	const uint64_t writes_before = cache->get_histogram(ioremap::cache::CACHE_HISTOGRAM_WRITE_MISS).count();
+	const uint64_t hits_before = cache->get_histogram(ioremap::cache::CACHE_HISTOGRAM_READ_HIT).count();
+
+	key id("cache_histograms_key");
+	ELLIPTICS_REQUIRE(write_result, sess.write_cache(id, std::string("histograms"), 3000));
+	ELLIPTICS_REQUIRE(read_result, sess.read_data(id, 0, 0));
+
+	BOOST_REQUIRE_GT(cache->get_histogram(ioremap::cache::CACHE_HISTOGRAM_WRITE_MISS).count(), writes_before);
+	BOOST_REQUIRE_GT(cache->get_histogram(ioremap::cache::CACHE_HISTOGRAM_READ_HIT).count(), hits_before);
+
+	auto stats = cache->get_total_cache_stats();
+	BOOST_REQUIRE_EQUAL(stats.object_sizes.count(), stats.number_of_objects);
+	BOOST_REQUIRE_GT(stats.lock_wait.count(), 0);
+}
+
+static void test_cache_index_tables(session &sess)
+{
+	dnet_node *node = global_data->nodes[0].get_native();
+	ioremap::cache::cache_manager *cache = (ioremap::cache::cache_manager*) node->io->backends[0].cache;
+
+	const std::vector<std::string> indexes = { "cache_index_tables_1", "cache_index_tables_2" };
+	const std::vector<data_pointer> data(indexes.size());
+	const size_t keys_number = 10;
+
+	BOOST_REQUIRE(cache->indexes_enabled());
+
+	for (size_t i = 0; i < keys_number; ++i) {
+		key id("cache_index_tables_key_" + boost::lexical_cast<std::string>(i));
+		ELLIPTICS_REQUIRE(set_indexes_result, sess.set_indexes(id, indexes, data));
+	}
+
+	BOOST_REQUIRE(cache->get_total_cache_stats().number_of_index_tables > 0);
+
+	ELLIPTICS_REQUIRE(all_indexes_result, sess.find_all_indexes(indexes));
+	sync_find_indexes_result all_result = all_indexes_result.get();
+	BOOST_REQUIRE_EQUAL(all_result.size(), keys_number);
+
+	// Dirty tables are packed and synced on clear, so they are loaded back from disk
+	cache->clear();
+	BOOST_REQUIRE_EQUAL(cache->get_total_cache_stats().number_of_index_tables, 0);
+
+	ELLIPTICS_REQUIRE(any_indexes_result, sess.find_any_indexes(indexes));
+	sync_find_indexes_result any_result = any_indexes_result.get();
+	BOOST_REQUIRE_EQUAL(any_result.size(), keys_number);
+
+	// Key removed from one of indexes is not found by intersection anymore
+	const std::vector<std::string> last_index(1, indexes.back());
+	ELLIPTICS_REQUIRE(update_result, sess.set_indexes(key("cache_index_tables_key_0"), last_index, std::vector<data_pointer>(1)));
+
+	ELLIPTICS_REQUIRE(all_indexes_result_updated, sess.find_all_indexes(indexes));
+	all_result = all_indexes_result_updated.get();
+	BOOST_REQUIRE_EQUAL(all_result.size(), keys_number - 1);
+
+	ELLIPTICS_REQUIRE(any_indexes_result_updated, sess.find_any_indexes(indexes));
+	any_result = any_indexes_result_updated.get();
+	BOOST_REQUIRE_EQUAL(any_result.size(), keys_number);
+}
+
 std::string generate_data(size_t length)
 {
 	std::string data;
@@ -265,6 +463,10 @@ bool register_tests(test_suite *suite, node n)
 	ELLIPTICS_TEST_CASE(test_cache_overflow, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
 	ELLIPTICS_TEST_CASE(test_cache_overflow, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE));
 	ELLIPTICS_TEST_CASE(test_cache_lru_eviction, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
+	ELLIPTICS_TEST_CASE(test_cache_concurrent_reads, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
+	ELLIPTICS_TEST_CASE(test_cache_admission_filter, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
+	ELLIPTICS_TEST_CASE(test_cache_histograms, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE | DNET_IO_FLAGS_CACHE_ONLY));
+	ELLIPTICS_TEST_CASE(test_cache_index_tables, create_session(n, { 5 }, 0, DNET_IO_FLAGS_CACHE));
 
 	return true;
 }
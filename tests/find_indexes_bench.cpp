@@ -0,0 +1,339 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Compares INDEXES_FIND set operations over sorted index tables:
+ *  - stl: std::set_intersection twice per index for intersection and std::map of ids for union,
+ *    which is how process_find_indexes() used to merge tables
+ *  - kernels: galloping intersection from the smallest table and k-way merge union
+ *    from indexes/find_indexes.hpp
+ * Both produce the same objects, which is checked after every round.
+ */
+
+#include "../indexes/find_indexes.hpp"
+
+#include <elliptics/timer.hpp>
+
+#include <boost/program_options.hpp>
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace ioremap;
+
+struct bench_entry
+{
+	dnet_raw_id index;
+	size_t data;
+};
+
+struct bench_table
+{
+	std::vector<bench_entry> entries;
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	const dnet_raw_id &id(size_t index) const {
+		return entries[index].index;
+	}
+};
+
+struct bench_result
+{
+	dnet_raw_id id;
+	std::vector<size_t> data;
+};
+
+struct bench_result_ids
+{
+	const std::vector<bench_result> &result;
+
+	size_t size() const {
+		return result.size();
+	}
+
+	const dnet_raw_id &id(size_t index) const {
+		return result[index].id;
+	}
+};
+
+struct id_less
+{
+	bool operator() (const dnet_raw_id &lhs, const dnet_raw_id &rhs) const {
+		return memcmp(lhs.id, rhs.id, DNET_ID_SIZE) < 0;
+	}
+	bool operator() (const bench_result &lhs, const bench_entry &rhs) const {
+		return memcmp(lhs.id.id, rhs.index.id, DNET_ID_SIZE) < 0;
+	}
+	bool operator() (const bench_entry &lhs, const bench_result &rhs) const {
+		return memcmp(lhs.index.id, rhs.id.id, DNET_ID_SIZE) < 0;
+	}
+	bool operator() (const bench_result &lhs, const bench_result &rhs) const {
+		return memcmp(lhs.id.id, rhs.id.id, DNET_ID_SIZE) < 0;
+	}
+	bool operator() (const bench_entry &lhs, const bench_entry &rhs) const {
+		return memcmp(lhs.index.id, rhs.index.id, DNET_ID_SIZE) < 0;
+	}
+};
+
+static void stl_intersect(const std::vector<bench_table> &tables, std::vector<bench_result> &result)
+{
+	result.clear();
+
+	for (size_t i = 0; i < tables.size(); ++i) {
+		if (i == 0) {
+			result.resize(tables[i].size());
+			for (size_t j = 0; j < tables[i].size(); ++j) {
+				result[j].id = tables[i].entries[j].index;
+				result[j].data.push_back(tables[i].entries[j].data);
+			}
+			continue;
+		}
+
+		// table used to be decoded into temporary vector, which is overwritten by second pass
+		std::vector<bench_entry> tmp = tables[i].entries;
+
+		auto it = std::set_intersection(result.begin(), result.end(), tmp.begin(), tmp.end(), result.begin(), id_less());
+		result.resize(it - result.begin());
+
+		std::set_intersection(tmp.begin(), tmp.end(), result.begin(), result.end(), tmp.begin(), id_less());
+
+		auto jt = tmp.begin();
+		for (auto kt = result.begin(); kt != result.end(); ++kt, ++jt)
+			kt->data.push_back(jt->data);
+	}
+}
+
+static void stl_unite(const std::vector<bench_table> &tables, std::vector<bench_result> &result)
+{
+	std::map<dnet_raw_id, size_t, id_less> result_map;
+	result.clear();
+
+	for (auto table = tables.begin(); table != tables.end(); ++table) {
+		for (auto entry = table->entries.begin(); entry != table->entries.end(); ++entry) {
+			auto it = result_map.find(entry->index);
+			if (it == result_map.end()) {
+				it = result_map.insert(std::make_pair(entry->index, result.size())).first;
+				result.resize(result.size() + 1);
+				result.back().id = entry->index;
+			}
+
+			result[it->second].data.push_back(entry->data);
+		}
+	}
+}
+
+static void kernels_intersect(const std::vector<bench_table> &tables, std::vector<bench_result> &result)
+{
+	result.clear();
+	if (tables.empty())
+		return;
+
+	std::vector<size_t> order(tables.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&tables] (size_t a, size_t b) {
+		return tables[a].size() < tables[b].size();
+	});
+
+	const bench_table &smallest = tables[order[0]];
+	result.resize(smallest.size());
+	for (size_t j = 0; j < smallest.size(); ++j) {
+		result[j].id = smallest.entries[j].index;
+		result[j].data.resize(tables.size());
+		result[j].data[order[0]] = smallest.entries[j].data;
+	}
+
+	for (size_t k = 1; k < order.size() && !result.empty(); ++k) {
+		const size_t position = order[k];
+		const bench_table &table = tables[position];
+		size_t out = 0;
+
+		elliptics::find_ids_intersect(bench_result_ids{result}, table, [&] (size_t i, size_t j) {
+			result[i].data[position] = table.entries[j].data;
+			if (out != i)
+				result[out] = std::move(result[i]);
+			++out;
+		});
+
+		result.erase(result.begin() + out, result.end());
+	}
+}
+
+static void kernels_unite(const std::vector<bench_table> &tables, std::vector<bench_result> &result)
+{
+	result.clear();
+
+	elliptics::find_ids_unite(tables, [&result] (const dnet_raw_id &id) {
+		result.resize(result.size() + 1);
+		result.back().id = id;
+		return true;
+	}, [&tables, &result] (size_t table, size_t index) {
+		result.back().data.push_back(tables[table].entries[index].data);
+	});
+}
+
+static void report(const char *name, size_t rounds, size_t entries, int64_t msecs)
+{
+	printf("%-28s rounds: %zu, time: %lld ms, %.2f ns/entry\n",
+			name, rounds, (long long)msecs, (double)msecs * 1000000 / (rounds * entries));
+}
+
+static void check(bool condition, const char *what)
+{
+	if (!condition)
+		throw std::runtime_error(what);
+}
+
+static void check_equal(std::vector<bench_result> stl, const std::vector<bench_result> &kernels, const char *what)
+{
+	// union used to keep objects in order of their first appearance
+	std::sort(stl.begin(), stl.end(), id_less());
+
+	check(stl.size() == kernels.size(), what);
+	for (size_t i = 0; i < stl.size(); ++i) {
+		check(!memcmp(stl[i].id.id, kernels[i].id.id, DNET_ID_SIZE), what);
+		check(stl[i].data == kernels[i].data, what);
+	}
+}
+
+/*
+ * Every table contains each object of @universe with given probability,
+ * so tables intersect by random subsets like independent tags do
+ */
+static bench_table make_table(std::mt19937_64 &rng, const std::vector<dnet_raw_id> &universe, double probability)
+{
+	std::bernoulli_distribution contains(probability);
+	bench_table table;
+
+	for (size_t i = 0; i < universe.size(); ++i) {
+		if (contains(rng)) {
+			bench_entry entry = { universe[i], i };
+			table.entries.push_back(entry);
+		}
+	}
+
+	return table;
+}
+
+static size_t total_size(const std::vector<bench_table> &tables)
+{
+	size_t size = 0;
+	for (auto it = tables.begin(); it != tables.end(); ++it)
+		size += it->size();
+	return size;
+}
+
+static void run(const char *name, const std::vector<bench_table> &tables, size_t rounds)
+{
+	const size_t entries = std::max<size_t>(total_size(tables), 1);
+	std::vector<bench_result> stl, kernels;
+
+	printf("%s: tables: %zu, entries: %zu\n", name, tables.size(), entries);
+
+	elliptics::timer tm;
+	for (size_t i = 0; i < rounds; ++i)
+		stl_intersect(tables, stl);
+	report("stl intersect", rounds, entries, tm.restart());
+
+	for (size_t i = 0; i < rounds; ++i)
+		kernels_intersect(tables, kernels);
+	report("kernels intersect", rounds, entries, tm.restart());
+	check_equal(stl, kernels, "intersection results differ");
+
+	for (size_t i = 0; i < rounds; ++i)
+		stl_unite(tables, stl);
+	report("stl unite", rounds, entries, tm.restart());
+
+	for (size_t i = 0; i < rounds; ++i)
+		kernels_unite(tables, kernels);
+	report("kernels unite", rounds, entries, tm.restart());
+	check_equal(stl, kernels, "union results differ");
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Find indexes benchmark options");
+
+	size_t objects_number, tables_number, rounds_number, small_ratio;
+
+	generic.add_options()
+		("help", "This help message")
+		("objects", bpo::value<size_t>(&objects_number)->default_value(1000000), "Number of distinct objects among all tables")
+		("tables", bpo::value<size_t>(&tables_number)->default_value(3), "Number of indexes in every request")
+		("rounds", bpo::value<size_t>(&rounds_number)->default_value(10), "Number of times every request is processed")
+		("small-ratio", bpo::value<size_t>(&small_ratio)->default_value(1000), "How many times the smallest table is smaller than others in skewed run")
+		;
+
+	bpo::variables_map vm;
+
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(generic).run(), vm);
+
+		if (vm.count("help")) {
+			std::cout << generic << std::endl;
+			return 0;
+		}
+
+		bpo::notify(vm);
+
+		if (objects_number == 0 || tables_number == 0 || rounds_number == 0 || small_ratio == 0)
+			throw std::invalid_argument("objects, tables, rounds and small-ratio must be positive");
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	try {
+		std::mt19937_64 rng(0);
+		std::vector<dnet_raw_id> universe(objects_number);
+
+		for (auto it = universe.begin(); it != universe.end(); ++it) {
+			for (size_t i = 0; i < DNET_ID_SIZE; i += sizeof(uint64_t)) {
+				uint64_t value = rng();
+				memcpy(it->id + i, &value, sizeof(value));
+			}
+		}
+		std::sort(universe.begin(), universe.end(), id_less());
+		universe.erase(std::unique(universe.begin(), universe.end(), [] (const dnet_raw_id &a, const dnet_raw_id &b) {
+			return !memcmp(a.id, b.id, DNET_ID_SIZE);
+		}), universe.end());
+
+		std::vector<bench_table> tables;
+		for (size_t i = 0; i < tables_number; ++i)
+			tables.push_back(make_table(rng, universe, 0.5));
+		run("similar tables", tables, rounds_number);
+
+		// rare tag intersected with popular ones
+		tables.back() = make_table(rng, universe, 0.5 / small_ratio);
+		run("skewed tables", tables, rounds_number);
+	} catch (const std::exception &e) {
+		std::cerr << "Exception caught: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,384 @@
+/*
+ * This file is part of Elliptics.
+ *
+ * Elliptics is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Elliptics is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Elliptics.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Drives the real reply send path of the network thread over loopback TCP connection.
+ * Replies are queued with dnet_send_data_ref() into a state built around the connection
+ * and flushed in one of two ways:
+ *  - cork: previous network thread behaviour, every queued reply is sent by dnet_send_request()
+ *    wrapped into TCP_CORK on/off and followed by TCP_NODELAY, as old dnet_send_request() did
+ *  - vectored: dnet_state_net_process() on EPOLLOUT, which coalesces queued replies
+ *    into single sendmsg() (dnet_process_send_single())
+ *
+ * Socket calls made on the connection are counted by wrappers of send(), sendmsg(), sendfile()
+ * and setsockopt() defined below, which take precedence over libc ones for the library too.
+ */
+
+#include "../library/elliptics.h"
+
+#include <elliptics/session.hpp>
+#include <elliptics/timer.hpp>
+
+#include <boost/program_options.hpp>
+
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace ioremap;
+
+/* socket whose calls are counted */
+static std::atomic<int> counted_socket(-1);
+static std::atomic<uint64_t> counted_calls(0);
+
+template <typename Function>
+static Function next_symbol(const char *name)
+{
+	return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+static void count_call(int s)
+{
+	if (s == counted_socket)
+		++counted_calls;
+}
+
+extern "C" ssize_t send(int s, const void *buf, size_t len, int flags)
+{
+	static auto next = next_symbol<ssize_t (*)(int, const void *, size_t, int)>("send");
+	count_call(s);
+	return next(s, buf, len, flags);
+}
+
+extern "C" ssize_t sendmsg(int s, const struct msghdr *msg, int flags)
+{
+	static auto next = next_symbol<ssize_t (*)(int, const struct msghdr *, int)>("sendmsg");
+	count_call(s);
+	return next(s, msg, flags);
+}
+
+extern "C" ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) throw()
+{
+	static auto next = next_symbol<ssize_t (*)(int, int, off_t *, size_t)>("sendfile");
+	count_call(out_fd);
+	return next(out_fd, in_fd, offset, count);
+}
+
+extern "C" ssize_t sendfile64(int out_fd, int in_fd, off64_t *offset, size_t count) throw()
+{
+	static auto next = next_symbol<ssize_t (*)(int, int, off64_t *, size_t)>("sendfile64");
+	count_call(out_fd);
+	return next(out_fd, in_fd, offset, count);
+}
+
+extern "C" int setsockopt(int s, int level, int name, const void *value, socklen_t len) throw()
+{
+	static auto next = next_symbol<int (*)(int, int, int, const void *, socklen_t)>("setsockopt");
+	count_call(s);
+	return next(s, level, name, value, len);
+}
+
+struct bench_result
+{
+	uint64_t calls;
+	int64_t msecs;
+};
+
+static void check(int err, const char *what)
+{
+	if (err < 0)
+		throw std::runtime_error(std::string(what) + ": " + strerror(errno));
+}
+
+static void connect_pair(int *client, int *server)
+{
+	int listen_s = socket(AF_INET, SOCK_STREAM, 0);
+	check(listen_s, "socket");
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	socklen_t len = sizeof(addr);
+	check(bind(listen_s, (struct sockaddr *)&addr, sizeof(addr)), "bind");
+	check(listen(listen_s, 1), "listen");
+	check(getsockname(listen_s, (struct sockaddr *)&addr, &len), "getsockname");
+
+	*client = socket(AF_INET, SOCK_STREAM, 0);
+	check(*client, "socket");
+	check(connect(*client, (struct sockaddr *)&addr, sizeof(addr)), "connect");
+
+	*server = accept(listen_s, NULL, NULL);
+	check(*server, "accept");
+
+	close(listen_s);
+}
+
+/*
+ * Minimal state which is enough for queueing and sending replies: it is not added
+ * into node's route table and is not polled by node's network threads.
+ */
+static struct dnet_net_state *bench_state_create(struct dnet_node *n, int s)
+{
+	struct dnet_net_state *st = (struct dnet_net_state *)calloc(1, sizeof(struct dnet_net_state));
+	if (!st)
+		throw std::bad_alloc();
+
+	st->n = n;
+	st->read_s = -1;
+	st->accept_s = -1;
+	st->write_s = s;
+	st->epoll_fd = epoll_create(1);
+	check(st->epoll_fd, "epoll_create");
+
+	atomic_init(&st->refcnt, 1);
+	atomic_init(&st->send_queue_size, 0);
+	pthread_mutex_init(&st->send_lock, NULL);
+	pthread_cond_init(&st->send_wait, NULL);
+	INIT_LIST_HEAD(&st->send_list);
+
+	return st;
+}
+
+static void bench_state_destroy(struct dnet_net_state *st)
+{
+	pthread_cond_destroy(&st->send_wait);
+	pthread_mutex_destroy(&st->send_lock);
+	close(st->epoll_fd);
+	free(st);
+}
+
+static void wait_writable(struct dnet_net_state *st)
+{
+	struct pollfd pfd;
+
+	pfd.fd = st->write_s;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+
+	check(poll(&pfd, 1, -1), "poll");
+}
+
+static bool send_list_empty(struct dnet_net_state *st)
+{
+	pthread_mutex_lock(&st->send_lock);
+	bool empty = list_empty(&st->send_list);
+	pthread_mutex_unlock(&st->send_lock);
+
+	return empty;
+}
+
+static void flush_vectored(struct dnet_net_state *st)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT;
+
+	while (!send_list_empty(st)) {
+		int err = dnet_state_net_process(NULL, st, &ev);
+		if (err && err != -EAGAIN)
+			throw std::runtime_error(std::string("dnet_state_net_process: ") + strerror(-err));
+
+		if (!send_list_empty(st))
+			wait_writable(st);
+	}
+}
+
+static void set_socket_option(struct dnet_net_state *st, int name, int value)
+{
+	setsockopt(st->write_s, IPPROTO_TCP, name, &value, sizeof(value));
+}
+
+/*
+ * Previous network thread: requests are sent one by one, every one is corked,
+ * uncorked and followed by TCP_NODELAY to flush it.
+ */
+static void flush_cork(struct dnet_net_state *st)
+{
+	while (!send_list_empty(st)) {
+		struct dnet_io_req *r = list_first_entry(&st->send_list, struct dnet_io_req, req_entry);
+
+		set_socket_option(st, TCP_CORK, 1);
+		int err = dnet_send_request(st, r);
+		set_socket_option(st, TCP_CORK, 0);
+		set_socket_option(st, TCP_NODELAY, 1);
+
+		if (err == -EAGAIN) {
+			wait_writable(st);
+			continue;
+		}
+		if (err)
+			throw std::runtime_error(std::string("dnet_send_request: ") + strerror(-err));
+
+		pthread_mutex_lock(&st->send_lock);
+		list_del(&r->req_entry);
+		pthread_mutex_unlock(&st->send_lock);
+
+		pthread_mutex_lock(&st->n->io->full_lock);
+		list_stat_size_decrease(&st->n->io->output_stats, 1);
+		pthread_mutex_unlock(&st->n->io->full_lock);
+
+		dnet_io_req_free(r);
+		st->send_offset = 0;
+	}
+
+	dnet_unschedule_send(st);
+}
+
+/* Reply data is shared by all replies just like cached data is, nothing to release */
+static void bench_data_put(void *)
+{
+}
+
+static bench_result run(struct dnet_node *n, bool vectored, int replies, int data_size, int batch)
+{
+	int client, server;
+	connect_pair(&client, &server);
+	check(fcntl(server, F_SETFL, O_NONBLOCK), "fcntl");
+
+	const size_t total = (size_t)replies * (sizeof(struct dnet_cmd) + data_size);
+
+	std::thread reader([client, total] () {
+		std::vector<char> buffer(1024 * 1024);
+		size_t received = 0;
+
+		while (received < total) {
+			ssize_t err = recv(client, buffer.data(), buffer.size(), 0);
+			if (err <= 0)
+				break;
+			received += err;
+		}
+	});
+
+	struct dnet_net_state *st = bench_state_create(n, server);
+
+	struct dnet_cmd cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.size = data_size;
+	cmd.flags = DNET_FLAGS_REPLY;
+
+	std::vector<char> data(data_size, 'x');
+
+	counted_calls = 0;
+	counted_socket = server;
+
+	elliptics::timer tm;
+
+	for (int i = 0; i < replies;) {
+		for (int num = 0; num < batch && i < replies; ++num, ++i) {
+			int err = dnet_send_data_ref(st, &cmd, sizeof(cmd), data.data(), data.size(), NULL, bench_data_put);
+			if (err)
+				throw std::runtime_error(std::string("dnet_send_data_ref: ") + strerror(-err));
+		}
+
+		if (vectored)
+			flush_vectored(st);
+		else
+			flush_cork(st);
+	}
+
+	reader.join();
+
+	bench_result result;
+	result.msecs = tm.elapsed();
+	result.calls = counted_calls;
+	counted_socket = -1;
+
+	bench_state_destroy(st);
+	close(client);
+	close(server);
+
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Reply send path benchmark options");
+
+	int replies, data_size, batch;
+
+	generic.add_options()
+		("help", "This help message")
+		("replies", bpo::value<int>(&replies)->default_value(1000000), "Number of replies to send")
+		("size", bpo::value<int>(&data_size)->default_value(100), "Size of reply data")
+		("batch", bpo::value<int>(&batch)->default_value(32), "Number of replies queued before send queue is flushed")
+		;
+
+	bpo::variables_map vm;
+
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(generic).run(), vm);
+
+		if (vm.count("help")) {
+			std::cout << generic << std::endl;
+			return 0;
+		}
+
+		bpo::notify(vm);
+
+		if (replies <= 0 || data_size < 0 || batch <= 0)
+			throw std::invalid_argument("replies and batch must be positive, size must not be negative");
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	try {
+		elliptics::file_logger log("/dev/null", DNET_LOG_ERROR);
+		elliptics::node node(elliptics::logger(log, blackhole::log::attributes_t()));
+
+		const char *names[] = { "cork", "vectored" };
+
+		for (int vectored = 0; vectored < 2; ++vectored) {
+			bench_result res = run(node.get_native(), vectored, replies, data_size, batch);
+			if (!res.msecs)
+				res.msecs = 1;
+
+			double bytes = (double)replies * (sizeof(struct dnet_cmd) + data_size);
+
+			printf("%-10s replies: %d, size: %d, batch: %d, syscalls/reply: %.3f, speed: %.0f replies/sec, %.2f MB/sec\n",
+					names[vectored], replies, data_size, batch,
+					(double)res.calls / replies,
+					(double)replies * 1000 / res.msecs,
+					bytes * 1000 / res.msecs / (1024 * 1024));
+		}
+	} catch (const std::exception &e) {
+		std::cerr << "Exception caught: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -15,7 +15,9 @@
  */
 
 #include "test_base.hpp"
+#include "../bindings/cpp/session_indexes.hpp"
 #include <algorithm>
+#include <set>
 
 #define BOOST_TEST_NO_MAIN
 #include <boost/test/included/unit_test.hpp>
@@ -34,8 +36,10 @@ static void configure_nodes(const std::vector<std::string> &remotes, const std::
 #ifndef NO_SERVER
 	if (remotes.empty()) {
 		global_data = start_nodes(results_reporter::get_stream(), std::vector<server_config>({
+			// Group 1 writes index shards in fixed-width layout, others in msgpack one
 			server_config::default_value().apply_options(config_data()
 				("group", 1)
+				("fixed_width_indexes", true)
 			),
 
 			server_config::default_value().apply_options(config_data()
@@ -320,6 +324,233 @@ static void test_indexes_metadata(session &sess)
 	BOOST_REQUIRE_EQUAL(invalid_results_number, 0);
 }
 
+/*!
+ * \brief Tests index shards updated by appending deltas
+ * Test workflow:
+ * - Put 1024 keys with data to index, test config lowers indexes_log_compact_size to 4 KB,
+ *   so delta logs of its shards are compacted several times
+ * - Update data of every fourth key and remove every second key from the index
+ * - Check that find returns the rest of keys with their latest data
+ * - Check that every shard of the index has been rewritten as a compacted base segment
+ */
+static void test_indexes_delta_log(session &sess)
+{
+	const std::string index = "delta-log-index";
+	const std::vector<std::string> indexes(1, index);
+
+	const size_t keys_count = 1024;
+
+	auto key_data = [] (size_t i, const char *prefix) {
+		return prefix + boost::lexical_cast<std::string>(i) + std::string(100, 'x');
+	};
+
+	std::map<key, std::string> expected;
+
+	for (size_t i = 0; i < keys_count; ++i) {
+		key id("delta-log-key-" + boost::lexical_cast<std::string>(i));
+		id.transform(sess);
+
+		const std::string data = key_data(i, "first-");
+		ELLIPTICS_REQUIRE(set_indexes_result, sess.set_indexes(id, indexes,
+			std::vector<data_pointer>(1, data_pointer::copy(data))));
+
+		expected[id.id()] = data;
+	}
+
+	for (size_t i = 0; i < keys_count; i += 2) {
+		key id("delta-log-key-" + boost::lexical_cast<std::string>(i));
+		id.transform(sess);
+
+		if (i % 4 == 0) {
+			ELLIPTICS_REQUIRE(remove_indexes_result, sess.set_indexes(id, std::vector<std::string>(), std::vector<data_pointer>()));
+			expected.erase(id.id());
+		} else {
+			const std::string data = key_data(i, "second-");
+			ELLIPTICS_REQUIRE(update_indexes_result, sess.set_indexes(id, indexes,
+				std::vector<data_pointer>(1, data_pointer::copy(data))));
+			expected[id.id()] = data;
+		}
+	}
+
+	ELLIPTICS_REQUIRE(find_result, sess.find_all_indexes(indexes));
+	sync_find_indexes_result result = find_result.get();
+
+	BOOST_REQUIRE_EQUAL(result.size(), expected.size());
+
+	for (auto it = result.begin(); it != result.end(); ++it) {
+		auto jt = expected.find(key(it->id));
+		BOOST_REQUIRE(jt != expected.end());
+		BOOST_REQUIRE_EQUAL(it->indexes.size(), 1);
+		BOOST_CHECK_EQUAL(it->indexes[0].data.to_string(), jt->second);
+	}
+
+	dnet_node *node = sess.get_native_node();
+	const int shard_count = dnet_node_get_indexes_shard_count(node);
+
+	key index_key(index);
+	index_key.transform(sess);
+
+	dnet_raw_id index_id;
+	dnet_indexes_transform_index_prepare(node, &index_key.raw_id(), &index_id);
+
+	for (int shard_id = 0; shard_id < shard_count; ++shard_id) {
+		dnet_raw_id shard = index_id;
+		dnet_indexes_transform_index_id_raw(node, &shard, shard_id);
+
+		dnet_id shard_key;
+		memset(&shard_key, 0, sizeof(shard_key));
+		memcpy(shard_key.id, shard.id, DNET_ID_SIZE);
+
+		ELLIPTICS_REQUIRE(read_result, sess.read_data(key(shard_key), 0, 0));
+		const data_pointer file = read_result.get_one().file();
+
+		// Shard which has never been compacted consists of delta log only
+		BOOST_CHECK_GT(indexes_base_size(file), 0);
+	}
+}
+
+/*!
+ * Reads all objects of \a indexes page by page and compares them with the ones found at once
+ */
+static void check_indexes_pages(session &sess, const std::vector<std::string> &indexes, bool intersect, size_t limit)
+{
+	ELLIPTICS_REQUIRE(whole_result, intersect ? sess.find_all_indexes(indexes) : sess.find_any_indexes(indexes));
+
+	std::set<key> expected;
+	sync_find_indexes_result whole = whole_result.get();
+	for (auto it = whole.begin(); it != whole.end(); ++it)
+		expected.insert(key(it->id));
+
+	std::set<key> found;
+	find_indexes_cursor cursor;
+
+	for (;;) {
+		ELLIPTICS_REQUIRE(page_result, intersect ?
+			sess.find_all_indexes(indexes, cursor, limit) :
+			sess.find_any_indexes(indexes, cursor, limit));
+		sync_find_indexes_result page = page_result.get();
+
+		if (page.empty())
+			break;
+
+		BOOST_REQUIRE_LE(page.size(), limit);
+
+		for (auto it = page.begin(); it != page.end(); ++it) {
+			if (cursor.started())
+				BOOST_REQUIRE(cursor.last() < it->id);
+			if (intersect)
+				BOOST_REQUIRE_EQUAL(it->indexes.size(), indexes.size());
+			BOOST_REQUIRE(found.insert(key(it->id)).second);
+			cursor = find_indexes_cursor(it->id);
+		}
+	}
+
+	BOOST_REQUIRE_EQUAL(found.size(), expected.size());
+	BOOST_REQUIRE(found == expected);
+}
+
+static void test_indexes_pages(session &sess)
+{
+	const std::string all_index = "pages-index-all";
+	const std::string third_index = "pages-index-third";
+
+	const size_t keys_count = 300;
+
+	for (size_t i = 0; i < keys_count; ++i) {
+		std::vector<std::string> indexes(1, all_index);
+		if (i % 3 == 0)
+			indexes.push_back(third_index);
+
+		const std::string key = "pages-key-" + boost::lexical_cast<std::string>(i);
+		ELLIPTICS_REQUIRE(set_indexes_result, sess.set_indexes(key, indexes,
+			std::vector<data_pointer>(indexes.size(), data_pointer::copy(key))));
+	}
+
+	std::vector<std::string> indexes = { all_index, third_index };
+
+	check_indexes_pages(sess, indexes, true, 7);
+	check_indexes_pages(sess, indexes, true, keys_count);
+	check_indexes_pages(sess, indexes, false, 1);
+	check_indexes_pages(sess, indexes, false, 64);
+}
+
+/*!
+ * \brief Tests group commit of concurrent updates of the same index shard
+ * Test workflow:
+ * - Pick keys which are all stored in the same shard of the index
+ * - Put them to the index concurrently from several sessions with different order of groups
+ * - Check that every group has every key in the index
+ */
+static void test_indexes_group_commit(session &sess)
+{
+	const std::string index = "group-commit-index";
+	const std::vector<std::string> indexes(1, index);
+
+	const size_t sessions_count = 4;
+	const size_t keys_count = 256;
+
+	dnet_node *node = sess.get_native_node();
+	std::vector<key> keys;
+	int shard_id = -1;
+
+	for (size_t i = 0; keys.size() < keys_count; ++i) {
+		key id("group-commit-key-" + boost::lexical_cast<std::string>(i));
+		id.transform(sess);
+
+		const int id_shard = dnet_indexes_get_shard_id(node, &id.raw_id());
+		if (shard_id == -1)
+			shard_id = id_shard;
+
+		if (id_shard == shard_id)
+			keys.push_back(id);
+	}
+
+	std::vector<int> groups = sess.get_groups();
+	std::vector<session> sessions;
+
+	for (size_t i = 0; i < sessions_count; ++i) {
+		session tmp = sess.clone();
+		tmp.set_groups(groups);
+		sessions.push_back(tmp);
+
+		std::rotate(groups.begin(), groups.begin() + 1, groups.end());
+	}
+
+	std::vector<async_set_indexes_result> results;
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		const std::string data = "group-commit-data-" + boost::lexical_cast<std::string>(i);
+		results.emplace_back(sessions[i % sessions_count].set_indexes(keys[i], indexes,
+			std::vector<data_pointer>(1, data_pointer::copy(data))));
+	}
+
+	for (auto it = results.begin(); it != results.end(); ++it) {
+		it->wait();
+		BOOST_REQUIRE_MESSAGE(!it->error(), "set_indexes: err: \"" + it->error().message() + "\"");
+	}
+
+	for (auto group = groups.begin(); group != groups.end(); ++group) {
+		session group_sess = sess.clone();
+		group_sess.set_groups(std::vector<int>(1, *group));
+
+		ELLIPTICS_REQUIRE(find_result, group_sess.find_all_indexes(indexes));
+		sync_find_indexes_result result = find_result.get();
+
+		BOOST_REQUIRE_EQUAL(result.size(), keys.size());
+
+		std::map<key, std::string> expected;
+		for (size_t i = 0; i < keys.size(); ++i)
+			expected[keys[i].id()] = "group-commit-data-" + boost::lexical_cast<std::string>(i);
+
+		for (auto it = result.begin(); it != result.end(); ++it) {
+			auto jt = expected.find(key(it->id));
+			BOOST_REQUIRE(jt != expected.end());
+			BOOST_REQUIRE_EQUAL(it->indexes.size(), 1);
+			BOOST_CHECK_EQUAL(it->indexes[0].data.to_string(), jt->second);
+		}
+	}
+}
+
 /*! \} */ //test_indexes group
 
 static void test_error(session &s, const std::string &id, int err)
@@ -1393,6 +1624,9 @@ bool register_tests(test_suite *suite, node n)
 	ELLIPTICS_TEST_CASE(test_indexes, create_session(n, {1, 2}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_more_indexes, create_session(n, {1, 2}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_indexes_metadata, create_session(n, {1, 2}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_indexes_delta_log, create_session(n, {1, 2}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_indexes_pages, create_session(n, {1, 2}, 0, 0));
+	ELLIPTICS_TEST_CASE(test_indexes_group_commit, create_session(n, {1, 2, 3}, 0, 0));
 	ELLIPTICS_TEST_CASE(test_error, create_session(n, {99}, 0, 0), "non-existen-key", -ENXIO);
 	ELLIPTICS_TEST_CASE(test_error, create_session(n, {1, 2}, 0, 0), "non-existen-key", -ENOENT);
 	ELLIPTICS_TEST_CASE(test_lookup, create_session(n, {1, 2}, 0, 0), "2.xml", "lookup data");
@@ -197,6 +197,7 @@ server_config server_config::default_value()
 			("nonblocking_io_thread_num", 4)
 			("net_thread_num", 2)
 			("indexes_shard_count", 16)
+			("indexes_log_compact_size", 4096)
 			("daemon", false)
 			("bg_ionice_class", 3)
 			("bg_ionice_prio", 0)